@@ -0,0 +1,110 @@
+#include "adr.h"
+#include <math.h>
+
+// SX127x demodulation limits: -7.5 dB at SF7, 2.5 dB lower per SF step.
+// At 250 kHz the noise floor is 3 dB higher for the same signal.
+const LoRaDataRate LORA_DATA_RATES[ADR_RATE_COUNT] = {
+  {10, 125000, -150, 0},
+  {9, 125000, -125, 0},
+  {8, 125000, -100, 0},
+  {7, 125000, -75, 0},
+  {7, 250000, -45, 30},
+};
+
+void adrReset(AdrState& adr) {
+  adr.rate = LORA_HOME_RATE;
+  adr.txPower = ADR_MAX_TX_POWER;
+  adr.targetRate = adr.rate;
+  adr.targetPower = adr.txPower;
+  adr.probes = 0;
+  adr.snrCount = 0;
+  adr.decided = false;
+  adr.snrMax = INT16_MIN;
+}
+
+bool adrPending(const AdrState& adr) {
+  return adr.targetRate != adr.rate || adr.targetPower != adr.txPower;
+}
+
+// As LoRaWAN's network-side ADR: the best SNR of the last few replies,
+// less what the current rate needs and a margin, is spent first on
+// faster rates, then on lower power. A negative margin takes power back
+// first, then rate.
+bool adrRecord(AdrState& adr, int8_t snr) {
+  int16_t referred = snr * 10 + LORA_DATA_RATES[adr.rate].noiseOffset;
+  if (referred > adr.snrMax) adr.snrMax = referred;
+  if (++adr.snrCount < (adr.decided ? ADR_HISTORY : ADR_FIRST_HISTORY)) return false;
+
+  int margin = adr.snrMax - LORA_DATA_RATES[adr.rate].snrFloor - ADR_MARGIN;
+  bool first = !adr.decided;
+  adr.snrCount = 0;
+  adr.snrMax = INT16_MIN;
+  adr.decided = true;
+
+  uint8_t rate = adr.rate;
+  int power = adr.txPower;
+  while (rate < ADR_MAX_RATE &&
+         margin >= LORA_DATA_RATES[rate + 1].snrFloor - LORA_DATA_RATES[rate].snrFloor) {
+    margin -= LORA_DATA_RATES[rate + 1].snrFloor - LORA_DATA_RATES[rate].snrFloor;
+    rate++;
+  }
+  // A single reply is enough to leave the home rate, not to save power
+  while (!first && margin >= ADR_POWER_STEP * 10 &&
+         power - ADR_POWER_STEP >= ADR_MIN_TX_POWER) {
+    margin -= ADR_POWER_STEP * 10;
+    power -= ADR_POWER_STEP;
+  }
+  while (margin < 0 && power < ADR_MAX_TX_POWER) {
+    margin += ADR_POWER_STEP * 10;
+    power += ADR_POWER_STEP;
+  }
+  if (power > ADR_MAX_TX_POWER) power = ADR_MAX_TX_POWER;
+  while (margin < 0 && rate > LORA_HOME_RATE) {
+    margin += LORA_DATA_RATES[rate].snrFloor - LORA_DATA_RATES[rate - 1].snrFloor;
+    rate--;
+  }
+
+  if (rate == adr.targetRate && power == adr.targetPower) return false;
+  adr.targetRate = rate;
+  adr.targetPower = static_cast<uint8_t>(power);
+  adr.probes = 0;
+  return adrPending(adr);
+}
+
+bool adrConfirm(AdrState& adr, uint8_t radio) {
+  uint8_t rate = adrRadioRate(radio);
+  uint8_t power = adrRadioPower(radio);
+  if (rate == adr.rate && power == adr.txPower) return false;
+  adr.rate = rate;
+  adr.txPower = power;
+  // Measured at the old setting
+  adr.snrCount = 0;
+  adr.snrMax = INT16_MIN;
+  return true;
+}
+
+uint8_t adrNextRate(AdrState& adr) {
+  if (!adrPending(adr)) return adr.rate;
+  return adr.probes++ & 1 ? adr.targetRate : adr.rate;
+}
+
+bool adrRadioValid(uint8_t radio) {
+  uint8_t rate = adrRadioRate(radio);
+  uint8_t power = adrRadioPower(radio);
+  // Rates below the home one wrap around, so one compare holds for any
+  // LORA_HOME_RATE, 0 too
+  uint8_t aboveHome = static_cast<uint8_t>(rate - LORA_HOME_RATE);
+  return aboveHome <= ADR_MAX_RATE - LORA_HOME_RATE &&
+         power >= ADR_MIN_TX_POWER && power <= ADR_MAX_TX_POWER;
+}
+
+uint32_t loraAirtimeUs(int spreadingFactor, long bandwidth, int codingRate, size_t len) {
+  double symbolUs = static_cast<double>(1L << spreadingFactor) * 1e6 / bandwidth;
+  int lowRate = spreadingFactor >= 11 && bandwidth <= 125000 ? 1 : 0;
+  double bits = 8.0 * len - 4.0 * spreadingFactor + 28 + 16;
+  double perBlock = 4.0 * (spreadingFactor - 2 * lowRate);
+  double blocks = ceil(bits / perBlock);
+  if (blocks < 0) blocks = 0;
+  double payloadSymbols = 8 + blocks * codingRate;
+  return static_cast<uint32_t>((8 + 4.25 + payloadSymbols) * symbolUs);
+}
@@ -0,0 +1,79 @@
+#ifndef ADR_H
+#define ADR_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Adaptive data rate for LoRa. Every node starts on the home rate, which
+// the whole fleet can reach; the base measures the SNR of its replies and
+// orders near nodes onto faster rates and lower TX power, so they spend
+// less time on air. The order rides on a trigger and the node switches
+// after it has answered, saying so in the reply; until then the base
+// keeps talking to it on the old rate, and retries alternate between both.
+//
+// Data rates, slowest first. Build with LORA_HOME_RATE and ADR_MAX_RATE
+// equal to fix the whole fleet on one rate.
+#define ADR_RATE_COUNT 5
+#ifndef LORA_HOME_RATE
+#define LORA_HOME_RATE 0 // Joins, and where a node that lost the base goes back to
+#endif
+#ifndef ADR_MAX_RATE
+#define ADR_MAX_RATE (ADR_RATE_COUNT - 1)
+#endif
+#define LORA_CODING_RATE 5   // 4/5 on every rate
+#define ADR_MAX_TX_POWER 17  // dBm on PA_BOOST; also what the base sends with
+#define ADR_MIN_TX_POWER 2
+#define ADR_POWER_STEP 3     // dB per step, rate or power, as in LoRaWAN
+#define ADR_HISTORY 6        // Replies at one setting before a decision
+#define ADR_FIRST_HISTORY 1  // Before the first one after a join, to leave the home rate soon
+#define ADR_MARGIN 60        // 0.1 dB kept over the demodulation floor, for fading
+
+struct LoRaDataRate {
+  uint8_t spreadingFactor;
+  long bandwidth;       // Hz
+  int16_t snrFloor;     // Lowest SNR that demodulates, 0.1 dB, over the 125 kHz noise floor
+  int16_t noiseOffset;  // 0.1 dB the noise floor sits above 125 kHz'
+};
+
+extern const LoRaDataRate LORA_DATA_RATES[ADR_RATE_COUNT];
+
+// What the base knows about one node's radio. Zeroed it is not valid;
+// start from adrReset().
+struct AdrState {
+  uint8_t rate;        // Data rate the node sends and listens on
+  uint8_t txPower;     // dBm
+  uint8_t targetRate;  // What the base ordered; equals rate once the node confirmed
+  uint8_t targetPower;
+  uint8_t probes;      // Orders sent since the last decision
+  uint8_t snrCount;    // Replies measured at the current setting
+  bool decided;        // A decision was made since the reset
+  int16_t snrMax;      // Best of them, 0.1 dB over the 125 kHz noise floor
+};
+
+// Home rate, full power, nothing measured
+void adrReset(AdrState& adr);
+bool adrPending(const AdrState& adr);
+// Records the SNR of a reply sent at the node's current setting. Once
+// ADR_HISTORY are in, decides on a new one; true when it ordered a change.
+bool adrRecord(AdrState& adr, int8_t snr);
+// The node reports it switched to radio; true when that is news
+bool adrConfirm(AdrState& adr, uint8_t radio);
+// Rate to reach the node on with the next trigger: its current rate, or
+// on every other try while an order is pending, the ordered one
+uint8_t adrNextRate(AdrState& adr);
+
+// Rate and power packed in one byte for frames, never 0
+inline uint8_t adrRadio(uint8_t rate, uint8_t txPower) { return txPower << 3 | rate; }
+inline uint8_t adrRadioRate(uint8_t radio) { return radio & 0x07; }
+inline uint8_t adrRadioPower(uint8_t radio) { return radio >> 3; }
+// A radio byte from a frame that names a rate and power we can use
+bool adrRadioValid(uint8_t radio);
+
+// Semtech's formula, explicit header, CRC on, 8 preamble symbols
+uint32_t loraAirtimeUs(int spreadingFactor, long bandwidth, int codingRate, size_t len);
+inline uint32_t adrAirtimeUs(uint8_t rate, size_t len) {
+  return loraAirtimeUs(LORA_DATA_RATES[rate].spreadingFactor, LORA_DATA_RATES[rate].bandwidth,
+                       LORA_CODING_RATE, len);
+}
+
+#endif
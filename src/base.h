@@ -1,47 +1,133 @@
 #ifndef BASE_H
 #define BASE_H
 
-#include <ArduinoJson.h>
-#include <WiFi.h>
-#include <vector>
-#include <array>
-#include <queue>
-#include <string>
-#include <WiFiClientSecure.h>
-#include <HTTPClient.h>
-
-#define MAX_NODES 50
-#define MAX_QUEUE_SIZE 100
+#include "hal.h"
+#include <atomic>
+#include "frame.h"
+#include "spsc_ring.h"
+#include "reading_store.h"
+#include "http_link.h"
+#include "batch_log.h"
+#include "slot_schedule.h"
+#include "node_table.h"
+#include "wifi_link.h"
+#include "trigger_engine.h"
+#include "metrics.h"
+#include "capture.h"
+#include "log.h"
 
+#define MAX_NODES NODE_TABLE_CAPACITY
+#define MAX_QUEUE_SIZE 128 // Power of two, holds the replies to one beacon
+#define SWEEP_INTERVAL 5000 // ms between the starts of two polling sweeps
+#define JOIN_QUEUE_SIZE 8   // Power of two
+#define BASE_MAX_TRANSPORTS 2 // Radios one base polls over at once
+
+class Transport;
+
+// The gateway: one node registry, batching pipeline and uplink shared by
+// every radio it polls over. Each radio is a Transport with its own
+// sweeps, triggers and receive queues; update() runs them all in turn,
+// so a slow sweep on one never holds up the other. A node belongs to
+// the transport it last joined over.
 class Base {
 public:
-  struct Message {
-    char json[256]; // Fixed-size array to reduce fragmentation
-    unsigned long receivedAt;
+  typedef Reading Message;
+
+  // Written by the uplink task, read anywhere
+  struct UplinkStats {
+    uint32_t batches;
+    uint32_t readings;      // Acknowledged by the server
+    uint32_t failures;
+    uint32_t partial;       // Failed uploads the server still acknowledged some readings of
+    uint32_t lastLatency;   // ms spent posting the last batch
+    uint32_t lastQueueWait; // ms the last batch waited between sealing and upload
+    uint32_t maxLatency;
+    uint32_t maxQueueWait;
+  };
+
+  // A node asking to join, queued from the radio callback
+  struct JoinRequest {
+    uint8_t mac[6];
+    uint16_t requestedId; // Id the node had before, 0 for none
+    int32_t ackedSeq;     // Newest reading seq the node no longer needs acked, -1 if not said
   };
 
-  virtual void begin() = 0;   // Setup logic to implement in subclass
-  virtual void update() = 0;  // Loop logic to implement in subclass
-  static void setup();        // Initialize static members
+  // Radios to poll over, added before begin(); false when there is no room
+  bool addTransport(Transport& transport);
+  void begin();
+  void update();
 
-  // Add a JSON message to the sending queue
-  static void enqueueMessage(const char* json); // Static, uses const char*
+  static const UplinkStats& getUplinkStats() { return uplinkStats; }
+  static const HttpLink::Stats& getLinkStats() { return uplink.getStats(); }
+  static const BatchLog::Stats& getLogStats() { return batchLog.getStats(); }
+  // Summed over the transports
+  static TriggerEngine::Stats getTriggerStats();
+  static const WifiLink::Stats& getWifiStats() { return wifi.getStats(); }
+  static const Metrics& getMetrics() { return metrics; }
+  // millis() when the first reading since reset was stored, 0 before
+  static uint32_t getFirstReadingAt() { return firstReadingAt; }
 
 protected:
+  friend class Transport;
+
   void setupWiFi();
-  void processHttpQueue();
-  void processLocalHttpQueue();
-  void addNodeMac(const uint8_t* mac);
+  void startUplink();
+  void startCapture(CaptureRadio radio); // Only with -DCAPTURE
+  void handOffBatch();
+  // Removes the readings the server acknowledged, so a retry posts only
+  // the rest. True once the batch is done with: whatever is left then was
+  // refused for good.
+  bool postBatch(ReadingStore& batch, uint32_t batchId);
+  bool postBatchTo(HttpLink& link, ReadingStore& batch, uint32_t batchId);
+  bool checkResponse(HttpLink& link, int code, const char* response, ReadingStore& batch);
+  static int addNode(const uint8_t* mac, uint16_t id);
+  static int admitNode(const uint8_t* mac, uint16_t requestedId);
+  static void removeNode(int index);
+  void processJoins(Transport& transport);
+  static const uint8_t* findNodeMac(uint16_t nodeId);
+  // Drains every transport's queue into the batch
   void processMessageQueue();
+  void processMessages(Transport& transport);
   void checkHeap();
+  void runSchedule(Transport& transport);
+  void runTriggers(Transport& transport);
+  static uint16_t nextPollSeq();
+  // Trigger carrying the node's ack and, when not 0, a radio setting order
+  static size_t buildTrigger(uint8_t* out, size_t outLen, uint16_t nodeId, uint16_t seq,
+                             uint8_t radio = 0);
 
-  static HTTPClient httpClient;
   static WiFiClientSecure secureClient;
-  static WiFiClient wifiClient; // Reusable WiFiClient
-  static std::vector<std::array<uint8_t, 6>> nodeMacs;
-  static char lastReceivedData[1024];
-  static StaticJsonDocument<1024> jsonDoc;
-  static std::queue<Message> messageQueue;
+  static WifiLink wifi;         // Station link, driven from update()
+  static uint32_t firstReadingAt;
+  static HttpLink uplink;       // Keep-alive connection to the API
+  static NodeTable nodes;
+  static Transport* transports[BASE_MAX_TRANSPORTS]; // Indexed by NodeInfo::transport
+  static size_t transportCount;
+  static Metrics metrics;
+  static char uploadBody[READING_JSON_BODY_SIZE];
+
+  // Double-buffered batches: the loop task fills *readings while the
+  // uplink task logs and posts *sealedBatch. The loop task only stores a
+  // batch there, after sealedAt and sealedId, and the uplink task only
+  // clears it, once done with the buffer; null means the uplink is idle.
+  static ReadingStore batches[2];
+  static ReadingStore* readings;
+  static std::atomic<ReadingStore*> sealedBatch;
+  static unsigned long sealedAt;
+  static uint32_t sealedId; // Batch id of *sealedBatch while the batch log is unavailable
+  static UplinkStats uplinkStats;
+  static TaskHandle_t uplinkTaskHandle;
+  static BatchLog batchLog; // Owned by the uplink task
+#ifdef CAPTURE
+  static Capture capture; // Received frames and upload outcomes, for replay
+#endif
+
+private:
+  static void uplinkTask(void* param);
+  static void captureTask(void* param);
+  void storeSealedBatch();
+  bool sendOldestBatch();
+  void sendMetrics();
 };
 
 #endif // BASE_H
\ No newline at end of file
@@ -1,321 +1,338 @@
 #include "base.h"
+#include "transport.h"
+#include <string.h>
 #include <time.h>
 
 // Static members definition
-HTTPClient Base::httpClient;
-WiFiClientSecure Base::secureClient;
-WiFiClient Base::wifiClient; // Reusable WiFiClient
-std::vector<std::array<uint8_t, 6>> Base::nodeMacs;
-char Base::lastReceivedData[1024] = "[]";
-StaticJsonDocument<1024> Base::jsonDoc;
-std::queue<Base::Message> Base::messageQueue;
-
-void Base::setup() {
-    // Pre-allocate vector capacity to avoid fragmentation
-    nodeMacs.reserve(MAX_NODES);
+NodeTable Base::nodes;
+Transport* Base::transports[BASE_MAX_TRANSPORTS] = {};
+size_t Base::transportCount = 0;
+Metrics Base::metrics;
+WifiLink Base::wifi;
+uint32_t Base::firstReadingAt = 0;
+
+bool Base::addTransport(Transport& transport) {
+    if (transportCount == BASE_MAX_TRANSPORTS) return false;
+    transport.index = static_cast<uint8_t>(transportCount);
+    transports[transportCount++] = &transport;
+    return true;
 }
 
-void Base::setupWiFi() {
-    WiFi.mode(WIFI_AP_STA);
-    const char* ssid = "MEO-563920";
-    const char* password = "346cbe99b8";
-    int attempts = 0;
-    const int maxAttempts = 5;
-
-    while (attempts < maxAttempts) {
-        WiFi.begin(ssid, password);
-        unsigned long start = millis();
-        while (WiFi.status() != WL_CONNECTED && millis() - start < 10000) {
-            delay(50);
-            Serial.print(".");
-        }
-        if (WiFi.status() == WL_CONNECTED) {
-            Serial.println("\nWiFi connected");
-            Serial.print("IP: ");
-            Serial.println(WiFi.localIP());
-            configTime(0, 0, "pool.ntp.org");
-            struct tm timeinfo;
-            if (getLocalTime(&timeinfo, 10000)) {
-                Serial.println("Time synchronized");
-            } else {
-                Serial.println("Failed to synchronize time");
-            }
-            return;
-        }
-        Serial.println("\nWiFi connection failed, retrying in 10 seconds");
-        WiFi.disconnect();
-        delay(10000);
-        attempts++;
-    }
-    Serial.println("WiFi connection failed after max attempts");
-}
+void Base::begin() {
+    Serial.begin(115200);
+    LOG_I("Base setup started, %u radio(s)", (unsigned)transportCount);
 
-void Base::processLocalHttpQueue() {
-    static bool wasEmpty = false;
+    setupWiFi();
+    for (size_t i = 0; i < transportCount; i++) transports[i]->begin();
+    startUplink();
+    startCapture(transportCount == 1 ? transports[0]->captureRadio() : CAPTURE_BOTH);
+}
 
-    if (lastReceivedData == nullptr || strlen(lastReceivedData) < 5 || 
-        strcmp(lastReceivedData, "[]") == 0 || strstr(lastReceivedData, "[null]")) {
-        if (!wasEmpty) {
-            Serial.println("[HTTP] Skipping empty or invalid data.");
-            wasEmpty = true;
-        }
-        return;
+// Every radio gets its turn on each pass; none of the steps waits for
+// another radio's sweep or replies
+void Base::update() {
+    wifi.update();
+    for (size_t i = 0; i < transportCount; i++) transports[i]->receive();
+    processMessageQueue();
+    for (size_t i = 0; i < transportCount; i++) {
+        Transport& transport = *transports[i];
+        // Sent now, beacons and join accepts would go out on whichever
+        // channel the scan is on; they wait, replies already in still count
+        if (transport.sharesWifiRadio() && wifi.scanning()) continue;
+        processJoins(transport);
+        runSchedule(transport);
+        runTriggers(transport);
+        transport.idle();
     }
+    handOffBatch();
+    checkHeap();
+}
 
-    wasEmpty = false;
-
-    Serial.println("======== DEBUG START ========");
-    Serial.print("[HTTP] ESP32 local IP: ");
-    Serial.println(WiFi.localIP());
-
-    const char* host = "192.168.1.87";
-    const int port = 10001;
-    const char* endpoint = "/esp/data";
-
-    Serial.print("[HTTP] Connecting to ");
-    Serial.print("http://");
-    Serial.print(host);
-    Serial.print(":");
-    Serial.print(port);
-    Serial.println(endpoint);
-
-    // Test raw TCP socket
-    if (!wifiClient.connect(host, port)) {
-        Serial.println("✖️ [TCP] Raw socket connect() failed");
-    } else {
-        Serial.println("✔️ [TCP] Raw socket connect() OK");
-        wifiClient.stop(); // Close so HTTPClient can use it
+TriggerEngine::Stats Base::getTriggerStats() {
+    TriggerEngine::Stats total = {};
+    for (size_t i = 0; i < transportCount; i++) {
+        const TriggerEngine::Stats& stats = transports[i]->getTriggerStats();
+        total.sent += stats.sent;
+        total.retries += stats.retries;
+        total.answered += stats.answered;
+        total.missed += stats.missed;
+        total.stale += stats.stale;
+        total.groups += stats.groups;
     }
+    return total;
+}
 
-    char url[128];
-    snprintf(url, sizeof(url), "http://%s:%d%s", host, port, endpoint);
+// Only starts the connection: wifi.update() brings it up while the radio
+// is already collecting, and keeps it up.
+void Base::setupWiFi() {
+    wifi.begin();
+}
 
-    Serial.println("[HTTP] Starting HTTPClient...");
-    httpClient.setTimeout(5000); // 5-second timeout
-    bool began = httpClient.begin(wifiClient, url);
-    if (!began) {
-        Serial.println("✖️ [HTTP] httpClient.begin() failed");
-        httpClient.end();
-        wifiClient.stop();
-        return;
+// Registers mac; when the table is full the node quiet for the longest
+// makes room. Returns the node's index, or -1 when its id is taken.
+int Base::addNode(const uint8_t* mac, uint16_t id) {
+    int index = nodes.find(mac);
+    if (index >= 0) return index;
+
+    if (nodes.full()) {
+        int victim = nodes.leastActive();
+        LOG_W("⚠️ Node table full, evicting %04X (quiet for %lu ms)",
+              nodes[victim].id, millis() - nodes[victim].lastSeen);
+        removeNode(victim);
     }
 
-    Serial.println("✔️ [HTTP] httpClient.begin() succeeded");
-    httpClient.addHeader("Content-Type", "application/json");
+    index = nodes.add(mac, id, millis());
+    if (index < 0) {
+        LOG_E("❌ Node id %04X already taken, %02X:%02X:%02X:%02X:%02X:%02X not added",
+              id, mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    }
+    return index;
+}
 
-    Serial.print("[HTTP] POSTing payload: ");
-    Serial.println(lastReceivedData);
+// Known nodes keep their id. New ones get the id they ask for, the one
+// they had before a base restart, unless another node holds it by now.
+int Base::admitNode(const uint8_t* mac, uint16_t requestedId) {
+    static uint16_t nextId = 1;
 
-    int httpResponseCode = httpClient.POST(lastReceivedData);
+    int index = nodes.find(mac);
+    if (index >= 0) return index;
 
-    if (httpResponseCode > 0) {
-        Serial.printf("✔️ [HTTP] POST success! Code: %d\n", httpResponseCode);
+    uint16_t id = requestedId;
+    while (id == 0 || id == FRAME_BROADCAST_ID || nodes.findId(id) >= 0) {
+        id = nextId++;
+    }
+    return addNode(mac, id);
+}
 
-        char buffer[512];
-        WiFiClient* stream = httpClient.getStreamPtr();
-        if (stream && stream->available()) {
-            unsigned long start = millis();
-            int readLen = 0;
-            while (stream->available() && millis() - start < 5000) {
-                readLen = stream->readBytes(buffer, sizeof(buffer) - 1);
-                buffer[readLen] = '\0';
-            }
-            Serial.print("[HTTP] Response body: ");
-            Serial.println(buffer);
+// Answers queued joins between the transport's sweeps, so an accept never
+// lands in a slot, and polls each new node right away instead of at the
+// next sweep.
+void Base::processJoins(Transport& transport) {
+    if (transport.schedule.active()) return;
+
+    JoinRequest request;
+    while (transport.joinQueue.pop(request)) {
+        const uint8_t* mac = request.mac;
+        int index = admitNode(mac, request.requestedId);
+        if (index < 0) continue;
+        if (request.ackedSeq >= 0) nodes.restartSeq(index, request.ackedSeq);
+        nodes.resetRadio(index);
+        if (nodes[index].transport != transport.index) {
+            // Known from another radio; it is polled on this one from now on
+            Transport& previous = *transports[nodes[index].transport];
+            previous.triggers.forget(index);
+            previous.forgetPeer(mac);
+            nodes[index].transport = transport.index;
         }
 
-        if (httpResponseCode == HTTP_CODE_OK || httpResponseCode == HTTP_CODE_CREATED) {
-            jsonDoc.clear();
-            strcpy(lastReceivedData, "[]");
-            Serial.println("[HTTP] Payload acknowledged, cleared lastReceivedData.");
-        }
-    } else {
-        Serial.printf("✖️ [HTTP] POST failed! Code: %d, Error: %s\n",
-                      httpResponseCode,
-                      httpClient.errorToString(httpResponseCode).c_str());
-        jsonDoc.clear();
+        uint8_t frame[FRAME_MAX_SIZE];
+        size_t len = encodeJoinAccept(frame, sizeof(frame), nodes[index].id, mac);
+        transport.tuneRadio(nodes[index].adr.rate);
+        transport.sendBroadcast(frame, len);
+        transport.triggers.request(index);
+        LOG_I("✔️ Node %02X:%02X:%02X:%02X:%02X:%02X joined as %04X",
+              mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], nodes[index].id);
     }
+}
 
-    httpClient.end();
-    wifiClient.stop();
+void Base::removeNode(int index) {
+    Transport& transport = *transports[nodes[index].transport];
+    transport.triggers.forget(index);
+    transport.forgetPeer(nodes[index].mac);
+    metrics.forgetNode(index);
+    nodes.remove(index);
+}
 
-    Serial.printf("[HTTP] Free heap after request: %u\n", ESP.getFreeHeap());
-    Serial.println("======== DEBUG END ========");
+const uint8_t* Base::findNodeMac(uint16_t nodeId) {
+    int index = nodes.findId(nodeId);
+    return index >= 0 ? nodes[index].mac : nullptr;
 }
 
-void Base::processHttpQueue() {
-    static bool wasEmpty = false;
+void Base::processMessageQueue() {
+    for (size_t i = 0; i < transportCount; i++) processMessages(*transports[i]);
+}
 
-    if (lastReceivedData == nullptr || strlen(lastReceivedData) < 5 ||
-        strcmp(lastReceivedData, "[]") == 0 || strstr(lastReceivedData, "[null]")) {
-        if (!wasEmpty) {
-            Serial.println("[HTTPS] Skipping empty or invalid data.");
-            wasEmpty = true;
-        }
+// Replies are matched against the sweep and triggers of the transport
+// they came in over
+void Base::processMessages(Transport& transport) {
+    SpscRing<Message, MAX_QUEUE_SIZE>& messageQueue = transport.messageQueue;
+    if (messageQueue.empty()) {
         return;
     }
 
-    wasEmpty = false;
-
-    static bool certSet = false;
-    if (!certSet) {
-        const char* GTS_ROOT_R4_CA = R"EOF(
------BEGIN CERTIFICATE-----
-MIIDejCCAmKgAwIBAgIQf+UwvzMTQ77dghYQST2KGzANBgkqhkiG9w0BAQsFADBX
-MQswCQYDVQQGEwJCRTEZMBcGA1UEChMQR2xvYmFsU2lnbiBudi1zYTEQMA4GA1UE
-CxMHUm9vdCBDQTEbMBkGA1UEAxMSR2xvYmFsU2lnbiBSb290IENBMB4XDTIzMTEx
-NTAzNDMyMVoXDTI4MDEyODAwMDA0MlowRzELMAkGA1UEBhMCVVMxIjAgBgNVBAoT
-GUdvb2dsZSBUcnVzdCBTZXJ2aWNlcyBMTEMxFDASBgNVBAMTC0dUUyBSb290IFI0
-MHYwEAYHKoZIzj0CAQYFK4EEACIDYgAE83Rzp2iLYK5DuDXFgTB7S0md+8Fhzube
-Rr1r1WEYNa5A3XP3iZEwWus87oV8okB2O6nGuEfYKueSkWpz6bFyOZ8pn6KY019e
-WIZlD6GEZQbR3IvJx3PIjGov5cSr0R2Ko4H/MIH8MA4GA1UdDwEB/wQEAwIBhjAd
-BgNVHSUEFjAUBggrBgEFBQcDAQYIKwYBBQUHAwIwDwYDVR0TAQH/BAUwAwEB/zAd
-BgNVHQ4EFgQUgEzW63T/STaj1dj8tT7FavCUHYwwHwYDVR0jBBgwFoAUYHtmGkUN
-l8qJUC99BM00qP/8/UswNgYIKwYBBQUHAQEEKjAoMCYGCCsGAQUFBzAChhpodHRw
-Oi8vaS5wa2kuZ29vZy9nc3IxLmNydDAtBgNVHR8EJjAkMCKgIKAehhxodHRwOi8v
-Yy5wa2kuZ29vZy9yL2dzcjEuY3JsMBMGA1UdIAQMMAowCAYGZ4EMAQIBMA0GCSqG
-SIb3DQEBCwUAA4IBAQAYQrsPBtYDh5bjP2OBDwmkoWhIDDkic574y04tfzHpn+cJ
-odI2D4SseesQ6bDrarZ7C30ddLibZatoKiws3UL9xnELz4ct92vID24FfVbiI1hY
-+SW6FoVHkNeWIP0GCbaM4C6uVdF5dTUsMVs/ZbzNnIdCp5Gxmx5ejvEau8otR/Cs
-kGN+hr/W5GvT1tMBjgWKZ1i4//emhA1JG1BbPzoLJQvyEotc03lXjTaCzv8mEbep
-8RqZ7a2CPsgRbuvTPBwcOMBBmuFeU88+FSBX6+7iP0il8b4Z0QFqIwwMHfs/L6K1
-vepuoxtGzi4CZ68zJpiq1UvSqTbFJjtbD4seiMHl
------END CERTIFICATE-----
-        )EOF";
-        secureClient.setCACert(GTS_ROOT_R4_CA);
-        certSet = true;
+    uint32_t drops = messageQueue.dropped();
+    if (drops != transport.reportedDrops) {
+        LOG_W("⚠️ Queue full, dropped %u readings (%u total, high water %u)",
+              drops - transport.reportedDrops, drops, messageQueue.highWater());
+        transport.reportedDrops = drops;
     }
 
-    Serial.println("======== HTTPS DEBUG START ========");
-    Serial.print("[HTTPS] ESP32 local IP: ");
-    Serial.println(WiFi.localIP());
-    Serial.println("[HTTPS] Starting HTTPClient...");
-
-    httpClient.setTimeout(5000);
-    bool began = httpClient.begin(secureClient, "https://vaquinet-api.onrender.com/esp/data");
-    if (!began) {
-        Serial.println("✖️ [HTTPS] httpClient.begin() failed");
-        httpClient.end();
-        secureClient.stop();
-        return;
-    }
-
-    Serial.println("✔️ [HTTPS] httpClient.begin() succeeded");
-    httpClient.addHeader("Content-Type", "application/json");
-
-    Serial.print("[HTTPS] POSTing payload: ");
-    Serial.println(lastReceivedData);
-
-    int httpResponseCode = httpClient.POST(lastReceivedData);
-
-    if (httpResponseCode > 0) {
-        Serial.printf("✔️ [HTTPS] POST success! Code: %d\n", httpResponseCode);
+    // Readings stay queued while the store is full, i.e. while the uplink is behind
+    Message msg;
+    time_t now = time(nullptr);
+    uint32_t epoch = now > 1600000000 ? now : 0; // Zero until NTP has synced
+    while (!readings->full() && messageQueue.pop(msg)) {
+        // A reading names its node by id alone: a stale or reassigned id,
+        // or a node that moved to another radio, must not touch its state
+        int index = nodes.findId(msg.nodeId);
+        if (index < 0 || nodes[index].transport != transport.index ||
+            memcmp(nodes[index].mac, msg.mac, 6) != 0) {
+            metrics.count(METRIC_FRAMES_INVALID);
+            LOG_W("[Queue] Dropped reading %04X #%u, not from a node on this radio",
+                  msg.nodeId, msg.seq);
+            continue;
+        }
+        if (!nodes.accept(index, msg.seq)) {
+            // A resend whose earlier copy made it after all
+            metrics.count(METRIC_DUPLICATES);
+            LOG_D("[Queue] Dropped duplicate %04X #%u", msg.nodeId, msg.seq);
+            continue;
+        }
 
-        char buffer[512];
-        WiFiClient* stream = httpClient.getStreamPtr();
-        if (stream && stream->available()) {
-            unsigned long start = millis();
-            int readLen = stream->readBytes(buffer, sizeof(buffer) - 1);
-            buffer[readLen] = '\0';
-            Serial.print("[HTTPS] Response body: ");
-            Serial.println(buffer);
+        msg.epoch = epoch;
+        readings->add(msg);
+        if (firstReadingAt == 0) {
+            firstReadingAt = millis();
+            LOG_I("✔️ First reading %lu ms after reset", (unsigned long)firstReadingAt);
         }
 
-        if (httpResponseCode == HTTP_CODE_OK || httpResponseCode == HTTP_CODE_CREATED) {
-            jsonDoc.clear();
-            strcpy(lastReceivedData, "[]");
-            Serial.println("[HTTPS] Payload acknowledged, cleared lastReceivedData.");
+        nodes.seen(index, msg.rssi, msg.snr, msg.receivedAt);
+        if (msg.span > 0) {
+            uint16_t abandoned = nodes.settleBefore(index, msg.seq - msg.span);
+            if (abandoned > 0) metrics.count(METRIC_READINGS_ABANDONED, abandoned);
+        }
+        if (msg.replyTo == 0) {
+            // Resent readings answer no poll
+            metrics.count(METRIC_READINGS_RESENT);
+            LOG_D("[Queue] Recovered reading %04X #%u: %d", msg.nodeId, msg.seq, msg.value);
+            continue;
         }
-    } else {
-        Serial.printf("✖️ [HTTPS] POST failed! Code: %d, Error: %s\n",
-                      httpResponseCode,
-                      httpClient.errorToString(httpResponseCode).c_str());
-        jsonDoc.clear();
+        if (msg.rssi != 0) {
+            metrics.record(METRIC_RSSI, msg.rssi);
+            metrics.record(METRIC_SNR, msg.snr);
+        }
+        int32_t rtt;
+        if (msg.replyTo == transport.schedule.sequence()) {
+            transport.schedule.markAnswered(msg.nodeId);
+        } else if (transport.triggers.onReply(index, msg.replyTo, msg.receivedAt, &rtt) &&
+                   rtt >= 0) {
+            metrics.recordRtt(index, rtt);
+        }
+        LOG_D("[Queue] Stored reading %04X #%u: %d", msg.nodeId, msg.seq, msg.value);
     }
-
-    httpClient.end();
-    secureClient.stop();
-
-    Serial.printf("Free heap after request: %u\n", ESP.getFreeHeap());
 }
 
-void Base::enqueueMessage(const char* json) {
-    if (messageQueue.size() >= MAX_QUEUE_SIZE) {
-        Serial.println("Queue full, dropping oldest message");
-        messageQueue.pop();
-    }
-    Message msg;
-    strncpy(msg.json, json, sizeof(msg.json) - 1);
-    msg.json[sizeof(msg.json) - 1] = '\0';
-    msg.receivedAt = millis();
-    messageQueue.push(msg);
+// Beacons and triggers of every transport share one sequence space, so a
+// reply's replyTo tells which of them it answers. Zero is left out: it
+// means "not set".
+uint16_t Base::nextPollSeq() {
+    static uint16_t pollSeq = 0;
+    if (++pollSeq == 0) pollSeq = 1;
+    return pollSeq;
 }
 
-
-void Base::addNodeMac(const uint8_t* mac) {
-    std::array<uint8_t, 6> macArray;
-    memcpy(macArray.data(), mac, 6);
-    
-    if (std::find(nodeMacs.begin(), nodeMacs.end(), macArray) == nodeMacs.end()) {
-        if (nodeMacs.size() >= MAX_NODES) {
-            nodeMacs.erase(nodeMacs.begin());
-        }
-        nodeMacs.push_back(macArray);
+size_t Base::buildTrigger(uint8_t* out, size_t outLen, uint16_t nodeId, uint16_t seq,
+                          uint8_t radio) {
+    int index = nodes.findId(nodeId);
+    if (index < 0 || nodes[index].seqWindow == 0) {
+        return encodeTrigger(out, outLen, nodeId, seq, nullptr, radio);
     }
+
+    FrameAck ack = {nodes[index].lastSeq, nodes[index].seqWindow};
+    return encodeTrigger(out, outLen, nodeId, seq, &ack, radio);
 }
 
-void Base::processMessageQueue() {
-    if (messageQueue.empty()) {
+// Starts a sweep of the transport's nodes every SWEEP_INTERVAL and sends
+// its beacons as they fall due. Replies are matched to slots in
+// processMessages; nodes that missed their slot are handed to the
+// transport's trigger engine.
+void Base::runSchedule(Transport& transport) {
+    SlotSchedule& schedule = transport.schedule;
+    TriggerEngine& triggers = transport.triggers;
+    unsigned long now = millis();
+
+    if (schedule.active() && schedule.done(now)) {
+        LOG_I("Sweep %u: %u/%u nodes answered in %lu ms", schedule.sequence(),
+              (unsigned)schedule.answeredCount(), (unsigned)schedule.size(),
+              now - transport.lastSweepStart);
+        for (size_t i = 0; i < schedule.size(); i++) {
+            if (!schedule.answeredAt(i)) {
+                int index = nodes.findId(schedule.idAt(i));
+                // Evicted, or joined over another radio, during the sweep
+                if (index < 0 || nodes[index].transport != transport.index) continue;
+                LOG_W("No response from node %04X, retrying", schedule.idAt(i));
+                triggers.request(index);
+            }
+        }
+        schedule.finish();
+        transport.lastSweepEnd = now;
+        // Joins wait for the gap between sweeps, even when this one overran
         return;
     }
 
-    jsonDoc.clear();
-    JsonArray jsonArray = jsonDoc.to<JsonArray>();
-
-    while (!messageQueue.empty() && messageQueue.size() <= MAX_QUEUE_SIZE) {
-        Message msg = messageQueue.front();
-        messageQueue.pop();
-
-        Serial.print("[Queue] Processing msg: ");
-        Serial.println(msg.json);
+    if (!schedule.active()) {
+        if (nodes.empty() || now - transport.lastSweepStart < SWEEP_INTERVAL) return;
+        // Replies to triggers still on air would land in the beacon's slots
+        if (triggers.outstanding() > 0) return;
+        // Retries of the last sweep go first, for at most another interval
+        if (!triggers.idle() && now - transport.lastSweepEnd < SWEEP_INTERVAL) return;
 
-        StaticJsonDocument<512> tempDoc;
-        DeserializationError error = deserializeJson(tempDoc, msg.json);
-        if (error) {
-            Serial.printf("❌ Failed to parse JSON: %s\n", error.c_str());
-            continue;
+        if (!triggers.idle()) {
+            LOG_W("⚠️ Retries still pending at sweep start, dropped");
+            triggers.reset();
         }
 
-        JsonObject obj = tempDoc.as<JsonObject>();
-        jsonArray.add(obj);
-        Serial.println("✅ Added to JSON array.");
-    }
-
-    if (jsonArray.size() == 0) {
-        Serial.println("[Queue] All messages were invalid, skipping serialization.");
-        strcpy(lastReceivedData, "[]");
-        return;
+        uint16_t ids[SLOT_SCHEDULE_MAX];
+        uint8_t acks[SLOT_SCHEDULE_MAX];
+        uint8_t rates[SLOT_SCHEDULE_MAX];
+        size_t count = 0;
+        for (int i = 0; i < NODE_TABLE_CAPACITY && count < SLOT_SCHEDULE_MAX; i++) {
+            if (!nodes.used(i) || nodes[i].transport != transport.index) continue;
+            acks[count] = nodes.ackedThrough(i) & 0xFF;
+            rates[count] = nodes[i].adr.rate;
+            ids[count++] = nodes[i].id;
+        }
+        transport.lastSweepStart = now;
+        // None of the nodes are on this radio
+        if (count == 0) return;
+        schedule.begin(ids, acks, rates, count, nextPollSeq());
     }
 
-    if (measureJson(jsonDoc) >= sizeof(lastReceivedData)) {
-        Serial.println("❌ JSON too large for lastReceivedData");
-        strcpy(lastReceivedData, "[]");
-        return;
+    uint8_t frame[FRAME_MAX_SIZE];
+    size_t len = schedule.poll(now, frame, sizeof(frame));
+    if (len > 0) {
+        transport.tuneRadio(schedule.groupRate());
+        transport.sendBroadcast(frame, len);
+        schedule.beaconSent(millis());
     }
+}
 
-    if (serializeJson(jsonDoc, lastReceivedData, sizeof(lastReceivedData)) == 0) {
-        Serial.println("❌ Failed to serialize to lastReceivedData");
-        strcpy(lastReceivedData, "[]");
-    } else {
-        Serial.print("✅ Final serialized JSON: ");
-        Serial.println(lastReceivedData);
+// Between the transport's sweeps: times out unanswered triggers and keeps
+// up to the engine's window of them in flight, grouped where the radio can.
+void Base::runTriggers(Transport& transport) {
+    if (transport.schedule.active()) return;
+
+    TriggerEngine& triggers = transport.triggers;
+    uint32_t now = millis();
+    triggers.expire(now);
+
+    const TriggerEngine::Stats& stats = triggers.getStats();
+    if (stats.missed != transport.reportedMisses) {
+        LOG_E("❌ %u node(s) gave up after %d retries (%u sent, %u answered, %u missed)",
+              stats.missed - transport.reportedMisses, TRIGGER_MAX_RETRIES,
+              stats.sent, stats.answered, stats.missed);
+        transport.reportedMisses = stats.missed;
     }
 
-    // Optional cleanup if queue still bloated
-    if (messageQueue.size() > MAX_QUEUE_SIZE) {
-        Serial.println("⚠️ Queue overflow, trimming...");
-        while (messageQueue.size() > MAX_QUEUE_SIZE / 2) {
-            messageQueue.pop();
+    int index;
+    while (triggers.ready()) {
+        uint16_t seq = nextPollSeq();
+        if (transport.sendGroupTrigger(now, seq)) continue;
+        if (!triggers.next(now, index, seq)) break;
+        if (!transport.sendTrigger(nodes[index].id, seq)) {
+            // Counts as sent; the timeout turns it into a retry
+            metrics.count(METRIC_SEND_ERRORS);
+            LOG_E("Failed to send trigger to node %04X", nodes[index].id);
         }
     }
 }
@@ -323,14 +340,13 @@ void Base::processMessageQueue() {
 void Base::checkHeap() {
     static unsigned long lastCheck = 0;
     if (millis() - lastCheck > 60000) {
-        Serial.printf("Free heap: %u, Max alloc heap: %u\n", 
-                      ESP.getFreeHeap(), ESP.getMaxAllocHeap());
+        LOG_I("Free heap: %u, Max alloc heap: %u, Min free heap: %u",
+              ESP.getFreeHeap(), ESP.getMaxAllocHeap(), ESP.getMinFreeHeap());
+        metrics.set(METRIC_FREE_HEAP, ESP.getFreeHeap());
+        metrics.set(METRIC_MIN_FREE_HEAP, ESP.getMinFreeHeap());
+        metrics.set(METRIC_MAX_ALLOC_HEAP, ESP.getMaxAllocHeap());
         if (ESP.getFreeHeap() < 10000) {
-            Serial.println("Warning: Low heap memory");
-            nodeMacs.clear();
-            while (!messageQueue.empty()) messageQueue.pop();
-            jsonDoc.clear();
-            strcpy(lastReceivedData, "[]");
+            LOG_W("Warning: Low heap memory");
         }
         lastCheck = millis();
     }
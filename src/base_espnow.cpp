@@ -1,192 +1,115 @@
 #include "base_espnow.h"
-#include <esp_wifi.h>
 
-void EspNowBase::begin() {
-  Serial.begin(115200);
-  Serial.println("ESP-NOW Base setup started");
-
-  nodeMacs = {
-    {0x4C, 0x11, 0xAE, 0x70, 0x47, 0xAC},
-    {0x4C, 0x11, 0xAE, 0x65, 0x76, 0x48},
-    {0x08, 0xA6, 0xF7, 0x0C, 0x04, 0x1C}
-  };
-
-  setupWiFi();
+#define ESPNOW_SLOT_MS 5 // A reply frame plus its MAC-level ack takes well under 1 ms
+// Unicast triggers are queued by the driver and answered within a few ms,
+// so several can be in flight without their replies getting in each other's way
+#define ESPNOW_TRIGGER_WINDOW 8
+#define ESPNOW_TRIGGER_RTT 10
+#define ESPNOW_TRIGGER_MIN_TIMEOUT 20
+#define ESPNOW_TRIGGER_MAX_TIMEOUT 500
+
+// Peers on channel 0 use the channel the station is on, which the router
+// picks; nodes find it by scanning
+#define ESPNOW_CHANNEL 0
+
+const uint8_t EspNowTransport::broadcastMac[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+PeerCache EspNowTransport::peers;
+EspNowTransport* EspNowTransport::receiver = nullptr;
+
+// After Base::setupWiFi(): ESP-NOW runs on the station interface
+void EspNowTransport::begin() {
+  LOG_I("ESP-NOW setup started");
   setupEspNow();
-
-  jsonDoc.clear();
-  jsonDoc.to<JsonArray>();
 }
 
-void EspNowBase::setupEspNow() {
+void EspNowTransport::setupEspNow() {
   if (esp_now_init() != ESP_OK) {
-    Serial.println("Error initializing ESP-NOW");
+    LOG_E("Error initializing ESP-NOW");
     return;
   }
 
-  esp_now_register_send_cb(EspNowBase::onDataSent);
-  esp_now_register_recv_cb(EspNowBase::onReceiveEspNow);
+  receiver = this;
+  esp_now_register_send_cb(EspNowTransport::onDataSent);
+  esp_now_register_recv_cb(EspNowTransport::onReceiveEspNow);
 
   esp_now_peer_info_t peerInfo = {};
-  peerInfo.channel = 6;
+  peerInfo.channel = ESPNOW_CHANNEL;
   peerInfo.encrypt = false;
 
-  for (const auto& mac : nodeMacs) {
-    addNodeMac(mac.data());
-    if (!esp_now_is_peer_exist(mac.data())) {
-      memcpy(peerInfo.peer_addr, mac.data(), 6);
-      if (esp_now_add_peer(&peerInfo) != ESP_OK) {
-        Serial.printf("Failed to add peer %02X:%02X:%02X:%02X:%02X:%02X\n",
-                      mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-      } else {
-        Serial.printf("ESP-NOW peer added: %02X:%02X:%02X:%02X:%02X:%02X\n",
-                      mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-      }
-    }
+  // Beacons and join accepts go to the broadcast address, so they need no
+  // per-node peers
+  memcpy(peerInfo.peer_addr, broadcastMac, 6);
+  if (!esp_now_is_peer_exist(broadcastMac) && esp_now_add_peer(&peerInfo) != ESP_OK) {
+    LOG_E("Failed to add broadcast peer");
   }
+  schedule.setSlotLength(ESPNOW_SLOT_MS);
+  triggers.configure(ESPNOW_TRIGGER_WINDOW, ESPNOW_TRIGGER_RTT,
+                     ESPNOW_TRIGGER_MIN_TIMEOUT, ESPNOW_TRIGGER_MAX_TIMEOUT);
 
-  uint8_t chan;
-  wifi_second_chan_t second;
-  esp_wifi_get_channel(&chan, &second);
-  Serial.printf("BASE Wi-Fi Channel: %d\n", chan);
+  // Node peers are added on demand, so the node count is not bound by
+  // the ESP-NOW peer limit
+  peers.begin(ESPNOW_CHANNEL);
 }
 
-void EspNowBase::addPeer(const uint8_t* mac_addr) {
-  if (mac_addr == nullptr) return;
+bool EspNowTransport::sendTrigger(uint16_t nodeId, uint16_t seq) {
+  const uint8_t* mac = findNodeMac(nodeId);
+  if (mac == nullptr || !peers.acquire(mac, millis())) return false;
 
-  esp_now_peer_info_t peerInfo = {};
-  peerInfo.channel = 6;
-  peerInfo.encrypt = false;
-  memcpy(peerInfo.peer_addr, mac_addr, 6);
-
-  if (!esp_now_is_peer_exist(mac_addr)) {
-    if (esp_now_add_peer(&peerInfo) != ESP_OK) {
-      Serial.printf("Failed to add peer %02X:%02X:%02X:%02X:%02X:%02X\n",
-                    mac_addr[0], mac_addr[1], mac_addr[2],
-                    mac_addr[3], mac_addr[4], mac_addr[5]);
-    } else {
-      Serial.printf("ESP-NOW peer added: %02X:%02X:%02X:%02X:%02X:%02X\n",
-                    mac_addr[0], mac_addr[1], mac_addr[2],
-                    mac_addr[3], mac_addr[4], mac_addr[5]);
-      addNodeMac(mac_addr);
-    }
-  }
-}
+  uint8_t frame[FRAME_MAX_SIZE];
+  size_t len = buildTrigger(frame, sizeof(frame), nodeId, seq);
+  esp_err_t result = esp_now_send(mac, frame, len);
+  if (result != ESP_OK) return false;
 
-void EspNowBase::removePeer(const uint8_t* mac_addr) {
-  if (mac_addr == nullptr) return;
-
-  if (esp_now_is_peer_exist(mac_addr)) {
-    if (esp_now_del_peer(mac_addr) != ESP_OK) {
-      Serial.printf("Failed to remove peer %02X:%02X:%02X:%02X:%02X:%02X\n",
-                    mac_addr[0], mac_addr[1], mac_addr[2],
-                    mac_addr[3], mac_addr[4], mac_addr[5]);
-    } else {
-      Serial.printf("ESP-NOW peer removed: %02X:%02X:%02X:%02X:%02X:%02X\n",
-                    mac_addr[0], mac_addr[1], mac_addr[2],
-                    mac_addr[3], mac_addr[4], mac_addr[5]);
-      std::array<uint8_t, 6> macArray;
-      memcpy(macArray.data(), mac_addr, 6);
-      auto it = std::find(nodeMacs.begin(), nodeMacs.end(), macArray);
-      if (it != nodeMacs.end()) {
-        nodeMacs.erase(it);
-      }
-    }
-  }
+  LOG_D("Sent trigger #%u to node %02X:%02X:%02X:%02X:%02X:%02X", seq,
+        mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+  return true;
 }
 
-void EspNowBase::sendTriggerToNode(const uint8_t* nodeId) {
-  if (nodeId == nullptr) return;
-
-  struct TriggerMessage { uint8_t command; } msg = {1};
-  esp_err_t result = esp_now_send(nodeId, reinterpret_cast<uint8_t*>(&msg), sizeof(msg));
-  if (result == ESP_OK) {
-    Serial.printf("Sent trigger to node %02X:%02X:%02X:%02X:%02X:%02X\n",
-                  nodeId[0], nodeId[1], nodeId[2], nodeId[3], nodeId[4], nodeId[5]);
-  } else {
-    Serial.printf("Failed to send trigger to node %02X:%02X:%02X:%02X:%02X:%02X\n",
-                  nodeId[0], nodeId[1], nodeId[2], nodeId[3], nodeId[4], nodeId[5]);
+void EspNowTransport::sendBroadcast(const uint8_t* frame, size_t len) {
+  esp_err_t result = esp_now_send(broadcastMac, frame, len);
+  if (result != ESP_OK) {
+    metrics.count(METRIC_SEND_ERRORS);
+    LOG_E("Failed to send broadcast: %d", result);
   }
 }
 
-void EspNowBase::update() {
-  static unsigned long lastTriggerTime = 0;
-  static size_t currentNodeIndex = 0;
-  static bool waitingForResponse = false;
-  static unsigned long triggerSentTime = 0;
-  constexpr unsigned long triggerInterval = 5000;
-  constexpr unsigned long responseTimeout = 500;
-
-  unsigned long now = millis();
-
-  if (!waitingForResponse && now - lastTriggerTime >= triggerInterval) {
-    if (nodeMacs.empty()) return;
-
-    if (currentNodeIndex > 0 && nodeMacs.size() > MAX_NODES) {
-      removePeer(nodeMacs[currentNodeIndex - 1].data());
-    }
-
-    addPeer(nodeMacs[currentNodeIndex].data());
-    sendTriggerToNode(nodeMacs[currentNodeIndex].data());
-    waitingForResponse = true;
-    triggerSentTime = now;
-
-    currentNodeIndex = (currentNodeIndex + 1) % nodeMacs.size();
-    if (currentNodeIndex == 0) {
-      lastTriggerTime = now;
-    }
-  }
-
-  if (waitingForResponse && now - triggerSentTime >= responseTimeout) {
-    const size_t index = currentNodeIndex ? currentNodeIndex - 1 : nodeMacs.size() - 1;
-    Serial.printf("Timeout waiting for response from node %02X:%02X:%02X:%02X:%02X:%02X\n",
-                  nodeMacs[index][0], nodeMacs[index][1], nodeMacs[index][2],
-                  nodeMacs[index][3], nodeMacs[index][4], nodeMacs[index][5]);
-    waitingForResponse = false;
+void EspNowTransport::onDataSent(const uint8_t* mac_addr, esp_now_send_status_t status) {
+  // Broadcasts are never acked, only unicast status says anything
+  if (mac_addr != nullptr && memcmp(mac_addr, broadcastMac, 6) != 0) {
+    metrics.count(status == ESP_NOW_SEND_SUCCESS ? METRIC_UNICAST_DELIVERED : METRIC_UNICAST_LOST);
   }
-
-  processMessageQueue();
-  processHttpQueue();
-  //processLocalHttpQueue();
-  checkHeap();
-}
-
-void EspNowBase::onDataSent(const uint8_t* mac_addr, esp_now_send_status_t status) {
-  Serial.print("Last Packet Send Status: ");
-  Serial.println(status == ESP_NOW_SEND_SUCCESS ? "Delivery Success" : "Delivery Fail");
+  LOG_D("Last Packet Send Status: %s", status == ESP_NOW_SEND_SUCCESS ? "Delivery Success" : "Delivery Fail");
 }
 
-void EspNowBase::onReceiveEspNow(const uint8_t* mac, const uint8_t* incomingData, int len) {
-  if (!incomingData || len <= 0 || len > 255) return;
-
-  char buffer[256];
-  memcpy(buffer, incomingData, len);
-  buffer[len] = '\0';
-
-  Serial.printf("Received ESP-NOW: %s\n", buffer);
-
-  StaticJsonDocument<256> doc;
-  DeserializationError error = deserializeJson(doc, buffer);
-  if (error) {
-    Serial.println("Failed to parse incoming JSON");
+void EspNowTransport::onReceiveEspNow(const uint8_t* mac, const uint8_t* incomingData, int len) {
+  if (!mac || !incomingData || len <= 0) return;
+
+#ifdef CAPTURE
+  capture.frame(mac, incomingData, len, 0, 0);
+#endif
+  metrics.count(METRIC_FRAMES_RECEIVED);
+  FrameReader reader;
+  if (!reader.parse(incomingData, len)) {
+    metrics.count(METRIC_FRAMES_INVALID);
+    LOG_W("Dropped invalid ESP-NOW frame");
     return;
   }
 
-  int value = doc["value"] | -1;
-  const char* deviceId = doc["deviceId"] | "";
-
-  jsonDoc.clear();
-  JsonArray dataArray = jsonDoc.to<JsonArray>();
-  JsonObject entry = dataArray.createNestedObject();
-  entry["value"] = value;
-  entry["deviceId"] = deviceId;
-
-  if (serializeJson(jsonDoc, lastReceivedData, sizeof(lastReceivedData)) == 0) {
-    Serial.println("Failed to serialize JSON to lastReceivedData");
-    strcpy(lastReceivedData, "[]");
+  if (reader.header().type == FRAME_JOIN) {
+    uint8_t joinMac[6];
+    int32_t ackedSeq;
+    // The frame's own MAC must match the sender, ESP-NOW knows the real one
+    if (findJoinMac(reader, joinMac, &ackedSeq) && memcmp(joinMac, mac, 6) == 0) {
+      receiver->enqueueJoin(mac, reader.header().nodeId, ackedSeq);
+    }
     return;
   }
 
-  Base::enqueueMessage(lastReceivedData); // Call static method
-  Serial.printf("Response: %s\n", lastReceivedData);
-}
\ No newline at end of file
+  ReadingFrame reading;
+  if (!decodeReading(incomingData, len, reading)) return;
+
+  // RSSI is not reported by the ESP-NOW receive callback
+  receiver->enqueueReading(mac, reading, 0, 0, millis());
+
+  LOG_D("Received reading from %04X #%u: %d", reading.nodeId, reading.seq, reading.value);
+}
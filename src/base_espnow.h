@@ -1,22 +1,30 @@
 #ifndef BASE_ESPNOW_H
 #define BASE_ESPNOW_H
 
-#include "base.h"
-#include <esp_now.h>
-#include <WiFi.h>
+#include "transport.h"
+#include "peer_cache.h"
+#include "hal_espnow.h"
 
-class EspNowBase : public Base {
+class EspNowTransport : public Transport {
 public:
   void begin() override;
-  void update() override;
+  CaptureRadio captureRadio() const override { return CAPTURE_ESPNOW; }
+  bool sharesWifiRadio() const override { return true; }
+  static const PeerCache::Stats& getPeerStats() { return peers.getStats(); }
+
+protected:
+  bool sendTrigger(uint16_t nodeId, uint16_t seq) override;
+  void sendBroadcast(const uint8_t* frame, size_t len) override;
+  void forgetPeer(const uint8_t* mac) override { peers.drop(mac); }
 
 private:
   void setupEspNow();
-  void addPeer(const uint8_t* mac_addr);
-  void removePeer(const uint8_t* mac_addr);
-  void sendTriggerToNode(const uint8_t* nodeId);
   static void onDataSent(const uint8_t* mac_addr, esp_now_send_status_t status);
   static void onReceiveEspNow(const uint8_t* mac, const uint8_t* incomingData, int len);
+
+  static const uint8_t broadcastMac[6];
+  static PeerCache peers; // Unicast peers, added around triggers
+  static EspNowTransport* receiver; // The one the driver callbacks reach
 };
 
 #endif
\ No newline at end of file
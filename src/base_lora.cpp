@@ -1,127 +1,243 @@
 #include "base_lora.h"
-#include <HTTPClient.h>
-#include <WiFiClientSecure.h>
 
 #define LORA_SS 5
 #define LORA_RST 14
 #define LORA_DIO0 26
 #define LORA_FREQUENCY 915E6
-#define LORA_SPREADING_FACTOR 7
-#define LORA_BANDWIDTH 125E3
-#define LORA_CODING_RATE 5
-
-void LoRaBase::begin() {
-  Serial.begin(115200);
-  Serial.println("LoRa Base setup started");
-  nodeMacs.push_back({0x4C, 0x11, 0xAE, 0x70, 0x47, 0xAC});
-  nodeMacs.push_back({0x4C, 0x11, 0xAE, 0x65, 0x76, 0x48});
-  nodeMacs.push_back({0x08, 0xA6, 0xF7, 0x0C, 0x04, 0x1C});
-
-  setupWiFi();
+// Slots and trigger round trips are sized per data rate from airtime
+#define LORA_REPLY_BYTES 28   // A reading with two resent ones and a radio echo
+#define LORA_TRIGGER_BYTES 18 // With the ack and a radio order
+#define LORA_TURNAROUND_MS 10 // Node loop and radio mode switches, per slot or round trip
+// Half duplex: a second trigger would go out while the first reply is on
+// air and the base would miss it, so one trigger at a time
+#define LORA_TRIGGER_WINDOW 1
+#define LORA_TRIGGER_MIN_TIMEOUT 120
+#define LORA_TRIGGER_MAX_TIMEOUT 2000
+// Retries after a sweep go out as group triggers: one frame and one
+// preamble for up to this many nodes, which answer in slots
+#define LORA_TRIGGER_GROUP_MAX 8
+
+#define LORA_RADIO_TASK_STACK 3072
+#define LORA_RADIO_TASK_PRIORITY 3 // Above loop(), so a packet is read before the next one lands
+#define LORA_RADIO_TASK_CORE 1
+
+void LoRaTransport::begin() {
+  LOG_I("LoRa setup started");
   setupLoRa();
+}
+
+uint8_t LoRaTransport::tunedRate = LORA_HOME_RATE;
 
-  jsonDoc.clear();
-  JsonArray dataArray = jsonDoc.to<JsonArray>();
+// Every send listens first, see LoRaRadio::send()
+static uint32_t listenUs(uint8_t rate) {
+  return LoRaRadio::listenUs(LORA_DATA_RATES[rate].spreadingFactor, LORA_DATA_RATES[rate].bandwidth);
 }
 
-void LoRaBase::setupLoRa() {
-  LoRa.setPins(LORA_SS, LORA_RST, LORA_DIO0);
-  if (!LoRa.begin(LORA_FREQUENCY)) {
-    Serial.println("Error initializing LoRa");
+void LoRaTransport::setupLoRa() {
+  const LoRaDataRate& home = LORA_DATA_RATES[LORA_HOME_RATE];
+  if (!LoRaRadio::begin(LORA_SS, LORA_RST, LORA_DIO0, LORA_FREQUENCY, home.spreadingFactor,
+                        home.bandwidth, LORA_CODING_RATE)) {
+    LOG_E("Error initializing LoRa");
     while (1);
   }
 
-  LoRa.setSpreadingFactor(LORA_SPREADING_FACTOR);
-  LoRa.setSignalBandwidth(LORA_BANDWIDTH);
-  LoRa.setCodingRate4(LORA_CODING_RATE);
-  LoRa.onReceive(LoRaBase::onReceiveLoRa);
-  LoRa.receive();
+  TaskHandle_t task;
+  xTaskCreatePinnedToCore(LoRaTransport::radioTask, "lora", LORA_RADIO_TASK_STACK, nullptr,
+                          LORA_RADIO_TASK_PRIORITY, &task, LORA_RADIO_TASK_CORE);
+  LoRaRadio::setNotify(task);
+  for (uint8_t rate = 0; rate < ADR_RATE_COUNT; rate++) {
+    uint32_t replyUs = listenUs(rate) + adrAirtimeUs(rate, LORA_REPLY_BYTES);
+    schedule.setSlotLength(rate, replyUs / 1000 + LORA_TURNAROUND_MS);
+  }
+  // Nodes start on the home rate
+  triggers.configure(LORA_TRIGGER_WINDOW, roundTrip(LORA_HOME_RATE),
+                     LORA_TRIGGER_MIN_TIMEOUT, LORA_TRIGGER_MAX_TIMEOUT);
 
-  Serial.println("LoRa initialized");
+  LOG_I("LoRa initialized");
 }
 
-void LoRaBase::sendTriggerToNode(const uint8_t* nodeId) {
-  uint8_t msg[7] = {1}; // Command byte (1) followed by 6-byte MAC
-  memcpy(msg + 1, nodeId, 6);
-  LoRa.beginPacket();
-  LoRa.write(msg, sizeof(msg));
-  LoRa.endPacket();
-  LoRa.receive();
-  Serial.printf("Sent trigger to node %02X:%02X:%02X:%02X:%02X:%02X\n",
-                nodeId[0], nodeId[1], nodeId[2], nodeId[3], nodeId[4], nodeId[5]);
+// Goes out on the node's rate, and carries the base's order while the
+// node has not confirmed it
+bool LoRaTransport::sendTrigger(uint16_t nodeId, uint16_t seq) {
+  int index = nodes.findId(nodeId);
+  if (index < 0) return false;
+  AdrState& adr = nodes[index].adr;
+  uint8_t radio = adrPending(adr) ? adrRadio(adr.targetRate, adr.targetPower) : 0;
+  uint8_t rate = adrNextRate(adr);
+
+  uint8_t frame[FRAME_MAX_SIZE];
+  size_t len = buildTrigger(frame, sizeof(frame), nodeId, seq, radio);
+  tuneRadio(rate);
+  bool sent = LoRaRadio::send(frame, len);
+  if (sent) LOG_D("Sent trigger #%u to node %04X on DR%u", seq, nodeId, rate);
+  return sent;
 }
 
-void LoRaBase::update() {
-  static unsigned long lastTriggerTime = 0;
-  static size_t currentNodeIndex = 0;
-  static bool waitingForResponse = false;
-  static unsigned long triggerSentTime = 0;
-  const unsigned long triggerInterval = 5000;
-  const unsigned long responseTimeout = 500;
+bool LoRaTransport::sendGroupTrigger(uint32_t now, uint16_t seq) {
+  int first = triggers.peek();
+  if (first < 0) return false;
+  uint8_t rate = nodes[first].adr.rate;
+  uint16_t slotMs = schedule.slotLength(rate);
+  int group[LORA_TRIGGER_GROUP_MAX];
+  size_t count = triggers.nextGroup(now, seq, slotMs, groupable, group, LORA_TRIGGER_GROUP_MAX);
+  if (count == 0) return false;
+
+  uint16_t ids[LORA_TRIGGER_GROUP_MAX];
+  uint8_t acks[LORA_TRIGGER_GROUP_MAX];
+  for (size_t i = 0; i < count; i++) {
+    ids[i] = nodes[group[i]].id;
+    acks[i] = nodes.ackedThrough(group[i]) & 0xFF;
+  }
+  uint8_t frame[FRAME_MAX_SIZE];
+  size_t len = encodeGroupTrigger(frame, sizeof(frame), seq, slotMs, ids, acks, count);
+  tuneRadio(rate);
+  if (LoRaRadio::send(frame, len)) {
+    LOG_D("Sent group trigger #%u to %u nodes on DR%u", seq, (unsigned)count, rate);
+  } else {
+    // The polls count as sent; their timeouts turn them into retries
+    metrics.count(METRIC_SEND_ERRORS);
+    LOG_E("Failed to send group trigger to %u nodes", (unsigned)count);
+  }
+  return true;
+}
 
-  unsigned long now = millis();
+// Nodes on one rate share a group trigger; one with an order pending
+// needs a trigger of its own to carry it
+bool LoRaTransport::groupable(int first, int index) {
+  return nodes[index].adr.rate == nodes[first].adr.rate && !adrPending(nodes[index].adr) &&
+         !adrPending(nodes[first].adr);
+}
 
-  if (!waitingForResponse && now - lastTriggerTime >= triggerInterval) {
-    if (nodeMacs.empty()) return;
+// The base always sends at full power; only the nodes' power is adapted
+void LoRaTransport::tuneRadio(uint8_t rate) {
+  if (rate == tunedRate) return;
+  LoRaRadio::configure(LORA_DATA_RATES[rate].spreadingFactor, LORA_DATA_RATES[rate].bandwidth,
+                       ADR_MAX_TX_POWER);
+  tunedRate = rate;
+}
 
-    sendTriggerToNode(nodeMacs[currentNodeIndex].data());
-    waitingForResponse = true;
-    triggerSentTime = now;
+uint16_t LoRaTransport::roundTrip(uint8_t rate) {
+  uint32_t us = 2 * listenUs(rate) + adrAirtimeUs(rate, LORA_TRIGGER_BYTES) +
+                adrAirtimeUs(rate, LORA_REPLY_BYTES);
+  return us / 1000 + LORA_TURNAROUND_MS;
+}
 
-    currentNodeIndex = (currentNodeIndex + 1) % nodeMacs.size();
-    if (currentNodeIndex == 0) {
-      lastTriggerTime = now;
+// Feeds the node's ADR state from a reading frame
+void LoRaTransport::updateAdr(int index, const ReadingFrame& reading, int8_t snr) {
+  NodeInfo& node = nodes[index];
+  AdrState& adr = node.adr;
+
+  if (reading.radio != 0) {
+    // Sent on the old setting, so its SNR says nothing about the new one
+    if (adrRadioValid(reading.radio) && adrConfirm(adr, reading.radio)) {
+      metrics.count(METRIC_RATE_CHANGES);
+      seedRoundTrip(index);
+      LOG_I("Node %04X now on DR%u at %u dBm", node.id, adr.rate, adr.txPower);
     }
+    return;
   }
 
-  if (waitingForResponse && now - triggerSentTime >= responseTimeout) {
-    Serial.printf("Timeout waiting for response from node %02X:%02X:%02X:%02X:%02X:%02X\n",
-                  nodeMacs[currentNodeIndex ? currentNodeIndex - 1 : nodeMacs.size() - 1][0],
-                  nodeMacs[currentNodeIndex ? currentNodeIndex - 1 : nodeMacs.size() - 1][1],
-                  nodeMacs[currentNodeIndex ? currentNodeIndex - 1 : nodeMacs.size() - 1][2],
-                  nodeMacs[currentNodeIndex ? currentNodeIndex - 1 : nodeMacs.size() - 1][3],
-                  nodeMacs[currentNodeIndex ? currentNodeIndex - 1 : nodeMacs.size() - 1][4],
-                  nodeMacs[currentNodeIndex ? currentNodeIndex - 1 : nodeMacs.size() - 1][5]);
-    waitingForResponse = false;
+  if (adrRecord(adr, snr)) {
+    LOG_I("Node %04X: DR%u at %u dBm -> DR%u at %u dBm", node.id, adr.rate, adr.txPower,
+          adr.targetRate, adr.targetPower);
+    seedRoundTrip(index);
   }
+  // Until the node confirms, every reply it sends on the old rate asks
+  // for the order to go out again
+  if (adrPending(adr)) triggers.request(index);
+}
 
-  processHttpQueue();
+// The trigger engine's estimate is for the rate it was measured on. While
+// an order is pending, triggers alternate between two rates, so the
+// slower one sets the timeout.
+void LoRaTransport::seedRoundTrip(int index) {
+  NodeInfo& node = nodes[index];
+  uint8_t slower = node.adr.rate < node.adr.targetRate ? node.adr.rate : node.adr.targetRate;
+  node.srtt = roundTrip(slower);
+  node.rttvar = node.srtt / 4;
 }
 
-void LoRaBase::onReceiveLoRa(int packetSize) {
-  if (packetSize == 0) return;
+void LoRaTransport::sendBroadcast(const uint8_t* frame, size_t len) {
+  if (!LoRaRadio::send(frame, len)) metrics.count(METRIC_SEND_ERRORS);
+}
+
+// Joins come in on the home rate, so the base listens there whenever it
+// is not waiting for a reply
+void LoRaTransport::idle() {
+  if (!schedule.active() && triggers.outstanding() == 0) tuneRadio(LORA_HOME_RATE);
+}
 
-  char buffer[256];
-  int len = 0;
-  while (LoRa.available() && len < sizeof(buffer) - 1) {
-    buffer[len++] = (char)LoRa.read();
+void LoRaTransport::radioTask(void* param) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    LoRaRadio::drain();
   }
-  buffer[len] = '\0';
+}
 
-  Serial.printf("Received LoRa: %s\n", buffer);
+void LoRaTransport::receive() {
+  uint32_t drops = LoRaRadio::dropped();
+  if (drops != reportedFifoDrops) {
+    LOG_W("⚠️ LoRa FIFO full, dropped %u packets (%u total, high water %u)",
+          drops - reportedFifoDrops, drops, LoRaRadio::highWater());
+    reportedFifoDrops = drops;
+  }
 
-  StaticJsonDocument<256> doc;
-  DeserializationError error = deserializeJson(doc, buffer);
-  if (!error) {
-    int value = doc["value"];
-    const char* deviceId = doc["deviceId"];
+  uint32_t busy = LoRaRadio::channelBusy();
+  uint32_t abandoned = LoRaRadio::abandoned();
+  metrics.count(METRIC_CHANNEL_BUSY, busy - reportedBusy);
+  if (abandoned != reportedAbandoned) {
+    LOG_W("⚠️ LoRa channel busy, gave up %u sends (%u total)", abandoned - reportedAbandoned,
+          abandoned);
+    metrics.count(METRIC_SENDS_ABANDONED, abandoned - reportedAbandoned);
+  }
+  reportedBusy = busy;
+  reportedAbandoned = abandoned;
 
-    jsonDoc.clear();
-    JsonArray dataArray = jsonDoc.to<JsonArray>();
-    JsonObject entry = dataArray.createNestedObject();
-    entry["value"] = value;
-    entry["deviceId"] = String(deviceId);
+  LoRaPacket packet;
+  while (LoRaRadio::pop(packet)) handlePacket(packet);
+}
 
-    lastReceivedData = "";
-    serializeJson(jsonDoc, lastReceivedData);
+void LoRaTransport::handlePacket(const LoRaPacket& packet) {
+  const uint8_t* buffer = packet.data;
+  size_t len = packet.len;
+
+#ifdef CAPTURE
+  capture.frame(nullptr, buffer, len, packet.rssi, packet.snr);
+#endif
+  metrics.count(METRIC_FRAMES_RECEIVED);
+  FrameReader reader;
+  if (!reader.parse(buffer, len)) {
+    metrics.count(METRIC_FRAMES_INVALID);
+    LOG_W("Dropped invalid LoRa frame");
+    return;
+  }
 
-    Message msg;
-    msg.json = lastReceivedData;
-    msg.receivedAt = millis();
-    messageQueue.push(msg);
+  if (reader.header().type == FRAME_JOIN) {
+    uint8_t joinMac[6];
+    int32_t ackedSeq;
+    if (findJoinMac(reader, joinMac, &ackedSeq)) {
+      enqueueJoin(joinMac, reader.header().nodeId, ackedSeq);
+    }
+    return;
+  }
 
-    Serial.printf("Response: %s\n", lastReceivedData.c_str());
-  } else {
-    Serial.println("Failed to parse incoming JSON");
+  ReadingFrame reading;
+  if (!decodeReading(buffer, len, reading)) return;
+
+  int index = nodes.findId(reading.nodeId);
+  if (index < 0) {
+    LOG_W("Reading from unknown node %04X", reading.nodeId);
+    return;
+  }
+  // Polled over another radio: its ADR state and retries are not ours to
+  // touch. It moves here by joining, and resends the reading until acked.
+  if (nodes[index].transport != this->index) {
+    LOG_W("LoRa reading from node %04X, which is on another radio", reading.nodeId);
+    return;
   }
-}
\ No newline at end of file
+
+  enqueueReading(nodes[index].mac, reading, packet.rssi, packet.snr, packet.receivedAt);
+  updateAdr(index, reading, packet.snr);
+
+  LOG_D("Received reading from %04X #%u: %d", reading.nodeId, reading.seq, reading.value);
+}
@@ -1,18 +1,40 @@
 #ifndef BASE_LORA_H
 #define BASE_LORA_H
 
-#include "base.h"
-#include <LoRa.h>
+#include "transport.h"
+#include "lora_radio.h"
+#include "adr.h"
 
-class LoRaBase : public Base {
+class LoRaTransport : public Transport {
 public:
   void begin() override;
-  void update() override;
+  // Decodes what the radio task queued
+  void receive() override;
+  void idle() override;
+  CaptureRadio captureRadio() const override { return CAPTURE_LORA; }
+
+protected:
+  bool sendTrigger(uint16_t nodeId, uint16_t seq) override;
+  bool sendGroupTrigger(uint32_t now, uint16_t seq) override;
+  void sendBroadcast(const uint8_t* frame, size_t len) override;
+  void tuneRadio(uint8_t rate) override;
 
 private:
   void setupLoRa();
-  void sendTriggerToNode(const uint8_t* nodeId);
-  static void onReceiveLoRa(int packetSize);
+  static bool groupable(int first, int index);
+  // ms from a trigger's start to the end of its reply on rate
+  static uint16_t roundTrip(uint8_t rate);
+  void updateAdr(int index, const ReadingFrame& reading, int8_t snr);
+  static void seedRoundTrip(int index);
+  // Radio task: reads packets off the radio as DIO0 flags them
+  static void radioTask(void* param);
+  void handlePacket(const LoRaPacket& packet);
+
+  static uint8_t tunedRate; // Data rate the radio is on
+  // Radio counters already reported, kept by receive()
+  uint32_t reportedFifoDrops = 0;
+  uint32_t reportedBusy = 0;
+  uint32_t reportedAbandoned = 0;
 };
 
 #endif
\ No newline at end of file
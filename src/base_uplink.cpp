@@ -0,0 +1,386 @@
+#include "base.h"
+#include "transport.h"
+#include "batch_codec.h"
+
+#define UPLINK_TASK_STACK 12288 // TLS handshake needs a deep stack
+#define UPLINK_TASK_PRIORITY 1
+#define UPLINK_TASK_CORE 0      // Arduino loop() runs on core 1
+#define UPLINK_BATCH_MAX_AGE 2000
+#define UPLINK_RESPONSE_SIZE 1024 // Room for ~38 acked ranges; ranges cut off are simply resent
+#define BATCH_ID_START_MAX 0x1000000 // Random first batch id, leaving the log's seqs room to grow
+
+#define CAPTURE_TASK_STACK 4096
+#define CAPTURE_FLUSH_MS 20 // Drains the frame ring well before a sweep fills it
+
+#ifndef BATCH_LOG_PATH
+#define BATCH_LOG_PATH "/littlefs/batches.log"
+#endif
+#ifndef CAPTURE_PATH
+#define CAPTURE_PATH "/littlefs/capture.bin"
+#endif
+#ifndef CAPTURE_MAX_BYTES
+#define CAPTURE_MAX_BYTES 262144 // Current file plus the .old one
+#endif
+
+// Override with -D flags to point the base at a local stand-in server
+#ifndef UPLINK_HOST
+#define UPLINK_HOST "vaquinet-api.onrender.com"
+#endif
+#ifndef UPLINK_PORT
+#define UPLINK_PORT 443
+#endif
+#ifndef UPLINK_PATH
+#define UPLINK_PATH "/esp/data"
+#endif
+#ifndef METRICS_PATH
+#define METRICS_PATH "/esp/metrics"
+#endif
+#ifndef METRICS_INTERVAL
+#define METRICS_INTERVAL 60000
+#endif
+
+static const char GTS_ROOT_R4_CA[] = R"EOF(
+-----BEGIN CERTIFICATE-----
+MIIDejCCAmKgAwIBAgIQf+UwvzMTQ77dghYQST2KGzANBgkqhkiG9w0BAQsFADBX
+MQswCQYDVQQGEwJCRTEZMBcGA1UEChMQR2xvYmFsU2lnbiBudi1zYTEQMA4GA1UE
+CxMHUm9vdCBDQTEbMBkGA1UEAxMSR2xvYmFsU2lnbiBSb290IENBMB4XDTIzMTEx
+NTAzNDMyMVoXDTI4MDEyODAwMDA0MlowRzELMAkGA1UEBhMCVVMxIjAgBgNVBAoT
+GUdvb2dsZSBUcnVzdCBTZXJ2aWNlcyBMTEMxFDASBgNVBAMTC0dUUyBSb290IFI0
+MHYwEAYHKoZIzj0CAQYFK4EEACIDYgAE83Rzp2iLYK5DuDXFgTB7S0md+8Fhzube
+Rr1r1WEYNa5A3XP3iZEwWus87oV8okB2O6nGuEfYKueSkWpz6bFyOZ8pn6KY019e
+WIZlD6GEZQbR3IvJx3PIjGov5cSr0R2Ko4H/MIH8MA4GA1UdDwEB/wQEAwIBhjAd
+BgNVHSUEFjAUBggrBgEFBQcDAQYIKwYBBQUHAwIwDwYDVR0TAQH/BAUwAwEB/zAd
+BgNVHQ4EFgQUgEzW63T/STaj1dj8tT7FavCUHYwwHwYDVR0jBBgwFoAUYHtmGkUN
+l8qJUC99BM00qP/8/UswNgYIKwYBBQUHAQEEKjAoMCYGCCsGAQUFBzAChhpodHRw
+Oi8vaS5wa2kuZ29vZy9nc3IxLmNydDAtBgNVHR8EJjAkMCKgIKAehhxodHRwOi8v
+Yy5wa2kuZ29vZy9yL2dzcjEuY3JsMBMGA1UdIAQMMAowCAYGZ4EMAQIBMA0GCSqG
+SIb3DQEBCwUAA4IBAQAYQrsPBtYDh5bjP2OBDwmkoWhIDDkic574y04tfzHpn+cJ
+odI2D4SseesQ6bDrarZ7C30ddLibZatoKiws3UL9xnELz4ct92vID24FfVbiI1hY
++SW6FoVHkNeWIP0GCbaM4C6uVdF5dTUsMVs/ZbzNnIdCp5Gxmx5ejvEau8otR/Cs
+kGN+hr/W5GvT1tMBjgWKZ1i4//emhA1JG1BbPzoLJQvyEotc03lXjTaCzv8mEbep
+8RqZ7a2CPsgRbuvTPBwcOMBBmuFeU88+FSBX6+7iP0il8b4Z0QFqIwwMHfs/L6K1
+vepuoxtGzi4CZ68zJpiq1UvSqTbFJjtbD4seiMHl
+-----END CERTIFICATE-----
+)EOF";
+
+WiFiClientSecure Base::secureClient;
+HttpLink Base::uplink(Base::secureClient, UPLINK_HOST, UPLINK_PORT, true);
+char Base::uploadBody[READING_JSON_BODY_SIZE];
+ReadingStore Base::batches[2];
+ReadingStore* Base::readings = &Base::batches[0];
+std::atomic<ReadingStore*> Base::sealedBatch(nullptr);
+unsigned long Base::sealedAt = 0;
+uint32_t Base::sealedId = 0;
+Base::UplinkStats Base::uplinkStats = {};
+TaskHandle_t Base::uplinkTaskHandle = nullptr;
+BatchLog Base::batchLog;
+#ifdef CAPTURE
+Capture Base::capture;
+#endif
+
+void Base::startUplink() {
+    if (uplinkTaskHandle != nullptr) return;
+#ifdef UPLINK_INSECURE
+    secureClient.setInsecure(); // Self-signed stand-in server
+#else
+    secureClient.setCACert(GTS_ROOT_R4_CA);
+#endif
+
+    // Logged batches are identified by their log seq, others by sealedId
+    if (!LittleFS.begin(true) || !batchLog.open(BATCH_LOG_PATH, random(1, BATCH_ID_START_MAX))) {
+        LOG_W("⚠️ [Uplink] Batch log unavailable, batches are kept in RAM only");
+    } else if (batchLog.pending() > 0) {
+        LOG_I("[Uplink] Replaying %u logged batches", batchLog.pending());
+    }
+    xTaskCreatePinnedToCore(Base::uplinkTask, "uplink", UPLINK_TASK_STACK, this,
+                            UPLINK_TASK_PRIORITY, &uplinkTaskHandle, UPLINK_TASK_CORE);
+}
+
+// Records received frames and upload outcomes for replay on a host, see
+// replay_main.cpp. Call after startUplink(), which mounts the filesystem.
+void Base::startCapture(CaptureRadio radio) {
+#ifdef CAPTURE
+    uint8_t mac[6];
+    WiFi.macAddress(mac);
+    if (!capture.open(CAPTURE_PATH, radio, mac, CAPTURE_MAX_BYTES)) {
+        LOG_W("⚠️ Capture unavailable");
+        return;
+    }
+    LOG_I("Capturing radio traffic to %s", CAPTURE_PATH);
+    xTaskCreatePinnedToCore(Base::captureTask, "capture", CAPTURE_TASK_STACK, nullptr,
+                            UPLINK_TASK_PRIORITY, nullptr, UPLINK_TASK_CORE);
+#endif
+}
+
+#ifdef CAPTURE
+// Owns the capture file. A new file starts with the nodes known so far,
+// read without a lock like the radio callbacks do.
+void Base::captureTask(void* param) {
+    for (;;) {
+        vTaskDelay(pdMS_TO_TICKS(CAPTURE_FLUSH_MS));
+        if (!capture.flush()) continue;
+        for (int i = 0; i < NODE_TABLE_CAPACITY; i++) {
+            if (nodes.used(i)) capture.node(nodes[i].mac, nodes[i].id);
+        }
+    }
+}
+#endif
+
+// Loop task: seals the filling batch and hands it to the uplink task when
+// that is idle. Never waits on the network.
+void Base::handOffBatch() {
+    if (readings->empty() || sealedBatch.load(std::memory_order_acquire) != nullptr) return;
+    if (!readings->full() && millis() - (*readings)[0].receivedAt < UPLINK_BATCH_MAX_AGE) return;
+
+    static uint32_t lastId = random(1, BATCH_ID_START_MAX);
+    metrics.record(METRIC_BATCH_SIZE, readings->size());
+    sealedAt = millis();
+    sealedId = ++lastId;
+    sealedBatch.store(readings, std::memory_order_release);
+    readings = (readings == &batches[0]) ? &batches[1] : &batches[0];
+    xTaskNotifyGive(uplinkTaskHandle);
+}
+
+void Base::uplinkTask(void* param) {
+    Base* base = static_cast<Base*>(param);
+    bool lastFailed = false;
+    for (;;) {
+        // Sleep until a batch is sealed, or until the next retry is due
+        // while a backlog remains. Metrics go out when the batches are done.
+        TickType_t wait = pdMS_TO_TICKS(METRICS_INTERVAL);
+        if (batchLog.pending() > 0 || sealedBatch.load(std::memory_order_acquire) != nullptr) {
+            wait = lastFailed ? pdMS_TO_TICKS(uplink.retryDelay()) : 0;
+        }
+        ulTaskNotifyTake(pdTRUE, wait);
+
+        base->storeSealedBatch();
+        lastFailed = !base->sendOldestBatch();
+        if (!lastFailed && batchLog.pending() == 0 &&
+            sealedBatch.load(std::memory_order_acquire) == nullptr) {
+            base->sendMetrics();
+        }
+    }
+}
+
+// Uplink task: moves the sealed batch into the flash log and releases the
+// buffer straight away. Without a log it stays sealed until it is sent.
+void Base::storeSealedBatch() {
+    ReadingStore* batch = sealedBatch.load(std::memory_order_acquire);
+    if (batch == nullptr || !batchLog.append(*batch, sealedAt)) return;
+
+    batch->clear();
+    sealedBatch.store(nullptr, std::memory_order_release);
+}
+
+// Uplink task: posts the oldest batch not yet acknowledged, logged ones
+// first. Returns false only when an upload was attempted and failed.
+bool Base::sendOldestBatch() {
+    static ReadingStore replay;
+    static uint32_t replaySeq = 0;
+    static uint32_t replayCreatedAt = 0;
+    ReadingStore* batch = nullptr;
+    ReadingStore* sealed = sealedBatch.load(std::memory_order_acquire);
+    uint32_t batchId = 0;
+    uint32_t createdAt = 0;
+
+    // A logged batch stays loaded while it is retried, less the readings
+    // the server acknowledged so far. After a restart it is loaded whole
+    // again and the server tells the rest apart by its key.
+    if ((replaySeq != 0 && replaySeq == batchLog.oldestPending()) ||
+        batchLog.peek(replay, replaySeq, replayCreatedAt)) {
+        batch = &replay;
+        batchId = replaySeq;
+        createdAt = replayCreatedAt;
+    } else if (sealed != nullptr) {
+        batch = sealed;
+        batchId = sealedId;
+        createdAt = sealedAt;
+    } else {
+        return true;
+    }
+
+    // createdAt is from an earlier boot when it is ahead of the clock
+    uint32_t now = millis();
+    uint32_t queueWait = createdAt <= now ? now - createdAt : 0;
+
+    size_t posted = batch->size();
+    unsigned long start = millis();
+    bool online = WiFi.status() == WL_CONNECTED;
+    bool ok = online && postBatch(*batch, batchId);
+    uint32_t latency = millis() - start;
+#ifdef CAPTURE
+    capture.upload(online ? uplink.getStats().lastStatus : 0, posted, latency);
+#endif
+
+    // What is left in the batch was not acknowledged: the rest of a
+    // partial upload, or readings the server refused for good
+    uint32_t acked = posted - batch->size();
+    uplinkStats.readings += acked;
+    if (!ok) {
+        uplinkStats.failures++;
+        if (acked > 0) {
+            uplinkStats.partial++;
+            metrics.count(METRIC_UPLOADS_PARTIAL);
+            LOG_W("[Uplink] Server kept %u of %u readings, resending the rest",
+                  (unsigned)acked, (unsigned)posted);
+        }
+        LOG_W("[Uplink] Batch upload failed, %u batches waiting, retrying in %u ms",
+              batchLog.pending(), uplink.retryDelay());
+        return false;
+    }
+
+    metrics.record(METRIC_HTTP_LATENCY, latency);
+    uplinkStats.batches++;
+    uplinkStats.lastLatency = latency;
+    uplinkStats.lastQueueWait = queueWait;
+    if (latency > uplinkStats.maxLatency) uplinkStats.maxLatency = latency;
+    if (queueWait > uplinkStats.maxQueueWait) uplinkStats.maxQueueWait = queueWait;
+    LOG_I("[Uplink] Batch of %u readings sent in %u ms (waited %u ms), %u acknowledged",
+          (unsigned)posted, latency, queueWait, (unsigned)acked);
+
+    batch->clear();
+    if (batch == &replay) {
+        batchLog.ack(replaySeq);
+    } else {
+        sealedBatch.store(nullptr, std::memory_order_release);
+    }
+    return true;
+}
+
+// Uplink task: posts a metrics snapshot every METRICS_INTERVAL. Nothing
+// is retried, the next snapshot carries the same totals. Node rows that
+// do not fit in one body follow in the next ones.
+void Base::sendMetrics() {
+    static uint32_t lastSent = 0;
+    static bool sentOnce = false;
+    static int nodeCursor = 0;
+    static MetricsSnapshot snap;
+
+    uint32_t now = millis();
+    if (sentOnce && now - lastSent < METRICS_INTERVAL) return;
+    if (WiFi.status() != WL_CONNECTED) return;
+    lastSent = now;
+    sentOnce = true;
+
+    // Summed over the transports' queues, high water of the fullest
+    uint32_t depth = 0, highWater = 0, drops = 0;
+    for (size_t i = 0; i < transportCount; i++) {
+        const SpscRing<Message, MAX_QUEUE_SIZE>& queue = transports[i]->messageQueue;
+        depth += queue.size();
+        if (queue.highWater() > highWater) highWater = queue.highWater();
+        drops += queue.dropped();
+    }
+    metrics.set(METRIC_QUEUE_DEPTH, depth);
+    metrics.set(METRIC_QUEUE_HIGH_WATER, highWater);
+    metrics.set(METRIC_QUEUE_DROPS, drops);
+    metrics.set(METRIC_NODES, nodes.size());
+    metrics.set(METRIC_BATCHES_PENDING, batchLog.pending());
+    metrics.snapshot(snap, now);
+
+    size_t len = metrics.writeJson(snap, nodes, &nodeCursor, uploadBody, sizeof(uploadBody));
+    if (len == 0) return;
+
+    char response[64];
+    int code = uplink.post(METRICS_PATH, "application/json",
+                           reinterpret_cast<const uint8_t*>(uploadBody), len,
+                           response, sizeof(response));
+    if (code != HTTP_CODE_OK && code != HTTP_CODE_CREATED && code != HTTP_CODE_NO_CONTENT) {
+        LOG_W("[Uplink] Metrics upload failed: %d", code);
+    }
+}
+
+bool Base::postBatch(ReadingStore& batch, uint32_t batchId) {
+    return postBatchTo(uplink, batch, batchId);
+}
+
+bool Base::postBatchTo(HttpLink& link, ReadingStore& batch, uint32_t batchId) {
+    static char response[UPLINK_RESPONSE_SIZE];
+    int code = 0;
+
+    uint8_t mac[6];
+    char key[BATCH_KEY_SIZE];
+    WiFi.macAddress(mac);
+    formatBatchKey(mac, batchId, key, sizeof(key));
+
+#ifdef UPLINK_COMPACT
+    // Compact bodies until the server says it does not understand them
+    static bool compactRejected = false;
+    if (!compactRejected) {
+        uint8_t* body = reinterpret_cast<uint8_t*>(uploadBody);
+        size_t bodyLen = encodeCompactBatch(batch, body, sizeof(uploadBody));
+        if (bodyLen > 0) {
+            code = link.post(UPLINK_PATH, BATCH_COMPACT_CONTENT_TYPE, body, bodyLen,
+                             response, sizeof(response), key);
+            if (code == HTTP_CODE_UNSUPPORTED_MEDIA_TYPE) {
+                LOG_I("[HTTP] Server rejected compact batches, falling back to JSON");
+                compactRejected = true;
+            } else {
+                return checkResponse(link, code, response, batch);
+            }
+        }
+    }
+#endif
+
+    size_t bodyLen = batch.writeJson(uploadBody, sizeof(uploadBody));
+    if (bodyLen == 0) {
+        LOG_E("✖️ [HTTP] Failed to build upload body");
+        return false;
+    }
+
+    code = link.post(UPLINK_PATH, "application/json",
+                     reinterpret_cast<const uint8_t*>(uploadBody), bodyLen,
+                     response, sizeof(response), key);
+    return checkResponse(link, code, response, batch);
+}
+
+// A timeout or a failed status may still have been committed: the retry
+// goes out under the same key, and acked ranges in any response trim it.
+// Only timeouts, 5xx and the two retryable 4xx are retried; any other 4xx
+// refuses the batch for good, and retrying it would block the backlog.
+bool Base::checkResponse(HttpLink& link, int code, const char* response, ReadingStore& batch) {
+    if (code <= 0) {
+        return false;
+    }
+
+    const HttpLink::Stats& stats = link.getStats();
+    bool success = code >= 200 && code < 300;
+    bool refused = code >= HTTP_CODE_BAD_REQUEST && code < 500 &&
+                   code != HTTP_CODE_REQUEST_TIMEOUT && code != HTTP_CODE_TOO_MANY_REQUESTS;
+    if (success) {
+        LOG_I("✔️ [HTTP] %s answered %d in %u ms (handshakes %u, reused %u)",
+              link.getHost(), code, stats.lastRequest, stats.connects, stats.reused);
+    } else {
+        LOG_W("⚠️ [HTTP] %s answered %d in %u ms (handshakes %u, reused %u)",
+              link.getHost(), code, stats.lastRequest, stats.connects, stats.reused);
+    }
+    if (response[0]) {
+        LOG_D("[HTTP] Response body: %s", response);
+    }
+
+    static BatchAck ack;
+    size_t before = batch.size();
+    if (!parseBatchAck(response, ack)) {
+        // Accepted without ranges: the whole batch is acknowledged
+        if (success) batch.clear();
+    } else {
+        batch.removeIf([](const Reading& r) { return ack.covers(r); });
+    }
+    if (batch.empty()) return true;
+
+    if (refused) {
+        metrics.count(METRIC_READINGS_REJECTED, batch.size());
+        LOG_E("❌ [HTTP] Server refused %u readings with %d, dropped", (unsigned)batch.size(), code);
+        return true;
+    }
+    if (!success) return false;
+
+    // Accepted, yet some readings are not acknowledged. Resending them is
+    // only worth it while the server makes progress; otherwise it refuses
+    // them for good and they would block the backlog.
+    if (batch.size() == before) {
+        metrics.count(METRIC_READINGS_REJECTED, batch.size());
+        LOG_E("❌ [HTTP] Server acknowledged none of %u readings, dropped", (unsigned)before);
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,269 @@
+#include "batch_codec.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace {
+
+class ByteWriter {
+public:
+  ByteWriter(uint8_t* buffer, size_t capacity) : buf(buffer), cap(capacity) {}
+
+  void put(uint8_t b) {
+    if (len >= cap) {
+      overflow = true;
+      return;
+    }
+    buf[len++] = b;
+  }
+
+  void putVarint(uint32_t v) {
+    while (v >= 0x80) {
+      put(static_cast<uint8_t>(v) | 0x80);
+      v >>= 7;
+    }
+    put(static_cast<uint8_t>(v));
+  }
+
+  void putSigned(int32_t v) {
+    putVarint((static_cast<uint32_t>(v) << 1) ^ static_cast<uint32_t>(v >> 31));
+  }
+
+  size_t finish() const { return overflow ? 0 : len; }
+
+private:
+  uint8_t* buf;
+  size_t cap;
+  size_t len = 0;
+  bool overflow = false;
+};
+
+class ByteReader {
+public:
+  ByteReader(const uint8_t* data, size_t length) : buf(data), end(length) {}
+
+  bool get(uint8_t& b) {
+    if (pos >= end) return false;
+    b = buf[pos++];
+    return true;
+  }
+
+  bool getVarint(uint32_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+      uint8_t b;
+      if (!get(b)) return false;
+      if (shift == 28 && (b & 0x70)) return false; // Past 32 bits
+      v |= static_cast<uint32_t>(b & 0x7F) << shift;
+      if (!(b & 0x80)) return true;
+    }
+    return false;
+  }
+
+  bool getSigned(int32_t& v) {
+    uint32_t raw;
+    if (!getVarint(raw)) return false;
+    v = static_cast<int32_t>(raw >> 1) ^ -static_cast<int32_t>(raw & 1);
+    return true;
+  }
+
+private:
+  const uint8_t* buf;
+  size_t end;
+  size_t pos = 0;
+};
+
+} // namespace
+
+size_t encodeCompactBatch(const ReadingStore& batch, uint8_t* out, size_t outLen) {
+  ByteWriter w(out, outLen);
+  w.put('V');
+  w.put('B');
+  w.put(BATCH_COMPACT_VERSION);
+
+  // Reference point: the first reading that knows the wall clock
+  uint32_t refEpoch = 0;
+  uint32_t refMillis = batch.empty() ? 0 : batch[0].receivedAt;
+  for (size_t i = 0; i < batch.size(); i++) {
+    if (batch[i].epoch) {
+      refEpoch = batch[i].epoch;
+      refMillis = batch[i].receivedAt;
+      break;
+    }
+  }
+  w.putVarint(refEpoch);
+  w.putVarint(refMillis);
+
+  // Group readings by MAC, keeping arrival order within each group
+  bool grouped[READING_STORE_CAPACITY] = {};
+  uint32_t groups = 0;
+  for (size_t i = 0; i < batch.size(); i++) {
+    if (grouped[i]) continue;
+    groups++;
+    for (size_t j = i + 1; j < batch.size(); j++) {
+      if (!grouped[j] && memcmp(batch[j].mac, batch[i].mac, 6) == 0) grouped[j] = true;
+    }
+  }
+  w.putVarint(groups);
+
+  memset(grouped, 0, sizeof(grouped));
+  for (size_t i = 0; i < batch.size(); i++) {
+    if (grouped[i]) continue;
+
+    uint32_t count = 0;
+    for (size_t j = i; j < batch.size(); j++) {
+      if (memcmp(batch[j].mac, batch[i].mac, 6) == 0) count++;
+    }
+    for (int k = 0; k < 6; k++) w.put(batch[i].mac[k]);
+    w.putVarint(count);
+
+    const Reading* prev = nullptr;
+    int32_t prevDelta = 0;
+    for (size_t j = i; j < batch.size(); j++) {
+      const Reading& r = batch[j];
+      if (grouped[j] || memcmp(r.mac, batch[i].mac, 6) != 0) continue;
+      grouped[j] = true;
+
+      if (prev == nullptr) {
+        w.putSigned(static_cast<int32_t>(r.receivedAt - refMillis));
+        w.putSigned(r.value);
+        w.putVarint(r.seq);
+      } else {
+        int32_t delta = static_cast<int32_t>(r.receivedAt - prev->receivedAt);
+        w.putSigned(static_cast<int32_t>(static_cast<uint32_t>(delta) - prevDelta));
+        w.putSigned(static_cast<int32_t>(static_cast<uint32_t>(r.value) - prev->value));
+        w.putSigned(static_cast<int16_t>(r.seq - prev->seq - 1));
+        prevDelta = delta;
+      }
+      prev = &r;
+    }
+  }
+
+  return w.finish();
+}
+
+bool decodeCompactBatch(const uint8_t* data, size_t len, ReadingStore& out) {
+  ByteReader r(data, len);
+  uint8_t magic0, magic1, version;
+  if (!r.get(magic0) || !r.get(magic1) || !r.get(version) ||
+      magic0 != 'V' || magic1 != 'B' || version != BATCH_COMPACT_VERSION) {
+    return false;
+  }
+
+  uint32_t refEpoch, refMillis, groups;
+  if (!r.getVarint(refEpoch) || !r.getVarint(refMillis) || !r.getVarint(groups)) return false;
+
+  out.clear();
+  for (uint32_t g = 0; g < groups; g++) {
+    Reading reading = {};
+    for (int k = 0; k < 6; k++) {
+      if (!r.get(reading.mac[k])) return false;
+    }
+
+    uint32_t count;
+    if (!r.getVarint(count)) return false;
+
+    int32_t prevDelta = 0;
+    for (uint32_t i = 0; i < count; i++) {
+      if (i == 0) {
+        int32_t offset;
+        uint32_t seq;
+        if (!r.getSigned(offset) || !r.getSigned(reading.value) || !r.getVarint(seq)) return false;
+        reading.receivedAt = refMillis + offset;
+        reading.seq = seq;
+      } else {
+        int32_t dod, dv, dseq;
+        if (!r.getSigned(dod) || !r.getSigned(dv) || !r.getSigned(dseq)) return false;
+        prevDelta = static_cast<int32_t>(static_cast<uint32_t>(prevDelta) + dod);
+        reading.receivedAt += prevDelta;
+        reading.value = static_cast<int32_t>(static_cast<uint32_t>(reading.value) + dv);
+        reading.seq += dseq + 1;
+      }
+
+      int32_t sinceRef = static_cast<int32_t>(reading.receivedAt - refMillis);
+      reading.epoch = refEpoch ? refEpoch + sinceRef / 1000 : 0;
+      if (!out.add(reading)) return false;
+    }
+  }
+  return true;
+}
+
+size_t formatBatchKey(const uint8_t* baseMac, uint32_t batchId, char* out, size_t outLen) {
+  int n = snprintf(out, outLen, "%02X%02X%02X%02X%02X%02X-%08lX", baseMac[0], baseMac[1],
+                   baseMac[2], baseMac[3], baseMac[4], baseMac[5],
+                   static_cast<unsigned long>(batchId));
+  return n > 0 && static_cast<size_t>(n) < outLen ? n : 0;
+}
+
+bool BatchAck::covers(const Reading& reading) const {
+  for (size_t i = 0; i < count; i++) {
+    const BatchAckRange& r = ranges[i];
+    if (memcmp(r.mac, reading.mac, 6) == 0 &&
+        static_cast<uint16_t>(reading.seq - r.first) <= static_cast<uint16_t>(r.last - r.first)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static const char* skipSpace(const char* p) {
+  while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+  return p;
+}
+
+static int hexDigit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+// One ["AABBCCDDEEFF",first,last] entry; returns the position after it,
+// or nullptr when it is malformed or cut off
+static const char* parseAckRange(const char* p, BatchAckRange& range) {
+  p = skipSpace(p);
+  if (*p++ != '[') return nullptr;
+  p = skipSpace(p);
+  if (*p++ != '"') return nullptr;
+  for (int i = 0; i < 6; i++) {
+    int hi = hexDigit(p[0]);
+    int lo = hi < 0 ? -1 : hexDigit(p[1]);
+    if (lo < 0) return nullptr;
+    range.mac[i] = static_cast<uint8_t>(hi << 4 | lo);
+    p += 2;
+  }
+  if (*p++ != '"') return nullptr;
+
+  uint16_t* bounds[2] = {&range.first, &range.last};
+  for (uint16_t* bound : bounds) {
+    p = skipSpace(p);
+    if (*p++ != ',') return nullptr;
+    char* end;
+    unsigned long v = strtoul(p, &end, 10);
+    if (end == p || v > 0xFFFF) return nullptr;
+    *bound = static_cast<uint16_t>(v);
+    p = skipSpace(end);
+  }
+  return *p == ']' ? p + 1 : nullptr;
+}
+
+bool parseBatchAck(const char* response, BatchAck& ack) {
+  ack.count = 0;
+  const char* p = strstr(response, "\"acked\"");
+  if (p == nullptr) return false;
+  p = skipSpace(p + 7);
+  if (*p++ != ':') return false;
+  p = skipSpace(p);
+  if (*p++ != '[') return false;
+
+  p = skipSpace(p);
+  if (*p == ']') return true;
+  while (ack.count < BATCH_ACK_MAX_RANGES) {
+    p = parseAckRange(p, ack.ranges[ack.count]);
+    if (p == nullptr) break;
+    ack.count++;
+    p = skipSpace(p);
+    if (*p++ != ',') break;
+  }
+  return true;
+}
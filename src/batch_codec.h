@@ -0,0 +1,73 @@
+#ifndef BATCH_CODEC_H
+#define BATCH_CODEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "reading_store.h"
+
+// Compact binary upload body, an alternative to the JSON array. Enabled
+// with -DUPLINK_COMPACT and sent as BATCH_COMPACT_CONTENT_TYPE; a server
+// that does not know it must answer 415 and the base falls back to JSON.
+//
+//   "VB" version
+//   varint  reference Unix time in seconds (0 when unknown)
+//   varint  reference millis(), the receive time that Unix time belongs to
+//   varint  number of node groups
+//   per group:
+//     6 bytes MAC, varint reading count
+//     first reading: zigzag time offset from the reference, zigzag value, seq
+//     next readings: zigzag delta-of-delta of the receive time,
+//                    zigzag delta of the value,
+//                    zigzag (seq delta - 1), so consecutive seqs cost one byte
+//
+// Readings of one node are polled at a steady interval, so the time
+// delta-of-delta is usually within a few ms and one byte, against the
+// ~45 bytes a JSON entry takes.
+
+#define BATCH_COMPACT_CONTENT_TYPE "application/vnd.vakinet.batch.v1"
+#define BATCH_COMPACT_VERSION 1
+
+// Returns the body length, or 0 if out is too small.
+size_t encodeCompactBatch(const ReadingStore& batch, uint8_t* out, size_t outLen);
+
+// Host-side decoder, the inverse of encodeCompactBatch. Readings come back
+// grouped by node; nodeId, RSSI and SNR are not carried and stay zero.
+// False on malformed input or when out overflows.
+bool decodeCompactBatch(const uint8_t* data, size_t len, ReadingStore& out);
+
+// Uploads are idempotent: every batch goes out with the header
+//
+//   Idempotency-Key: <base MAC>-<batch id>
+//
+// which stays the same across retries, also after a restart for logged
+// batches, and every reading carries its node's seq. The server may list
+// the readings it holds, per node and as inclusive seq ranges, in
+//
+//   {"acked":[["AABBCCDDEEFF",first,last],...]}
+//
+// with any status; readings outside the ranges are posted again under the
+// same key. A 200 or 201 without "acked" acknowledges the whole batch.
+
+#define BATCH_KEY_SIZE 24 // 12 hex digits, '-', 8 hex digits, NUL
+#define BATCH_ACK_MAX_RANGES 64
+
+struct BatchAckRange {
+  uint8_t mac[6];
+  uint16_t first;
+  uint16_t last; // Inclusive, may wrap past 65535
+};
+
+struct BatchAck {
+  size_t count;
+  BatchAckRange ranges[BATCH_ACK_MAX_RANGES];
+
+  bool covers(const Reading& reading) const;
+};
+
+size_t formatBatchKey(const uint8_t* baseMac, uint32_t batchId, char* out, size_t outLen);
+
+// False when the response has no "acked" list. A list cut short by a
+// truncated response keeps the ranges read before the cut.
+bool parseBatchAck(const char* response, BatchAck& ack);
+
+#endif
@@ -0,0 +1,128 @@
+#include "batch_log.h"
+#include "frame.h"
+#include <string.h>
+#include <unistd.h>
+
+bool BatchLog::open(const char* path, uint32_t startSeq) {
+  close();
+  file = fopen(path, "r+b");
+  if (file == nullptr) {
+    file = fopen(path, "w+b");
+  }
+  if (file == nullptr) return false;
+
+  // Restart scan: only the slot headers are read
+  headSeq = 0;
+  ackedSeq = 0;
+  uint32_t oldestSeq = 0;
+  for (uint32_t slot = 0; slot < BATCH_LOG_SLOTS; slot++) {
+    SlotHeader hdr;
+    if (fseek(file, slot * SLOT_SIZE, SEEK_SET) != 0 ||
+        fread(&hdr, sizeof(hdr), 1, file) != 1 || hdr.magic != BATCH_LOG_MAGIC ||
+        hdr.seq % BATCH_LOG_SLOTS != slot) {
+      continue;
+    }
+    if (hdr.seq > headSeq) headSeq = hdr.seq;
+    if (hdr.ackedSeq > ackedSeq) ackedSeq = hdr.ackedSeq;
+    if (oldestSeq == 0 || hdr.seq < oldestSeq) oldestSeq = hdr.seq;
+  }
+
+  if (headSeq == 0) {
+    headSeq = startSeq;
+    ackedSeq = startSeq;
+    return true;
+  }
+
+  // Batches that were already overwritten can never be replayed
+  if (oldestSeq > ackedSeq + 1) ackedSeq = oldestSeq - 1;
+  return true;
+}
+
+void BatchLog::close() {
+  if (file) {
+    fclose(file);
+    file = nullptr;
+  }
+}
+
+bool BatchLog::append(const ReadingStore& batch, uint32_t createdAt) {
+  if (file == nullptr || batch.empty()) return false;
+
+  uint32_t seq = headSeq + 1;
+  if (seq - ackedSeq > BATCH_LOG_SLOTS) {
+    ackedSeq = seq - BATCH_LOG_SLOTS; // Oldest pending batch is about to be overwritten
+    stats.overwritten++;
+  }
+
+  SlotHeader hdr = {};
+  hdr.magic = BATCH_LOG_MAGIC;
+  hdr.seq = seq;
+  hdr.ackedSeq = ackedSeq;
+  hdr.createdAt = createdAt;
+  hdr.count = batch.size();
+  hdr.crc = 0;
+  uint16_t crc = frameCrc16(reinterpret_cast<const uint8_t*>(&hdr), sizeof(hdr));
+  crc = frameCrc16(reinterpret_cast<const uint8_t*>(&batch[0]), sizeof(Reading) * batch.size(), crc);
+  hdr.crc = crc;
+
+  if (fseek(file, (seq % BATCH_LOG_SLOTS) * SLOT_SIZE, SEEK_SET) != 0 ||
+      fwrite(&hdr, sizeof(hdr), 1, file) != 1 ||
+      fwrite(&batch[0], sizeof(Reading), batch.size(), file) != batch.size() ||
+      fflush(file) != 0) {
+    stats.errors++;
+    return false;
+  }
+  fsync(fileno(file));
+
+  headSeq = seq;
+  stats.appended++;
+  return true;
+}
+
+bool BatchLog::readHeader(uint32_t seq, SlotHeader& hdr) {
+  return fseek(file, (seq % BATCH_LOG_SLOTS) * SLOT_SIZE, SEEK_SET) == 0 &&
+         fread(&hdr, sizeof(hdr), 1, file) == 1 && hdr.magic == BATCH_LOG_MAGIC &&
+         hdr.seq == seq && hdr.count <= READING_STORE_CAPACITY;
+}
+
+bool BatchLog::peek(ReadingStore& out, uint32_t& seq, uint32_t& createdAt) {
+  if (file == nullptr) return false;
+
+  while (ackedSeq < headSeq) {
+    uint32_t next = ackedSeq + 1;
+    SlotHeader hdr;
+    if (readHeader(next, hdr)) {
+      uint16_t stored = hdr.crc;
+      hdr.crc = 0;
+      uint16_t crc = frameCrc16(reinterpret_cast<const uint8_t*>(&hdr), sizeof(hdr));
+
+      out.clear();
+      Reading reading;
+      bool ok = true;
+      for (uint16_t i = 0; i < hdr.count && ok; i++) {
+        ok = fread(&reading, sizeof(reading), 1, file) == 1;
+        crc = frameCrc16(reinterpret_cast<const uint8_t*>(&reading), sizeof(reading), crc);
+        out.add(reading);
+      }
+
+      if (ok && crc == stored) {
+        seq = next;
+        createdAt = hdr.createdAt;
+        return true;
+      }
+    }
+
+    // Torn or corrupt slot: skip it rather than block the backlog
+    stats.errors++;
+    ackedSeq = next;
+    out.clear();
+  }
+  return false;
+}
+
+void BatchLog::ack(uint32_t seq) {
+  if (seq > ackedSeq && seq <= headSeq) {
+    stats.acked += seq - ackedSeq;
+    ackedSeq = seq;
+  }
+}
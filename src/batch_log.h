@@ -0,0 +1,74 @@
+#ifndef BATCH_LOG_H
+#define BATCH_LOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "reading_store.h"
+
+#define BATCH_LOG_SLOTS 32
+#define BATCH_LOG_MAGIC 0x56424C31 // "VBL1"
+
+// Store-and-forward log of upload batches in one fixed-size file, written
+// as a ring of BATCH_LOG_SLOTS slots. Every batch is appended before it is
+// uploaded and acknowledged once the server has it; unacknowledged batches
+// survive restarts and are replayed oldest first.
+//
+// Slots are written strictly round-robin, so flash wear is spread evenly
+// and usage never exceeds BATCH_LOG_SLOTS * slot size. When the ring is
+// full the oldest unacknowledged batch is overwritten and counted.
+//
+// The acknowledged watermark is persisted in the header of the next
+// append rather than with a write of its own, so after a crash the
+// batches acknowledged since the last append are sent again.
+//
+// Only stdio is used: on the ESP32 the path points into the LittleFS
+// mount, on a host it is a plain file.
+class BatchLog {
+public:
+  struct Stats {
+    uint32_t appended;
+    uint32_t acked;
+    uint32_t overwritten; // unacknowledged batches lost to a full ring
+    uint32_t errors;
+  };
+
+  ~BatchLog() { close(); }
+
+  // Opens or creates the log and scans slot headers to find the backlog.
+  // An empty log numbers its batches from startSeq + 1, so seqs can serve
+  // as batch ids without a recreated log reusing those of an earlier one.
+  bool open(const char* path, uint32_t startSeq = 0);
+  void close();
+  bool isOpen() const { return file != nullptr; }
+
+  bool append(const ReadingStore& batch, uint32_t createdAt);
+  // Loads the oldest unacknowledged batch. False when there is none.
+  bool peek(ReadingStore& out, uint32_t& seq, uint32_t& createdAt);
+  void ack(uint32_t seq);
+
+  uint32_t pending() const { return headSeq - ackedSeq; }
+  // Seq the next peek() starts from, 0 when nothing is pending
+  uint32_t oldestPending() const { return pending() > 0 ? ackedSeq + 1 : 0; }
+  const Stats& getStats() const { return stats; }
+
+private:
+  struct SlotHeader {
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t ackedSeq;  // Watermark at the time this slot was written
+    uint32_t createdAt; // millis() when the batch was sealed
+    uint16_t count;
+    uint16_t crc;       // Over the header (crc = 0) and the records
+  };
+
+  static constexpr long SLOT_SIZE = sizeof(SlotHeader) + sizeof(Reading) * READING_STORE_CAPACITY;
+
+  bool readHeader(uint32_t seq, SlotHeader& hdr);
+
+  FILE* file = nullptr;
+  uint32_t headSeq = 0;  // Last appended
+  uint32_t ackedSeq = 0; // Everything up to here has been acknowledged
+  Stats stats = {};
+};
+
+#endif
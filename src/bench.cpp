@@ -0,0 +1,237 @@
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <string>
+#include <vector>
+
+#define BENCH_REPETITIONS 3
+#define BENCH_MAX_ITERATIONS 1000000000ull
+#define BENCH_ALLOC_SLACK 0.01 // Allocations per item allowed above the baseline
+
+// ---- Allocation counting
+
+// Per thread, so the uplink task allocating in the background does not
+// show up in the loop task's numbers
+static thread_local uint64_t threadAllocs = 0;
+
+void* operator new(size_t size) {
+  threadAllocs++;
+  void* p = malloc(size ? size : 1);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+  free(p);
+}
+
+// ---- BenchState
+
+bool BenchState::keepRunning() {
+  if (!started) {
+    started = true;
+    resumeTiming();
+  }
+  if (done < target) {
+    done++;
+    return true;
+  }
+  pauseTiming();
+  return false;
+}
+
+void BenchState::pauseTiming() {
+  elapsed += Clock::now() - resumedAt;
+  allocs += threadAllocs - allocsAtResume;
+}
+
+void BenchState::resumeTiming() {
+  allocsAtResume = threadAllocs;
+  resumedAt = Clock::now();
+}
+
+void BenchState::setLabel(const char* label) {
+  snprintf(text, sizeof(text), "%s", label);
+}
+
+// ---- Registry and runner
+
+struct Benchmark {
+  const char* name;
+  BenchFunction function;
+};
+
+struct BenchResult {
+  std::string name;
+  double itemsPerSec;
+  double allocsPerItem;
+  double bytesPerSec;
+  std::string label;
+};
+
+static std::vector<Benchmark>& registry() {
+  static std::vector<Benchmark> benchmarks;
+  return benchmarks;
+}
+
+void benchRegister(const char* name, BenchFunction function) {
+  registry().push_back({name, function});
+}
+
+// Grows the iteration count until one run lasts minTime, then keeps the
+// fastest of BENCH_REPETITIONS runs at that count
+static BenchResult runBenchmark(const Benchmark& bench, double minTime) {
+  uint64_t iterations = 1;
+  for (;;) {
+    BenchState state(iterations);
+    bench.function(state);
+    if (state.seconds() >= minTime || iterations >= BENCH_MAX_ITERATIONS) break;
+    double scale = state.seconds() > 0 ? 1.4 * minTime / state.seconds() : 10;
+    if (scale > 10) scale = 10;
+    if (scale < 2) scale = 2;
+    iterations = static_cast<uint64_t>(iterations * scale);
+    if (iterations > BENCH_MAX_ITERATIONS) iterations = BENCH_MAX_ITERATIONS;
+  }
+
+  BenchResult best = {bench.name, 0, 0, 0, ""};
+  for (int r = 0; r < BENCH_REPETITIONS; r++) {
+    BenchState state(iterations);
+    bench.function(state);
+    double items = static_cast<double>(state.itemsProcessed());
+    double rate = items / state.seconds();
+    if (rate > best.itemsPerSec) {
+      best.itemsPerSec = rate;
+      best.allocsPerItem = state.allocations() / items;
+      best.bytesPerSec = state.bytesProcessed() / state.seconds();
+      best.label = state.label();
+    }
+  }
+  return best;
+}
+
+// Lines of "name items_per_sec allocs_per_item", # starts a comment
+static std::vector<BenchResult> loadBaseline(const char* path) {
+  std::vector<BenchResult> baseline;
+  FILE* file = fopen(path, "r");
+  if (file == nullptr) return baseline;
+
+  char line[256];
+  while (fgets(line, sizeof(line), file) != nullptr) {
+    char name[128];
+    BenchResult entry = {"", 0, 0, 0, ""};
+    if (line[0] == '#') continue;
+    if (sscanf(line, "%127s %lf %lf", name, &entry.itemsPerSec, &entry.allocsPerItem) == 3) {
+      entry.name = name;
+      baseline.push_back(entry);
+    }
+  }
+  fclose(file);
+  return baseline;
+}
+
+static bool saveBaseline(const char* path, const std::vector<BenchResult>& results) {
+  FILE* file = fopen(path, "w");
+  if (file == nullptr) return false;
+  fprintf(file, "# Written by the bench env with --save; numbers are for one host,\n");
+  fprintf(file, "# record a new baseline before comparing on another machine.\n");
+  fprintf(file, "# name items_per_sec allocs_per_item\n");
+  for (const BenchResult& r : results) {
+    fprintf(file, "%s %.0f %.3f\n", r.name.c_str(), r.itemsPerSec, r.allocsPerItem);
+  }
+  fclose(file);
+  return true;
+}
+
+static const BenchResult* findResult(const std::vector<BenchResult>& results, const std::string& name) {
+  for (const BenchResult& r : results) {
+    if (r.name == name) return &r;
+  }
+  return nullptr;
+}
+
+int benchMain(int argc, char** argv) {
+  const char* filter = nullptr;
+  const char* baselinePath = "bench_baseline.txt";
+  const char* savePath = nullptr;
+  double minTime = 0.2;
+  double threshold = 25;
+
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 >= argc) {
+      fprintf(stderr, "missing value for %s\n", argv[i]);
+      return 2;
+    }
+    const char* arg = argv[i];
+    const char* value = argv[++i];
+    if (strcmp(arg, "--filter") == 0) filter = value;
+    else if (strcmp(arg, "--min-time") == 0) minTime = atof(value);
+    else if (strcmp(arg, "--baseline") == 0) baselinePath = value;
+    else if (strcmp(arg, "--save") == 0) savePath = value;
+    else if (strcmp(arg, "--threshold") == 0) threshold = atof(value);
+    else {
+      fprintf(stderr, "unknown option %s\n", arg);
+      return 2;
+    }
+  }
+
+  std::vector<BenchResult> baseline = loadBaseline(baselinePath);
+  std::vector<BenchResult> results;
+  int regressions = 0;
+
+  printf("%-28s %12s %12s %12s %10s  %s\n", "benchmark", "ns/item", "items/s", "allocs/item",
+         "MB/s", "vs baseline");
+  for (const Benchmark& bench : registry()) {
+    if (filter != nullptr && strstr(bench.name, filter) == nullptr) continue;
+
+    BenchResult r = runBenchmark(bench, minTime);
+    results.push_back(r);
+
+    char verdict[64] = "no baseline";
+    const BenchResult* base = findResult(baseline, r.name);
+    if (base != nullptr) {
+      double change = 100.0 * (r.itemsPerSec / base->itemsPerSec - 1);
+      bool slower = change < -threshold;
+      bool allocates = r.allocsPerItem > base->allocsPerItem + BENCH_ALLOC_SLACK;
+      snprintf(verdict, sizeof(verdict), "%+.1f%%%s%s", change, slower ? " SLOWER" : "",
+               allocates ? " ALLOCATES" : "");
+      if (slower || allocates) regressions++;
+    }
+    char mbps[16] = "-";
+    if (r.bytesPerSec > 0) snprintf(mbps, sizeof(mbps), "%.1f", r.bytesPerSec / 1e6);
+    printf("%-28s %12.1f %12.0f %12.3f %10s  %s%s%s\n", r.name.c_str(), 1e9 / r.itemsPerSec,
+           r.itemsPerSec, r.allocsPerItem, mbps, verdict, r.label.empty() ? "" : "  ",
+           r.label.c_str());
+    fflush(stdout);
+  }
+
+  if (savePath != nullptr) {
+    if (!saveBaseline(savePath, results)) {
+      fprintf(stderr, "could not write %s\n", savePath);
+      return 2;
+    }
+    printf("baseline written to %s\n", savePath);
+  }
+  if (regressions > 0) {
+    printf("%d benchmark(s) regressed beyond %.0f%% (or allocate more)\n", regressions, threshold);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,72 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <chrono>
+
+// Small host benchmark harness in the style of Google Benchmark, without
+// the dependency:
+//
+//   static void BM_Thing(BenchState& state) {
+//     while (state.keepRunning()) { ...one iteration... }
+//     state.setItemsProcessed(state.iterations());
+//   }
+//   BENCHMARK(BM_Thing);
+//
+// Iterations grow until a run takes --min-time, the fastest of three runs
+// counts. Heap allocations on the benchmark thread are counted while the
+// timer runs. Results are compared with a baseline file, and the run fails
+// when throughput drops or allocations per item grow beyond the threshold.
+class BenchState {
+public:
+  explicit BenchState(uint64_t iterations) : target(iterations) {}
+
+  bool keepRunning();
+  // Excludes setup inside the loop from the time and allocation count
+  void pauseTiming();
+  void resumeTiming();
+
+  uint64_t iterations() const { return target; }
+  void setItemsProcessed(uint64_t n) { items = n; }
+  void setBytesProcessed(uint64_t n) { bytes = n; }
+  // Printed after the result, e.g. a compression ratio
+  void setLabel(const char* text);
+
+  double seconds() const { return elapsed.count(); }
+  uint64_t itemsProcessed() const { return items ? items : target; }
+  uint64_t bytesProcessed() const { return bytes; }
+  uint64_t allocations() const { return allocs; }
+  const char* label() const { return text; }
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  uint64_t target;
+  uint64_t done = 0;
+  bool started = false;
+  Clock::time_point resumedAt;
+  std::chrono::duration<double> elapsed{0};
+  uint64_t allocsAtResume = 0;
+  uint64_t allocs = 0;
+  uint64_t items = 0;
+  uint64_t bytes = 0;
+  char text[64] = "";
+};
+
+typedef void (*BenchFunction)(BenchState& state);
+
+void benchRegister(const char* name, BenchFunction function);
+
+#define BENCHMARK(function) \
+  static const bool function##Registered = (benchRegister(#function, function), true)
+
+// Runs the registered benchmarks; returns the process exit code.
+//   --filter TEXT     only names containing TEXT
+//   --min-time S      per run, 0.2 by default
+//   --baseline FILE   compare, bench_baseline.txt by default
+//   --save FILE       write the results as a new baseline
+//   --threshold PCT   allowed throughput drop, 25 by default
+int benchMain(int argc, char** argv);
+
+#endif
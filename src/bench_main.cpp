@@ -0,0 +1,387 @@
+// Host benchmarks of the base hot paths, built against hal_native:
+//
+//   pio run -e bench -t exec                       compare with bench_baseline.txt
+//   .pio/build/bench/program --save bench_baseline.txt
+#include <stdio.h>
+#include <string.h>
+#include <queue>
+#include <random>
+#include "hal.h"
+#include "bench.h"
+#include "log.h"
+#include "base_espnow.h"
+#include "batch_codec.h"
+
+#define BENCH_NODES 50
+#define BENCH_FRAMES 256     // Power of two
+#define BENCH_INVALID_EVERY 50 // One corrupt frame in 50
+#define BENCH_DRAIN_EVERY 64   // Queue drained outside the timer this often
+#define BENCH_PATH_BATCH 20    // Readings per upload body in the path comparison
+#define BENCH_LOG_DRAIN (LOG_RING_SIZE / 2) // Log ring drained outside the timer this often
+
+// Exposes the receive queue to the benchmarks
+class BenchTransport : public EspNowTransport {
+public:
+  bool push(const Message& msg) { return messageQueue.push(msg); }
+  void clear() { messageQueue.clear(); }
+};
+
+static BenchTransport espNow;
+
+// Exposes the loop-side steps to the benchmarks
+class BenchBase : public Base {
+public:
+  using Base::admitNode;
+  using Base::processMessageQueue;
+  using Base::readings;
+
+  static void reset() {
+    espNow.clear();
+    readings->clear();
+    // Forget the seqs seen, so the same messages are not duplicates next time
+    for (int i = 0; i < NODE_TABLE_CAPACITY; i++) {
+      if (nodes.used(i)) nodes[i].seqWindow = 0;
+    }
+  }
+};
+
+// Radio and uplink go nowhere, uploads succeed at once
+class NullBackend : public HalBackend {
+public:
+  void espNowSend(const uint8_t* dest, const uint8_t* data, size_t len) override {}
+  void loraSend(const uint8_t* data, size_t len, uint32_t airtimeUs, int spreadingFactor,
+                long bandwidth) override {}
+  bool httpConnect(const char* host, uint16_t port) override { return true; }
+  int httpPost(const char* host, const char* path, const char* contentType,
+               const char* idempotencyKey, const uint8_t* body, size_t len,
+               std::string& response) override {
+    return HTTP_CODE_OK;
+  }
+};
+
+struct BenchFrame {
+  uint8_t mac[6];
+  uint8_t len;
+  uint8_t data[FRAME_MAX_SIZE];
+};
+
+static BenchBase base;
+static NullBackend backend;
+static BenchFrame frames[BENCH_FRAMES];
+static Base::Message messages[BENCH_FRAMES];
+static ReadingStore fullBatch;
+// What the nodes sent before the binary frame, for BM_LegacyReadingPath
+static char legacyPayloads[BENCH_FRAMES][64];
+
+static void nodeMac(int node, uint8_t* mac) {
+  const uint8_t prefix[4] = {0x24, 0x6F, 0x28, 0x10};
+  memcpy(mac, prefix, 4);
+  mac[4] = static_cast<uint8_t>(node >> 8);
+  mac[5] = static_cast<uint8_t>(node);
+}
+
+// Readings as a sweep delivers them: every node in turn, consecutive seqs,
+// sensor values drifting around a few thousand with the odd outlier, and a
+// corrupt frame now and then
+static void buildPayloads() {
+  std::mt19937 rng(1);
+  std::normal_distribution<double> drift(0, 15);
+  int32_t values[BENCH_NODES];
+  for (int n = 0; n < BENCH_NODES; n++) values[n] = 2000 + n * 37;
+
+  uint32_t receivedAt = 1000;
+  for (int i = 0; i < BENCH_FRAMES; i++) {
+    int node = i % BENCH_NODES;
+    values[node] += static_cast<int32_t>(drift(rng));
+    bool outlier = i % 97 == 0;
+
+    ReadingFrame reading;
+    reading.nodeId = static_cast<uint16_t>(node + 1);
+    reading.seq = static_cast<uint16_t>(100 + i / BENCH_NODES);
+    reading.replyTo = static_cast<uint16_t>(7 + i / BENCH_NODES);
+    reading.value = outlier ? -values[node] * 1000 : values[node];
+    reading.radio = 0;
+    reading.resentCount = 0;
+
+    BenchFrame& frame = frames[i];
+    nodeMac(node, frame.mac);
+    frame.len = static_cast<uint8_t>(encodeReading(frame.data, sizeof(frame.data), reading));
+    if (i % BENCH_INVALID_EVERY == BENCH_INVALID_EVERY - 1) frame.data[frame.len - 1] ^= 0x5A;
+
+    Base::Message& msg = messages[i];
+    memset(&msg, 0, sizeof(msg));
+    memcpy(msg.mac, frame.mac, 6);
+    msg.nodeId = reading.nodeId;
+    msg.seq = reading.seq;
+    msg.replyTo = reading.replyTo;
+    msg.value = reading.value;
+    receivedAt += 40 + rng() % 20; // Slot spacing
+    msg.receivedAt = receivedAt;
+
+    snprintf(legacyPayloads[i], sizeof(legacyPayloads[i]),
+             "{\"value\":%ld,\"deviceId\":\"%02X%02X%02X%02X%02X%02X\"}", (long)reading.value,
+             frame.mac[0], frame.mac[1], frame.mac[2], frame.mac[3], frame.mac[4], frame.mac[5]);
+  }
+
+  for (int i = 0; !fullBatch.full(); i++) fullBatch.add(messages[i % BENCH_FRAMES]);
+}
+
+// Radio callback: parse, validate, decode and queue one frame
+static void BM_EspNowReceive(BenchState& state) {
+  uint64_t i = 0;
+  while (state.keepRunning()) {
+    const BenchFrame& frame = frames[i & (BENCH_FRAMES - 1)];
+    halNativeEspNowReceive(frame.mac, frame.data, frame.len);
+    if (++i % BENCH_DRAIN_EVERY == 0) {
+      state.pauseTiming();
+      BenchBase::reset();
+      state.resumeTiming();
+    }
+  }
+  BenchBase::reset();
+}
+BENCHMARK(BM_EspNowReceive);
+
+static void BM_EnqueueMessage(BenchState& state) {
+  uint64_t i = 0;
+  while (state.keepRunning()) {
+    espNow.enqueueMessage(messages[i & (BENCH_FRAMES - 1)]);
+    if (++i % BENCH_DRAIN_EVERY == 0) {
+      state.pauseTiming();
+      BenchBase::reset();
+      state.resumeTiming();
+    }
+  }
+  BenchBase::reset();
+}
+BENCHMARK(BM_EnqueueMessage);
+
+// Loop side: drains a queue holding one beacon's worth of replies into
+// the batch, updating the node table, schedule and metrics
+static void BM_ProcessMessageQueue(BenchState& state) {
+  uint64_t offset = 0;
+  while (state.keepRunning()) {
+    state.pauseTiming();
+    BenchBase::reset();
+    for (int i = 0; i < BENCH_DRAIN_EVERY; i++) {
+      espNow.push(messages[(offset + i) & (BENCH_FRAMES - 1)]);
+    }
+    offset += BENCH_DRAIN_EVERY;
+    state.resumeTiming();
+    base.processMessageQueue();
+  }
+  BenchBase::reset();
+  state.setItemsProcessed(state.iterations() * BENCH_DRAIN_EVERY);
+}
+BENCHMARK(BM_ProcessMessageQueue);
+
+// Upload body of a full batch, JSON and compact
+static void BM_BatchJson(BenchState& state) {
+  static char body[READING_JSON_BODY_SIZE];
+  uint64_t bytes = 0;
+  while (state.keepRunning()) {
+    bytes += fullBatch.writeJson(body, sizeof(body));
+  }
+  state.setItemsProcessed(state.iterations() * fullBatch.size());
+  state.setBytesProcessed(bytes);
+}
+BENCHMARK(BM_BatchJson);
+
+static void BM_BatchCompact(BenchState& state) {
+  static uint8_t body[READING_JSON_BODY_SIZE];
+  uint64_t bytes = 0;
+  while (state.keepRunning()) {
+    bytes += encodeCompactBatch(fullBatch, body, sizeof(body));
+  }
+  state.setItemsProcessed(state.iterations() * fullBatch.size());
+  state.setBytesProcessed(bytes);
+
+  // Size against the JSON body of the same batch
+  static char json[READING_JSON_BODY_SIZE];
+  size_t jsonLen = fullBatch.writeJson(json, sizeof(json));
+  size_t compactLen = encodeCompactBatch(fullBatch, body, sizeof(body));
+  char label[64];
+  snprintf(label, sizeof(label), "%zu B vs %zu B JSON, %.1fx", compactLen, jsonLen,
+           static_cast<double>(jsonLen) / compactLen);
+  state.setLabel(label);
+}
+BENCHMARK(BM_BatchCompact);
+
+// Reading path from radio callback to upload body, against the one it
+// replaced below. Bytes processed counts what the path copies, so
+// MB/s over items/s is bytes copied per reading.
+static void BM_ReadingPath(BenchState& state) {
+  static char body[READING_JSON_BODY_SIZE];
+  uint64_t offset = 0;
+  uint64_t copied = 0;
+  while (state.keepRunning()) {
+    state.pauseTiming();
+    BenchBase::reset();
+    state.resumeTiming();
+    for (int i = 0; i < BENCH_PATH_BATCH; i++) {
+      const BenchFrame& frame = frames[(offset + i) & (BENCH_FRAMES - 1)];
+      halNativeEspNowReceive(frame.mac, frame.data, frame.len);
+    }
+    offset += BENCH_PATH_BATCH;
+    base.processMessageQueue();
+    size_t stored = BenchBase::readings->size();
+    // Into the ring, out of it, into the store, then the body once
+    copied += stored * (2 * sizeof(Base::Message) + sizeof(Reading));
+    copied += BenchBase::readings->writeJson(body, sizeof(body));
+  }
+  BenchBase::reset();
+  state.setItemsProcessed(state.iterations() * BENCH_PATH_BATCH);
+  state.setBytesProcessed(copied);
+}
+BENCHMARK(BM_ReadingPath);
+
+// ---- The path before typed records, for comparison
+//
+// Per reading, the radio callback parsed the node's JSON, serialised it
+// again into lastReceivedData and copied that into a 256-byte message on
+// a std::queue. The loop copied each message out, parsed it once more
+// into the batch document and serialised the batch, which had to fit in
+// 1 KB. ArduinoJson is not in the host envs, so a minimal scanner stands
+// in for deserializeJson: the copies and allocations are the old ones,
+// the parsing is cheaper than it was.
+
+struct LegacyMessage {
+  char json[256];
+  unsigned long receivedAt;
+};
+
+struct LegacyEntry {
+  long value;
+  char deviceId[13];
+};
+
+static std::queue<LegacyMessage> legacyQueue;
+static char legacyLastReceived[1024];
+static uint64_t legacyCopied = 0;
+
+static bool legacyParse(const char* json, LegacyEntry& entry) {
+  const char* value = strstr(json, "\"value\":");
+  const char* id = strstr(json, "\"deviceId\":\"");
+  if (value == nullptr || id == nullptr) return false;
+  entry.value = strtol(value + 8, nullptr, 10);
+  id += 12;
+  const char* end = strchr(id, '"');
+  if (end == nullptr || end - id >= static_cast<long>(sizeof(entry.deviceId))) return false;
+  memcpy(entry.deviceId, id, end - id);
+  entry.deviceId[end - id] = '\0';
+  return true;
+}
+
+static void legacyReceive(const char* data, size_t len) {
+  char buffer[256];
+  memcpy(buffer, data, len);
+  buffer[len] = '\0';
+  LegacyEntry entry;
+  if (!legacyParse(buffer, entry)) return;
+  int n = snprintf(legacyLastReceived, sizeof(legacyLastReceived),
+                   "[{\"value\":%ld,\"deviceId\":\"%s\"}]", entry.value, entry.deviceId);
+
+  // enqueueMessage(): strncpy pads the whole field, push copies it again
+  LegacyMessage msg;
+  strncpy(msg.json, legacyLastReceived, sizeof(msg.json) - 1);
+  msg.json[sizeof(msg.json) - 1] = '\0';
+  msg.receivedAt = millis();
+  legacyQueue.push(msg);
+  legacyCopied += len + n + sizeof(msg.json) + sizeof(msg);
+}
+
+static void legacyProcess() {
+  LegacyEntry batch[BENCH_PATH_BATCH];
+  size_t count = 0;
+  while (!legacyQueue.empty()) {
+    LegacyMessage msg = legacyQueue.front();
+    legacyQueue.pop();
+    legacyCopied += sizeof(msg);
+    // Skip the wrapping '[' the callback added
+    if (count < BENCH_PATH_BATCH && legacyParse(msg.json + 1, batch[count])) {
+      legacyCopied += sizeof(LegacyEntry);
+      count++;
+    }
+  }
+
+  size_t len = 0;
+  legacyLastReceived[len++] = '[';
+  for (size_t i = 0; i < count; i++) {
+    len += snprintf(legacyLastReceived + len, sizeof(legacyLastReceived) - len,
+                    "%s{\"value\":%ld,\"deviceId\":\"%s\"}", i ? "," : "", batch[i].value,
+                    batch[i].deviceId);
+  }
+  legacyLastReceived[len++] = ']';
+  legacyLastReceived[len] = '\0';
+  legacyCopied += len;
+}
+
+static void BM_LegacyReadingPath(BenchState& state) {
+  uint64_t offset = 0;
+  legacyCopied = 0;
+  while (state.keepRunning()) {
+    for (int i = 0; i < BENCH_PATH_BATCH; i++) {
+      const char* payload = legacyPayloads[(offset + i) & (BENCH_FRAMES - 1)];
+      legacyReceive(payload, strlen(payload));
+    }
+    offset += BENCH_PATH_BATCH;
+    legacyProcess();
+  }
+  state.setItemsProcessed(state.iterations() * BENCH_PATH_BATCH);
+  state.setBytesProcessed(legacyCopied);
+}
+BENCHMARK(BM_LegacyReadingPath);
+
+// One log call as the radio and loop paths make it: claim a ring cell,
+// copy the arguments, commit. Formatting is the drain task's, below.
+static void BM_LogWrite(BenchState& state) {
+  LogRecord record;
+  while (logPop(record)) {}
+  uint32_t i = 0;
+  while (state.keepRunning()) {
+    LOG_I("[Queue] Stored reading %04X #%u: %d from %s", i % BENCH_NODES, i, -1234, "espnow");
+    if (++i % BENCH_LOG_DRAIN == 0) {
+      state.pauseTiming();
+      while (logPop(record)) {}
+      state.resumeTiming();
+    }
+  }
+  while (logPop(record)) {}
+}
+BENCHMARK(BM_LogWrite);
+
+static void BM_LogFormat(BenchState& state) {
+  LogRecord record;
+  while (logPop(record)) {}
+  LOG_I("[Queue] Stored reading %04X #%u: %d from %s", 17, 4242, -1234, "espnow");
+  logPop(record);
+  char line[LOG_LINE_MAX];
+  uint64_t bytes = 0;
+  while (state.keepRunning()) {
+    bytes += logFormat(record, line, sizeof(line));
+  }
+  state.setBytesProcessed(bytes);
+}
+BENCHMARK(BM_LogFormat);
+
+int main(int argc, char** argv) {
+#ifdef BATCH_LOG_PATH
+  remove(BATCH_LOG_PATH);
+#endif
+  HalNativeConfig hal;
+  halNativeBegin(&backend, hal);
+  base.addTransport(espNow);
+  base.begin();
+
+  buildPayloads();
+  for (int n = 0; n < BENCH_NODES; n++) {
+    uint8_t mac[6];
+    nodeMac(n, mac);
+    base.admitNode(mac, static_cast<uint16_t>(n + 1));
+  }
+
+  int result = benchMain(argc, argv);
+  fflush(stdout);
+  // The uplink task is still running; skip the static destructors
+  _Exit(result);
+}
@@ -0,0 +1,236 @@
+#include "capture.h"
+#include <string.h>
+#include "hal.h"
+
+static inline uint32_t zigzagEncode(int32_t v) {
+  return (static_cast<uint32_t>(v) << 1) ^ static_cast<uint32_t>(v >> 31);
+}
+
+static inline int32_t zigzagDecode(uint32_t v) {
+  return static_cast<int32_t>(v >> 1) ^ -static_cast<int32_t>(v & 1);
+}
+
+// ---- Writer
+
+bool Capture::open(const char* filePath, CaptureRadio fileRadio, const uint8_t* mac,
+                   uint32_t limit) {
+  close();
+  if (strlen(filePath) >= sizeof(path)) return false;
+  strcpy(path, filePath);
+  snprintf(oldPath, sizeof(oldPath), "%s.old", path);
+  radio = fileRadio;
+  memcpy(baseMac, mac, 6);
+  maxBytes = limit;
+  if (!start()) return false;
+  ready.store(true);
+  return true;
+}
+
+void Capture::close() {
+  ready.store(false);
+  if (file) {
+    fclose(file);
+    file = nullptr;
+  }
+}
+
+// A fresh file; whatever was there belongs to an earlier boot and moves
+// to path.old
+bool Capture::start() {
+  remove(oldPath);
+  rename(path, oldPath);
+  file = fopen(path, "wb");
+  if (file == nullptr) {
+    stats.errors++;
+    return false;
+  }
+
+  uint32_t magic = CAPTURE_MAGIC;
+  uint8_t version = CAPTURE_VERSION;
+  fwrite(&magic, sizeof(magic), 1, file);
+  fwrite(&version, 1, 1, file);
+  fwrite(&radio, 1, 1, file);
+  fwrite(baseMac, 6, 1, file);
+  lastAt = micros();
+  return true;
+}
+
+bool Capture::rotate() {
+  fclose(file);
+  file = nullptr;
+  stats.rotations++;
+  if (start()) return true;
+  ready.store(false);
+  return false;
+}
+
+void Capture::frame(const uint8_t* mac, const uint8_t* data, size_t len, int16_t rssi,
+                    int8_t snr) {
+  if (!ready.load(std::memory_order_relaxed)) return;
+
+  PendingFrame f;
+  f.at = micros();
+  if (mac != nullptr) {
+    memcpy(f.mac, mac, 6);
+  } else {
+    memset(f.mac, 0, 6);
+  }
+  f.rssi = rssi;
+  f.snr = snr;
+  f.len = static_cast<uint8_t>(len < sizeof(f.data) ? len : sizeof(f.data));
+  memcpy(f.data, data, f.len);
+  if (mac != nullptr) {
+    pending.push(f);
+  } else {
+    pendingLoRa.push(f);
+  }
+}
+
+void Capture::upload(int status, uint32_t readings, uint32_t latencyMs) {
+  if (!ready.load(std::memory_order_relaxed)) return;
+  PendingUpload u = {static_cast<uint32_t>(micros()), status, readings, latencyMs};
+  uploads.push(u);
+}
+
+void Capture::node(const uint8_t* mac, uint16_t id) {
+  if (file == nullptr) return;
+  beginRecord(CAPTURE_NODE, micros());
+  fwrite(mac, 6, 1, file);
+  putVarint(id);
+}
+
+bool Capture::flush() {
+  if (file == nullptr) return false;
+
+  bool wrote = writeFrames(pending);
+  if (writeFrames(pendingLoRa)) wrote = true;
+
+  PendingUpload u;
+  while (uploads.pop(u)) {
+    beginRecord(CAPTURE_UPLOAD, u.at);
+    putSigned(u.status);
+    putVarint(u.readings);
+    putVarint(u.latencyMs);
+    stats.uploads++;
+    wrote = true;
+  }
+  stats.dropped = pending.dropped() + pendingLoRa.dropped() + uploads.dropped();
+  if (!wrote) return false;
+
+  if (fflush(file) != 0) stats.errors++;
+  return ftell(file) >= static_cast<long>(maxBytes / 2) && rotate();
+}
+
+bool Capture::writeFrames(SpscRing<PendingFrame, CAPTURE_RING_SIZE>& ring) {
+  PendingFrame f;
+  bool wrote = false;
+  while (ring.pop(f)) {
+    beginRecord(CAPTURE_FRAME, f.at);
+    fwrite(f.mac, 6, 1, file);
+    putSigned(f.rssi);
+    putSigned(f.snr);
+    fputc(f.len, file);
+    fwrite(f.data, f.len, 1, file);
+    stats.frames++;
+    wrote = true;
+  }
+  return wrote;
+}
+
+void Capture::beginRecord(CaptureRecordType type, uint32_t at) {
+  fputc(type, file);
+  putSigned(static_cast<int32_t>(at - lastAt));
+  lastAt = at;
+}
+
+void Capture::putVarint(uint32_t value) {
+  while (value >= 0x80) {
+    fputc(static_cast<uint8_t>(value) | 0x80, file);
+    value >>= 7;
+  }
+  fputc(static_cast<uint8_t>(value), file);
+}
+
+void Capture::putSigned(int32_t value) {
+  putVarint(zigzagEncode(value));
+}
+
+// ---- Reader
+
+bool CaptureReader::open(const char* path) {
+  close();
+  file = fopen(path, "rb");
+  if (file == nullptr) return false;
+
+  uint32_t magic;
+  uint8_t version;
+  if (fread(&magic, sizeof(magic), 1, file) != 1 || magic != CAPTURE_MAGIC ||
+      fread(&version, 1, 1, file) != 1 || version != CAPTURE_VERSION ||
+      fread(&fileRadio, 1, 1, file) != 1 || fileRadio > CAPTURE_BOTH ||
+      fread(fileBaseMac, 6, 1, file) != 1) {
+    close();
+    return false;
+  }
+  clock = 0;
+  return true;
+}
+
+void CaptureReader::close() {
+  if (file) {
+    fclose(file);
+    file = nullptr;
+  }
+}
+
+bool CaptureReader::next(CaptureRecord& record) {
+  if (file == nullptr) return false;
+
+  int type = fgetc(file);
+  int32_t delta;
+  if (type == EOF || !getSigned(delta)) return false;
+  clock += delta;
+  record.type = static_cast<CaptureRecordType>(type);
+  record.at = clock;
+
+  int32_t value;
+  uint32_t raw;
+  switch (record.type) {
+    case CAPTURE_FRAME: {
+      if (fread(record.mac, 6, 1, file) != 1 || !getSigned(value)) return false;
+      record.rssi = static_cast<int16_t>(value);
+      if (!getSigned(value)) return false;
+      record.snr = static_cast<int8_t>(value);
+      int len = fgetc(file);
+      if (len == EOF) return false;
+      record.len = static_cast<uint8_t>(len);
+      return fread(record.data, 1, record.len, file) == record.len;
+    }
+    case CAPTURE_UPLOAD:
+      if (!getSigned(value)) return false;
+      record.status = value;
+      return getVarint(record.readings) && getVarint(record.latencyMs);
+    case CAPTURE_NODE:
+      if (fread(record.mac, 6, 1, file) != 1 || !getVarint(raw)) return false;
+      record.id = static_cast<uint16_t>(raw);
+      return true;
+  }
+  return false; // Unknown record type, the rest cannot be framed
+}
+
+bool CaptureReader::getVarint(uint32_t& value) {
+  value = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    int b = fgetc(file);
+    if (b == EOF) return false;
+    value |= static_cast<uint32_t>(b & 0x7F) << shift;
+    if (!(b & 0x80)) return true;
+  }
+  return false;
+}
+
+bool CaptureReader::getSigned(int32_t& value) {
+  uint32_t raw;
+  if (!getVarint(raw)) return false;
+  value = zigzagDecode(raw);
+  return true;
+}
@@ -0,0 +1,147 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include "frame.h"
+#include "spsc_ring.h"
+
+#define CAPTURE_MAGIC 0x50414356 // "VCAP" read little endian
+#define CAPTURE_VERSION 1
+#define CAPTURE_RING_SIZE 32     // Frames between two flushes, power of two
+#define CAPTURE_UPLOAD_RING_SIZE 8
+
+// With both radios, a frame with a zero source MAC came in over LoRa
+enum CaptureRadio : uint8_t { CAPTURE_ESPNOW = 0, CAPTURE_LORA = 1, CAPTURE_BOTH = 2 };
+
+enum CaptureRecordType : uint8_t {
+  CAPTURE_FRAME = 1,  // A received frame, valid or not
+  CAPTURE_UPLOAD = 2, // Outcome of one batch upload
+  CAPTURE_NODE = 3,   // A node the base knew when the file was started
+};
+
+// Radio traffic and upload outcomes of a base, for replay on a host.
+//
+//   header   magic u32, version u8, radio u8, base MAC 6 bytes
+//   record   type u8, zigzag varint us since the previous record, then
+//     frame    source MAC (zero on LoRa), zigzag RSSI, zigzag SNR, len u8, bytes
+//     upload   zigzag HTTP status (0: not attempted), readings, latency ms
+//     node     MAC, id
+//
+// A record without all its bytes ends the capture, so a file cut short by a
+// reset still reads up to there. Frames arrive on the radio receive
+// contexts, one per radio, and upload outcomes on the uplink task; each
+// waits in its own ring until the owner task flushes them, so no producer
+// ever touches flash.
+// Once the file passes half the size limit it becomes path.old and a new
+// one is started, so the latest traffic is always kept within the limit.
+//
+// Only stdio is used: on the ESP32 the path points into the LittleFS
+// mount, on a host it is a plain file.
+class Capture {
+public:
+  struct Stats {
+    uint32_t frames;
+    uint32_t uploads;
+    uint32_t dropped;   // Records lost to a full ring
+    uint32_t rotations;
+    uint32_t errors;
+  };
+
+  ~Capture() { close(); }
+
+  bool open(const char* path, CaptureRadio radio, const uint8_t* baseMac, uint32_t maxBytes);
+  void close();
+  bool isOpen() const { return ready.load(); }
+
+  // Radio receive context, never blocks. mac is nullptr for LoRa.
+  void frame(const uint8_t* mac, const uint8_t* data, size_t len, int16_t rssi, int8_t snr);
+  // Uplink task, never blocks
+  void upload(int status, uint32_t readings, uint32_t latencyMs);
+
+  // Owner task
+  void node(const uint8_t* mac, uint16_t id);
+  // Writes the queued frames. True when a new file was started, for the
+  // caller to record the nodes it knows.
+  bool flush();
+
+  const Stats& getStats() const { return stats; }
+
+private:
+  struct PendingFrame {
+    uint32_t at; // micros()
+    uint8_t mac[6];
+    int16_t rssi;
+    int8_t snr;
+    uint8_t len;
+    uint8_t data[FRAME_MAX_SIZE];
+  };
+
+  struct PendingUpload {
+    uint32_t at;
+    int status;
+    uint32_t readings;
+    uint32_t latencyMs;
+  };
+
+  bool start();
+  bool rotate();
+  bool writeFrames(SpscRing<PendingFrame, CAPTURE_RING_SIZE>& ring);
+  void beginRecord(CaptureRecordType type, uint32_t at);
+  void putVarint(uint32_t value);
+  void putSigned(int32_t value);
+
+  FILE* file = nullptr;
+  char path[48];
+  char oldPath[52];
+  CaptureRadio radio = CAPTURE_ESPNOW;
+  uint8_t baseMac[6] = {};
+  uint32_t maxBytes = 0;
+  uint32_t lastAt = 0;
+  std::atomic<bool> ready{false};
+  SpscRing<PendingFrame, CAPTURE_RING_SIZE> pending;     // ESP-NOW
+  SpscRing<PendingFrame, CAPTURE_RING_SIZE> pendingLoRa;
+  SpscRing<PendingUpload, CAPTURE_UPLOAD_RING_SIZE> uploads;
+  Stats stats = {};
+};
+
+// One record of a capture file, as read back
+struct CaptureRecord {
+  CaptureRecordType type;
+  int64_t at; // us since the file was started
+  uint8_t mac[6];
+  int16_t rssi;
+  int8_t snr;
+  uint8_t len;
+  uint8_t data[255];
+  int status;
+  uint32_t readings;
+  uint32_t latencyMs;
+  uint16_t id;
+};
+
+// Host side: walks the records of a capture file in order.
+class CaptureReader {
+public:
+  ~CaptureReader() { close(); }
+
+  bool open(const char* path);
+  void close();
+  bool next(CaptureRecord& record);
+
+  CaptureRadio radio() const { return fileRadio; }
+  const uint8_t* baseMac() const { return fileBaseMac; }
+
+private:
+  bool getVarint(uint32_t& value);
+  bool getSigned(int32_t& value);
+
+  FILE* file = nullptr;
+  CaptureRadio fileRadio = CAPTURE_ESPNOW;
+  uint8_t fileBaseMac[6] = {};
+  int64_t clock = 0;
+};
+
+#endif
@@ -0,0 +1,356 @@
+#include "frame.h"
+#include <string.h>
+
+static inline uint32_t zigzagEncode(int32_t v) {
+  return (static_cast<uint32_t>(v) << 1) ^ static_cast<uint32_t>(v >> 31);
+}
+
+static inline int32_t zigzagDecode(uint32_t v) {
+  return static_cast<int32_t>(v >> 1) ^ -static_cast<int32_t>(v & 1);
+}
+
+// Raw varints inside a bytes field; false once out of room or data
+static bool putRaw(uint8_t* out, size_t cap, size_t& pos, uint32_t value) {
+  while (value >= 0x80) {
+    if (pos >= cap) return false;
+    out[pos++] = static_cast<uint8_t>(value) | 0x80;
+    value >>= 7;
+  }
+  if (pos >= cap) return false;
+  out[pos++] = static_cast<uint8_t>(value);
+  return true;
+}
+
+static bool getRaw(const uint8_t* data, size_t len, size_t& pos, uint32_t& value) {
+  value = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    if (pos >= len) return false;
+    uint8_t b = data[pos++];
+    if (shift == 28 && (b & 0x70)) return false; // Past 32 bits
+    value |= static_cast<uint32_t>(b & 0x7F) << shift;
+    if (!(b & 0x80)) return true;
+  }
+  return false;
+}
+
+uint16_t frameCrc16(const uint8_t* data, size_t len, uint16_t crc) {
+  for (size_t i = 0; i < len; i++) {
+    crc ^= static_cast<uint16_t>(data[i]) << 8;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+FrameWriter::FrameWriter(uint8_t* buffer, size_t capacity)
+  : buf(buffer), cap(capacity), len(0), overflow(false) {}
+
+void FrameWriter::putByte(uint8_t b) {
+  if (len >= cap) {
+    overflow = true;
+    return;
+  }
+  buf[len++] = b;
+}
+
+void FrameWriter::putRawVarint(uint32_t value) {
+  while (value >= 0x80) {
+    putByte(static_cast<uint8_t>(value) | 0x80);
+    value >>= 7;
+  }
+  putByte(static_cast<uint8_t>(value));
+}
+
+void FrameWriter::begin(uint8_t type, uint16_t nodeId, uint16_t seq) {
+  len = 0;
+  overflow = false;
+  putByte(FRAME_VERSION << 4 | (type & 0x0F));
+  putByte(nodeId & 0xFF);
+  putByte(nodeId >> 8);
+  putByte(seq & 0xFF);
+  putByte(seq >> 8);
+}
+
+void FrameWriter::putVarint(uint8_t field, int32_t value) {
+  putByte(field << 3 | WIRE_VARINT);
+  putRawVarint(zigzagEncode(value));
+}
+
+void FrameWriter::putBytes(uint8_t field, const uint8_t* data, uint8_t dataLen) {
+  putByte(field << 3 | WIRE_BYTES);
+  putByte(dataLen);
+  for (uint8_t i = 0; i < dataLen; i++) {
+    putByte(data[i]);
+  }
+}
+
+size_t FrameWriter::finish() {
+  if (overflow || len + FRAME_CRC_SIZE > cap) return 0;
+  uint16_t crc = frameCrc16(buf, len);
+  buf[len++] = crc & 0xFF;
+  buf[len++] = crc >> 8;
+  return len;
+}
+
+bool FrameReader::parse(const uint8_t* data, size_t length) {
+  if (data == nullptr || length < FRAME_MIN_SIZE || length > FRAME_MAX_SIZE) return false;
+
+  uint16_t crc = data[length - 2] | static_cast<uint16_t>(data[length - 1]) << 8;
+  if (crc != frameCrc16(data, length - FRAME_CRC_SIZE)) return false;
+
+  hdr.version = data[0] >> 4;
+  hdr.type = data[0] & 0x0F;
+  if (hdr.version != FRAME_VERSION) return false;
+  hdr.nodeId = data[1] | static_cast<uint16_t>(data[2]) << 8;
+  hdr.seq = data[3] | static_cast<uint16_t>(data[4]) << 8;
+
+  buf = data;
+  pos = FRAME_HEADER_SIZE;
+  end = length - FRAME_CRC_SIZE;
+  return true;
+}
+
+bool FrameReader::readRawVarint(uint32_t& value) {
+  value = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    if (pos >= end) return false;
+    uint8_t b = buf[pos++];
+    if (shift == 28 && (b & 0x70)) return false; // Past 32 bits
+    value |= static_cast<uint32_t>(b & 0x7F) << shift;
+    if (!(b & 0x80)) return true;
+  }
+  return false;
+}
+
+bool FrameReader::next(Field& field) {
+  if (pos >= end) return false;
+
+  uint8_t tag = buf[pos++];
+  field.id = tag >> 3;
+  field.wireType = tag & 0x07;
+
+  if (field.wireType == WIRE_VARINT) {
+    uint32_t raw;
+    if (!readRawVarint(raw)) return false;
+    field.value = zigzagDecode(raw);
+    field.data = nullptr;
+    field.len = 0;
+    return true;
+  }
+
+  if (field.wireType == WIRE_BYTES) {
+    if (pos >= end) return false;
+    field.len = buf[pos++];
+    if (end - pos < field.len) return false;
+    field.data = buf + pos;
+    field.value = 0;
+    pos += field.len;
+    return true;
+  }
+
+  // Unknown wire type, the rest of the frame cannot be walked
+  pos = end;
+  return false;
+}
+
+size_t encodeTrigger(uint8_t* out, size_t outLen, uint16_t nodeId, uint16_t seq,
+                     const FrameAck* ack, uint8_t radio) {
+  FrameWriter writer(out, outLen);
+  writer.begin(FRAME_TRIGGER, nodeId, seq);
+  if (ack != nullptr) {
+    writer.putVarint(FIELD_ACK_SEQ, ack->seq);
+    // Zigzag keeps a full window, the common case, at one byte
+    writer.putVarint(FIELD_ACK_WINDOW, static_cast<int32_t>(ack->window));
+  }
+  if (radio != 0) writer.putVarint(FIELD_RADIO, radio);
+  return writer.finish();
+}
+
+bool findAck(FrameReader& trigger, FrameAck& ack) {
+  if (trigger.header().type != FRAME_TRIGGER) return false;
+
+  bool haveSeq = false;
+  bool haveWindow = false;
+  FrameReader::Field field;
+  trigger.rewind();
+  while (trigger.next(field)) {
+    if (field.wireType != WIRE_VARINT) continue;
+    if (field.id == FIELD_ACK_SEQ) {
+      ack.seq = static_cast<uint16_t>(field.value);
+      haveSeq = true;
+    } else if (field.id == FIELD_ACK_WINDOW) {
+      ack.window = static_cast<uint32_t>(field.value);
+      haveWindow = true;
+    }
+  }
+  return haveSeq && haveWindow;
+}
+
+bool findRadio(FrameReader& trigger, uint8_t& radio) {
+  if (trigger.header().type != FRAME_TRIGGER) return false;
+
+  FrameReader::Field field;
+  trigger.rewind();
+  while (trigger.next(field)) {
+    if (field.id == FIELD_RADIO && field.wireType == WIRE_VARINT) {
+      radio = static_cast<uint8_t>(field.value);
+      return radio != 0;
+    }
+  }
+  return false;
+}
+
+size_t encodeReading(uint8_t* out, size_t outLen, const ReadingFrame& reading) {
+  FrameWriter writer(out, outLen);
+  writer.begin(FRAME_READING, reading.nodeId, reading.seq);
+  writer.putVarint(FIELD_VALUE, reading.value);
+  if (reading.replyTo != 0) writer.putVarint(FIELD_REPLY_TO, reading.replyTo);
+  if (reading.radio != 0) writer.putVarint(FIELD_RADIO, reading.radio);
+
+  if (reading.resentCount > 0) {
+    uint8_t list[FRAME_MAX_RESENT * 13]; // Three varints per reading, at most 3 + 5 + 5 bytes
+    size_t len = 0;
+    for (uint8_t i = 0; i < reading.resentCount && i < FRAME_MAX_RESENT; i++) {
+      const ReadingFrame::Resent& r = reading.resent[i];
+      putRaw(list, sizeof(list), len, static_cast<uint16_t>(reading.seq - r.seq));
+      putRaw(list, sizeof(list), len, zigzagEncode(r.value));
+      putRaw(list, sizeof(list), len, r.ageMs);
+    }
+    writer.putBytes(FIELD_RESENT, list, static_cast<uint8_t>(len));
+  }
+  return writer.finish();
+}
+
+bool decodeReading(const uint8_t* data, size_t len, ReadingFrame& reading) {
+  FrameReader reader;
+  if (!reader.parse(data, len) || reader.header().type != FRAME_READING) return false;
+
+  reading.nodeId = reader.header().nodeId;
+  reading.seq = reader.header().seq;
+  reading.replyTo = 0;
+  reading.value = -1;
+  reading.radio = 0;
+  reading.resentCount = 0;
+
+  FrameReader::Field field;
+  while (reader.next(field)) {
+    if (field.id == FIELD_VALUE && field.wireType == WIRE_VARINT) {
+      reading.value = field.value;
+    } else if (field.id == FIELD_REPLY_TO && field.wireType == WIRE_VARINT) {
+      reading.replyTo = field.value;
+    } else if (field.id == FIELD_RADIO && field.wireType == WIRE_VARINT) {
+      reading.radio = static_cast<uint8_t>(field.value);
+    } else if (field.id == FIELD_RESENT && field.wireType == WIRE_BYTES) {
+      size_t pos = 0;
+      uint32_t back, value, age;
+      while (reading.resentCount < FRAME_MAX_RESENT &&
+             getRaw(field.data, field.len, pos, back) &&
+             getRaw(field.data, field.len, pos, value) &&
+             getRaw(field.data, field.len, pos, age)) {
+        ReadingFrame::Resent& r = reading.resent[reading.resentCount++];
+        r.seq = static_cast<uint16_t>(reading.seq - back);
+        r.value = zigzagDecode(value);
+        r.ageMs = age;
+      }
+    }
+  }
+  return true;
+}
+
+static size_t encodeSlots(uint8_t* out, size_t outLen, uint8_t type, uint16_t seq,
+                          uint16_t slotMs, const uint16_t* ids, const uint8_t* acks,
+                          size_t count) {
+  if (count > BEACON_MAX_SLOTS) return 0;
+
+  uint8_t list[BEACON_MAX_SLOTS * 2];
+  for (size_t i = 0; i < count; i++) {
+    list[i * 2] = ids[i] & 0xFF;
+    list[i * 2 + 1] = ids[i] >> 8;
+  }
+
+  FrameWriter writer(out, outLen);
+  writer.begin(type, FRAME_BROADCAST_ID, seq);
+  writer.putVarint(FIELD_SLOT_LENGTH, slotMs);
+  writer.putBytes(FIELD_SLOT_IDS, list, count * 2);
+  if (acks != nullptr) writer.putBytes(FIELD_SLOT_ACKS, acks, count);
+  return writer.finish();
+}
+
+size_t encodeBeacon(uint8_t* out, size_t outLen, uint16_t seq, uint16_t slotMs,
+                    const uint16_t* ids, const uint8_t* acks, size_t count) {
+  return encodeSlots(out, outLen, FRAME_BEACON, seq, slotMs, ids, acks, count);
+}
+
+size_t encodeGroupTrigger(uint8_t* out, size_t outLen, uint16_t seq, uint16_t slotMs,
+                          const uint16_t* ids, const uint8_t* acks, size_t count) {
+  return encodeSlots(out, outLen, FRAME_TRIGGER, seq, slotMs, ids, acks, count);
+}
+
+bool findBeaconSlot(FrameReader& beacon, uint16_t nodeId, uint32_t& replyDelayMs, int* ack) {
+  uint8_t type = beacon.header().type;
+  if (type != FRAME_BEACON &&
+      (type != FRAME_TRIGGER || beacon.header().nodeId != FRAME_BROADCAST_ID)) {
+    return false;
+  }
+
+  int32_t slotMs = -1;
+  int index = -1;
+  const uint8_t* acks = nullptr;
+  uint8_t ackCount = 0;
+  FrameReader::Field field;
+  while (beacon.next(field)) {
+    if (field.id == FIELD_SLOT_LENGTH && field.wireType == WIRE_VARINT) {
+      slotMs = field.value;
+    } else if (field.id == FIELD_SLOT_IDS && field.wireType == WIRE_BYTES) {
+      for (int i = 0; i + 1 < field.len; i += 2) {
+        if ((field.data[i] | static_cast<uint16_t>(field.data[i + 1]) << 8) == nodeId) {
+          index = i / 2;
+          break;
+        }
+      }
+    } else if (field.id == FIELD_SLOT_ACKS && field.wireType == WIRE_BYTES) {
+      acks = field.data;
+      ackCount = field.len;
+    }
+  }
+
+  if (slotMs <= 0 || index < 0) return false;
+  replyDelayMs = static_cast<uint32_t>(index + 1) * slotMs;
+  if (ack != nullptr) *ack = index < ackCount ? acks[index] : -1;
+  return true;
+}
+
+size_t encodeJoin(uint8_t* out, size_t outLen, uint16_t nodeId, const uint8_t* mac,
+                  uint16_t ackedSeq) {
+  FrameWriter writer(out, outLen);
+  writer.begin(FRAME_JOIN, nodeId, 0);
+  writer.putBytes(FIELD_MAC, mac, 6);
+  writer.putVarint(FIELD_ACK_SEQ, ackedSeq);
+  return writer.finish();
+}
+
+size_t encodeJoinAccept(uint8_t* out, size_t outLen, uint16_t nodeId, const uint8_t* mac) {
+  FrameWriter writer(out, outLen);
+  writer.begin(FRAME_JOIN_ACCEPT, nodeId, 0);
+  writer.putBytes(FIELD_MAC, mac, 6);
+  return writer.finish();
+}
+
+bool findJoinMac(FrameReader& frame, uint8_t* mac, int32_t* ackedSeq) {
+  uint8_t type = frame.header().type;
+  if (type != FRAME_JOIN && type != FRAME_JOIN_ACCEPT) return false;
+
+  bool found = false;
+  if (ackedSeq != nullptr) *ackedSeq = -1;
+  FrameReader::Field field;
+  while (frame.next(field)) {
+    if (field.id == FIELD_MAC && field.wireType == WIRE_BYTES && field.len == 6) {
+      memcpy(mac, field.data, 6);
+      found = true;
+    } else if (field.id == FIELD_ACK_SEQ && field.wireType == WIRE_VARINT && ackedSeq != nullptr) {
+      *ackedSeq = static_cast<uint16_t>(field.value);
+    }
+  }
+  return found;
+}
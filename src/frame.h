@@ -0,0 +1,177 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Binary radio frame shared by every role (ESP-NOW and LoRa, base and node).
+//
+//   byte 0      version (high nibble) | frame type (low nibble)
+//   bytes 1-2   short node id, little endian
+//   bytes 3-4   sequence number, little endian
+//   ...         typed fields: tag byte (id << 3 | wire type) + value
+//   last 2      CRC-16/CCITT over everything before it
+//
+// Varint fields are zigzag encoded, byte fields carry a one-byte length.
+// Readers skip field ids they do not know, so new fields can be added
+// without bumping FRAME_VERSION.
+
+#define FRAME_VERSION 1
+#define FRAME_HEADER_SIZE 5
+#define FRAME_CRC_SIZE 2
+#define FRAME_MIN_SIZE (FRAME_HEADER_SIZE + FRAME_CRC_SIZE)
+#define FRAME_MAX_SIZE 250 // ESP-NOW payload limit, LoRa allows 255
+
+#define FRAME_BROADCAST_ID 0xFFFF
+#define BEACON_MAX_SLOTS 75 // Node ids and their ack bytes that fit in one beacon frame
+#define FRAME_MAX_RESENT 7  // Older readings a reading frame carries again
+#define FRAME_ACK_WINDOW 32 // Seqs covered by the bits of FrameAck::window
+
+enum FrameType : uint8_t {
+  FRAME_TRIGGER = 1, // To one node, or to FRAME_BROADCAST_ID listing slots as a beacon
+  FRAME_READING = 2,
+  FRAME_BEACON = 3,  // Slot assignments for one polling sweep
+  FRAME_JOIN = 4,    // Node looking for a base, carries its MAC and wanted id
+  FRAME_JOIN_ACCEPT = 5, // Base reply, broadcast: the node's MAC and assigned id
+};
+
+enum FrameWireType : uint8_t {
+  WIRE_VARINT = 0,
+  WIRE_BYTES = 1,
+};
+
+enum FrameField : uint8_t {
+  FIELD_VALUE = 1,
+  FIELD_SLOT_LENGTH = 2, // Beacon, group trigger: slot length in ms
+  FIELD_SLOT_IDS = 3,    // Beacon, group trigger: node ids in slot order, little endian
+  FIELD_REPLY_TO = 4,    // Reading: seq of the trigger or beacon it answers
+  FIELD_MAC = 5,         // Join, join accept: the joining node's MAC
+  FIELD_ACK_SEQ = 6,     // Trigger: newest reading seq the base holds from the node;
+                         // join: newest one the node no longer needs acked
+  FIELD_ACK_WINDOW = 7,  // Trigger: which readings before FIELD_ACK_SEQ it holds
+  FIELD_SLOT_ACKS = 8,   // Beacon, group trigger: per slot, low byte of the node's cumulative ack
+  FIELD_RESENT = 9,      // Reading: older unacked readings, oldest first
+  FIELD_RADIO = 10,      // Trigger: LoRa data rate and TX power to switch to after the
+                         // reply; reading: the ones the node switched to with it
+};
+
+struct FrameHeader {
+  uint8_t version;
+  uint8_t type;
+  uint16_t nodeId;
+  uint16_t seq;
+};
+
+// Builds a frame in a caller-provided buffer. Any overflow is sticky and
+// makes finish() return 0.
+class FrameWriter {
+public:
+  FrameWriter(uint8_t* buffer, size_t capacity);
+
+  void begin(uint8_t type, uint16_t nodeId, uint16_t seq);
+  void putVarint(uint8_t field, int32_t value);
+  void putBytes(uint8_t field, const uint8_t* data, uint8_t len);
+  size_t finish(); // Appends the CRC, returns the frame length or 0
+
+private:
+  void putByte(uint8_t b);
+  void putRawVarint(uint32_t value);
+
+  uint8_t* buf;
+  size_t cap;
+  size_t len;
+  bool overflow;
+};
+
+// Validates a received frame and walks its fields in order.
+class FrameReader {
+public:
+  struct Field {
+    uint8_t id;
+    uint8_t wireType;
+    int32_t value;        // WIRE_VARINT
+    const uint8_t* data;  // WIRE_BYTES
+    uint8_t len;          // WIRE_BYTES
+  };
+
+  // Returns false on short frames, unknown versions or CRC mismatch.
+  bool parse(const uint8_t* data, size_t length);
+  const FrameHeader& header() const { return hdr; }
+  bool next(Field& field);
+  // Back to the first field, to walk them again
+  void rewind() { pos = FRAME_HEADER_SIZE; }
+
+private:
+  bool readRawVarint(uint32_t& value);
+
+  FrameHeader hdr;
+  const uint8_t* buf = nullptr;
+  size_t pos = 0;
+  size_t end = 0;
+};
+
+// Decoded FRAME_READING. Readings the base has not acked yet ride along
+// with the next one, each as seq distance, value and age.
+struct ReadingFrame {
+  struct Resent {
+    uint16_t seq;
+    int32_t value;
+    uint32_t ageMs; // Since the reading was taken
+  };
+
+  uint16_t nodeId;
+  uint16_t seq;
+  uint16_t replyTo; // 0 when the sender did not say
+  int32_t value;
+  uint8_t radio;    // LoRa setting the node switched to after this reply, 0 for none
+  uint8_t resentCount;
+  Resent resent[FRAME_MAX_RESENT]; // Oldest first
+};
+
+// Which readings of one node the base holds: seq, and seq - i for every
+// bit i set in window. Anything older than the window counts as held.
+struct FrameAck {
+  uint16_t seq;
+  uint32_t window;
+};
+
+// ack, when given, is piggybacked for the triggered node; radio, when not
+// 0, orders it onto another LoRa data rate and TX power (see adr.h)
+size_t encodeTrigger(uint8_t* out, size_t outLen, uint16_t nodeId, uint16_t seq,
+                     const FrameAck* ack = nullptr, uint8_t radio = 0);
+// For a parsed trigger: true and the ack when it carries one
+bool findAck(FrameReader& trigger, FrameAck& ack);
+// For a parsed trigger: true and the radio setting when it orders one
+bool findRadio(FrameReader& trigger, uint8_t& radio);
+size_t encodeReading(uint8_t* out, size_t outLen, const ReadingFrame& reading);
+bool decodeReading(const uint8_t* data, size_t len, ReadingFrame& reading);
+
+// Beacon listing up to BEACON_MAX_SLOTS node ids. The node at position i
+// answers (i + 1) * slotMs after the beacon, slot 0 doubling as guard time.
+// acks, when given, holds the low byte of each node's cumulative ack: the
+// seq up to which the base holds or gave up on all its readings.
+size_t encodeBeacon(uint8_t* out, size_t outLen, uint16_t seq, uint16_t slotMs,
+                    const uint16_t* ids, const uint8_t* acks, size_t count);
+// Group trigger: the listed nodes answer in their slots as after a beacon.
+// Unlike a beacon, it says nothing about the nodes it leaves out.
+size_t encodeGroupTrigger(uint8_t* out, size_t outLen, uint16_t seq, uint16_t slotMs,
+                          const uint16_t* ids, const uint8_t* acks, size_t count);
+// For a parsed beacon or group trigger: true and the reply delay when
+// nodeId has a slot. ack, when given, gets the node's ack byte, or -1 when
+// the frame has none.
+bool findBeaconSlot(FrameReader& beacon, uint16_t nodeId, uint32_t& replyDelayMs,
+                    int* ack = nullptr);
+
+// Join request; nodeId is the id the node had before, 0 for none.
+size_t encodeJoin(uint8_t* out, size_t outLen, uint16_t nodeId, const uint8_t* mac,
+                  uint16_t ackedSeq);
+// Join accept assigning nodeId to the node with mac
+size_t encodeJoinAccept(uint8_t* out, size_t outLen, uint16_t nodeId, const uint8_t* mac);
+// For a parsed join or join accept: copies the MAC field into mac.
+// ackedSeq, when given, gets a join's FIELD_ACK_SEQ, or -1 when it has none.
+bool findJoinMac(FrameReader& frame, uint8_t* mac, int32_t* ackedSeq = nullptr);
+
+// Pass a previous result as crc to checksum data in several pieces
+uint16_t frameCrc16(const uint8_t* data, size_t len, uint16_t crc = 0xFFFF);
+
+#endif
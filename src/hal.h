@@ -0,0 +1,25 @@
+#ifndef HAL_H
+#define HAL_H
+
+// Platform layer. Firmware sources include this instead of the Arduino,
+// WiFi, HTTPClient, LittleFS, Preferences and FreeRTOS headers; on the
+// ESP32 it is exactly those headers, in the native env hal_native.h
+// provides the same names on top of the simulator. Radios have their own
+// headers, hal_espnow.h and hal_lora.h, so only the envs with a radio
+// library pull it in.
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <WiFi.h>
+#include <WiFiClientSecure.h>
+#include <HTTPClient.h>
+#include <LittleFS.h>
+#include <Preferences.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#else
+#include "hal_native.h"
+#endif
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef HAL_ESPNOW_H
+#define HAL_ESPNOW_H
+
+#include "hal.h"
+
+#ifdef ARDUINO
+#include <esp_now.h>
+#include <esp_wifi.h>
+#endif
+
+#endif
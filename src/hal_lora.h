@@ -0,0 +1,10 @@
+#ifndef HAL_LORA_H
+#define HAL_LORA_H
+
+#include "hal.h"
+
+#ifdef ARDUINO
+#include <LoRa.h>
+#endif
+
+#endif
@@ -0,0 +1,590 @@
+#include "hal_native.h"
+#include "adr.h"
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+HardwareSerial Serial;
+EspClass ESP;
+WiFiClass WiFi;
+LittleFSClass LittleFS;
+LoRaClass LoRa;
+SPIClass SPI;
+
+static HalBackend* backend = nullptr;
+static HalNativeConfig config;
+
+// ---- Clock
+
+typedef std::chrono::steady_clock Clock;
+static const Clock::time_point clockStart = Clock::now();
+static std::atomic<double> clockSpeed(1.0);
+
+void halNativeBegin(HalBackend* newBackend, const HalNativeConfig& newConfig) {
+  backend = newBackend;
+  config = newConfig;
+}
+
+void halNativeSetSpeed(double speed) {
+  clockSpeed.store(speed > 0 ? speed : 1.0);
+}
+
+double halNativeSpeed() {
+  return clockSpeed.load();
+}
+
+uint64_t halNativeMicros64() {
+  double real = std::chrono::duration<double, std::micro>(Clock::now() - clockStart).count();
+  return static_cast<uint64_t>(real * clockSpeed.load());
+}
+
+void halNativeSleepMicros(uint64_t us) {
+  std::this_thread::sleep_for(std::chrono::duration<double, std::micro>(us / clockSpeed.load()));
+}
+
+uint32_t millis() {
+  return static_cast<uint32_t>(halNativeMicros64() / 1000);
+}
+
+uint32_t micros() {
+  return static_cast<uint32_t>(halNativeMicros64());
+}
+
+void delay(uint32_t ms) {
+  halNativeSleepMicros(static_cast<uint64_t>(ms) * 1000);
+}
+
+// ---- Arduino core
+
+static std::mutex randomLock;
+static std::mt19937 randomEngine(1);
+
+long random(long max) {
+  return random(0, max);
+}
+
+long random(long min, long max) {
+  if (max <= min) return min;
+  std::lock_guard<std::mutex> guard(randomLock);
+  return min + static_cast<long>(randomEngine() % static_cast<unsigned long>(max - min));
+}
+
+void randomSeed(unsigned long seed) {
+  std::lock_guard<std::mutex> guard(randomLock);
+  randomEngine.seed(seed);
+}
+
+void pinMode(uint8_t, uint8_t) {}
+void digitalWrite(uint8_t, uint8_t) {}
+
+static std::atomic<int> interruptPin(-1);
+static std::atomic<void (*)()> interruptHandler(nullptr);
+
+void attachInterrupt(uint8_t pin, void (*isr)(), int mode) {
+  interruptPin.store(pin);
+  interruptHandler.store(isr);
+}
+
+size_t HardwareSerial::write(uint8_t b) {
+  return fwrite(&b, 1, 1, stdout);
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+  return fwrite(buffer, 1, size, stdout);
+}
+
+// ---- FreeRTOS tasks
+
+struct HalTask {
+  TaskFunction_t function = nullptr;
+  void* param = nullptr;
+  std::mutex lock;
+  std::condition_variable wake;
+  uint32_t notifications = 0;
+};
+
+// Threads not started through xTaskCreatePinnedToCore (main, the
+// simulator) get a task record of their own on first use
+static thread_local HalTask* currentTask = nullptr;
+
+static HalTask* thisTask() {
+  if (currentTask == nullptr) currentTask = new HalTask();
+  return currentTask;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char* name, uint32_t stack,
+                                   void* param, UBaseType_t priority, TaskHandle_t* handle,
+                                   BaseType_t core) {
+  HalTask* task = new HalTask();
+  task->function = function;
+  task->param = param;
+  if (handle != nullptr) *handle = task;
+  std::thread([task] {
+    currentTask = task;
+    task->function(task->param);
+  }).detach();
+  return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t wait) {
+  HalTask* task = thisTask();
+  std::unique_lock<std::mutex> guard(task->lock);
+  auto notified = [task] { return task->notifications > 0; };
+  if (wait == portMAX_DELAY) {
+    task->wake.wait(guard, notified);
+  } else if (wait > 0) {
+    auto real = std::chrono::duration<double, std::milli>(wait / clockSpeed.load());
+    task->wake.wait_for(guard, real, notified);
+  }
+
+  uint32_t count = task->notifications;
+  if (count > 0) task->notifications = clearOnExit ? 0 : count - 1;
+  return count;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+  if (task == nullptr) return pdFALSE;
+  {
+    std::lock_guard<std::mutex> guard(task->lock);
+    task->notifications++;
+  }
+  task->wake.notify_one();
+  return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* higherPriorityTaskWoken) {
+  xTaskNotifyGive(task);
+  if (higherPriorityTaskWoken != nullptr) *higherPriorityTaskWoken = pdTRUE;
+}
+
+void vTaskDelay(TickType_t ticks) {
+  delay(ticks);
+}
+
+struct HalMutex {
+  std::mutex lock;
+};
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+  return new HalMutex();
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t wait) {
+  mutex->lock.lock();
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t mutex) {
+  mutex->lock.unlock();
+  return pdTRUE;
+}
+
+// ---- WiFi
+
+static std::atomic<bool> wifiStarted(false);
+static std::atomic<uint32_t> wifiConnectAt(0);
+static uint8_t wifiBssid[6] = {0x02, 0xAA, 0xBB, 0xCC, 0xDD, 0xEE};
+
+String IPAddress::toString() const {
+  char text[16];
+  snprintf(text, sizeof(text), "%u.%u.%u.%u", bytes[0], bytes[1], bytes[2], bytes[3]);
+  return String(text);
+}
+
+wl_status_t WiFiClass::begin(const char* ssid, const char* password, int32_t channel,
+                             const uint8_t* bssid, bool connect) {
+  wifiConnectAt.store(millis() + config.wifiConnectMs);
+  wifiStarted.store(true);
+  return WL_DISCONNECTED;
+}
+
+bool WiFiClass::disconnect(bool wifiOff, bool eraseAp) {
+  wifiStarted.store(false);
+  return true;
+}
+
+wl_status_t WiFiClass::status() {
+  if (!wifiStarted.load()) return WL_DISCONNECTED;
+  return static_cast<int32_t>(millis() - wifiConnectAt.load()) >= 0 ? WL_CONNECTED : WL_DISCONNECTED;
+}
+
+uint8_t WiFiClass::channel() {
+  return config.wifiChannel;
+}
+
+uint8_t* WiFiClass::BSSID() {
+  return status() == WL_CONNECTED ? wifiBssid : nullptr;
+}
+
+IPAddress WiFiClass::localIP() {
+  return status() == WL_CONNECTED ? IPAddress(192, 168, 1, 50) : IPAddress();
+}
+
+String WiFiClass::macAddress() {
+  char text[18];
+  snprintf(text, sizeof(text), "%02X:%02X:%02X:%02X:%02X:%02X", config.mac[0], config.mac[1],
+           config.mac[2], config.mac[3], config.mac[4], config.mac[5]);
+  return String(text);
+}
+
+uint8_t* WiFiClass::macAddress(uint8_t* mac) {
+  memcpy(mac, config.mac, 6);
+  return mac;
+}
+
+int WiFiClient::connect(const char* host, uint16_t port) {
+  open = WiFi.status() == WL_CONNECTED && backend != nullptr && backend->httpConnect(host, port);
+  return open;
+}
+
+// ---- HTTPClient
+
+bool HTTPClient::begin(WiFiClient& newClient, const char* newHost, uint16_t port,
+                       const char* newUri, bool https) {
+  client = &newClient;
+  host = newHost;
+  uri = newUri;
+  contentType.clear();
+  idempotencyKey.clear();
+  return true;
+}
+
+void HTTPClient::addHeader(const char* name, const char* value) {
+  if (strcmp(name, "Content-Type") == 0) contentType = value;
+  if (strcmp(name, "Idempotency-Key") == 0) idempotencyKey = value;
+}
+
+int HTTPClient::POST(uint8_t* payload, size_t size) {
+  response.clear();
+  if (client == nullptr || !client->connected()) return HTTPC_ERROR_NOT_CONNECTED;
+  int code = backend->httpPost(host.c_str(), uri.c_str(), contentType.c_str(),
+                               idempotencyKey.c_str(), payload, size, response);
+  if (code < 0 || !backend->httpKeepAlive()) client->stop();
+  return code;
+}
+
+// Like the library, fails once the connection is gone even when the
+// status came in before it closed
+int HTTPClient::writeToStream(Stream* stream) {
+  if (stream == nullptr) return -1;
+  if (client == nullptr || !client->connected()) return HTTPC_ERROR_NOT_CONNECTED;
+  return static_cast<int>(stream->write(reinterpret_cast<const uint8_t*>(response.data()),
+                                        response.size()));
+}
+
+void HTTPClient::end() {
+  response.clear();
+}
+
+String HTTPClient::errorToString(int error) {
+  switch (error) {
+    case HTTPC_ERROR_CONNECTION_REFUSED: return String("connection refused");
+    case HTTPC_ERROR_SEND_PAYLOAD_FAILED: return String("send payload failed");
+    case HTTPC_ERROR_NOT_CONNECTED: return String("not connected");
+    case HTTPC_ERROR_CONNECTION_LOST: return String("connection lost");
+    case HTTPC_ERROR_READ_TIMEOUT: return String("read Timeout");
+    default: return String();
+  }
+}
+
+// ---- Preferences
+
+static std::mutex prefsLock;
+static std::map<std::string, std::string> prefsStore;
+
+bool Preferences::begin(const char* name, bool readOnly) {
+  ns = name;
+  return true;
+}
+
+size_t Preferences::getString(const char* key, char* value, size_t maxLen) {
+  std::lock_guard<std::mutex> guard(prefsLock);
+  auto it = prefsStore.find(path(key));
+  if (it == prefsStore.end() || it->second.size() + 1 > maxLen) return 0;
+  memcpy(value, it->second.c_str(), it->second.size() + 1);
+  return it->second.size() + 1;
+}
+
+size_t Preferences::putString(const char* key, const char* value) {
+  std::lock_guard<std::mutex> guard(prefsLock);
+  prefsStore[path(key)] = value;
+  return strlen(value);
+}
+
+size_t Preferences::getBytes(const char* key, void* buf, size_t maxLen) {
+  std::lock_guard<std::mutex> guard(prefsLock);
+  auto it = prefsStore.find(path(key));
+  if (it == prefsStore.end() || it->second.size() > maxLen) return 0;
+  memcpy(buf, it->second.data(), it->second.size());
+  return it->second.size();
+}
+
+size_t Preferences::putBytes(const char* key, const void* value, size_t len) {
+  std::lock_guard<std::mutex> guard(prefsLock);
+  prefsStore[path(key)].assign(static_cast<const char*>(value), len);
+  return len;
+}
+
+uint8_t Preferences::getUChar(const char* key, uint8_t defaultValue) {
+  uint8_t value;
+  return getBytes(key, &value, sizeof(value)) == sizeof(value) ? value : defaultValue;
+}
+
+size_t Preferences::putUChar(const char* key, uint8_t value) {
+  return putBytes(key, &value, sizeof(value));
+}
+
+uint16_t Preferences::getUShort(const char* key, uint16_t defaultValue) {
+  uint16_t value;
+  return getBytes(key, &value, sizeof(value)) == sizeof(value) ? value : defaultValue;
+}
+
+size_t Preferences::putUShort(const char* key, uint16_t value) {
+  return putBytes(key, &value, sizeof(value));
+}
+
+// ---- ESP-NOW
+
+static const uint8_t broadcastAddress[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+static bool espNowReady = false;
+static esp_now_send_cb_t espNowSendCb = nullptr;
+static esp_now_recv_cb_t espNowRecvCb = nullptr;
+static std::mutex peerLock;
+static std::vector<std::vector<uint8_t>> espNowPeers;
+
+static int findPeer(const uint8_t* mac) {
+  for (size_t i = 0; i < espNowPeers.size(); i++) {
+    if (memcmp(espNowPeers[i].data(), mac, 6) == 0) return static_cast<int>(i);
+  }
+  return -1;
+}
+
+esp_err_t esp_now_init() {
+  espNowReady = true;
+  return ESP_OK;
+}
+
+esp_err_t esp_now_register_send_cb(esp_now_send_cb_t cb) {
+  espNowSendCb = cb;
+  return ESP_OK;
+}
+
+esp_err_t esp_now_register_recv_cb(esp_now_recv_cb_t cb) {
+  espNowRecvCb = cb;
+  return ESP_OK;
+}
+
+// Same limit as the driver: 20 peers, broadcast included
+esp_err_t esp_now_add_peer(const esp_now_peer_info_t* peer) {
+  if (!espNowReady) return ESP_ERR_ESPNOW_NOT_INIT;
+  if (peer == nullptr) return ESP_ERR_ESPNOW_ARG;
+  std::lock_guard<std::mutex> guard(peerLock);
+  if (findPeer(peer->peer_addr) >= 0) return ESP_ERR_ESPNOW_EXIST;
+  if (espNowPeers.size() >= ESP_NOW_MAX_TOTAL_PEER_NUM) return ESP_ERR_ESPNOW_FULL;
+  espNowPeers.emplace_back(peer->peer_addr, peer->peer_addr + 6);
+  return ESP_OK;
+}
+
+esp_err_t esp_now_del_peer(const uint8_t* mac) {
+  std::lock_guard<std::mutex> guard(peerLock);
+  int index = findPeer(mac);
+  if (index < 0) return ESP_ERR_ESPNOW_NOT_FOUND;
+  espNowPeers.erase(espNowPeers.begin() + index);
+  return ESP_OK;
+}
+
+bool esp_now_is_peer_exist(const uint8_t* mac) {
+  std::lock_guard<std::mutex> guard(peerLock);
+  return findPeer(mac) >= 0;
+}
+
+size_t halNativeEspNowPeerCount() {
+  std::lock_guard<std::mutex> guard(peerLock);
+  return espNowPeers.size();
+}
+
+esp_err_t esp_now_send(const uint8_t* mac, const uint8_t* data, size_t len) {
+  if (!espNowReady) return ESP_ERR_ESPNOW_NOT_INIT;
+  if (mac == nullptr || data == nullptr || len == 0 || len > ESP_NOW_MAX_DATA_LEN) {
+    return ESP_ERR_ESPNOW_ARG;
+  }
+  if (!esp_now_is_peer_exist(mac)) return ESP_ERR_ESPNOW_NOT_FOUND;
+  backend->espNowSend(mac, data, len);
+  return ESP_OK;
+}
+
+void halNativeEspNowReceive(const uint8_t* from, const uint8_t* data, size_t len) {
+  if (espNowReady && espNowRecvCb != nullptr) espNowRecvCb(from, data, static_cast<int>(len));
+}
+
+void halNativeEspNowSent(const uint8_t* to, bool delivered) {
+  if (espNowReady && espNowSendCb != nullptr) {
+    espNowSendCb(to, delivered ? ESP_NOW_SEND_SUCCESS : ESP_NOW_SEND_FAIL);
+  }
+}
+
+esp_err_t esp_read_mac(uint8_t* mac, esp_mac_type_t type) {
+  memcpy(mac, config.mac, 6);
+  return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_channel(uint8_t primary, wifi_second_chan_t second) {
+  return ESP_OK;
+}
+
+// ---- LoRa
+
+// The radio's registers, between the backend's thread and the firmware's
+static std::mutex loraLock;
+static std::atomic<bool> loraTransmitting(false);
+static std::atomic<uint32_t> loraMissed(0);
+
+void LoRaClass::receive(int size) {
+  std::lock_guard<std::mutex> guard(loraLock);
+  listening = true;
+}
+
+void LoRaClass::idle() {
+  std::lock_guard<std::mutex> guard(loraLock);
+  listening = false;
+}
+
+void LoRaClass::channelActivityDetection() {
+  bool active = backend->loraChannelActive(spreadingFactor, bandwidth);
+  std::lock_guard<std::mutex> guard(loraLock);
+  listening = false;
+  cadPending = true;
+  cadDetected = active;
+  // Two symbols
+  cadDoneAt = halNativeMicros64() + (2ULL << spreadingFactor) * 1000000 / bandwidth;
+}
+
+#define LORA_REG_IRQ_FLAGS 0x12
+#define LORA_IRQ_RX_DONE 0x40
+#define LORA_IRQ_CAD_DONE 0x04
+#define LORA_IRQ_CAD_DETECTED 0x01
+
+uint8_t LoRaClass::readRegister(uint8_t address) {
+  if (address != LORA_REG_IRQ_FLAGS) return 0;
+  std::lock_guard<std::mutex> guard(loraLock);
+  uint8_t flags = rxDone ? LORA_IRQ_RX_DONE : 0;
+  if (cadPending && halNativeMicros64() >= cadDoneAt) {
+    flags |= LORA_IRQ_CAD_DONE | (cadDetected ? LORA_IRQ_CAD_DETECTED : 0);
+  }
+  return flags;
+}
+
+// Writing 1 clears an IRQ flag
+void LoRaClass::writeRegister(uint8_t address, uint8_t value) {
+  if (address != LORA_REG_IRQ_FLAGS) return;
+  std::lock_guard<std::mutex> guard(loraLock);
+  if (value & LORA_IRQ_RX_DONE) rxDone = false;
+  if (value & LORA_IRQ_CAD_DONE) cadPending = false;
+}
+
+uint8_t SPIClass::transfer(uint8_t data) {
+  if (position++ == 0) {
+    address = data;
+    return 0;
+  }
+  if (address & 0x80) {
+    LoRa.writeRegister(address & 0x7F, data);
+    return 0;
+  }
+  return LoRa.readRegister(address);
+}
+
+int LoRaClass::parsePacket(int size) {
+  std::lock_guard<std::mutex> guard(loraLock);
+  if (!rxDone) return 0;
+  rxDone = false;
+  listening = false;
+  rxPos = 0;
+  return static_cast<int>(rxLen);
+}
+
+int LoRaClass::beginPacket(int implicitHeader) {
+  idle();
+  txLen = 0;
+  return 1;
+}
+
+size_t LoRaClass::write(uint8_t b) {
+  return write(&b, 1);
+}
+
+size_t LoRaClass::write(const uint8_t* buffer, size_t size) {
+  if (size > sizeof(txBuf) - txLen) size = sizeof(txBuf) - txLen;
+  memcpy(txBuf + txLen, buffer, size);
+  txLen += size;
+  return size;
+}
+
+// The radio cannot hear anything while it transmits
+int LoRaClass::endPacket(bool async) {
+  uint32_t airtime = airtimeUs(txLen);
+  loraTransmitting.store(true);
+  backend->loraSend(txBuf, txLen, airtime, spreadingFactor, bandwidth);
+  halNativeSleepMicros(airtime);
+  loraTransmitting.store(false);
+  return 1;
+}
+
+int LoRaClass::available() {
+  return static_cast<int>(rxLen - rxPos);
+}
+
+int LoRaClass::read() {
+  return rxPos < rxLen ? rxBuf[rxPos++] : -1;
+}
+
+int LoRaClass::peek() {
+  return rxPos < rxLen ? rxBuf[rxPos] : -1;
+}
+
+uint32_t LoRaClass::airtimeUs(size_t len) const {
+  return loraAirtimeUs(spreadingFactor, bandwidth, codingRate, len);
+}
+
+void halNativeLoRaReceive(const uint8_t* data, size_t len, int rssi, float snr) {
+  if (loraTransmitting.load()) return;
+  {
+    std::lock_guard<std::mutex> guard(loraLock);
+    if (!LoRa.listening) {
+      loraMissed++;
+      return;
+    }
+    if (LoRa.rxDone) loraMissed++; // The unread packet is overwritten
+    if (len > sizeof(LoRa.rxBuf)) len = sizeof(LoRa.rxBuf);
+    memcpy(LoRa.rxBuf, data, len);
+    LoRa.rxLen = len;
+    LoRa.rxPos = 0;
+    LoRa.rxRssi = rssi;
+    LoRa.rxSnr = snr;
+    LoRa.rxDone = true;
+  }
+
+  // DIO0 rises on RxDone
+  void (*isr)() = interruptHandler.load();
+  if (isr != nullptr && interruptPin.load() == LoRa.dio0Pin) isr();
+}
+
+bool halNativeLoRaReady() {
+  std::lock_guard<std::mutex> guard(loraLock);
+  return LoRa.listening && !LoRa.rxDone;
+}
+
+bool halNativeLoRaTunedTo(int spreadingFactor, long bandwidth) {
+  std::lock_guard<std::mutex> guard(loraLock);
+  return LoRa.spreadingFactor == spreadingFactor && LoRa.bandwidth == bandwidth;
+}
+
+uint32_t halNativeLoRaMissed() {
+  return loraMissed.load();
+}
@@ -0,0 +1,438 @@
+#ifndef HAL_NATIVE_H
+#define HAL_NATIVE_H
+
+// Host stand-ins for the parts of the Arduino core, ESP-IDF, HTTPClient
+// and the LoRa library that the firmware uses, so it builds and runs in
+// the native env. Only what the firmware calls is here, with the same
+// names and signatures.
+//
+// Time is a steady clock that can run faster than real time, see
+// halNativeSetSpeed(); every wait (delay, task notifications, LoRa
+// airtime) is scaled with it. Radio frames, WiFi association and HTTP go
+// to a HalBackend, normally the simulator, which hands frames back
+// through the halNative*Receive functions from its own thread, the way
+// the radio drivers call back from theirs.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+
+// ---- Backend
+
+class HalBackend {
+public:
+  virtual ~HalBackend() {}
+  // dest is a peer MAC or the broadcast address
+  virtual void espNowSend(const uint8_t* dest, const uint8_t* data, size_t len) = 0;
+  // Sent at the radio's current spreading factor and bandwidth
+  virtual void loraSend(const uint8_t* data, size_t len, uint32_t airtimeUs,
+                        int spreadingFactor, long bandwidth) = 0;
+  // What channel activity detection at these settings finds right now
+  virtual bool loraChannelActive(int spreadingFactor, long bandwidth) { return false; }
+  // Called from the task doing HTTP; may take (scaled) time
+  virtual bool httpConnect(const char* host, uint16_t port) = 0;
+  // idempotencyKey is empty when the request carries none
+  virtual int httpPost(const char* host, const char* path, const char* contentType,
+                       const char* idempotencyKey, const uint8_t* body, size_t len,
+                       std::string& response) = 0;
+  // After a post with a status: false when the server closed the
+  // connection behind its response, so reading the body fails
+  virtual bool httpKeepAlive() { return true; }
+};
+
+struct HalNativeConfig {
+  uint8_t mac[6] = {0x24, 0x0A, 0xC4, 0x00, 0x00, 0x01};
+  uint32_t wifiConnectMs = 500; // From WiFi.begin() to WL_CONNECTED
+  uint8_t wifiChannel = 6;
+};
+
+void halNativeBegin(HalBackend* backend, const HalNativeConfig& config);
+// Simulated ms per real ms, 1 by default
+void halNativeSetSpeed(double speed);
+double halNativeSpeed();
+uint64_t halNativeMicros64();
+// Sleeps for us of simulated time
+void halNativeSleepMicros(uint64_t us);
+
+// Backend -> firmware, from the backend's thread
+void halNativeEspNowReceive(const uint8_t* from, const uint8_t* data, size_t len);
+void halNativeEspNowSent(const uint8_t* to, bool delivered);
+// Peers registered with the ESP-NOW driver, broadcast included
+size_t halNativeEspNowPeerCount();
+void halNativeLoRaReceive(const uint8_t* data, size_t len, int rssi, float snr);
+// In receive mode with no unread packet: the next one will not be missed
+bool halNativeLoRaReady();
+// The radio only demodulates packets sent with its own settings
+bool halNativeLoRaTunedTo(int spreadingFactor, long bandwidth);
+// Packets lost at the radio: overwritten before they were read, or
+// arriving while it was not in receive mode
+uint32_t halNativeLoRaMissed();
+
+// ---- Arduino core
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define RISING 0x01
+#define IRAM_ATTR
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+inline int digitalPinToInterrupt(int pin) { return pin; }
+// Only the LoRa DIO0 pin ever fires, from the backend's thread
+void attachInterrupt(uint8_t pin, void (*isr)(), int mode);
+
+class String {
+public:
+  String() {}
+  String(const char* text) : s(text ? text : "") {}
+  String(const std::string& text) : s(text) {}
+  const char* c_str() const { return s.c_str(); }
+  size_t length() const { return s.size(); }
+
+private:
+  std::string s;
+};
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t b) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size) {
+    size_t n = 0;
+    while (n < size && write(buffer[n])) n++;
+    return n;
+  }
+  virtual void flush() {}
+};
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+};
+
+class HardwareSerial : public Stream {
+public:
+  void begin(unsigned long) {}
+  size_t write(uint8_t b) override;
+  size_t write(const uint8_t* buffer, size_t size) override;
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+};
+extern HardwareSerial Serial;
+
+// Host numbers mean nothing here; fixed values keep the heap checks quiet
+class EspClass {
+public:
+  uint32_t getFreeHeap() { return 200000; }
+  uint32_t getMinFreeHeap() { return 180000; }
+  uint32_t getMaxAllocHeap() { return 110000; }
+};
+extern EspClass ESP;
+
+// The host clock is already set
+inline void configTime(long, int, const char*) {}
+
+// ---- FreeRTOS
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef struct HalTask* TaskHandle_t;
+typedef struct HalMutex* SemaphoreHandle_t;
+typedef void (*TaskFunction_t)(void*);
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define portMAX_DELAY 0xFFFFFFFFu
+#define pdMS_TO_TICKS(ms) (static_cast<TickType_t>(ms))
+#define tskIDLE_PRIORITY 0
+
+// Runs the task on a thread of its own; priority and core are ignored
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char* name, uint32_t stack,
+                                   void* param, UBaseType_t priority, TaskHandle_t* handle,
+                                   BaseType_t core);
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t wait);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* higherPriorityTaskWoken);
+#define portYIELD_FROM_ISR(woken) ((void)(woken))
+void vTaskDelay(TickType_t ticks);
+
+SemaphoreHandle_t xSemaphoreCreateMutex();
+BaseType_t xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t wait); // Waits forever
+BaseType_t xSemaphoreGive(SemaphoreHandle_t mutex);
+
+// ---- WiFi
+
+typedef enum {
+  WL_IDLE_STATUS = 0,
+  WL_NO_SSID_AVAIL = 1,
+  WL_CONNECTED = 3,
+  WL_CONNECT_FAILED = 4,
+  WL_CONNECTION_LOST = 5,
+  WL_DISCONNECTED = 6,
+} wl_status_t;
+
+typedef enum {
+  WIFI_MODE_NULL = 0,
+  WIFI_MODE_STA,
+  WIFI_MODE_AP,
+  WIFI_MODE_APSTA,
+} wifi_mode_t;
+#define WIFI_STA WIFI_MODE_STA
+#define WIFI_AP_STA WIFI_MODE_APSTA
+
+class IPAddress {
+public:
+  IPAddress(uint8_t a = 0, uint8_t b = 0, uint8_t c = 0, uint8_t d = 0) : bytes{a, b, c, d} {}
+  String toString() const;
+
+private:
+  uint8_t bytes[4];
+};
+
+class WiFiClass {
+public:
+  bool mode(wifi_mode_t) { return true; }
+  bool setAutoReconnect(bool) { return true; }
+  wl_status_t begin(const char* ssid, const char* password, int32_t channel = 0,
+                    const uint8_t* bssid = nullptr, bool connect = true);
+  bool disconnect(bool wifiOff = false, bool eraseAp = false);
+  wl_status_t status();
+  uint8_t channel();
+  uint8_t* BSSID();
+  IPAddress localIP();
+  String macAddress();
+  uint8_t* macAddress(uint8_t* mac);
+};
+extern WiFiClass WiFi;
+
+class WiFiClient {
+public:
+  virtual ~WiFiClient() {}
+  int connect(const char* host, uint16_t port);
+  uint8_t connected() { return open; }
+  void stop() { open = false; }
+
+private:
+  bool open = false;
+};
+
+class WiFiClientSecure : public WiFiClient {
+public:
+  void setCACert(const char*) {}
+  void setInsecure() {}
+};
+
+// ---- HTTPClient
+
+#define HTTPC_ERROR_CONNECTION_REFUSED (-1)
+#define HTTPC_ERROR_SEND_PAYLOAD_FAILED (-3)
+#define HTTPC_ERROR_NOT_CONNECTED (-4)
+#define HTTPC_ERROR_CONNECTION_LOST (-5)
+#define HTTPC_ERROR_READ_TIMEOUT (-11)
+
+#define HTTP_CODE_OK 200
+#define HTTP_CODE_CREATED 201
+#define HTTP_CODE_NO_CONTENT 204
+#define HTTP_CODE_BAD_REQUEST 400
+#define HTTP_CODE_REQUEST_TIMEOUT 408
+#define HTTP_CODE_UNSUPPORTED_MEDIA_TYPE 415
+#define HTTP_CODE_TOO_MANY_REQUESTS 429
+#define HTTP_CODE_SERVICE_UNAVAILABLE 503
+
+class HTTPClient {
+public:
+  void setReuse(bool) {}
+  void setTimeout(uint16_t) {}
+  bool begin(WiFiClient& client, const char* host, uint16_t port, const char* uri,
+             bool https = false);
+  void addHeader(const char* name, const char* value);
+  int POST(uint8_t* payload, size_t size);
+  int writeToStream(Stream* stream);
+  void end();
+  static String errorToString(int error);
+
+private:
+  WiFiClient* client = nullptr;
+  std::string host;
+  std::string uri;
+  std::string contentType;
+  std::string idempotencyKey;
+  std::string response;
+};
+
+// ---- LittleFS, Preferences
+
+// The batch log is a plain file next to the binary, see BATCH_LOG_PATH
+class LittleFSClass {
+public:
+  bool begin(bool formatOnFail = false) { return true; }
+};
+extern LittleFSClass LittleFS;
+
+// Kept in memory for the life of the process
+class Preferences {
+public:
+  bool begin(const char* name, bool readOnly = false);
+  void end() {}
+
+  size_t getString(const char* key, char* value, size_t maxLen);
+  size_t putString(const char* key, const char* value);
+  uint8_t getUChar(const char* key, uint8_t defaultValue = 0);
+  size_t putUChar(const char* key, uint8_t value);
+  uint16_t getUShort(const char* key, uint16_t defaultValue = 0);
+  size_t putUShort(const char* key, uint16_t value);
+  size_t getBytes(const char* key, void* buf, size_t maxLen);
+  size_t putBytes(const char* key, const void* value, size_t len);
+
+private:
+  std::string path(const char* key) const { return ns + "/" + key; }
+  std::string ns;
+};
+
+// ---- ESP-IDF: ESP-NOW, MAC, channel
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL (-1)
+#define ESP_ERR_ESPNOW_NOT_INIT 0x3065
+#define ESP_ERR_ESPNOW_ARG 0x3066
+#define ESP_ERR_ESPNOW_FULL 0x3068
+#define ESP_ERR_ESPNOW_NOT_FOUND 0x3069
+#define ESP_ERR_ESPNOW_EXIST 0x306B
+
+#define ESP_NOW_MAX_TOTAL_PEER_NUM 20
+#define ESP_NOW_MAX_DATA_LEN 250
+
+typedef enum {
+  ESP_NOW_SEND_SUCCESS = 0,
+  ESP_NOW_SEND_FAIL,
+} esp_now_send_status_t;
+
+typedef struct {
+  uint8_t peer_addr[6];
+  uint8_t lmk[16];
+  uint8_t channel;
+  int ifidx;
+  bool encrypt;
+  void* priv;
+} esp_now_peer_info_t;
+
+typedef void (*esp_now_send_cb_t)(const uint8_t* mac, esp_now_send_status_t status);
+typedef void (*esp_now_recv_cb_t)(const uint8_t* mac, const uint8_t* data, int len);
+
+esp_err_t esp_now_init();
+esp_err_t esp_now_register_send_cb(esp_now_send_cb_t cb);
+esp_err_t esp_now_register_recv_cb(esp_now_recv_cb_t cb);
+esp_err_t esp_now_add_peer(const esp_now_peer_info_t* peer);
+esp_err_t esp_now_del_peer(const uint8_t* mac);
+bool esp_now_is_peer_exist(const uint8_t* mac);
+esp_err_t esp_now_send(const uint8_t* mac, const uint8_t* data, size_t len);
+
+typedef enum { ESP_MAC_WIFI_STA = 0 } esp_mac_type_t;
+esp_err_t esp_read_mac(uint8_t* mac, esp_mac_type_t type);
+
+typedef enum { WIFI_SECOND_CHAN_NONE = 0 } wifi_second_chan_t;
+esp_err_t esp_wifi_set_channel(uint8_t primary, wifi_second_chan_t second);
+
+// ---- SPI, only the LoRa radio is on the bus
+
+#define MSBFIRST 1
+#define SPI_MODE0 0
+
+struct SPISettings {
+  SPISettings(uint32_t clock, uint8_t bitOrder, uint8_t dataMode) {}
+};
+
+class SPIClass {
+public:
+  void beginTransaction(SPISettings settings) { position = 0; }
+  void endTransaction() {}
+  // The first byte of a transaction addresses a radio register, top bit
+  // set to write; the next one is its value
+  uint8_t transfer(uint8_t data);
+
+private:
+  int position = 0;
+  uint8_t address = 0;
+};
+extern SPIClass SPI;
+
+// ---- LoRa (sandeepmistry/LoRa)
+
+class LoRaClass : public Stream {
+public:
+  void setPins(int ss, int reset, int dio0) { dio0Pin = dio0; }
+  int begin(long frequency) { return 1; }
+  void setSpreadingFactor(int sf) { spreadingFactor = sf; }
+  void setSignalBandwidth(long bw) { bandwidth = bw; }
+  void setCodingRate4(int denominator) { codingRate = denominator; }
+  void setTxPower(int level) { txPower = level; }
+  // Continuous receive; a packet raises DIO0, see attachInterrupt()
+  void receive(int size = 0);
+  void idle();
+  // CadDone and CadDetected in the IRQ flags a CAD's time later; the
+  // channel is sampled when it starts
+  void channelActivityDetection();
+  // Length of the packet received since the last call, 0 if none. Like
+  // the library, leaves the radio idle after a packet until receive().
+  int parsePacket(int size = 0);
+
+  int beginPacket(int implicitHeader = false);
+  size_t write(uint8_t b) override;
+  size_t write(const uint8_t* buffer, size_t size) override;
+  // Blocks for the packet's airtime, like the library's synchronous mode
+  int endPacket(bool async = false);
+
+  int available() override;
+  int read() override;
+  int peek() override;
+  int packetRssi() { return rxRssi; }
+  float packetSnr() { return rxSnr; }
+
+  uint32_t airtimeUs(size_t len) const;
+
+private:
+  friend void halNativeLoRaReceive(const uint8_t*, size_t, int, float);
+  friend bool halNativeLoRaReady();
+  friend bool halNativeLoRaTunedTo(int, long);
+  friend class SPIClass;
+  uint8_t readRegister(uint8_t address);
+  void writeRegister(uint8_t address, uint8_t value);
+
+  int spreadingFactor = 7;
+  long bandwidth = 125000;
+  int codingRate = 5;
+  int txPower = 17;
+  int dio0Pin = -1;
+  bool listening = false;
+  bool rxDone = false; // IRQ flag: rxBuf holds a packet not parsed yet
+  bool cadPending = false;
+  bool cadDetected = false;
+  uint64_t cadDoneAt = 0; // Simulated us
+  uint8_t txBuf[256];
+  size_t txLen = 0;
+  uint8_t rxBuf[256];
+  size_t rxLen = 0;
+  size_t rxPos = 0;
+  int rxRssi = 0;
+  float rxSnr = 0;
+};
+extern LoRaClass LoRa;
+
+#endif
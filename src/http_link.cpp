@@ -0,0 +1,110 @@
+#include "http_link.h"
+#include "log.h"
+
+// Stream that keeps the first bytes written to it and discards the rest
+class BufferSink : public Stream {
+public:
+  BufferSink(char* buffer, size_t capacity) : buf(buffer), cap(capacity), len(0) {}
+
+  size_t write(uint8_t b) override {
+    if (buf && len + 1 < cap) {
+      buf[len++] = static_cast<char>(b);
+      buf[len] = '\0';
+    }
+    return 1;
+  }
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+  void flush() override {}
+
+private:
+  char* buf;
+  size_t cap;
+  size_t len;
+};
+
+HttpLink::HttpLink(WiFiClient& client, const char* host, uint16_t port, bool https)
+  : client(client), host(host), port(port), https(https),
+    backoff(HTTP_LINK_BACKOFF_MIN), stats() {}
+
+bool HttpLink::connect() {
+  if (client.connected()) {
+    stats.reused++;
+    return true;
+  }
+
+  client.stop(); // Clear any half-closed socket before dialing again
+  unsigned long start = millis();
+  if (!client.connect(host, port)) {
+    LOG_E("✖️ [HTTP] Connect to %s:%u failed", host, port);
+    return false;
+  }
+
+  stats.connects++;
+  stats.lastHandshake = millis() - start;
+  if (stats.lastHandshake > stats.maxHandshake) stats.maxHandshake = stats.lastHandshake;
+  LOG_I("✔️ [HTTP] Connected to %s:%u in %u ms", host, port, stats.lastHandshake);
+  return true;
+}
+
+void HttpLink::close() {
+  http.end();
+  client.stop();
+}
+
+void HttpLink::failed() {
+  stats.failures++;
+  close();
+  backoff = backoff * 2 > HTTP_LINK_BACKOFF_MAX ? HTTP_LINK_BACKOFF_MAX : backoff * 2;
+}
+
+int HttpLink::post(const char* path, const char* contentType, const uint8_t* body, size_t len,
+                   char* response, size_t responseLen, const char* idempotencyKey) {
+  if (response && responseLen) response[0] = '\0';
+  stats.requests++;
+
+  stats.lastStatus = HTTPC_ERROR_CONNECTION_REFUSED;
+  if (!connect()) {
+    failed();
+    return HTTPC_ERROR_CONNECTION_REFUSED;
+  }
+
+  // HTTPClient picks up the already connected client and, with reuse
+  // enabled, leaves it open in end() when the server allows keep-alive.
+  http.setReuse(true);
+  http.setTimeout(HTTP_LINK_TIMEOUT);
+  if (!http.begin(client, host, port, path, https)) {
+    failed();
+    return HTTPC_ERROR_CONNECTION_REFUSED;
+  }
+  http.addHeader("Content-Type", contentType);
+  if (idempotencyKey) http.addHeader("Idempotency-Key", idempotencyKey);
+
+  unsigned long start = millis();
+  int code = http.POST(const_cast<uint8_t*>(body), len);
+  stats.lastRequest = millis() - start;
+  stats.lastStatus = code;
+
+  if (code <= 0) {
+    LOG_E("✖️ [HTTP] POST failed! Code: %d, Error: %s",
+          code, HTTPClient::errorToString(code).c_str());
+    failed();
+    return code;
+  }
+
+  // Read the whole body, chunked or not, so the connection is clean for
+  // the next request. The status is in already: a body that cannot be
+  // read, as from a server closing behind its response, only costs the
+  // connection, not a failure and a longer backoff.
+  BufferSink sink(response, responseLen);
+  int read = http.writeToStream(&sink);
+  if (read < 0) {
+    LOG_D("[HTTP] Response body unread (%d), reconnecting next time", read);
+    close();
+  } else {
+    http.end();
+  }
+  backoff = HTTP_LINK_BACKOFF_MIN;
+  return code;
+}
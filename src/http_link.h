@@ -0,0 +1,58 @@
+#ifndef HTTP_LINK_H
+#define HTTP_LINK_H
+
+#include "hal.h"
+
+#define HTTP_LINK_TIMEOUT 5000
+#define HTTP_LINK_BACKOFF_MIN 1000
+#define HTTP_LINK_BACKOFF_MAX 30000
+
+// Keeps one HTTP/1.1 keep-alive connection to a single host open across
+// requests. Connects explicitly, so the TCP/TLS handshake is timed apart
+// from the request itself. When the connect or the request fails before
+// a status arrives, the connection is dropped and the retry delay doubles
+// up to HTTP_LINK_BACKOFF_MAX.
+//
+// TLS sessions are not resumed: WiFiClientSecure has no session cache,
+// so every reconnect is a full handshake. Keeping the connection open is
+// what saves them.
+class HttpLink {
+public:
+  struct Stats {
+    uint32_t requests;
+    uint32_t connects;       // handshakes performed
+    uint32_t reused;         // requests sent on an already open connection
+    uint32_t failures;       // connects or requests that got no status
+    uint32_t lastHandshake;  // ms
+    uint32_t maxHandshake;   // ms
+    uint32_t lastRequest;    // ms, excluding any handshake
+    int lastStatus;          // HTTP status or HTTPClient error of the last post
+  };
+
+  HttpLink(WiFiClient& client, const char* host, uint16_t port, bool https);
+
+  // Returns the HTTP status, or a negative HTTPClient error. Up to
+  // responseLen - 1 bytes of the response body are copied into response.
+  // idempotencyKey, when set, goes out as the Idempotency-Key header.
+  int post(const char* path, const char* contentType, const uint8_t* body, size_t len,
+           char* response, size_t responseLen, const char* idempotencyKey = nullptr);
+  void close();
+
+  uint32_t retryDelay() const { return backoff; }
+  const Stats& getStats() const { return stats; }
+  const char* getHost() const { return host; }
+
+private:
+  bool connect();
+  void failed();
+
+  HTTPClient http;
+  WiFiClient& client;
+  const char* host;
+  uint16_t port;
+  bool https;
+  uint32_t backoff;
+  Stats stats;
+};
+
+#endif
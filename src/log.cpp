@@ -0,0 +1,191 @@
+#include "log.h"
+#include <stdio.h>
+#include "hal.h"
+
+#ifdef ARDUINO
+#define LOG_TASK_STACK 3072
+#define LOG_TASK_CORE 0
+#define LOG_TASK_IDLE_MS 20
+#endif
+
+// Bounded multi-producer queue after Dmitry Vyukov: every cell carries a
+// sequence number telling whose turn it is, so producers only race on one
+// compare-and-swap of the write position and never wait for each other.
+struct LogCell {
+  std::atomic<uint32_t> seq;
+  LogRecord record;
+};
+
+static LogCell cells[LOG_RING_SIZE];
+static std::atomic<uint32_t> writePos(0);
+static uint32_t readPos = 0; // Single consumer
+static std::atomic<uint32_t> dropped(0);
+
+// Cells start out as "free for the producer at position i". Runs with
+// the static constructors; a record logged before that is dropped.
+struct LogRingInit {
+  LogRingInit() {
+    for (uint32_t i = 0; i < LOG_RING_SIZE; i++) {
+      cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+};
+static LogRingInit ringInit;
+
+uint32_t logNow() {
+  return millis();
+}
+
+LogRecord* logClaim(uint32_t& pos) {
+  pos = writePos.load(std::memory_order_relaxed);
+  for (;;) {
+    LogCell& cell = cells[pos & (LOG_RING_SIZE - 1)];
+    int32_t diff = static_cast<int32_t>(cell.seq.load(std::memory_order_acquire) - pos);
+    if (diff == 0) {
+      if (writePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        return &cell.record;
+      }
+    } else if (diff < 0) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return nullptr; // Full
+    } else {
+      pos = writePos.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+void logCommit(uint32_t pos) {
+  LogCell& cell = cells[pos & (LOG_RING_SIZE - 1)];
+  cell.seq.store(pos + 1, std::memory_order_release);
+}
+
+bool logPop(LogRecord& record) {
+  LogCell& cell = cells[readPos & (LOG_RING_SIZE - 1)];
+  if (cell.seq.load(std::memory_order_acquire) != readPos + 1) return false;
+  record = cell.record;
+  cell.seq.store(readPos + LOG_RING_SIZE, std::memory_order_release);
+  readPos++;
+  return true;
+}
+
+uint32_t logDropped() {
+  return dropped.load(std::memory_order_relaxed);
+}
+
+// Formats one conversion at a time with snprintf, handing it the argument
+// with the type the conversion expects. Length modifiers are dropped since
+// every argument was stored as 32 bits.
+size_t logFormat(const LogRecord& rec, char* out, size_t outLen) {
+  if (outLen == 0) return 0;
+  size_t len = 0;
+  uint8_t arg = 0;
+  const char* p = rec.fmt;
+
+  auto put = [&](int n) {
+    if (n > 0) len += static_cast<size_t>(n);
+    if (len >= outLen) len = outLen - 1;
+  };
+
+  while (*p && len < outLen - 1) {
+    if (*p != '%') {
+      out[len++] = *p++;
+      continue;
+    }
+    if (p[1] == '%') {
+      out[len++] = '%';
+      p += 2;
+      continue;
+    }
+
+    char spec[16];
+    size_t s = 0;
+    spec[s++] = *p++;
+    while (*p && strchr("-+ #0123456789.", *p) && s < sizeof(spec) - 2) spec[s++] = *p++;
+    while (*p && strchr("hlzjtL", *p)) p++;
+    if (!*p) break;
+    char conv = *p++;
+    spec[s++] = conv;
+    spec[s] = '\0';
+
+    if (arg >= rec.argc) {
+      put(snprintf(out + len, outLen - len, "%s", spec));
+      continue;
+    }
+
+    const LogArg& a = rec.args[arg++];
+    char* dst = out + len;
+    size_t room = outLen - len;
+    switch (conv) {
+      case 'd': case 'i': case 'c':
+        put(snprintf(dst, room, spec, static_cast<int>(a.i)));
+        break;
+      case 'u': case 'x': case 'X': case 'o':
+        put(snprintf(dst, room, spec, static_cast<unsigned>(a.u)));
+        break;
+      case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+        put(snprintf(dst, room, spec, a.d));
+        break;
+      case 's':
+        put(snprintf(dst, room, spec, a.u < LOG_STRING_SPACE ? rec.strings + a.u : ""));
+        break;
+      case 'p':
+        put(snprintf(dst, room, spec, a.p));
+        break;
+      default:
+        put(snprintf(dst, room, "%s", spec));
+        break;
+    }
+  }
+  out[len] = '\0';
+  return len;
+}
+
+static void logOutput(const char* line, size_t len) {
+#ifdef ARDUINO
+  Serial.write(reinterpret_cast<const uint8_t*>(line), len);
+#else
+  fwrite(line, 1, len, stdout);
+#endif
+}
+
+void logDrain() {
+  static const char levels[] = "-EWID";
+  static uint32_t reportedDrops = 0;
+  char line[LOG_LINE_MAX];
+  LogRecord rec;
+
+  uint32_t drops = logDropped();
+  if (drops != reportedDrops) {
+    int n = snprintf(line, sizeof(line), "[log] %u records dropped\n", (unsigned)(drops - reportedDrops));
+    logOutput(line, n);
+    reportedDrops = drops;
+  }
+
+  while (logPop(rec)) {
+    int n = snprintf(line, sizeof(line), "[%lu %c] ", (unsigned long)rec.time,
+                     levels[rec.level < sizeof(levels) - 1 ? rec.level : 0]);
+    size_t len = n + logFormat(rec, line + n, sizeof(line) - n - 1);
+    line[len++] = '\n';
+    logOutput(line, len);
+  }
+}
+
+#ifdef ARDUINO
+static void logTask(void*) {
+  for (;;) {
+    logDrain();
+    vTaskDelay(pdMS_TO_TICKS(LOG_TASK_IDLE_MS));
+  }
+}
+
+void logBegin() {
+  static bool started = false;
+  if (started) return;
+  started = true;
+  // Lowest priority: the log only uses time nothing else wants
+  xTaskCreatePinnedToCore(logTask, "log", LOG_TASK_STACK, nullptr, tskIDLE_PRIORITY,
+                          nullptr, LOG_TASK_CORE);
+}
+#else
+void logBegin() {}
+#endif
@@ -0,0 +1,150 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
+#include <type_traits>
+
+// Levelled logging that keeps Serial off the radio paths.
+//
+// LOG_E/W/I/D take a printf format and its arguments. Levels above
+// LOG_LEVEL compile to nothing, arguments included. Enabled calls copy the
+// format pointer, the raw arguments and copies of any strings into a
+// record of a lock-free ring and return; formatting and the UART happen
+// in a low-priority task that drains the ring. A full ring drops the
+// record and counts it, it never blocks, so the macros are safe in radio
+// callbacks and ISRs.
+//
+// The format must be a string literal, it is read when the record is
+// drained. Arguments are kept as 32 bits (floats as double) and strings
+// are truncated to LOG_STRING_SPACE bytes per record in total.
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_RING_SIZE 64    // Records, power of two
+#define LOG_MAX_ARGS 8
+#define LOG_STRING_SPACE 40 // Bytes for %s copies per record
+#define LOG_LINE_MAX 192
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_E(...) logWrite(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_E(...) do {} while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_W(...) logWrite(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_W(...) do {} while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_I(...) logWrite(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_I(...) do {} while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_D(...) logWrite(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_D(...) do {} while (0)
+#endif
+
+union LogArg {
+  uint32_t u;
+  int32_t i;
+  double d;
+  const void* p;
+};
+
+struct LogRecord {
+  uint32_t time; // millis()
+  const char* fmt;
+  uint8_t level;
+  uint8_t argc;
+  uint8_t stringsUsed;
+  LogArg args[LOG_MAX_ARGS];
+  char strings[LOG_STRING_SPACE];
+};
+
+// Starts the drain task; records written before are kept until then
+void logBegin();
+// Formats and prints everything queued; the drain task calls this, a
+// host build calls it itself
+void logDrain();
+// Formats one record without the prefix, returns the length
+size_t logFormat(const LogRecord& record, char* out, size_t outLen);
+bool logPop(LogRecord& record);
+uint32_t logDropped();
+
+// Ring internals used by logWrite
+LogRecord* logClaim(uint32_t& pos);
+void logCommit(uint32_t pos);
+uint32_t logNow();
+
+// Adds arguments to a record by type
+class LogCapture {
+public:
+  explicit LogCapture(LogRecord& record) : rec(record) {}
+
+  template <typename T>
+  typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type
+  add(T value) {
+    if (rec.argc < LOG_MAX_ARGS) rec.args[rec.argc++].u = static_cast<uint32_t>(value);
+  }
+
+  template <typename T>
+  typename std::enable_if<std::is_floating_point<T>::value>::type add(T value) {
+    if (rec.argc < LOG_MAX_ARGS) rec.args[rec.argc++].d = value;
+  }
+
+  template <typename T>
+  void add(T* pointer) {
+    if (rec.argc < LOG_MAX_ARGS) rec.args[rec.argc++].p = pointer;
+  }
+
+  // Strings are copied: the caller's buffer may be gone by drain time
+  void add(const char* text) {
+    if (rec.argc >= LOG_MAX_ARGS) return;
+    size_t offset = rec.stringsUsed;
+    size_t room = LOG_STRING_SPACE - offset;
+    size_t len = 0;
+    while (text && len + 1 < room && text[len]) len++;
+    if (room > 0) {
+      if (len > 0) memcpy(rec.strings + offset, text, len);
+      rec.strings[offset + len] = '\0';
+      rec.stringsUsed = offset + len + 1;
+    }
+    rec.args[rec.argc++].u = room > 0 ? offset : LOG_STRING_SPACE;
+  }
+  void add(char* text) { add(static_cast<const char*>(text)); }
+
+private:
+  LogRecord& rec;
+};
+
+template <typename... Args>
+inline void logWrite(uint8_t level, const char* fmt, Args... args) {
+  uint32_t pos;
+  LogRecord* rec = logClaim(pos);
+  if (rec == nullptr) return;
+
+  rec->time = logNow();
+  rec->fmt = fmt;
+  rec->level = level;
+  rec->argc = 0;
+  rec->stringsUsed = 0;
+  LogCapture capture(*rec);
+  int expand[] = {0, (capture.add(args), 0)...};
+  (void)expand;
+  logCommit(pos);
+}
+
+#endif
@@ -0,0 +1,155 @@
+#include "lora_radio.h"
+
+// SX127x registers the library keeps private
+#define LORA_SPI_FREQUENCY 8E6 // As the library's default
+#define LORA_REG_IRQ_FLAGS 0x12
+#define LORA_IRQ_CAD_DONE 0x04
+#define LORA_IRQ_CAD_DETECTED 0x01
+
+SemaphoreHandle_t LoRaRadio::lock = nullptr;
+TaskHandle_t LoRaRadio::notifyTask = nullptr;
+std::atomic<bool> LoRaRadio::interrupted(false);
+SpscRing<LoRaPacket, LORA_RX_FIFO_SIZE> LoRaRadio::fifo;
+int LoRaRadio::ssPin = -1;
+uint32_t LoRaRadio::symbolUs = 0;
+uint32_t LoRaRadio::busyCount = 0;
+uint32_t LoRaRadio::abandonedCount = 0;
+uint32_t LoRaRadio::attemptCounts[LORA_LBT_ATTEMPTS > 0 ? LORA_LBT_ATTEMPTS : 1] = {};
+
+bool LoRaRadio::begin(int ss, int reset, int dio0, long frequency, int spreadingFactor,
+                      long bandwidth, int codingRate) {
+  lock = xSemaphoreCreateMutex();
+  LoRa.setPins(ss, reset, dio0);
+  if (lock == nullptr || !LoRa.begin(frequency)) return false;
+
+  LoRa.setSpreadingFactor(spreadingFactor);
+  LoRa.setSignalBandwidth(bandwidth);
+  LoRa.setCodingRate4(codingRate);
+  ssPin = ss;
+  setSymbolTime(spreadingFactor, bandwidth);
+  // DIO0 maps to RxDone in receive mode and to TxDone while sending; a
+  // wake-up after a send simply finds nothing to read
+  attachInterrupt(digitalPinToInterrupt(dio0), onDio0, RISING);
+  LoRa.receive();
+  return true;
+}
+
+void IRAM_ATTR LoRaRadio::onDio0() {
+  interrupted.store(true, std::memory_order_relaxed);
+  if (notifyTask == nullptr) return;
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(notifyTask, &woken);
+  portYIELD_FROM_ISR(woken);
+}
+
+void LoRaRadio::drain() {
+  // Cleared first: an interrupt during the read flags the next packet
+  interrupted.store(false, std::memory_order_relaxed);
+  xSemaphoreTake(lock, portMAX_DELAY);
+  readPacket();
+  LoRa.receive();
+  xSemaphoreGive(lock);
+}
+
+bool LoRaRadio::send(const uint8_t* frame, size_t len) {
+  uint8_t attempt = 0;
+  for (;;) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    readPacket();
+    if (attempt < LORA_LBT_ATTEMPTS && channelActive()) {
+      busyCount++;
+      LoRa.receive();
+      xSemaphoreGive(lock);
+      if (++attempt == LORA_LBT_ATTEMPTS) break;
+      long units = random(1, (1L << attempt) + 1);
+      delay(units * LORA_LBT_BACKOFF_SYMBOLS * symbolUs / 1000);
+      continue;
+    }
+
+    LoRa.beginPacket();
+    LoRa.write(frame, len);
+    bool sent = LoRa.endPacket();
+    LoRa.receive();
+    if (attempt < LORA_LBT_ATTEMPTS) attemptCounts[attempt]++;
+    xSemaphoreGive(lock);
+    return sent;
+  }
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  abandonedCount++;
+  xSemaphoreGive(lock);
+  return false;
+}
+
+// CAD, then up to a poll interval before the flags are seen
+uint32_t LoRaRadio::listenUs(int spreadingFactor, long bandwidth) {
+  if (LORA_LBT_ATTEMPTS == 0) return 0;
+  return static_cast<uint32_t>((static_cast<uint64_t>(LORA_CAD_SYMBOLS) << spreadingFactor) *
+                               1000000 / bandwidth) + 1000;
+}
+
+void LoRaRadio::configure(int spreadingFactor, long bandwidth, int txPower) {
+  xSemaphoreTake(lock, portMAX_DELAY);
+  readPacket();
+  LoRa.idle();
+  LoRa.setSpreadingFactor(spreadingFactor);
+  LoRa.setSignalBandwidth(bandwidth);
+  LoRa.setTxPower(txPower);
+  setSymbolTime(spreadingFactor, bandwidth);
+  LoRa.receive();
+  xSemaphoreGive(lock);
+}
+
+// Under the lock. A packet longer than a frame is cut; it fails the CRC
+// check in the decoder like any other corrupt frame.
+void LoRaRadio::readPacket() {
+  if (LoRa.parsePacket() <= 0) return;
+
+  LoRaPacket packet;
+  packet.receivedAt = millis();
+  packet.rssi = LoRa.packetRssi();
+  packet.snr = static_cast<int8_t>(LoRa.packetSnr());
+  packet.len = 0;
+  while (LoRa.available() && packet.len < sizeof(packet.data)) {
+    packet.data[packet.len++] = LoRa.read();
+  }
+  fifo.push(packet);
+}
+
+// Under the lock. Leaves the radio out of receive mode. DIO0 rises on
+// CadDone too; the drain it triggers finds nothing to read.
+bool LoRaRadio::channelActive() {
+  LoRa.channelActivityDetection();
+  uint32_t start = millis();
+  uint8_t flags;
+  while (!((flags = readRegister(LORA_REG_IRQ_FLAGS)) & LORA_IRQ_CAD_DONE)) {
+    // A radio that never finishes counts as a clear channel
+    if (millis() - start >= LORA_CAD_TIMEOUT_MS) return false;
+    delay(1);
+  }
+  writeRegister(LORA_REG_IRQ_FLAGS, LORA_IRQ_CAD_DONE | LORA_IRQ_CAD_DETECTED);
+  return flags & LORA_IRQ_CAD_DETECTED;
+}
+
+uint8_t LoRaRadio::readRegister(uint8_t address) {
+  SPI.beginTransaction(SPISettings(LORA_SPI_FREQUENCY, MSBFIRST, SPI_MODE0));
+  digitalWrite(ssPin, LOW);
+  SPI.transfer(address & 0x7F);
+  uint8_t value = SPI.transfer(0x00);
+  digitalWrite(ssPin, HIGH);
+  SPI.endTransaction();
+  return value;
+}
+
+void LoRaRadio::writeRegister(uint8_t address, uint8_t value) {
+  SPI.beginTransaction(SPISettings(LORA_SPI_FREQUENCY, MSBFIRST, SPI_MODE0));
+  digitalWrite(ssPin, LOW);
+  SPI.transfer(address | 0x80);
+  SPI.transfer(value);
+  digitalWrite(ssPin, HIGH);
+  SPI.endTransaction();
+}
+
+void LoRaRadio::setSymbolTime(int spreadingFactor, long bandwidth) {
+  symbolUs = static_cast<uint32_t>((1ULL << spreadingFactor) * 1000000ULL / bandwidth);
+}
@@ -0,0 +1,95 @@
+#ifndef LORA_RADIO_H
+#define LORA_RADIO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include "hal_lora.h"
+#include "frame.h"
+#include "spsc_ring.h"
+
+#define LORA_RX_FIFO_SIZE 16 // Packets, power of two
+// Listen before talk: a send first runs channel activity detection and,
+// while the channel is busy, backs off a random number of units, the
+// window doubling every time. Build with 0 to send without listening.
+#ifndef LORA_LBT_ATTEMPTS
+#define LORA_LBT_ATTEMPTS 4
+#endif
+#define LORA_LBT_BACKOFF_SYMBOLS 8 // One backoff unit, in symbols of the current rate
+#define LORA_CAD_SYMBOLS 2          // What a CAD takes, 17 ms at SF10/125 kHz
+#define LORA_CAD_TIMEOUT_MS 50
+
+struct LoRaPacket {
+  uint32_t receivedAt; // millis() when it was read off the radio
+  int16_t rssi;
+  int8_t snr;
+  uint8_t len;
+  uint8_t data[FRAME_MAX_SIZE];
+};
+
+// SX127x access without SPI in interrupt context. The library's
+// onReceive() reads the packet inside the DIO0 interrupt; here the
+// interrupt only flags it and wakes a task. drain(), in task context,
+// reads the packet with its RSSI and SNR, puts the radio straight back
+// into receive so a packet right behind it is not missed, and queues it
+// in a fixed FIFO for the decoder.
+//
+// Every radio access, sends included, holds one lock, so the SPI bus has
+// a single user at a time. A send first reads out a packet the radio
+// still holds, as starting a transmission would overwrite it; the lock
+// also makes it safe for drain() and send() to both push into the FIFO.
+//
+// The library reports CAD only through its own DIO0 handler, which reads
+// the radio in the interrupt, so send() polls the IRQ flags over SPI
+// itself. The lock is released while it backs off.
+class LoRaRadio {
+public:
+  static bool begin(int ss, int reset, int dio0, long frequency, int spreadingFactor,
+                    long bandwidth, int codingRate);
+  // Task to notify on every DIO0 interrupt. Without one, poll pending().
+  static void setNotify(TaskHandle_t task) { notifyTask = task; }
+  static bool pending() { return interrupted.load(std::memory_order_relaxed); }
+
+  static void drain();
+  // False when the radio refused the frame or the channel stayed busy on
+  // every attempt; it then was not sent. Blocks while it backs off.
+  static bool send(const uint8_t* frame, size_t len);
+  // us a send on a clear channel listens before it transmits, for
+  // slots and round trips to allow for; 0 without listen before talk
+  static uint32_t listenUs(int spreadingFactor, long bandwidth);
+  // Retunes for what is sent and heard next. A packet arriving while the
+  // radio retunes is lost.
+  static void configure(int spreadingFactor, long bandwidth, int txPower);
+
+  // Decoder side
+  static bool pop(LoRaPacket& packet) { return fifo.pop(packet); }
+  static uint32_t dropped() { return fifo.dropped(); }
+  static uint32_t highWater() { return fifo.highWater(); }
+
+  // Listen before talk, since begin()
+  static uint32_t channelBusy() { return busyCount; }    // CAD found activity, once per backoff
+  static uint32_t abandoned() { return abandonedCount; } // Sends given up
+  // Sends that went out on attempt n, from 0
+  static uint32_t sentOnAttempt(uint8_t n) { return n < LORA_LBT_ATTEMPTS ? attemptCounts[n] : 0; }
+
+private:
+  static void IRAM_ATTR onDio0();
+  static void readPacket();
+  static bool channelActive();
+  static uint8_t readRegister(uint8_t address);
+  static void writeRegister(uint8_t address, uint8_t value);
+  static void setSymbolTime(int spreadingFactor, long bandwidth);
+
+  static SemaphoreHandle_t lock;
+  static TaskHandle_t notifyTask;
+  static std::atomic<bool> interrupted;
+  static SpscRing<LoRaPacket, LORA_RX_FIFO_SIZE> fifo;
+  static int ssPin;
+  static uint32_t symbolUs;
+  // Under the lock
+  static uint32_t busyCount;
+  static uint32_t abandonedCount;
+  static uint32_t attemptCounts[LORA_LBT_ATTEMPTS > 0 ? LORA_LBT_ATTEMPTS : 1];
+};
+
+#endif
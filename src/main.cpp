@@ -1,11 +1,16 @@
-#include <Arduino.h>
+#include "hal.h"
+#include "log.h"
 #ifdef ROLE_BASE
+  // A base runs every radio it is built with
+  #include "base.h"
+  Base base;
   #ifdef PROTOCOL_ESPNOW
     #include "base_espnow.h"
-    EspNowBase base;
-  #elif defined(PROTOCOL_LORA)
+    EspNowTransport espNow;
+  #endif
+  #ifdef PROTOCOL_LORA
     #include "base_lora.h"
-    LoRaBase base;
+    LoRaTransport lora;
   #endif
 #elif defined(ROLE_NODE)
   #ifdef PROTOCOL_ESPNOW
@@ -19,7 +24,14 @@
 
 void setup() {
   Serial.begin(115200);
+  logBegin();
   #ifdef ROLE_BASE
+    #ifdef PROTOCOL_ESPNOW
+      base.addTransport(espNow);
+    #endif
+    #ifdef PROTOCOL_LORA
+      base.addTransport(lora);
+    #endif
     base.begin();
   #elif defined(ROLE_NODE)
     node.begin();
@@ -0,0 +1,211 @@
+#include "metrics.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifdef ARDUINO
+#include <freertos/FreeRTOS.h>
+
+// The _SAFE variants work from tasks and ISRs alike
+static portMUX_TYPE metricsLock = portMUX_INITIALIZER_UNLOCKED;
+#define METRICS_LOCK() portENTER_CRITICAL_SAFE(&metricsLock)
+#define METRICS_UNLOCK() portEXIT_CRITICAL_SAFE(&metricsLock)
+#else
+#include <atomic>
+
+static std::atomic_flag metricsLock = ATOMIC_FLAG_INIT;
+#define METRICS_LOCK() while (metricsLock.test_and_set(std::memory_order_acquire)) {}
+#define METRICS_UNLOCK() metricsLock.clear(std::memory_order_release)
+#endif
+
+// Upper bounds per histogram, ascending; one more bucket catches the rest
+static const int32_t RTT_BOUNDS[] = {2, 5, 10, 20, 50, 100, 200, 500, 1000};
+static const int32_t RSSI_BOUNDS[] = {-120, -110, -100, -90, -80, -70, -60, -50};
+static const int32_t SNR_BOUNDS[] = {-15, -10, -5, 0, 5, 10};
+static const int32_t BATCH_SIZE_BOUNDS[] = {1, 2, 4, 8, 16, 32, 64, 128};
+static const int32_t HTTP_LATENCY_BOUNDS[] = {100, 200, 500, 1000, 2000, 5000, 10000};
+
+struct HistogramSpec {
+  const char* name;
+  const int32_t* bounds;
+  uint8_t boundCount;
+};
+
+#define SPEC(name, bounds) {name, bounds, sizeof(bounds) / sizeof(bounds[0])}
+static const HistogramSpec HISTOGRAMS[METRIC_HISTOGRAM_COUNT] = {
+  SPEC("rtt", RTT_BOUNDS),
+  SPEC("rssi", RSSI_BOUNDS),
+  SPEC("snr", SNR_BOUNDS),
+  SPEC("batch", BATCH_SIZE_BOUNDS),
+  SPEC("http", HTTP_LATENCY_BOUNDS),
+};
+#undef SPEC
+
+static_assert(sizeof(RTT_BOUNDS) / sizeof(RTT_BOUNDS[0]) + 1 == METRICS_RTT_BUCKETS,
+              "per-node RTT rows use the RTT bounds");
+
+static const char* const COUNTER_NAMES[METRIC_COUNTER_COUNT] = {
+  "rx", "invalid", "sendErrors", "delivered", "lost", "resent", "dups", "abandoned",
+  "partial", "rejected", "rateChanges", "busy", "lbtAbandoned",
+};
+static const char* const GAUGE_NAMES[METRIC_GAUGE_COUNT] = {
+  "queue", "queueMax", "queueDrops", "nodes", "batchesPending",
+  "heap", "heapMin", "allocMax",
+};
+
+static uint8_t bucketFor(const HistogramSpec& spec, int32_t value) {
+  uint8_t i = 0;
+  while (i < spec.boundCount && value > spec.bounds[i]) i++;
+  return i;
+}
+
+uint8_t Metrics::bucketCount(MetricHistogram histogram) {
+  return HISTOGRAMS[histogram].boundCount + 1;
+}
+
+void Metrics::count(MetricCounter counter, uint32_t n) {
+  METRICS_LOCK();
+  counters[counter] += n;
+  METRICS_UNLOCK();
+}
+
+void Metrics::set(MetricGauge gauge, uint32_t value) {
+  METRICS_LOCK();
+  gauges[gauge] = value;
+  METRICS_UNLOCK();
+}
+
+static void add(MetricHistogramData& h, uint8_t bucket, int32_t value) {
+  h.counts[bucket]++;
+  if (h.count == 0 || value < h.min) h.min = value;
+  if (h.count == 0 || value > h.max) h.max = value;
+  h.count++;
+  h.sum += value;
+}
+
+void Metrics::record(MetricHistogram histogram, int32_t value) {
+  uint8_t bucket = bucketFor(HISTOGRAMS[histogram], value);
+  METRICS_LOCK();
+  add(histograms[histogram], bucket, value);
+  METRICS_UNLOCK();
+}
+
+void Metrics::recordRtt(int index, int32_t ms) {
+  uint8_t bucket = bucketFor(HISTOGRAMS[METRIC_RTT], ms);
+  METRICS_LOCK();
+  add(histograms[METRIC_RTT], bucket, ms);
+  if (index >= 0 && index < NODE_TABLE_CAPACITY && nodeRtts[index][bucket] != UINT16_MAX) {
+    nodeRtts[index][bucket]++;
+  }
+  METRICS_UNLOCK();
+}
+
+void Metrics::forgetNode(int index) {
+  if (index < 0 || index >= NODE_TABLE_CAPACITY) return;
+  METRICS_LOCK();
+  memset(nodeRtts[index], 0, sizeof(nodeRtts[index]));
+  METRICS_UNLOCK();
+}
+
+void Metrics::clear() {
+  METRICS_LOCK();
+  memset(counters, 0, sizeof(counters));
+  memset(gauges, 0, sizeof(gauges));
+  memset(histograms, 0, sizeof(histograms));
+  memset(nodeRtts, 0, sizeof(nodeRtts));
+  METRICS_UNLOCK();
+}
+
+void Metrics::snapshot(MetricsSnapshot& out, uint32_t now) const {
+  out.takenAt = now;
+  METRICS_LOCK();
+  memcpy(out.counters, counters, sizeof(counters));
+  memcpy(out.gauges, gauges, sizeof(gauges));
+  memcpy(out.histograms, histograms, sizeof(histograms));
+  METRICS_UNLOCK();
+}
+
+bool Metrics::nodeRtt(int index, uint16_t* counts) const {
+  if (index < 0 || index >= NODE_TABLE_CAPACITY) return false;
+  METRICS_LOCK();
+  memcpy(counts, nodeRtts[index], sizeof(nodeRtts[index]));
+  METRICS_UNLOCK();
+  for (int i = 0; i < METRICS_RTT_BUCKETS; i++) {
+    if (counts[i]) return true;
+  }
+  return false;
+}
+
+namespace {
+
+// snprintf into a fixed buffer, remembering whether anything was cut off
+class JsonWriter {
+public:
+  JsonWriter(char* buffer, size_t capacity) : buf(buffer), cap(capacity) {}
+
+  template <typename... Args>
+  void put(const char* fmt, Args... args) {
+    if (overflow) return;
+    int n = snprintf(buf + len, cap - len, fmt, args...);
+    if (n < 0 || static_cast<size_t>(n) >= cap - len) {
+      overflow = true;
+      return;
+    }
+    len += n;
+  }
+
+  size_t room() const { return overflow ? 0 : cap - len; }
+  size_t finish() const { return overflow ? 0 : len; }
+
+private:
+  char* buf;
+  size_t cap;
+  size_t len = 0;
+  bool overflow = false;
+};
+
+} // namespace
+
+// Longest per-node row: id plus ten 16-bit counts, as [12345,65535,...],
+#define NODE_ROW_MAX (2 + 6 + METRICS_RTT_BUCKETS * 6)
+
+size_t Metrics::writeJson(const MetricsSnapshot& snap, const NodeTable& nodes, int* cursor,
+                          char* out, size_t outLen) const {
+  if (out == nullptr || outLen == 0) return 0;
+  JsonWriter w(out, outLen);
+
+  w.put("{\"v\":%d,\"t\":%lu,\"c\":{", METRICS_JSON_VERSION, (unsigned long)snap.takenAt);
+  for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+    w.put("%s\"%s\":%lu", i ? "," : "", COUNTER_NAMES[i], (unsigned long)snap.counters[i]);
+  }
+  w.put("},\"g\":{");
+  for (int i = 0; i < METRIC_GAUGE_COUNT; i++) {
+    w.put("%s\"%s\":%lu", i ? "," : "", GAUGE_NAMES[i], (unsigned long)snap.gauges[i]);
+  }
+  w.put("},\"h\":{");
+  for (int i = 0; i < METRIC_HISTOGRAM_COUNT; i++) {
+    const MetricHistogramData& h = snap.histograms[i];
+    w.put("%s\"%s\":{\"n\":%lu,\"sum\":%lld,\"min\":%ld,\"max\":%ld,\"b\":[", i ? "," : "",
+          HISTOGRAMS[i].name, (unsigned long)h.count, (long long)h.sum, (long)h.min, (long)h.max);
+    for (int b = 0; b <= HISTOGRAMS[i].boundCount; b++) {
+      w.put("%s%lu", b ? "," : "", (unsigned long)h.counts[b]);
+    }
+    w.put("]}");
+  }
+
+  // Node rows while they fit, leaving room for the closing brackets
+  w.put("},\"nodes\":[");
+  int index = *cursor;
+  bool first = true;
+  uint16_t counts[METRICS_RTT_BUCKETS];
+  for (; index < NODE_TABLE_CAPACITY; index++) {
+    if (w.room() < NODE_ROW_MAX + 16) break;
+    if (!nodes.used(index) || !nodeRtt(index, counts)) continue;
+    w.put("%s[%u", first ? "" : ",", (unsigned)nodes[index].id);
+    for (int b = 0; b < METRICS_RTT_BUCKETS; b++) w.put(",%u", (unsigned)counts[b]);
+    w.put("]");
+    first = false;
+  }
+  *cursor = index < NODE_TABLE_CAPACITY ? index : 0;
+  w.put("],\"next\":%d}", *cursor);
+  return w.finish();
+}
@@ -0,0 +1,105 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "node_table.h"
+
+#define METRICS_MAX_BUCKETS 12
+#define METRICS_RTT_BUCKETS 10
+#define METRICS_JSON_VERSION 1
+
+enum MetricCounter : uint8_t {
+  METRIC_FRAMES_RECEIVED,
+  METRIC_FRAMES_INVALID,
+  METRIC_SEND_ERRORS,        // The radio refused a frame outright
+  METRIC_UNICAST_DELIVERED,  // ESP-NOW MAC-level ack received
+  METRIC_UNICAST_LOST,       // ESP-NOW retries used up without an ack
+  METRIC_READINGS_RESENT,    // Lost on the way, recovered from a later frame
+  METRIC_DUPLICATES,         // Resent readings already held, dropped
+  METRIC_READINGS_ABANDONED, // Readings a node gave up resending
+  METRIC_UPLOADS_PARTIAL,    // Batch uploads the server acknowledged in part
+  METRIC_READINGS_REJECTED,  // Left out of a successful upload's acks, dropped
+  METRIC_RATE_CHANGES,       // LoRa nodes that confirmed a new data rate or TX power
+  METRIC_CHANNEL_BUSY,       // LoRa sends that found the channel busy and backed off, per attempt
+  METRIC_SENDS_ABANDONED,    // LoRa sends given up on a busy channel, also send errors
+  METRIC_COUNTER_COUNT
+};
+
+enum MetricGauge : uint8_t {
+  METRIC_QUEUE_DEPTH,
+  METRIC_QUEUE_HIGH_WATER,
+  METRIC_QUEUE_DROPS,
+  METRIC_NODES,
+  METRIC_BATCHES_PENDING,
+  METRIC_FREE_HEAP,
+  METRIC_MIN_FREE_HEAP,    // Low-water mark since reset
+  METRIC_MAX_ALLOC_HEAP,
+  METRIC_GAUGE_COUNT
+};
+
+enum MetricHistogram : uint8_t {
+  METRIC_RTT,          // ms from a trigger to its reply, first attempts only
+  METRIC_RSSI,         // dBm, radios that report it
+  METRIC_SNR,          // dB, LoRa
+  METRIC_BATCH_SIZE,   // Readings per sealed batch
+  METRIC_HTTP_LATENCY, // ms per batch upload, handshake included
+  METRIC_HISTOGRAM_COUNT
+};
+
+// Fixed buckets: counts[i] holds values <= the i-th bound of the
+// histogram, the last bucket everything above.
+struct MetricHistogramData {
+  uint32_t counts[METRICS_MAX_BUCKETS];
+  uint32_t count;
+  int32_t min;
+  int32_t max;
+  int64_t sum;
+};
+
+struct MetricsSnapshot {
+  uint32_t takenAt; // millis()
+  uint32_t counters[METRIC_COUNTER_COUNT];
+  uint32_t gauges[METRIC_GAUGE_COUNT];
+  MetricHistogramData histograms[METRIC_HISTOGRAM_COUNT];
+};
+
+// Counters, gauges and histograms for the base, recorded from the loop,
+// the uplink task and the radio receive context alike. Every update is a
+// few adds under one spinlock, so snapshot() sees all of them at one
+// instant. The trigger RTT is also kept per node, by node table index, as
+// saturating 16-bit bucket counts.
+class Metrics {
+public:
+  Metrics() { clear(); }
+
+  void count(MetricCounter counter, uint32_t n = 1);
+  void set(MetricGauge gauge, uint32_t value);
+  void record(MetricHistogram histogram, int32_t value);
+  // Records into METRIC_RTT and the node's own histogram
+  void recordRtt(int index, int32_t ms);
+  // Clears the node's histogram, for a node leaving the table
+  void forgetNode(int index);
+  void clear();
+
+  void snapshot(MetricsSnapshot& out, uint32_t now) const;
+  // Copies the node's RTT bucket counts, false when it has none
+  bool nodeRtt(int index, uint16_t* counts) const;
+
+  // Compact JSON of a snapshot plus per-node RTT rows, starting at node
+  // index *cursor and continuing while out has room. *cursor is left at
+  // the first node not written, 0 once all were, so successive uploads
+  // cycle through the table. Returns the length, 0 if out is too small.
+  size_t writeJson(const MetricsSnapshot& snap, const NodeTable& nodes, int* cursor,
+                   char* out, size_t outLen) const;
+
+  static uint8_t bucketCount(MetricHistogram histogram);
+
+private:
+  uint32_t counters[METRIC_COUNTER_COUNT];
+  uint32_t gauges[METRIC_GAUGE_COUNT];
+  MetricHistogramData histograms[METRIC_HISTOGRAM_COUNT];
+  uint16_t nodeRtts[NODE_TABLE_CAPACITY][METRICS_RTT_BUCKETS];
+};
+
+#endif
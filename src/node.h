@@ -1,8 +1,17 @@
 #ifndef NODE_H
 #define NODE_H
 
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include "frame.h"
+#include "log.h"
+
 #define LED_PIN 2
 #define BLINK_DURATION 1000
+#define NODE_BASE_TIMEOUT 15000     // ms without a beacon or trigger before looking for the base again
+#define NODE_MAX_UNLISTED_BEACONS 5 // Beacons in a row without our id: the base forgot us, rejoin
+#define NODE_RESEND_SLOTS (FRAME_MAX_RESENT + 1) // Readings kept until acked, the newest included
 
 class Node {
 public:
@@ -11,8 +20,64 @@ public:
 
 protected:
   void updateBlink();
+  void startBlink();
+
+  // Replies are sent from update(), never from the radio callback
+  static void scheduleReply(uint32_t delayMs, uint16_t pollSeq);
+  static bool replyDue();
+  // Takes a reading and writes the reply: the new reading plus up to
+  // maxResent of the oldest ones the base has not acked yet
+  static size_t buildReading(uint8_t* out, size_t outLen, uint8_t maxResent, ReadingFrame& reading);
+
+  // Pairing with the base, kept in NVS so a restart goes straight back to it
+  static void loadPairing();
+  static void savePairing();
+  static size_t buildJoin(uint8_t* out, size_t outLen);
+  // True once after a join accept for this node arrived; adopts id and base
+  static bool takeJoinAccept();
+  static bool baseLost();
+  // Radio receive side, the ESP-NOW callback or LoRa's update(): join
+  // accepts and polls. from is the sender's MAC, nullptr on LoRa.
+  static void handleFrame(const uint8_t* from, FrameReader& frame);
+  // The ack from the latest poll; noted in the callback, applied before
+  // the reply is built
+  static void noteAck(const FrameAck& ack);
+  static void noteAckByte(int ackByte);
+  // The latest noted ack, once; seq and window always from the same poll
+  static bool takeAck(FrameAck& ack);
+  static void applyAck();
+
+  struct UnackedReading {
+    uint16_t seq;
+    int32_t value;
+    uint32_t takenAt; // millis()
+  };
 
   static bool blinking;
+  static uint16_t sequence;
+  static uint16_t nodeId;
+  // Pending bit, poll seq and the micros() the reply is due at, written
+  // by the poll's callback and taken by update(); 0 when none is pending
+  static std::atomic<uint64_t> pendingReply;
+  static uint16_t replyTo; // Seq of the trigger or beacon being answered, set by replyDue()
+  static uint8_t mac[6];
+  static uint8_t baseMac[6];
+  static uint8_t baseChannel;       // ESP-NOW channel the base was last found on, 0 if never
+  static bool joined;
+  static volatile bool joinAccepted;
+  static volatile uint16_t acceptedId;
+  static uint8_t acceptedFrom[6];   // Written before joinAccepted is set
+  static volatile uint32_t lastBaseFrame; // millis()
+  static volatile uint8_t unlistedBeacons;
+  static UnackedReading unacked[NODE_RESEND_SLOTS]; // Oldest first
+  static uint8_t unackedCount;
+  static uint32_t abandoned; // Readings dropped unacked to make room
+  // Pending bit, window and seq in one word, so the callback publishes
+  // them together; 0 when no ack is pending
+  static std::atomic<uint64_t> pendingAck;
+  // LoRa: the setting the latest trigger ordered, 0 for none. The next
+  // reading echoes it and the node switches once that reply is sent.
+  static volatile uint8_t radioOrder;
   static unsigned long blinkStartTime;
   static const int blinkDuration = BLINK_DURATION;
   static const int ledPin = LED_PIN;
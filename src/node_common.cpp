@@ -1,9 +1,31 @@
 #include "node.h"
-#include <arduino.h>
+#include "hal.h"
+
+#define PAIRING_NAMESPACE "vakinet"
+#define ACK_PENDING (1ull << 48) // Above the 16-bit seq and 32-bit window in pendingAck
+#define REPLY_PENDING (1ull << 48) // Above the 16-bit seq and 32-bit time in pendingReply
 
 // Define static members from Node class
 bool Node::blinking = false;
 unsigned long Node::blinkStartTime = 0;
+uint16_t Node::sequence = 0;
+uint16_t Node::nodeId = 0;
+std::atomic<uint64_t> Node::pendingReply(0);
+uint16_t Node::replyTo = 0;
+uint8_t Node::mac[6] = {0};
+uint8_t Node::baseMac[6] = {0};
+uint8_t Node::baseChannel = 0;
+bool Node::joined = false;
+volatile bool Node::joinAccepted = false;
+volatile uint16_t Node::acceptedId = 0;
+uint8_t Node::acceptedFrom[6] = {0};
+volatile uint32_t Node::lastBaseFrame = 0;
+volatile uint8_t Node::unlistedBeacons = 0;
+Node::UnackedReading Node::unacked[NODE_RESEND_SLOTS];
+uint8_t Node::unackedCount = 0;
+uint32_t Node::abandoned = 0;
+std::atomic<uint64_t> Node::pendingAck(0);
+volatile uint8_t Node::radioOrder = 0;
 
 // Manages LED blinking for node roles (ESP-NOW and LoRa).
 // Turns off the LED after the blink duration expires.
@@ -12,7 +34,195 @@ void Node::updateBlink() {
     if (millis() - blinkStartTime >= blinkDuration) {
       digitalWrite(LED_PIN, LOW);
       blinking = false;
-      Serial.println("LED turned off after blink");
+      LOG_D("LED turned off after blink");
+    }
+  }
+}
+
+void Node::startBlink() {
+  blinking = true;
+  blinkStartTime = millis();
+  digitalWrite(LED_PIN, HIGH);
+}
+
+void Node::scheduleReply(uint32_t delayMs, uint16_t pollSeq) {
+  uint32_t at = micros() + delayMs * 1000;
+  pendingReply.store(REPLY_PENDING | static_cast<uint64_t>(pollSeq) << 32 | at,
+                     std::memory_order_release);
+}
+
+// True once, when a scheduled reply slot has started; replyTo is then the
+// seq of the poll it answers
+bool Node::replyDue() {
+  uint64_t packed = pendingReply.load(std::memory_order_acquire);
+  if (packed == 0 || static_cast<int32_t>(micros() - static_cast<uint32_t>(packed)) < 0) {
+    return false;
+  }
+  // A poll noted since the load keeps its own reply pending
+  if (!pendingReply.compare_exchange_strong(packed, 0, std::memory_order_acquire)) return false;
+  replyTo = static_cast<uint16_t>(packed >> 32);
+  return true;
+}
+
+void Node::noteAck(const FrameAck& ack) {
+  pendingAck.store(ACK_PENDING | static_cast<uint64_t>(ack.window) << 16 | ack.seq,
+                   std::memory_order_release);
+}
+
+bool Node::takeAck(FrameAck& ack) {
+  uint64_t packed = pendingAck.exchange(0, std::memory_order_acquire);
+  if (packed == 0) return false;
+  ack.seq = static_cast<uint16_t>(packed);
+  ack.window = static_cast<uint32_t>(packed >> 16);
+  return true;
+}
+
+// Drops every reading the ack says the base holds
+void Node::applyAck() {
+  FrameAck ack;
+  if (!takeAck(ack)) return;
+
+  uint8_t kept = 0;
+  for (uint8_t i = 0; i < unackedCount; i++) {
+    int16_t behind = static_cast<int16_t>(ack.seq - unacked[i].seq);
+    bool held = behind >= 0 && (behind >= FRAME_ACK_WINDOW || (ack.window & 1u << behind));
+    if (!held) unacked[kept++] = unacked[i];
+  }
+  unackedCount = kept;
+}
+
+size_t Node::buildReading(uint8_t* out, size_t outLen, uint8_t maxResent, ReadingFrame& reading) {
+  applyAck();
+  if (unackedCount == NODE_RESEND_SLOTS) {
+    // The base settles it as given up once it sees the next frame
+    LOG_W("Reading #%u never acked, dropped", unacked[0].seq);
+    memmove(unacked, unacked + 1, (NODE_RESEND_SLOTS - 1) * sizeof(unacked[0]));
+    unackedCount--;
+    abandoned++;
+  }
+
+  uint32_t now = millis();
+  UnackedReading& fresh = unacked[unackedCount++];
+  fresh.seq = sequence++;
+  fresh.value = random(0, 100);
+  fresh.takenAt = now;
+
+  reading.nodeId = nodeId;
+  reading.seq = fresh.seq;
+  reading.replyTo = replyTo;
+  reading.value = fresh.value;
+  reading.radio = radioOrder;
+  radioOrder = 0;
+  // Oldest first: anything older than what the frame carries is given up
+  reading.resentCount = 0;
+  for (uint8_t i = 0; i + 1 < unackedCount && i < maxResent && i < FRAME_MAX_RESENT; i++) {
+    ReadingFrame::Resent& r = reading.resent[reading.resentCount++];
+    r.seq = unacked[i].seq;
+    r.value = unacked[i].value;
+    r.ageMs = now - unacked[i].takenAt;
+  }
+  return encodeReading(out, outLen, reading);
+}
+
+void Node::loadPairing() {
+  Preferences prefs;
+  prefs.begin(PAIRING_NAMESPACE, true);
+  nodeId = prefs.getUShort("id", 0);
+  baseChannel = prefs.getUChar("channel", 0);
+  if (prefs.getBytes("base", baseMac, 6) != 6) memset(baseMac, 0, 6);
+  prefs.end();
+
+  if (nodeId != 0) {
+    LOG_I("Paired before as %04X with base %02X:%02X:%02X:%02X:%02X:%02X, channel %u",
+          nodeId, baseMac[0], baseMac[1], baseMac[2], baseMac[3], baseMac[4], baseMac[5],
+          baseChannel);
+  }
+}
+
+void Node::savePairing() {
+  Preferences prefs;
+  prefs.begin(PAIRING_NAMESPACE, false);
+  prefs.putUShort("id", nodeId);
+  prefs.putUChar("channel", baseChannel);
+  prefs.putBytes("base", baseMac, 6);
+  prefs.end();
+}
+
+// Asks for the id held before, so a base that restarted hands it back.
+// Readings still unacked are resent after the join.
+size_t Node::buildJoin(uint8_t* out, size_t outLen) {
+  uint16_t ackedSeq = (unackedCount > 0 ? unacked[0].seq : sequence) - 1;
+  return encodeJoin(out, outLen, nodeId, mac, ackedSeq);
+}
+
+bool Node::takeJoinAccept() {
+  if (!joinAccepted) return false;
+  joinAccepted = false;
+
+  nodeId = acceptedId;
+  memcpy(baseMac, acceptedFrom, 6);
+  unlistedBeacons = 0;
+  lastBaseFrame = millis();
+  joined = true;
+  return true;
+}
+
+bool Node::baseLost() {
+  return joined && (millis() - lastBaseFrame > NODE_BASE_TIMEOUT ||
+                    unlistedBeacons >= NODE_MAX_UNLISTED_BEACONS);
+}
+
+void Node::handleFrame(const uint8_t* from, FrameReader& frame) {
+  uint8_t type = frame.header().type;
+
+  if (type == FRAME_JOIN_ACCEPT) {
+    uint8_t target[6];
+    if (joined || joinAccepted || !findJoinMac(frame, target) || memcmp(target, mac, 6) != 0) return;
+    acceptedId = frame.header().nodeId;
+    if (from != nullptr) memcpy(acceptedFrom, from, 6);
+    joinAccepted = true;
+    return;
+  }
+
+  // Polls only count from our own base
+  if (!joined || (from != nullptr && memcmp(from, baseMac, 6) != 0)) return;
+  lastBaseFrame = millis();
+
+  uint32_t replyDelay;
+  int ackByte;
+  if (type == FRAME_TRIGGER) {
+    if (frame.header().nodeId == nodeId) {
+      LOG_D("Trigger Activated");
+      FrameAck ack;
+      if (findAck(frame, ack)) noteAck(ack);
+      uint8_t radio;
+      if (findRadio(frame, radio)) radioOrder = radio;
+      scheduleReply(0, frame.header().seq);
+    } else if (findBeaconSlot(frame, nodeId, replyDelay, &ackByte)) {
+      // Group trigger: a slot like a beacon's, but not listing us means nothing
+      LOG_D("Group trigger, slot at %lu ms", (unsigned long)replyDelay);
+      noteAckByte(ackByte);
+      scheduleReply(replyDelay, frame.header().seq);
+    }
+  } else if (type == FRAME_BEACON) {
+    // The base's full table of 200 nodes takes three beacon groups of
+    // BEACON_MAX_SLOTS, and we are in one of them: a listed node counts
+    // two unlisted in a row, four when it missed its own. Rejoining takes
+    // NODE_MAX_UNLISTED_BEACONS, one more than that.
+    if (findBeaconSlot(frame, nodeId, replyDelay, &ackByte)) {
+      unlistedBeacons = 0;
+      noteAckByte(ackByte);
+      scheduleReply(replyDelay, frame.header().seq);
+    } else {
+      unlistedBeacons++;
     }
   }
-}
\ No newline at end of file
+}
+
+// Cumulative: the newest seq we took ending in that byte; -1 for none
+void Node::noteAckByte(int ackByte) {
+  if (ackByte < 0) return;
+  uint16_t latest = sequence - 1;
+  FrameAck ack = {static_cast<uint16_t>(latest - static_cast<uint8_t>(latest - ackByte)), ~0u};
+  noteAck(ack);
+}
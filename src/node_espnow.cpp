@@ -1,13 +1,25 @@
 #include "node_espnow.h"
-#include <esp_wifi.h>
+
+#define ESPNOW_CHANNELS 13     // 2.4 GHz channels 1-13
+#define NODE_JOIN_LISTEN_MS 30 // Wait for a join accept before the next channel
+#define NODE_SCAN_PAUSE_MS 1000 // Between two passes that found no base
+
+const uint8_t EspNowNode::broadcastMac[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
 
 void EspNowNode::begin() {
   Serial.begin(115200);
-  Serial.println("ESP-NOW Node setup started");
+  LOG_I("ESP-NOW Node setup started");
   pinMode(LED_PIN, OUTPUT);
   digitalWrite(LED_PIN, LOW);
+
+  esp_read_mac(mac, ESP_MAC_WIFI_STA);
+  loadPairing();
+  // Seqs the base still remembers from before a restart would be dropped
+  sequence = random(0, 0x10000);
+
   setupWiFi();
   setupEspNow();
+  startScan();
 }
 
 void EspNowNode::setupWiFi() {
@@ -15,84 +27,129 @@ void EspNowNode::setupWiFi() {
   WiFi.disconnect();
   delay(100);
 
-  Serial.println("BASE not found. Defaulting to channel 6");
-  String mac = WiFi.macAddress();
-  Serial.print("MAC Address: ");
-  Serial.println(mac);
-  esp_wifi_set_channel(6, WIFI_SECOND_CHAN_NONE);
-
-  uint8_t chan;
-  wifi_second_chan_t second;
-  esp_wifi_get_channel(&chan, &second);
-  Serial.printf("NODE Wi-Fi Channel: %d\n", chan);
+  String macAddress = WiFi.macAddress();
+  LOG_I("MAC Address: %s", macAddress.c_str());
 }
 
 void EspNowNode::setupEspNow() {
   if (esp_now_init() != ESP_OK) {
-    Serial.println("Error initializing ESP-NOW");
+    LOG_E("Error initializing ESP-NOW");
     return;
   }
 
   esp_now_register_send_cb(EspNowNode::onDataSent);
   esp_now_register_recv_cb(EspNowNode::onReceiveEspNow);
 
+  // Channel 0 sends on whatever channel the radio is on, so the peer
+  // follows the scan
   esp_now_peer_info_t peerInfo = {};
-  uint8_t baseMac[] = {0xBC, 0xDD, 0xC2, 0xCE, 0xCA, 0x58}; // Update with actual base MAC
-  memcpy(peerInfo.peer_addr, baseMac, 6);
-  peerInfo.channel = 6;
+  memcpy(peerInfo.peer_addr, broadcastMac, 6);
+  peerInfo.channel = 0;
   peerInfo.encrypt = false;
+  if (!esp_now_is_peer_exist(broadcastMac) && esp_now_add_peer(&peerInfo) != ESP_OK) {
+    LOG_E("Failed to add broadcast peer");
+  }
+}
 
-  if (!esp_now_is_peer_exist(baseMac)) {
-    if (esp_now_add_peer(&peerInfo) != ESP_OK) {
-      Serial.println("Failed to add peer");
-    } else {
-      Serial.println("ESP-NOW peer added");
-    }
+void EspNowNode::addBasePeer() {
+  if (esp_now_is_peer_exist(baseMac)) return;
+
+  esp_now_peer_info_t peerInfo = {};
+  memcpy(peerInfo.peer_addr, baseMac, 6);
+  peerInfo.channel = 0;
+  peerInfo.encrypt = false;
+  if (esp_now_add_peer(&peerInfo) != ESP_OK) {
+    LOG_E("Failed to add base peer");
   }
 }
 
+void EspNowNode::startScan() {
+  joined = false;
+  scanStep = 0;
+  joinSentAt = millis() - NODE_JOIN_LISTEN_MS;
+  scanStart = millis();
+}
 
+// The channel the base was last seen on first, then all others in order
+uint8_t EspNowNode::scanChannelAt(uint8_t step) const {
+  if (baseChannel < 1 || baseChannel > ESPNOW_CHANNELS) return step + 1;
+  if (step == 0) return baseChannel;
+  return step >= baseChannel ? step + 1 : step;
+}
 
-void EspNowNode::update() {
-  updateBlink();
+// One join per channel, NODE_JOIN_LISTEN_MS apart. The base answers from
+// its loop within a few ms, so a full pass takes about 400 ms.
+void EspNowNode::scan() {
+  if (takeJoinAccept()) {
+    baseChannel = scanChannel;
+    addBasePeer();
+    savePairing();
+    LOG_I("Joined base %02X:%02X:%02X:%02X:%02X:%02X as %04X on channel %u in %lu ms",
+          baseMac[0], baseMac[1], baseMac[2], baseMac[3], baseMac[4], baseMac[5],
+          nodeId, baseChannel, millis() - scanStart);
+    return;
+  }
+
+  unsigned long now = millis();
+  if (now - joinSentAt < NODE_JOIN_LISTEN_MS) return;
+  if (scanStep >= ESPNOW_CHANNELS) {
+    if (now - joinSentAt < NODE_SCAN_PAUSE_MS) return;
+    LOG_W("BASE not found, scanning again");
+    scanStep = 0;
+  }
+
+  scanChannel = scanChannelAt(scanStep++);
+  esp_wifi_set_channel(scanChannel, WIFI_SECOND_CHAN_NONE);
+
+  uint8_t frame[FRAME_MAX_SIZE];
+  size_t len = buildJoin(frame, sizeof(frame));
+  esp_now_send(broadcastMac, frame, len);
+  joinSentAt = now;
 }
 
-void EspNowNode::onDataSent(const uint8_t* mac_addr, esp_now_send_status_t status) {
-  Serial.print("Last Packet Send Status: ");
-  Serial.println(status == ESP_NOW_SEND_SUCCESS ? "Delivery Success" : "Delivery Fail");
+void EspNowNode::update() {
+  if (!joined) {
+    scan();
+    return;
+  }
+  if (baseLost()) {
+    // Usually the router moved the base to another channel
+    LOG_W("Lost the base, scanning");
+    startScan();
+    return;
+  }
+
+  updateBlink();
+  if (replyDue()) {
+    sendReading();
+  }
 }
 
-void EspNowNode::onReceiveEspNow(const uint8_t* mac, const uint8_t* incomingData, int len) {
-  struct TriggerMessage { uint8_t command; };
-  if (len == sizeof(TriggerMessage)) {
-    TriggerMessage msg;
-    memcpy(&msg, incomingData, sizeof(TriggerMessage));
-    if (msg.command == 1) {
-      Serial.println("Trigger Activated");
-      blinking = true;
-      blinkStartTime = millis();
-      digitalWrite(LED_PIN, HIGH);
-     
-
-      int randomValue = random(0, 100);
-
-  uint8_t mac[6];
-  esp_read_mac(mac, ESP_MAC_WIFI_STA);
-  char macStr[13];
-  snprintf(macStr, sizeof(macStr), "%02X%02X%02X%02X%02X%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+void EspNowNode::sendReading() {
+  startBlink();
 
-  char message[64];
-  snprintf(message, sizeof(message), "{\"value\":%d,\"deviceId\":\"%s\"}", randomValue, macStr);
+  ReadingFrame reading;
+  uint8_t frame[FRAME_MAX_SIZE];
+  size_t frameLen = buildReading(frame, sizeof(frame), FRAME_MAX_RESENT, reading);
 
-  uint8_t baseMac[] = {0xBC, 0xDD, 0xC2, 0xCE, 0xCA, 0x58}; // Update with actual base MAC
-  esp_err_t result = esp_now_send(baseMac, (uint8_t *)message, strlen(message));
+  esp_err_t result = esp_now_send(baseMac, frame, frameLen);
   if (result == ESP_OK) {
-    Serial.printf("ESP-NOW sent: %s\n", message);
+    LOG_D("ESP-NOW sent reading #%u: %d, %u resent (%u bytes)", reading.seq, reading.value,
+          reading.resentCount, (unsigned)frameLen);
   } else {
-    Serial.println("ESP-NOW send failed");
+    LOG_E("ESP-NOW send failed");
   }
-    }
-  } else {
-    Serial.println("Received data is not a valid trigger message");
+}
+
+void EspNowNode::onDataSent(const uint8_t* mac_addr, esp_now_send_status_t status) {
+  LOG_D("Last Packet Send Status: %s", status == ESP_NOW_SEND_SUCCESS ? "Delivery Success" : "Delivery Fail");
+}
+
+void EspNowNode::onReceiveEspNow(const uint8_t* mac, const uint8_t* incomingData, int len) {
+  FrameReader reader;
+  if (!reader.parse(incomingData, len)) {
+    LOG_W("Received data is not a valid frame");
+    return;
   }
-}
\ No newline at end of file
+  handleFrame(mac, reader);
+}
@@ -2,9 +2,8 @@
 #define NODE_ESPNOW_H
 
 #include "node.h"
-#include <esp_now.h>
-#include <WiFi.h>
-#include <ArduinoJson.h>
+#include "hal_espnow.h"
+#include "frame.h"
 
 class EspNowNode : public Node {
 public:
@@ -13,10 +12,20 @@ public:
 
 private:
   void setupEspNow();
-  void sendEspNow();
+  void startScan();
+  void scan();
+  uint8_t scanChannelAt(uint8_t step) const;
+  void addBasePeer();
+  void sendReading();
   static void onDataSent(const uint8_t* mac_addr, esp_now_send_status_t status);
   static void onReceiveEspNow(const uint8_t* mac, const uint8_t* incomingData, int len);
   void setupWiFi();
+
+  static const uint8_t broadcastMac[6];
+  uint8_t scanStep = 0;        // Channels tried in this pass
+  uint8_t scanChannel = 0;     // Channel the last join went out on
+  unsigned long joinSentAt = 0;
+  unsigned long scanStart = 0;
 };
 
 #endif
\ No newline at end of file
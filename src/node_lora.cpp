@@ -1,78 +1,116 @@
 #include "node_lora.h"
-#include <WiFi.h>
 
 #define LORA_SS 5
 #define LORA_RST 14
 #define LORA_DIO0 26
 #define LORA_FREQUENCY 915E6
-#define LORA_SPREADING_FACTOR 7
-#define LORA_BANDWIDTH 125E3
-#define LORA_CODING_RATE 5
+// The base answers joins between sweeps; retries are spread so nodes that
+// booted together do not keep colliding. Joins go out on the slow home
+// rate, so the spread doubles with every unanswered one.
+#define NODE_JOIN_RETRY_MS 1000
+#define NODE_JOIN_MAX_DOUBLINGS 6
+// Resent readings per reply that still fit the base's slot, see LORA_REPLY_BYTES
+#define NODE_LORA_MAX_RESENT 2
 
 void LoRaNode::begin() {
   Serial.begin(115200);
-  Serial.println("LoRa Node setup started");
+  LOG_I("LoRa Node setup started");
   pinMode(LED_PIN, OUTPUT);
   digitalWrite(LED_PIN, LOW);
+
+  esp_read_mac(mac, ESP_MAC_WIFI_STA);
+  loadPairing();
+  // Seqs the base still remembers from before a restart would be dropped
+  sequence = random(0, 0x10000);
+
   setupLoRa();
+  joinStart = millis();
 }
 
 void LoRaNode::setupLoRa() {
   WiFi.mode(WIFI_MODE_NULL);
   WiFi.disconnect();
-  LoRa.setPins(LORA_SS, LORA_RST, LORA_DIO0);
-  if (!LoRa.begin(LORA_FREQUENCY)) {
-    Serial.println("Error initializing LoRa");
+  const LoRaDataRate& home = LORA_DATA_RATES[LORA_HOME_RATE];
+  if (!LoRaRadio::begin(LORA_SS, LORA_RST, LORA_DIO0, LORA_FREQUENCY, home.spreadingFactor,
+                        home.bandwidth, LORA_CODING_RATE)) {
+    LOG_E("Error initializing LoRa");
     while (1);
   }
 
-  LoRa.setSpreadingFactor(LORA_SPREADING_FACTOR);
-  LoRa.setSignalBandwidth(LORA_BANDWIDTH);
-  LoRa.setCodingRate4(LORA_CODING_RATE);
-  LoRa.onReceive(LoRaNode::onReceiveLoRa);
-  LoRa.receive();
-
-  Serial.println("LoRa initialized");
+  LOG_I("LoRa initialized");
 }
 
 
+// No channels to scan on LoRa: repeat the join until the base accepts it
+void LoRaNode::join() {
+  if (takeJoinAccept()) {
+    joinAttempts = 0;
+    savePairing();
+    LOG_I("Joined base as %04X in %lu ms", nodeId, millis() - joinStart);
+    return;
+  }
+
+  if (static_cast<long>(millis() - nextJoinAt) < 0) return;
+
+  uint8_t frame[FRAME_MAX_SIZE];
+  size_t len = buildJoin(frame, sizeof(frame));
+  LoRaRadio::send(frame, len);
+  uint8_t doublings = joinAttempts < NODE_JOIN_MAX_DOUBLINGS ? joinAttempts : NODE_JOIN_MAX_DOUBLINGS;
+  nextJoinAt = millis() + NODE_JOIN_RETRY_MS + random(0, NODE_JOIN_RETRY_MS << doublings);
+  joinAttempts++;
+}
+
 void LoRaNode::update() {
+  receivePackets();
+  if (!joined) {
+    join();
+    return;
+  }
+  if (baseLost()) {
+    LOG_W("Lost the base, joining again");
+    // The base may have lost us on a rate it no longer listens on
+    setRadio(adrRadio(LORA_HOME_RATE, ADR_MAX_TX_POWER));
+    joined = false;
+    nextJoinAt = millis();
+    joinStart = millis();
+    joinAttempts = 0;
+    return;
+  }
+
   updateBlink();
+  if (replyDue()) {
+    sendReading();
+  }
 }
 
-void LoRaNode::onReceiveLoRa(int packetSize) {
-  if (packetSize == 0) return;
+void LoRaNode::sendReading() {
+  startBlink();
 
-  uint8_t buffer[256];
-  int len = 0;
-  while (LoRa.available() && len < sizeof(buffer)) {
-    buffer[len++] = LoRa.read();
-  }
+  ReadingFrame reading;
+  uint8_t frame[FRAME_MAX_SIZE];
+  size_t frameLen = buildReading(frame, sizeof(frame), NODE_LORA_MAX_RESENT, reading);
 
-  if (len == 7 && buffer[0] == 1) {
-    uint8_t nodeMac[6];
-    esp_read_mac(nodeMac, ESP_MAC_WIFI_STA);
-    if (memcmp(buffer + 1, nodeMac, 6) == 0) {
-      Serial.println("Trigger Activated");
-      blinking = true;
-      blinkStartTime = millis();
-      digitalWrite(LED_PIN, HIGH);
-     
-      
-       int randomValue = random(0, 100);
-  uint8_t mac[6];
-  esp_read_mac(mac, ESP_MAC_WIFI_STA);
-  char macStr[13];
-  snprintf(macStr, sizeof(macStr), "%02X%02X%02X%02X%02X%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-
-  char message[64];
-  snprintf(message, sizeof(message), "{\"value\":%d,\"deviceId\":\"%s\"}", randomValue, macStr);
-
-  LoRa.beginPacket();
-  LoRa.print(message);
-  LoRa.endPacket();
-  LoRa.receive();
-  Serial.printf("LoRa sent: %s\n", message);
-    }
+  LoRaRadio::send(frame, frameLen);
+  LOG_D("LoRa sent reading #%u: %d, %u resent (%u bytes)", reading.seq, reading.value,
+        reading.resentCount, (unsigned)frameLen);
+  // Ordered by the trigger this answered; the reply said so on the old rate
+  if (reading.radio != 0) setRadio(reading.radio);
+}
+
+void LoRaNode::setRadio(uint8_t setting) {
+  if (setting == radio || !adrRadioValid(setting)) return;
+  const LoRaDataRate& rate = LORA_DATA_RATES[adrRadioRate(setting)];
+  LoRaRadio::configure(rate.spreadingFactor, rate.bandwidth, adrRadioPower(setting));
+  radio = setting;
+  LOG_I("Now on DR%u at %u dBm", adrRadioRate(setting), adrRadioPower(setting));
+}
+
+void LoRaNode::receivePackets() {
+  if (LoRaRadio::pending()) LoRaRadio::drain();
+
+  LoRaPacket packet;
+  while (LoRaRadio::pop(packet)) {
+    FrameReader reader;
+    if (reader.parse(packet.data, packet.len)) handleFrame(nullptr, reader);
   }
-}
\ No newline at end of file
+}
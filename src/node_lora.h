@@ -2,8 +2,9 @@
 #define NODE_LORA_H
 
 #include "node.h"
-#include <LoRa.h>
-#include <ArduinoJson.h>
+#include "lora_radio.h"
+#include "adr.h"
+#include "frame.h"
 
 class LoRaNode : public Node {
 public:
@@ -12,9 +13,18 @@ public:
 
 private:
   void setupLoRa();
-  void sendEspNow();
-  static void onReceiveLoRa(int packetSize);
-  void setupWiFi();
+  void join();
+  void sendReading();
+  // Data rate and TX power, packed as in adr.h
+  void setRadio(uint8_t setting);
+  // Reads and handles what DIO0 flagged, from update(), which also sends
+  // the replies, so the node needs no radio task
+  void receivePackets();
+
+  unsigned long nextJoinAt = 0;
+  unsigned long joinStart = 0;
+  uint8_t joinAttempts = 0; // Unanswered since the last join
+  uint8_t radio = adrRadio(LORA_HOME_RATE, ADR_MAX_TX_POWER);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,178 @@
+#include "node_table.h"
+#include <string.h>
+
+static const size_t SLOT_MASK = NODE_TABLE_SLOTS - 1;
+
+static inline size_t hashMac(const uint8_t* mac) {
+  uint32_t h = 2166136261u; // FNV-1a
+  for (int i = 0; i < 6; i++) {
+    h = (h ^ mac[i]) * 16777619u;
+  }
+  return h & SLOT_MASK;
+}
+
+static inline size_t hashId(uint16_t id) {
+  return (id * 2654435761u >> 16) & SLOT_MASK;
+}
+
+void NodeTable::clear() {
+  memset(inUse, 0, sizeof(inUse));
+  memset(byMac, EMPTY, sizeof(byMac));
+  memset(byId, EMPTY, sizeof(byId));
+  count = 0;
+}
+
+// Slot holding mac, or the empty slot that ends its probe chain
+size_t NodeTable::macSlot(const uint8_t* mac) const {
+  size_t slot = hashMac(mac);
+  while (byMac[slot] != EMPTY && memcmp(entries[byMac[slot]].mac, mac, 6) != 0) {
+    slot = (slot + 1) & SLOT_MASK;
+  }
+  return slot;
+}
+
+size_t NodeTable::idSlot(uint16_t id) const {
+  size_t slot = hashId(id);
+  while (byId[slot] != EMPTY && entries[byId[slot]].id != id) {
+    slot = (slot + 1) & SLOT_MASK;
+  }
+  return slot;
+}
+
+size_t NodeTable::homeSlot(const uint8_t* slots, uint8_t index) const {
+  return slots == byMac ? hashMac(entries[index].mac) : hashId(entries[index].id);
+}
+
+int NodeTable::find(const uint8_t* mac) const {
+  uint8_t index = byMac[macSlot(mac)];
+  return index == EMPTY ? -1 : index;
+}
+
+int NodeTable::findId(uint16_t id) const {
+  uint8_t index = byId[idSlot(id)];
+  return index == EMPTY ? -1 : index;
+}
+
+int NodeTable::add(const uint8_t* mac, uint16_t id, uint32_t now) {
+  int existing = find(mac);
+  if (existing >= 0) return existing;
+  if (full() || findId(id) >= 0) return -1;
+
+  int index = 0;
+  while (inUse[index]) index++;
+
+  NodeInfo& node = entries[index];
+  memset(&node, 0, sizeof(node));
+  memcpy(node.mac, mac, 6);
+  node.id = id;
+  node.lastSeen = now;
+  adrReset(node.adr);
+  inUse[index] = true;
+
+  byMac[macSlot(mac)] = index;
+  byId[idSlot(id)] = index;
+  count++;
+  return index;
+}
+
+// Empties slot and moves later entries of the probe chain back into the
+// gap, so lookups never need to skip deleted slots.
+void NodeTable::unlink(uint8_t* slots, size_t slot) {
+  size_t gap = slot;
+  slots[gap] = EMPTY;
+  for (size_t next = (gap + 1) & SLOT_MASK; slots[next] != EMPTY; next = (next + 1) & SLOT_MASK) {
+    size_t home = homeSlot(slots, slots[next]);
+    bool reachable = gap <= next ? (home > gap && home <= next) : (home > gap || home <= next);
+    if (reachable) continue;
+    slots[gap] = slots[next];
+    slots[next] = EMPTY;
+    gap = next;
+  }
+}
+
+bool NodeTable::remove(int index) {
+  if (index < 0 || index >= NODE_TABLE_CAPACITY || !inUse[index]) return false;
+
+  unlink(byMac, macSlot(entries[index].mac));
+  unlink(byId, idSlot(entries[index].id));
+  inUse[index] = false;
+  count--;
+  return true;
+}
+
+void NodeTable::seen(int index, int16_t rssi, int8_t snr, uint32_t now) {
+  NodeInfo& node = entries[index];
+  node.rssi = rssi;
+  node.snr = snr;
+  node.misses = 0;
+  node.readings++;
+  node.lastSeen = now;
+}
+
+bool NodeTable::accept(int index, uint16_t seq) {
+  NodeInfo& node = entries[index];
+  if (node.seqWindow == 0) {
+    restartSeq(index, seq);
+    return true;
+  }
+
+  int16_t ahead = static_cast<int16_t>(seq - node.lastSeq);
+  if (ahead > 0) {
+    node.seqWindow = ahead >= FRAME_ACK_WINDOW ? 1 : node.seqWindow << ahead | 1;
+    node.lastSeq = seq;
+    return true;
+  }
+  int behind = -ahead;
+  if (behind >= FRAME_ACK_WINDOW || (node.seqWindow & 1u << behind)) return false;
+  node.seqWindow |= 1u << behind;
+  return true;
+}
+
+uint16_t NodeTable::settleBefore(int index, uint16_t seq) {
+  NodeInfo& node = entries[index];
+  int behind = static_cast<int16_t>(node.lastSeq - seq);
+  if (node.seqWindow == 0 || behind < 0 || behind + 1 >= FRAME_ACK_WINDOW) return 0;
+
+  uint32_t older = ~0u << (behind + 1);
+  uint16_t settled = __builtin_popcount(older & ~node.seqWindow);
+  node.seqWindow |= older;
+  return settled;
+}
+
+void NodeTable::restartSeq(int index, uint16_t seq) {
+  NodeInfo& node = entries[index];
+  int behind = static_cast<int16_t>(node.lastSeq - seq);
+  if (node.seqWindow != 0 && behind >= 0 && behind < FRAME_ACK_WINDOW) {
+    settleBefore(index, seq + 1);
+    return;
+  }
+  node.lastSeq = seq;
+  node.seqWindow = ~0u;
+}
+
+void NodeTable::resetRadio(int index) {
+  NodeInfo& node = entries[index];
+  adrReset(node.adr);
+  node.srtt = 0;
+  node.rttvar = 0;
+}
+
+uint16_t NodeTable::ackedThrough(int index) const {
+  const NodeInfo& node = entries[index];
+  uint32_t missing = ~node.seqWindow;
+  if (missing == 0) return node.lastSeq;
+  // The oldest reading still missing; everything before it is settled
+  int oldest = 31 - __builtin_clz(missing);
+  return node.lastSeq - oldest - 1;
+}
+
+int NodeTable::leastActive() const {
+  int oldest = -1;
+  for (int i = 0; i < NODE_TABLE_CAPACITY; i++) {
+    if (!inUse[i]) continue;
+    if (oldest < 0 || static_cast<int32_t>(entries[i].lastSeen - entries[oldest].lastSeen) < 0) {
+      oldest = i;
+    }
+  }
+  return oldest;
+}
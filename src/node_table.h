@@ -0,0 +1,92 @@
+#ifndef NODE_TABLE_H
+#define NODE_TABLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "frame.h"
+#include "adr.h"
+
+#define NODE_TABLE_CAPACITY 200 // Nodes, at most 254; an index stays stable while a node is known
+#define NODE_TABLE_SLOTS 512    // Hash slots, power of two, at least twice the capacity
+
+// What the base knows about one node. Radio state is updated on every
+// reading; RTT and misses are kept by the trigger engine. lastSeq and
+// seqWindow are also the node's ack: bit i of the window is set when
+// reading lastSeq - i is held, or was given up by the node.
+struct NodeInfo {
+  uint8_t mac[6];
+  uint16_t id;        // Short id used in frames
+  uint16_t lastSeq;   // Newest reading seq
+  uint32_t seqWindow; // 0 until the first reading or join
+  int16_t rssi;       // dBm of the last reading, 0 when not reported
+  int8_t snr;         // dB, LoRa only
+  uint16_t srtt;      // Smoothed trigger round trip in ms, 0 until measured
+  uint16_t rttvar;
+  uint16_t misses;    // Polls in a row that went unanswered
+  uint32_t readings;
+  uint32_t lastSeen;  // millis() of the last reading, or when added
+  AdrState adr;       // LoRa only: data rate and TX power the node is on
+  uint8_t transport;  // Index of the base transport the node joined over
+};
+
+// Fixed-capacity node registry. Two open-addressed hash indexes, one by MAC
+// and one by short id, both point into the entry array, so the per-packet
+// lookups are O(1) and nothing is allocated. Deletion shifts probe chains
+// back instead of leaving tombstones.
+class NodeTable {
+public:
+  NodeTable() { clear(); }
+
+  // Returns the index of the new entry, or of the existing one when mac is
+  // known. -1 when the table is full or another MAC has the same id.
+  int add(const uint8_t* mac, uint16_t id, uint32_t now);
+  bool remove(int index);
+  void clear();
+
+  int find(const uint8_t* mac) const;
+  int findId(uint16_t id) const;
+
+  // Records a reading from the node at index
+  void seen(int index, int16_t rssi, int8_t snr, uint32_t now);
+  // Dedup window of FRAME_ACK_WINDOW seqs: true for a reading seq not held
+  // yet, which it then is. Seqs older than the window count as held.
+  bool accept(int index, uint16_t seq);
+  // The node resends everything unacked, so a seq below the oldest one in
+  // its frame is one it gave up on. Marks those as settled and returns how
+  // many there were.
+  uint16_t settleBefore(int index, uint16_t seq);
+  // A join says the node needs nothing up to seq acked. A node that kept
+  // counting keeps its window, so what it resends after the join is still
+  // recognized; anything else starts a new window at seq.
+  void restartSeq(int index, uint16_t seq);
+  // A node that (re)joins listens on the home data rate again, and its
+  // round trip there is not measured yet
+  void resetRadio(int index);
+  // Newest seq with every reading up to it held or given up
+  uint16_t ackedThrough(int index) const;
+  // The node that has been quiet the longest, the one to evict; -1 if empty
+  int leastActive() const;
+
+  bool used(int index) const { return inUse[index]; }
+  NodeInfo& operator[](int index) { return entries[index]; }
+  const NodeInfo& operator[](int index) const { return entries[index]; }
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  bool full() const { return count >= NODE_TABLE_CAPACITY; }
+
+private:
+  static const uint8_t EMPTY = 0xFF;
+
+  size_t macSlot(const uint8_t* mac) const;
+  size_t idSlot(uint16_t id) const;
+  size_t homeSlot(const uint8_t* slots, uint8_t index) const;
+  void unlink(uint8_t* slots, size_t slot);
+
+  NodeInfo entries[NODE_TABLE_CAPACITY];
+  bool inUse[NODE_TABLE_CAPACITY];
+  uint8_t byMac[NODE_TABLE_SLOTS];
+  uint8_t byId[NODE_TABLE_SLOTS];
+  size_t count;
+};
+
+#endif
@@ -0,0 +1,79 @@
+#include "peer_cache.h"
+#include "hal_espnow.h"
+#include <string.h>
+
+void PeerCache::begin(uint8_t ch) {
+  channel = ch;
+  for (auto& entry : entries) {
+    if (entry.used) esp_now_del_peer(entry.mac);
+    entry.used = false;
+  }
+  count = 0;
+}
+
+int PeerCache::find(const uint8_t* mac) const {
+  for (int i = 0; i < PEER_CACHE_SIZE; i++) {
+    if (entries[i].used && memcmp(entries[i].mac, mac, 6) == 0) return i;
+  }
+  return -1;
+}
+
+// Least recently used entry that is past its hold time, -1 if none
+int PeerCache::victim(uint32_t now) const {
+  int oldest = -1;
+  for (int i = 0; i < PEER_CACHE_SIZE; i++) {
+    if (now - entries[i].lastUse < PEER_CACHE_HOLD_MS) continue;
+    if (oldest < 0 || static_cast<int32_t>(entries[i].lastUse - entries[oldest].lastUse) < 0) {
+      oldest = i;
+    }
+  }
+  return oldest;
+}
+
+bool PeerCache::acquire(const uint8_t* mac, uint32_t now) {
+  int index = find(mac);
+  if (index >= 0) {
+    entries[index].lastUse = now;
+    stats.hits++;
+    return true;
+  }
+
+  stats.misses++;
+  if (count < PEER_CACHE_SIZE) {
+    for (index = 0; entries[index].used; index++) {}
+  } else {
+    index = victim(now);
+    if (index < 0) {
+      stats.failures++;
+      return false;
+    }
+    esp_now_del_peer(entries[index].mac);
+    entries[index].used = false;
+    count--;
+    stats.evictions++;
+  }
+
+  esp_now_peer_info_t peerInfo = {};
+  memcpy(peerInfo.peer_addr, mac, 6);
+  peerInfo.channel = channel;
+  peerInfo.encrypt = false;
+  // The peer may already exist if it was added outside the cache
+  if (!esp_now_is_peer_exist(mac) && esp_now_add_peer(&peerInfo) != ESP_OK) {
+    stats.failures++;
+    return false;
+  }
+
+  memcpy(entries[index].mac, mac, 6);
+  entries[index].used = true;
+  entries[index].lastUse = now;
+  count++;
+  return true;
+}
+
+void PeerCache::drop(const uint8_t* mac) {
+  int index = find(mac);
+  if (index < 0) return;
+  esp_now_del_peer(mac);
+  entries[index].used = false;
+  count--;
+}
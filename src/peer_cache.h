@@ -0,0 +1,52 @@
+#ifndef PEER_CACHE_H
+#define PEER_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// ESP-NOW holds at most 20 unencrypted peers, one of them the broadcast
+// address. The rest is left free for peers added outside the cache.
+#define PEER_CACHE_SIZE 16
+// A peer is not removed this soon after a send to it, so the driver is
+// done with the frame (and its MAC-level retries) before the peer goes.
+#define PEER_CACHE_HOLD_MS 20
+
+// Least recently used set of ESP-NOW unicast peers. Nodes are only known
+// to the node table; a peer is added just before a unicast send to it, and
+// the least recently used one is removed only when room is needed, so a
+// burst of retries to the same few nodes costs no peer churn at all.
+class PeerCache {
+public:
+  struct Stats {
+    uint32_t hits;
+    uint32_t misses;    // Peer had to be added
+    uint32_t evictions;
+    uint32_t failures;  // No room (every peer held) or esp_now_add_peer failed
+  };
+
+  void begin(uint8_t channel);
+  // Makes mac a registered peer; false when that is not possible right now
+  bool acquire(const uint8_t* mac, uint32_t now);
+  // Removes mac if cached, for nodes that leave
+  void drop(const uint8_t* mac);
+
+  size_t size() const { return count; }
+  const Stats& getStats() const { return stats; }
+
+private:
+  struct Entry {
+    uint8_t mac[6];
+    bool used;
+    uint32_t lastUse;
+  };
+
+  int find(const uint8_t* mac) const;
+  int victim(uint32_t now) const;
+
+  Entry entries[PEER_CACHE_SIZE] = {};
+  size_t count = 0;
+  uint8_t channel = 0;
+  Stats stats = {};
+};
+
+#endif
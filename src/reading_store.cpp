@@ -0,0 +1,57 @@
+#include "reading_store.h"
+#include <string.h>
+
+bool ReadingStore::add(const Reading& reading) {
+  if (full()) return false;
+  records[count++] = reading;
+  return true;
+}
+
+static char* appendLiteral(char* p, const char* s, size_t n) {
+  memcpy(p, s, n);
+  return p + n;
+}
+
+static char* appendInt(char* p, int32_t v) {
+  char digits[11];
+  int n = 0;
+  uint32_t u = v < 0 ? 0u - static_cast<uint32_t>(v) : static_cast<uint32_t>(v);
+  do {
+    digits[n++] = '0' + u % 10;
+    u /= 10;
+  } while (u);
+  if (v < 0) *p++ = '-';
+  while (n) *p++ = digits[--n];
+  return p;
+}
+
+static char* appendMac(char* p, const uint8_t* mac) {
+  static const char hex[] = "0123456789ABCDEF";
+  for (int i = 0; i < 6; i++) {
+    *p++ = hex[mac[i] >> 4];
+    *p++ = hex[mac[i] & 0x0F];
+  }
+  return p;
+}
+
+size_t ReadingStore::writeJson(char* out, size_t outLen) const {
+  // Every entry fits in READING_JSON_MAX, so one bound check up front
+  // replaces per-field checks.
+  if (out == nullptr || outLen < count * READING_JSON_MAX + 3) return 0;
+
+  char* p = out;
+  *p++ = '[';
+  for (size_t i = 0; i < count; i++) {
+    if (i) *p++ = ',';
+    p = appendLiteral(p, "{\"value\":", 9);
+    p = appendInt(p, records[i].value);
+    p = appendLiteral(p, ",\"deviceId\":\"", 13);
+    p = appendMac(p, records[i].mac);
+    p = appendLiteral(p, "\",\"seq\":", 8);
+    p = appendInt(p, records[i].seq);
+    *p++ = '}';
+  }
+  *p++ = ']';
+  *p = '\0';
+  return p - out;
+}
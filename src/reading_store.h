@@ -0,0 +1,59 @@
+#ifndef READING_STORE_H
+#define READING_STORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define READING_STORE_CAPACITY 128
+// Worst case for one {"value":-2147483648,"deviceId":"AABBCCDDEEFF","seq":65535}, entry
+#define READING_JSON_MAX 60
+#define READING_JSON_BODY_SIZE (READING_STORE_CAPACITY * READING_JSON_MAX + 3)
+
+// One decoded reading as the base keeps it between the radio and the uplink.
+struct Reading {
+  uint8_t mac[6];
+  uint16_t nodeId;
+  uint16_t seq;
+  int16_t rssi;         // dBm, 0 when the radio does not report it
+  int8_t snr;           // dB, LoRa only
+  uint8_t span;         // Seqs back to the oldest reading resent with this one, fits in padding
+  uint16_t replyTo;     // Poll seq the reading answers, 0 for a resent one
+  int32_t value;
+  uint32_t receivedAt;  // millis() at reception, less the age of a resent reading
+  uint32_t epoch;       // Unix time at ingestion, 0 before NTP sync
+};
+
+// Preallocated batch of readings waiting for upload.
+class ReadingStore {
+public:
+  bool add(const Reading& reading); // false when full
+  void clear() { count = 0; }
+
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  bool full() const { return count >= READING_STORE_CAPACITY; }
+  const Reading& operator[](size_t i) const { return records[i]; }
+
+  // Drops the readings pred(reading) holds for, keeping the order of the
+  // rest. Returns how many were dropped.
+  template <class Pred>
+  size_t removeIf(Pred pred) {
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++) {
+      if (!pred(records[i])) records[kept++] = records[i];
+    }
+    size_t removed = count - kept;
+    count = kept;
+    return removed;
+  }
+
+  // Writes the upload body, [{"value":..,"deviceId":"..","seq":..},...], straight
+  // from the records in one pass. Returns the length, or 0 if out is too small.
+  size_t writeJson(char* out, size_t outLen) const;
+
+private:
+  Reading records[READING_STORE_CAPACITY];
+  size_t count = 0;
+};
+
+#endif
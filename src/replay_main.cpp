@@ -0,0 +1,239 @@
+// Replays a capture recorded by a base built with -DCAPTURE through the
+// base sources on a host: frames go into the radio receive callbacks at
+// their recorded times, or back to back with --fast, and the uplink gets
+// the recorded upload outcomes in order.
+//
+//   .pio/build/replay/program capture.bin.old capture.bin [--fast] [--quiet]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "hal.h"
+#include "log.h"
+#include "capture.h"
+#include "base_espnow.h"
+#include "base_lora.h"
+
+#define REPLAY_DRAIN_MS 3000 // After the last frame, for the last batch to seal and upload
+
+class ReplayBase : public Base {
+public:
+  using Base::admitNode;
+};
+
+// The nodes in a capture answered the original base, so this one keeps
+// quiet instead of polling them
+template <class Radio>
+class ReplayTransport : public Radio {
+public:
+  size_t queued() const { return this->messageQueue.size(); }
+  uint32_t queueDrops() const { return this->messageQueue.dropped(); }
+
+protected:
+  bool sendTrigger(uint16_t nodeId, uint16_t seq) override { return true; }
+  void sendBroadcast(const uint8_t* frame, size_t len) override {}
+};
+
+// Answers batch uploads with the recorded outcomes, in order. Once they run
+// out, or for anything not captured such as metrics, the server is fine.
+class ReplayBackend : public HalBackend {
+public:
+  struct Outcome {
+    int status;
+    uint32_t latencyMs;
+  };
+
+  bool fast = false;
+  std::deque<Outcome> outcomes;
+
+  void espNowSend(const uint8_t* dest, const uint8_t* data, size_t len) override {}
+  void loraSend(const uint8_t* data, size_t len, uint32_t airtimeUs, int spreadingFactor,
+                long bandwidth) override {}
+
+  // A negative status is an HTTPClient error, replayed as a failed connect
+  bool httpConnect(const char* host, uint16_t port) override {
+    std::lock_guard<std::mutex> guard(lock);
+    if (outcomes.empty() || outcomes.front().status >= 0) return true;
+    wait(outcomes.front().latencyMs);
+    outcomes.pop_front();
+    return false;
+  }
+
+  int httpPost(const char* host, const char* path, const char* contentType,
+               const char* idempotencyKey, const uint8_t* body, size_t len,
+               std::string& response) override {
+    std::lock_guard<std::mutex> guard(lock);
+    response = "{}";
+    if (strstr(path, "metrics") != nullptr || outcomes.empty()) return HTTP_CODE_OK;
+    Outcome outcome = outcomes.front();
+    outcomes.pop_front();
+    wait(outcome.latencyMs);
+    return outcome.status;
+  }
+
+private:
+  void wait(uint32_t ms) {
+    if (!fast) halNativeSleepMicros(ms * 1000ull);
+  }
+
+  std::mutex lock;
+};
+
+// Source MAC of LoRa frames in a capture of both radios
+static const uint8_t loraMac[6] = {};
+
+static ReplayBase base;
+static ReplayTransport<EspNowTransport> espNow;
+static ReplayTransport<LoRaTransport> lora;
+static ReplayBackend backend;
+
+struct CaptureTotals {
+  uint32_t frames = 0;
+  uint32_t nodes = 0;
+  uint32_t uploads = 0;
+  uint32_t uploadFailures = 0;
+  uint32_t readingsUploaded = 0;
+};
+
+// Reads the files as one timeline, each continuing where the previous ended
+static bool loadCapture(const std::vector<const char*>& paths, std::vector<CaptureRecord>& records,
+                        CaptureRadio& radio, uint8_t* baseMac, CaptureTotals& totals) {
+  int64_t offset = 0;
+  for (size_t f = 0; f < paths.size(); f++) {
+    CaptureReader reader;
+    if (!reader.open(paths[f])) {
+      fprintf(stderr, "%s: not a capture file\n", paths[f]);
+      return false;
+    }
+    if (f == 0) {
+      radio = reader.radio();
+      memcpy(baseMac, reader.baseMac(), 6);
+    }
+
+    CaptureRecord record;
+    int64_t last = 0;
+    while (reader.next(record)) {
+      record.at += offset;
+      last = record.at;
+      if (record.type == CAPTURE_UPLOAD) {
+        if (record.status == 0) continue; // WiFi was down, nothing was posted
+        totals.uploads++;
+        if (record.status == HTTP_CODE_OK || record.status == HTTP_CODE_CREATED) {
+          totals.readingsUploaded += record.readings;
+        } else {
+          totals.uploadFailures++;
+        }
+        backend.outcomes.push_back({record.status, record.latencyMs});
+        continue;
+      }
+      if (record.type == CAPTURE_FRAME) totals.frames++;
+      if (record.type == CAPTURE_NODE) totals.nodes++;
+      records.push_back(record);
+    }
+    offset = last;
+  }
+  return true;
+}
+
+static void usage() {
+  fprintf(stderr, "usage: program FILE... [--fast] [--quiet]\n"
+                  "  FILE    capture files, oldest first (capture.bin.old capture.bin)\n");
+  exit(2);
+}
+
+int main(int argc, char** argv) {
+  std::vector<const char*> paths;
+  bool quiet = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--fast") == 0) backend.fast = true;
+    else if (strcmp(argv[i], "--quiet") == 0) quiet = true;
+    else if (argv[i][0] == '-') usage();
+    else paths.push_back(argv[i]);
+  }
+  if (paths.empty()) usage();
+
+  std::vector<CaptureRecord> records;
+  CaptureRadio radio;
+  HalNativeConfig hal;
+  CaptureTotals captured;
+  if (!loadCapture(paths, records, radio, hal.mac, captured)) return 1;
+
+#ifdef BATCH_LOG_PATH
+  remove(BATCH_LOG_PATH);
+#endif
+  if (backend.fast) hal.wifiConnectMs = 0;
+  halNativeBegin(&backend, hal);
+
+  if (radio != CAPTURE_LORA) base.addTransport(espNow);
+  if (radio != CAPTURE_ESPNOW) base.addTransport(lora);
+  logBegin();
+  base.begin();
+  // Let WiFi come up as it did before the capture started
+  while (WiFi.status() != WL_CONNECTED) base.update();
+
+  uint64_t start = halNativeMicros64();
+  int64_t first = records.empty() ? 0 : records.front().at;
+  for (const CaptureRecord& record : records) {
+    if (backend.fast) {
+      // Backpressure instead of time: keep the queue from overflowing
+      while (espNow.queued() >= MAX_QUEUE_SIZE / 2 || lora.queued() >= MAX_QUEUE_SIZE / 2) {
+        base.update();
+      }
+    } else {
+      while (static_cast<int64_t>(halNativeMicros64() - start) < record.at - first) {
+        base.update();
+        if (!quiet) logDrain();
+        std::this_thread::sleep_for(std::chrono::microseconds(20));
+      }
+    }
+
+    if (record.type == CAPTURE_NODE) {
+      base.admitNode(record.mac, record.id);
+    } else if (radio == CAPTURE_LORA ||
+               (radio == CAPTURE_BOTH && memcmp(record.mac, loraMac, 6) == 0)) {
+      halNativeLoRaReceive(record.data, record.len, record.rssi, record.snr);
+      // Back to back: the radio task reads the packet into its FIFO before
+      // the next one lands, and the update below decodes it
+      while (backend.fast && !halNativeLoRaReady()) std::this_thread::yield();
+    } else {
+      halNativeEspNowReceive(record.mac, record.data, record.len);
+    }
+    if (backend.fast) base.update();
+    if (!quiet) logDrain();
+  }
+  double replaySeconds = (halNativeMicros64() - start) / 1e6;
+
+  uint32_t drainUntil = millis() + REPLAY_DRAIN_MS;
+  while (static_cast<int32_t>(millis() - drainUntil) < 0) {
+    base.update();
+    if (!quiet) logDrain();
+    std::this_thread::sleep_for(std::chrono::microseconds(20));
+  }
+  if (!quiet) logDrain();
+
+  MetricsSnapshot snap;
+  Base::getMetrics().snapshot(snap, millis());
+  const Base::UplinkStats& uplink = Base::getUplinkStats();
+  double capturedSeconds = records.empty() ? 0 : (records.back().at - first) / 1e6;
+
+  static const char* radioNames[] = {"espnow", "lora", "espnow and lora"};
+  printf("capture       %s, %u frames, %u node records, %.1f s\n", radioNames[radio],
+         captured.frames, captured.nodes, capturedSeconds);
+  printf("  captured    %u uploads, %u failed, %u readings uploaded\n", captured.uploads,
+         captured.uploadFailures, captured.readingsUploaded);
+  printf("replay        %s, %.3f s, %.0f frames/s into the receive callback\n",
+         backend.fast ? "fast" : "original speed", replaySeconds, captured.frames / replaySeconds);
+  printf("  frames      %u received, %u invalid, %u queue drops\n",
+         snap.counters[METRIC_FRAMES_RECEIVED], snap.counters[METRIC_FRAMES_INVALID],
+         espNow.queueDrops() + lora.queueDrops());
+  printf("  uploads     %u batches, %u failures, %u readings\n", uplink.batches, uplink.failures,
+         uplink.readings);
+  fflush(stdout);
+  // Task threads are still running; skip the static destructors
+  _Exit(0);
+}
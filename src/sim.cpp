@@ -0,0 +1,883 @@
+#include "sim.h"
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <string>
+#include "batch_codec.h"
+#include "reading_store.h"
+
+#define SIM_LORA_RX_HISTORY 256 // LoRa frames remembered for collision checks
+#define SIM_JOIN_RETRY_MS 1000  // Plus up to as much again at random
+#define SIM_LORA_JOIN_DOUBLINGS 6 // As NODE_JOIN_MAX_DOUBLINGS
+#define SIM_MAX_UNLISTED_BEACONS 5
+#define SIM_RESEND_SLOTS (FRAME_MAX_RESENT + 1) // As NODE_RESEND_SLOTS
+#define SIM_LORA_MAX_RESENT 2                   // As NODE_LORA_MAX_RESENT
+#define SIM_BASE_TIMEOUT_MS 15000               // As NODE_BASE_TIMEOUT
+#define SIM_LORA_MIN_DISTANCE_M 20
+#define SIM_PATH_LOSS_1M 32.0   // dB at 1 m, free space at 915 MHz
+#define SIM_PATH_LOSS_EXP 3.5   // Suburban, antennas near the ground
+#define SIM_SHADOWING_DB 4.0    // Per node, fixed: walls, terrain
+#define SIM_FADING_DB 2.0       // Per frame
+#define SIM_NOISE_FLOOR -117.0  // dBm in 125 kHz, 6 dB noise figure
+#define SIM_SNR_MAX 10          // SX127x reports no better than this
+#define SIM_INTERFERER_BYTES 32
+
+const uint8_t Simulator::baseMac[6] = {0x24, 0x0A, 0xC4, 0x00, 0x00, 0x01};
+static const uint8_t broadcastMac[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+static uint64_t macKey(const uint8_t* mac) {
+  uint64_t key = 0;
+  for (int i = 0; i < 6; i++) key = key << 8 | mac[i];
+  return key;
+}
+
+// Data rate index of a radio setting, -1 when it is none of them
+static int rateOf(int spreadingFactor, long bandwidth) {
+  for (int rate = 0; rate < ADR_RATE_COUNT; rate++) {
+    if (LORA_DATA_RATES[rate].spreadingFactor == spreadingFactor &&
+        LORA_DATA_RATES[rate].bandwidth == bandwidth) {
+      return rate;
+    }
+  }
+  return -1;
+}
+
+Simulator::Simulator(const SimConfig& config)
+  : cfg(config), nodes(config.nodes), loraRx(SIM_LORA_RX_HISTORY), rng(config.seed),
+    running(false), nodesActive(false) {
+  std::uniform_real_distribution<double> area(0, 1);
+  std::normal_distribution<double> shadowing(0, SIM_SHADOWING_DB);
+  for (int i = 0; i < cfg.nodes; i++) {
+    Node& node = nodes[i];
+    node.radio = cfg.radio == SIM_BOTH ? (i % 2 ? SIM_LORA : SIM_ESPNOW) : cfg.radio;
+    const uint8_t mac[6] = {0x02, 0x53, 0x49, 0x4D, static_cast<uint8_t>(i >> 8),
+                            static_cast<uint8_t>(i)};
+    memcpy(node.mac, mac, 6);
+    node.id = 0;
+    node.joined = false;
+    node.seq = 0;
+    node.replyTo = 0;
+    node.replyToken = 0;
+    node.unlistedBeacons = 0;
+    double distance = std::max<double>(SIM_LORA_MIN_DISTANCE_M, cfg.loraRangeM * sqrt(area(rng)));
+    node.pathLoss = SIM_PATH_LOSS_1M + 10 * SIM_PATH_LOSS_EXP * log10(distance) + shadowing(rng);
+    node.rate = LORA_HOME_RATE;
+    node.txPower = ADR_MAX_TX_POWER;
+    node.radioOrder = 0;
+    node.heardAt = 0;
+    node.joinedAt = 0;
+    node.joins = 0;
+    node.joinAttempts = 0;
+    nodeByMac[macKey(node.mac)] = i;
+  }
+}
+
+Simulator::~Simulator() {
+  stop();
+}
+
+void Simulator::start() {
+  std::lock_guard<std::mutex> guard(lock);
+  running = true;
+  nodesActive = true;
+  uint64_t now = halNativeMicros64();
+  std::uniform_int_distribution<uint32_t> boot(0, cfg.joinSpreadMs * 1000);
+  for (int i = 0; i < cfg.nodes; i++) {
+    Event event = makeEvent(now + boot(rng), NODE_JOIN, i, nullptr, 0);
+    push(event);
+  }
+  for (int i = 0; hasLoRa() && i < cfg.interferers; i++) {
+    Event event = makeEvent(now + boot(rng), INTERFERE, -1, nullptr, 0);
+    push(event);
+  }
+  worker = std::thread(&Simulator::run, this);
+}
+
+void Simulator::stopNodes() {
+  std::lock_guard<std::mutex> guard(lock);
+  nodesActive = false;
+  // Slots still open now would go unanswered for the stop, not the sweep
+  uint64_t now = halNativeMicros64();
+  for (auto it = slotEnds.begin(); it != slotEnds.end();) {
+    if (it->second <= now) {
+      ++it;
+      continue;
+    }
+    slots.listed--;
+    it = slotEnds.erase(it);
+  }
+}
+
+void Simulator::stop() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    running = false;
+  }
+  wake.notify_all();
+  if (worker.joinable()) worker.join();
+}
+
+// ---- Event loop
+
+// Handles due events with the lock held. The base callbacks it calls
+// only queue, they never send.
+void Simulator::run() {
+  std::unique_lock<std::mutex> guard(lock);
+  while (running) {
+    if (events.empty()) {
+      wake.wait(guard);
+      continue;
+    }
+    uint64_t now = halNativeMicros64();
+    if (events.top().at > now) {
+      double realUs = (events.top().at - now) / halNativeSpeed();
+      wake.wait_for(guard, std::chrono::duration<double, std::micro>(realUs));
+      continue;
+    }
+    Event event = events.top();
+    events.pop();
+    handle(event);
+  }
+}
+
+void Simulator::push(Event& event) {
+  event.order = nextOrder++;
+  events.push(event);
+  wake.notify_one();
+}
+
+Simulator::Event Simulator::makeEvent(uint64_t at, EventType type, int node,
+                                      const uint8_t* data, size_t len) {
+  Event event;
+  event.at = at;
+  event.order = 0;
+  event.type = type;
+  event.delivered = true;
+  event.node = node;
+  event.token = 0;
+  event.rxSlot = -1;
+  event.rate = 0;
+  event.rssi = 0;
+  event.snr = 0;
+  event.txPower = 0;
+  event.attempt = 0;
+  event.airStart = 0;
+  event.airEnd = 0;
+  event.len = static_cast<uint8_t>(std::min(len, sizeof(event.data)));
+  if (data != nullptr) memcpy(event.data, data, event.len);
+  return event;
+}
+
+uint64_t Simulator::linkDelay(size_t len) {
+  std::uniform_int_distribution<uint32_t> jitter(0, cfg.jitterUs);
+  return cfg.latencyUs + jitter(rng);
+}
+
+bool Simulator::lost() {
+  std::uniform_real_distribution<double> dice(0, 1);
+  if (dice(rng) >= cfg.loss) return false;
+  framesLost++;
+  return true;
+}
+
+double Simulator::linkSnr(const Node& node, int txPower, double* rssi) {
+  std::normal_distribution<double> fading(0, SIM_FADING_DB);
+  double power = txPower - node.pathLoss + fading(rng);
+  if (rssi != nullptr) *rssi = power;
+  return power - SIM_NOISE_FLOOR;
+}
+
+bool Simulator::unicast(uint32_t& attempts) {
+  for (attempts = 1; attempts <= 1u + cfg.espNowRetries; attempts++) {
+    if (!lost()) return true;
+  }
+  attempts = 1 + cfg.espNowRetries;
+  return false;
+}
+
+void Simulator::handle(Event& event) {
+  uint64_t now = event.at;
+  Node& node = nodes[event.node];
+
+  switch (event.type) {
+    case TO_NODE:
+      if (!nodesActive) break;
+      if (node.radio == SIM_LORA) {
+        bool interfered = false;
+        for (const LoRaRx& other : loraRx) {
+          if (other.foreign && other.rate == event.rate && other.end > event.airStart &&
+              other.start < event.airEnd) {
+            interfered = true;
+          }
+        }
+        if (interfered) {
+          loraInterfered++;
+          break;
+        }
+      }
+      nodeReceive(node, event);
+      break;
+
+    case TO_BASE:
+      framesToBase++;
+      if (node.radio == SIM_ESPNOW) {
+        noteSlotReply(event);
+        halNativeEspNowReceive(node.mac, event.data, event.len);
+      } else if (event.rxSlot >= 0 && loraRx[event.rxSlot].collided) {
+        loraCollisions++;
+      } else if (!halNativeLoRaTunedTo(LORA_DATA_RATES[event.rate].spreadingFactor,
+                                       LORA_DATA_RATES[event.rate].bandwidth)) {
+        loraOffRate++;
+      } else {
+        noteSlotReply(event);
+        halNativeLoRaReceive(event.data, event.len, event.rssi, event.snr);
+      }
+      break;
+
+    case SEND_STATUS:
+      halNativeEspNowSent(event.node >= 0 ? node.mac : broadcastMac, event.delivered);
+      break;
+
+    case NODE_JOIN:
+      if (nodesActive && !node.joined) {
+        sendJoin(event.node, now);
+        uint32_t doublings = node.radio == SIM_LORA
+                               ? std::min<uint32_t>(node.joinAttempts++, SIM_LORA_JOIN_DOUBLINGS)
+                               : 0;
+        std::uniform_int_distribution<uint32_t> spread(0, SIM_JOIN_RETRY_MS * 1000 << doublings);
+        Event retry = makeEvent(now + SIM_JOIN_RETRY_MS * 1000 + spread(rng), NODE_JOIN,
+                                event.node, nullptr, 0);
+        push(retry);
+      }
+      break;
+
+    case NODE_REPLY:
+      if (nodesActive && node.joined && event.token == node.replyToken) {
+        sendReading(event.node, now);
+      }
+      break;
+
+    case NODE_SEND:
+      loraTransmit(event);
+      break;
+
+    case INTERFERE:
+      if (nodesActive) interfere(now);
+      break;
+
+    case NODE_TIMEOUT:
+      if (!nodesActive || !node.joined) break;
+      if (now - node.heardAt >= SIM_BASE_TIMEOUT_MS * 1000ull) {
+        forgetBase(event.node, now);
+      } else {
+        Event check = makeEvent(node.heardAt + SIM_BASE_TIMEOUT_MS * 1000ull, NODE_TIMEOUT,
+                                event.node, nullptr, 0);
+        push(check);
+      }
+      break;
+  }
+}
+
+// Mirrors LoRaNode::update() on baseLost(): back to the home rate, join again
+void Simulator::forgetBase(int index, uint64_t now) {
+  Node& node = nodes[index];
+  node.joined = false;
+  node.rate = LORA_HOME_RATE;
+  node.txPower = ADR_MAX_TX_POWER;
+  node.radioOrder = 0;
+  Event join = makeEvent(now, NODE_JOIN, index, nullptr, 0);
+  push(join);
+}
+
+// ---- Nodes
+
+// Mirrors Node::handleFrame: a later poll replaces a reply not sent yet
+void Simulator::nodeReceive(Node& node, const Event& event) {
+  framesToNodes++;
+  FrameReader frame;
+  if (!frame.parse(event.data, event.len)) return;
+  uint8_t type = frame.header().type;
+  int index = static_cast<int>(&node - nodes.data());
+
+  if (type == FRAME_JOIN_ACCEPT) {
+    uint8_t target[6];
+    if (node.joined || !findJoinMac(frame, target) || memcmp(target, node.mac, 6) != 0) return;
+    node.id = frame.header().nodeId;
+    node.joined = true;
+    node.joinedAt = event.at;
+    node.joins++;
+    node.joinAttempts = 0;
+    node.unlistedBeacons = 0;
+    node.heardAt = event.at;
+    if (node.radio == SIM_LORA) {
+      Event check = makeEvent(event.at + SIM_BASE_TIMEOUT_MS * 1000ull, NODE_TIMEOUT, index,
+                              nullptr, 0);
+      push(check);
+    }
+    return;
+  }
+  if (!node.joined) return;
+  node.heardAt = event.at;
+
+  uint32_t replyDelayMs;
+  uint64_t replyAt;
+  FrameAck ack;
+  int ackByte;
+  if (type == FRAME_TRIGGER && frame.header().nodeId == node.id) {
+    if (findAck(frame, ack)) applyAck(node, ack);
+    uint8_t radio;
+    if (findRadio(frame, radio)) node.radioOrder = radio;
+    replyAt = event.at + cfg.nodeProcessingUs;
+  } else if (findBeaconSlot(frame, node.id, replyDelayMs, &ackByte)) {
+    // A beacon or a group trigger listing us
+    if (type == FRAME_BEACON) node.unlistedBeacons = 0;
+    if (ackByte >= 0) {
+      uint16_t latest = node.seq - 1;
+      ack.seq = static_cast<uint16_t>(latest - static_cast<uint8_t>(latest - ackByte));
+      ack.window = ~0u;
+      applyAck(node, ack);
+    }
+    replyAt = event.at + replyDelayMs * 1000ull;
+  } else {
+    if (type == FRAME_BEACON && ++node.unlistedBeacons >= SIM_MAX_UNLISTED_BEACONS) {
+      // The base forgot us
+      forgetBase(index, event.at);
+    }
+    return;
+  }
+
+  node.replyTo = frame.header().seq;
+  Event reply = makeEvent(replyAt, NODE_REPLY, index, nullptr, 0);
+  reply.token = ++node.replyToken;
+  push(reply);
+}
+
+// Mirrors Node::applyAck
+void Simulator::applyAck(Node& node, const FrameAck& ack) {
+  size_t kept = 0;
+  for (const Unacked& u : node.unacked) {
+    int16_t behind = static_cast<int16_t>(ack.seq - u.seq);
+    bool held = behind >= 0 && (behind >= FRAME_ACK_WINDOW || (ack.window & 1u << behind));
+    if (!held) node.unacked[kept++] = u;
+  }
+  node.unacked.resize(kept);
+}
+
+void Simulator::sendJoin(int index, uint64_t now) {
+  Node& node = nodes[index];
+  uint16_t ackedSeq = (node.unacked.empty() ? node.seq : node.unacked.front().seq) - 1;
+  uint8_t frame[FRAME_MAX_SIZE];
+  size_t len = encodeJoin(frame, sizeof(frame), node.id, node.mac, ackedSeq);
+  nodeSend(index, frame, len, now);
+}
+
+// Mirrors Node::buildReading
+void Simulator::sendReading(int index, uint64_t now) {
+  Node& node = nodes[index];
+  if (node.unacked.size() == SIM_RESEND_SLOTS) {
+    node.unacked.erase(node.unacked.begin());
+    readingsAbandoned++;
+  }
+
+  ReadingFrame reading;
+  reading.nodeId = node.id;
+  reading.seq = node.seq++;
+  reading.replyTo = node.replyTo;
+  reading.value = static_cast<int32_t>(node.sentAt.size());
+  reading.radio = node.radioOrder;
+  node.radioOrder = 0;
+  node.sentAt.push_back(now);
+  node.delivered.push_back(false);
+  readingsSent++;
+
+  size_t maxResent = node.radio == SIM_LORA ? SIM_LORA_MAX_RESENT : FRAME_MAX_RESENT;
+  reading.resentCount = 0;
+  for (size_t i = 0; i < node.unacked.size() && i < maxResent; i++) {
+    ReadingFrame::Resent& r = reading.resent[reading.resentCount++];
+    r.seq = node.unacked[i].seq;
+    r.value = node.unacked[i].value;
+    r.ageMs = static_cast<uint32_t>((now - node.unacked[i].takenAt) / 1000);
+  }
+  readingsResent += reading.resentCount;
+  node.unacked.push_back({reading.seq, reading.value, now});
+
+  uint8_t frame[FRAME_MAX_SIZE];
+  size_t len = encodeReading(frame, sizeof(frame), reading);
+  nodeSend(index, frame, len, now);
+  // Mirrors LoRaNode::setRadio()
+  if (reading.radio != 0 && adrRadioValid(reading.radio)) {
+    node.rate = adrRadioRate(reading.radio);
+    node.txPower = adrRadioPower(reading.radio);
+  }
+}
+
+// Readings go unicast to the base on ESP-NOW, with MAC retries; joins are
+// broadcasts. On LoRa every frame is a broadcast, it needs the SNR its
+// data rate does, and frames on one rate that overlap at the base are
+// both lost.
+void Simulator::nodeSend(int index, const uint8_t* frame, size_t len, uint64_t now) {
+  Event event = makeEvent(now, TO_BASE, index, frame, len);
+
+  if (nodes[index].radio == SIM_ESPNOW) {
+    bool broadcast = frame[0] == (FRAME_VERSION << 4 | FRAME_JOIN);
+    uint32_t attempts = 1;
+    if (broadcast ? lost() : !unicast(attempts)) return;
+    event.at = now + attempts * linkDelay(len);
+    push(event);
+    return;
+  }
+
+  // The setting it was sent with, even if the node switches before the
+  // channel clears
+  Event send = makeEvent(now, NODE_SEND, index, frame, len);
+  send.rate = nodes[index].rate;
+  send.txPower = nodes[index].txPower;
+  loraTransmit(send);
+}
+
+// Mirrors LoRaRadio::send(): CAD, then a random backoff in a window that
+// doubles while the channel is busy
+void Simulator::loraTransmit(Event& send) {
+  uint64_t now = send.at;
+  const LoRaDataRate& rate = LORA_DATA_RATES[send.rate];
+  if (send.attempt < LORA_LBT_ATTEMPTS) {
+    uint64_t symbolUs = (1ULL << rate.spreadingFactor) * 1000000 / rate.bandwidth;
+    uint64_t cadEnd = now + LoRaRadio::listenUs(rate.spreadingFactor, rate.bandwidth);
+    if (loraBusy(send.rate, now, false)) {
+      nodeBusy++;
+      if (++send.attempt == LORA_LBT_ATTEMPTS) {
+        nodeAbandoned++;
+        return;
+      }
+      std::uniform_int_distribution<uint32_t> units(1, 1u << send.attempt);
+      send.at = cadEnd + units(rng) * LORA_LBT_BACKOFF_SYMBOLS * symbolUs;
+      push(send);
+      return;
+    }
+    nodeSentOnAttempt[send.attempt]++;
+    now = cadEnd;
+  }
+
+  Node& node = nodes[send.node];
+  uint32_t airtime = adrAirtimeUs(send.rate, send.len);
+  loraNodeAirUs += airtime;
+  uint64_t end = now + airtime;
+  double rssi;
+  double snr = linkSnr(node, send.txPower, &rssi);
+  if (snr * 10 < rate.snrFloor) {
+    loraFaded++;
+    return;
+  }
+  if (lost()) return;
+  Event event = makeEvent(end + linkDelay(send.len), TO_BASE, send.node, send.data, send.len);
+  event.rxSlot = addLoRaRx(now, end, send.rate, false);
+  event.rate = send.rate;
+  event.rssi = static_cast<int16_t>(lround(rssi));
+  // Measured against the noise in the rate's own bandwidth
+  long reported = lround(snr - rate.noiseOffset / 10.0);
+  event.snr = static_cast<int8_t>(std::max(-30L, std::min<long>(SIM_SNR_MAX, reported)));
+  push(event);
+}
+
+int Simulator::addLoRaRx(uint64_t start, uint64_t end, uint8_t rate, bool foreign) {
+  int slot = static_cast<int>(nextRx++ % SIM_LORA_RX_HISTORY);
+  LoRaRx& rx = loraRx[slot];
+  rx.start = start;
+  rx.end = end;
+  rx.rate = rate;
+  rx.collided = false;
+  rx.foreign = foreign;
+  for (int i = 0; i < SIM_LORA_RX_HISTORY; i++) {
+    LoRaRx& other = loraRx[i];
+    if (i != slot && other.rate == rx.rate && other.end > start && other.start < end) {
+      other.collided = true;
+      rx.collided = true;
+    }
+  }
+  return slot;
+}
+
+bool Simulator::loraBusy(uint8_t rate, uint64_t now, bool base) {
+  if (!base && baseAirRate == rate && baseAirStart <= now && now < baseAirEnd) return true;
+  for (const LoRaRx& rx : loraRx) {
+    if (rx.rate == rate && rx.start <= now && now < rx.end) return true;
+  }
+  return false;
+}
+
+// A foreign frame at a random rate, then the next one after an
+// exponential gap that keeps the interferer on air cfg.interfererDuty
+void Simulator::interfere(uint64_t now) {
+  std::uniform_int_distribution<int> rates(0, ADR_RATE_COUNT - 1);
+  uint8_t rate = static_cast<uint8_t>(rates(rng));
+  uint32_t airtime = adrAirtimeUs(rate, SIM_INTERFERER_BYTES);
+  addLoRaRx(now, now + airtime, rate, true);
+  interfererFrames++;
+
+  std::exponential_distribution<double> gap(cfg.interfererDuty / airtime);
+  Event next = makeEvent(now + airtime + static_cast<uint64_t>(gap(rng)), INTERFERE, -1,
+                         nullptr, 0);
+  push(next);
+}
+
+// ---- Base side of the medium
+
+void Simulator::espNowSend(const uint8_t* dest, const uint8_t* data, size_t len) {
+  std::lock_guard<std::mutex> guard(lock);
+  uint64_t now = halNativeMicros64();
+
+  if (memcmp(dest, broadcastMac, 6) == 0) {
+    noteBeacon(data, len, now);
+    for (int i = 0; i < cfg.nodes; i++) {
+      if (nodes[i].radio != SIM_ESPNOW || lost()) continue;
+      Event event = makeEvent(now + linkDelay(len), TO_NODE, i, data, len);
+      push(event);
+    }
+    Event status = makeEvent(now + cfg.latencyUs, SEND_STATUS, -1, nullptr, 0);
+    push(status);
+    return;
+  }
+
+  auto it = nodeByMac.find(macKey(dest));
+  if (it != nodeByMac.end() && nodes[it->second].radio != SIM_ESPNOW) it = nodeByMac.end();
+  uint32_t attempts = 1 + cfg.espNowRetries;
+  bool delivered = it != nodeByMac.end() && unicast(attempts);
+  uint64_t at = now + attempts * linkDelay(len);
+  if (delivered) {
+    Event event = makeEvent(at, TO_NODE, it->second, data, len);
+    push(event);
+  }
+  if (it != nodeByMac.end()) {
+    Event status = makeEvent(at, SEND_STATUS, it->second, nullptr, 0);
+    status.delivered = delivered;
+    push(status);
+  }
+}
+
+// Only nodes on the rate the base sent on can hear it
+void Simulator::loraSend(const uint8_t* data, size_t len, uint32_t airtimeUs,
+                         int spreadingFactor, long bandwidth) {
+  std::lock_guard<std::mutex> guard(lock);
+  uint64_t start = halNativeMicros64();
+  uint64_t end = start + airtimeUs;
+  loraBaseAirUs += airtimeUs;
+  FrameReader frame;
+  if (frame.parse(data, len) && frame.header().type == FRAME_BEACON &&
+      frame.header().seq != lastBeaconSeq) {
+    lastBeaconSeq = frame.header().seq;
+    sweeps++;
+  }
+  noteBeacon(data, len, end);
+
+  int rate = rateOf(spreadingFactor, bandwidth);
+  if (rate >= 0) {
+    baseAirStart = start;
+    baseAirEnd = end;
+    baseAirRate = static_cast<uint8_t>(rate);
+  }
+  for (int i = 0; i < cfg.nodes; i++) {
+    if (rate < 0 || nodes[i].radio != SIM_LORA || nodes[i].rate != rate) continue;
+    if (linkSnr(nodes[i], ADR_MAX_TX_POWER) * 10 < LORA_DATA_RATES[rate].snrFloor) {
+      loraFaded++;
+      continue;
+    }
+    if (lost()) continue;
+    Event event = makeEvent(end + linkDelay(len), TO_NODE, i, data, len);
+    event.rate = static_cast<uint8_t>(rate);
+    event.airStart = start;
+    event.airEnd = end;
+    push(event);
+  }
+}
+
+bool Simulator::loraChannelActive(int spreadingFactor, long bandwidth) {
+  std::lock_guard<std::mutex> guard(lock);
+  int rate = rateOf(spreadingFactor, bandwidth);
+  return rate >= 0 && loraBusy(static_cast<uint8_t>(rate), halNativeMicros64(), true);
+}
+
+// ---- HTTP sink
+
+bool Simulator::httpConnect(const char* host, uint16_t port) {
+  halNativeSleepMicros(cfg.httpConnectMs * 1000ull);
+  std::lock_guard<std::mutex> guard(lock);
+  httpConnects++;
+  return true;
+}
+
+static bool parseMac(const char* hex, uint8_t* mac) {
+  for (int i = 0; i < 6; i++) {
+    char byte[3] = {hex[2 * i], hex[2 * i + 1], 0};
+    char* end;
+    mac[i] = static_cast<uint8_t>(strtoul(byte, &end, 16));
+    if (end != byte + 2) return false;
+  }
+  return true;
+}
+
+// Batch sink of an idempotent server: readings already committed under
+// the request's key are acknowledged again but not stored twice
+int Simulator::httpPost(const char* host, const char* path, const char* contentType,
+                        const char* idempotencyKey, const uint8_t* body, size_t len,
+                        std::string& response) {
+  halNativeSleepMicros(cfg.httpLatencyMs * 1000ull);
+  std::lock_guard<std::mutex> guard(lock);
+  uint64_t now = halNativeMicros64();
+
+  std::uniform_real_distribution<double> dice(0, 1);
+  if (dice(rng) < cfg.httpFailRate) {
+    failedPosts++;
+    response = "{\"error\":\"unavailable\"}";
+    return HTTP_CODE_SERVICE_UNAVAILABLE;
+  }
+  response = "{\"ok\":true}";
+
+  if (strstr(path, "metrics") != nullptr) {
+    metricsPosts++;
+    return HTTP_CODE_OK;
+  }
+  batchPosts++;
+  batchBytes += len;
+
+  static ReadingStore batch;
+  batch.clear();
+  if (strcmp(contentType, BATCH_COMPACT_CONTENT_TYPE) == 0) {
+    if (!decodeCompactBatch(body, len, batch)) return 400;
+  } else {
+    // [{"value":N,"deviceId":"0123456789AB","seq":N},...]
+    std::string text(reinterpret_cast<const char*>(body), len);
+    const char* p = text.c_str();
+    while ((p = strstr(p, "\"value\":")) != nullptr) {
+      Reading reading = {};
+      char* next;
+      reading.value = static_cast<int32_t>(strtol(p + 8, &next, 10));
+      const char* id = strstr(next, "\"deviceId\":\"");
+      if (id == nullptr || !parseMac(id + 12, reading.mac)) return 400;
+      const char* seq = strstr(id, "\"seq\":");
+      if (seq != nullptr) reading.seq = static_cast<uint16_t>(strtoul(seq + 6, nullptr, 10));
+      if (!batch.add(reading)) return 400;
+      p = id + 12;
+    }
+  }
+
+  // Some requests commit only a prefix and fail, or commit and never answer
+  size_t commit = batch.size();
+  bool partial = dice(rng) < cfg.httpPartialRate;
+  bool lostReply = !partial && dice(rng) < cfg.httpLostRate;
+  if (partial) commit = std::uniform_int_distribution<size_t>(0, batch.size())(rng);
+
+  std::unordered_set<uint64_t>* seen = idempotencyKey[0] ? &committed[idempotencyKey] : nullptr;
+  std::map<uint64_t, std::vector<uint16_t>> acked;
+  for (size_t i = 0; i < commit; i++) {
+    const Reading& r = batch[i];
+    uint64_t key = macKey(r.mac) << 16 | r.seq;
+    if (seen != nullptr && !seen->insert(key).second) {
+      replayedReadings++;
+    } else {
+      sinkReading(r.mac, r.value, now);
+    }
+    acked[macKey(r.mac)].push_back(r.seq);
+  }
+
+  if (lostReply) {
+    failedPosts++;
+    return HTTPC_ERROR_READ_TIMEOUT;
+  }
+  if (!partial) return HTTP_CODE_OK;
+
+  failedPosts++;
+  partialPosts++;
+  char entry[40];
+  response = "{\"acked\":[";
+  for (auto& node : acked) {
+    std::vector<uint16_t>& seqs = node.second;
+    std::sort(seqs.begin(), seqs.end());
+    for (size_t i = 0; i < seqs.size();) {
+      size_t j = i;
+      while (j + 1 < seqs.size() && seqs[j + 1] <= seqs[j] + 1) j++;
+      snprintf(entry, sizeof(entry), "%s[\"%012llX\",%u,%u]", response.size() > 10 ? "," : "",
+               (unsigned long long)node.first, seqs[i], seqs[j]);
+      response += entry;
+      i = j + 1;
+    }
+  }
+  response += "]}";
+  return HTTP_CODE_SERVICE_UNAVAILABLE;
+}
+
+void Simulator::sinkReading(const uint8_t* mac, int32_t value, uint64_t now) {
+  auto it = nodeByMac.find(macKey(mac));
+  if (it == nodeByMac.end() || value < 0 ||
+      static_cast<size_t>(value) >= nodes[it->second].sentAt.size()) {
+    unknownReadings++;
+    return;
+  }
+
+  Node& node = nodes[it->second];
+  if (node.delivered[value]) {
+    duplicates++;
+    return;
+  }
+  node.delivered[value] = true;
+  readingsDelivered++;
+  latenciesUs.push_back(static_cast<uint32_t>(now - node.sentAt[value]));
+  if (firstDeliveryAt == 0) firstDeliveryAt = now;
+  lastDeliveryAt = now;
+}
+
+// ---- Slot check
+
+// A node at position i answers (i + 1) slots after the beacon reached it,
+// so its reply is at the base by the end of slot i + 1 plus the link
+// delay both ways
+void Simulator::noteBeacon(const uint8_t* data, size_t len, uint64_t airEnd) {
+  FrameReader frame;
+  if (!nodesActive || !frame.parse(data, len) || frame.header().type != FRAME_BEACON) return;
+  uint32_t slotUs = 0;
+  const uint8_t* ids = nullptr;
+  size_t count = 0;
+  FrameReader::Field field;
+  while (frame.next(field)) {
+    if (field.id == FIELD_SLOT_LENGTH && field.wireType == WIRE_VARINT) {
+      slotUs = field.value * 1000;
+    } else if (field.id == FIELD_SLOT_IDS && field.wireType == WIRE_BYTES) {
+      ids = field.data;
+      count = field.len / 2;
+    }
+  }
+
+  slots.beacons++;
+  slots.listed += count;
+  uint64_t slack = 2 * (cfg.latencyUs + cfg.jitterUs);
+  for (size_t i = 0; i < count; i++) {
+    uint16_t id = ids[2 * i] | static_cast<uint16_t>(ids[2 * i + 1]) << 8;
+    slotEnds[static_cast<uint32_t>(frame.header().seq) << 16 | id] =
+      airEnd + (i + 2) * slotUs + slack;
+  }
+}
+
+void Simulator::noteSlotReply(const Event& event) {
+  ReadingFrame reading;
+  if (!decodeReading(event.data, event.len, reading)) return;
+  auto it = slotEnds.find(static_cast<uint32_t>(reading.replyTo) << 16 | reading.nodeId);
+  if (it == slotEnds.end()) return;
+  slots.answered++;
+  if (event.at > it->second) slots.late++;
+  slotEnds.erase(it);
+}
+
+Simulator::SlotStats Simulator::getSlotStats() const {
+  std::lock_guard<std::mutex> guard(const_cast<std::mutex&>(lock));
+  return slots;
+}
+
+// ---- Report
+
+static double percentileMs(std::vector<uint32_t>& sorted, double p) {
+  if (sorted.empty()) return 0;
+  size_t i = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+  return sorted[i] / 1000.0;
+}
+
+void Simulator::report(FILE* out) const {
+  std::lock_guard<std::mutex> guard(const_cast<std::mutex&>(lock));
+
+  int joined = 0;
+  uint32_t rejoins = 0;
+  uint64_t lastJoin = 0;
+  int onRate[ADR_RATE_COUNT] = {};
+  int loraJoined = 0;
+  double power = 0;
+  for (const Node& node : nodes) {
+    if (node.joined) joined++;
+    if (node.joined && node.radio == SIM_LORA) {
+      onRate[node.rate]++;
+      power += node.txPower;
+      loraJoined++;
+    }
+    if (node.joins > 1) rejoins += node.joins - 1;
+    if (node.joins > 0 && node.joinedAt > lastJoin) lastJoin = node.joinedAt;
+  }
+
+  std::vector<uint32_t> sorted(latenciesUs);
+  std::sort(sorted.begin(), sorted.end());
+  double seconds = cfg.durationMs / 1000.0;
+
+  static const char* radioNames[] = {"espnow", "lora", "espnow and lora"};
+  fprintf(out, "radio %s, %d nodes, loss %.2f, %.0f s at x%.1f\n", radioNames[cfg.radio],
+          cfg.nodes, cfg.loss, seconds, cfg.speed);
+  fprintf(out, "  joined        %d/%d, last join at %.0f ms, %u rejoins\n", joined, cfg.nodes,
+          lastJoin / 1000.0, rejoins);
+  fprintf(out, "  frames        %llu to nodes, %llu to base, %llu lost, %llu LoRa collisions\n",
+          (unsigned long long)framesToNodes, (unsigned long long)framesToBase,
+          (unsigned long long)framesLost, (unsigned long long)loraCollisions);
+  fprintf(out, "  slots         %llu listed in %llu beacons, %llu answered, %llu late\n",
+          (unsigned long long)slots.listed, (unsigned long long)slots.beacons,
+          (unsigned long long)slots.answered, (unsigned long long)slots.late);
+  if (cfg.radio == SIM_BOTH) {
+    for (SimRadio radio : {SIM_ESPNOW, SIM_LORA}) {
+      int count = 0;
+      int joinedOn = 0;
+      size_t sent = 0;
+      size_t delivered = 0;
+      for (const Node& node : nodes) {
+        if (node.radio != radio) continue;
+        count++;
+        if (node.joined) joinedOn++;
+        sent += node.sentAt.size();
+        delivered += std::count(node.delivered.begin(), node.delivered.end(), true);
+      }
+      fprintf(out, "  %-13s %d/%d joined, %zu readings sent, %zu delivered (%.1f%%)\n",
+              radioNames[radio], joinedOn, count, sent, delivered,
+              sent ? 100.0 * delivered / sent : 0.0);
+    }
+  }
+  if (hasLoRa()) {
+    fprintf(out, "  lora rx       %u missed at the base radio, FIFO high water %u, %u dropped\n",
+            halNativeLoRaMissed(), LoRaRadio::highWater(), LoRaRadio::dropped());
+    fprintf(out, "  lora link     %llu frames below their rate's floor, %llu sent on a rate the base was not on\n",
+            (unsigned long long)loraFaded, (unsigned long long)loraOffRate);
+    fprintf(out, "  lora rates   ");
+    for (int rate = 0; rate < ADR_RATE_COUNT; rate++) fprintf(out, " DR%d %d,", rate, onRate[rate]);
+    fprintf(out, " mean TX power %.1f dBm\n", loraJoined ? power / loraJoined : 0.0);
+    fprintf(out, "  lora airtime  %.0f ms per sweep over %llu sweeps: base %.0f, nodes %.0f\n",
+            sweeps ? (loraBaseAirUs + loraNodeAirUs) / 1000.0 / sweeps : 0.0,
+            (unsigned long long)sweeps, sweeps ? loraBaseAirUs / 1000.0 / sweeps : 0.0,
+            sweeps ? loraNodeAirUs / 1000.0 / sweeps : 0.0);
+    if (cfg.interferers > 0) {
+      fprintf(out, "  interference  %d transmitters at %.1f%% duty, %llu frames, %llu frames to nodes lost\n",
+              cfg.interferers, cfg.interfererDuty * 100, (unsigned long long)interfererFrames,
+              (unsigned long long)loraInterfered);
+    }
+    if (LORA_LBT_ATTEMPTS > 0) {
+      fprintf(out, "  lbt base      %u busy, %u given up, sent on attempt",
+              LoRaRadio::channelBusy(), LoRaRadio::abandoned());
+      for (uint8_t i = 0; i < LORA_LBT_ATTEMPTS; i++) {
+        fprintf(out, "%s%u", i ? "/" : " ", LoRaRadio::sentOnAttempt(i));
+      }
+      fprintf(out, "\n  lbt nodes     %llu busy, %llu given up, sent on attempt",
+              (unsigned long long)nodeBusy, (unsigned long long)nodeAbandoned);
+      for (int i = 0; i < LORA_LBT_ATTEMPTS; i++) {
+        fprintf(out, "%s%llu", i ? "/" : " ", (unsigned long long)nodeSentOnAttempt[i]);
+      }
+      fprintf(out, "\n");
+    }
+  }
+  fprintf(out, "  readings      %llu sent, %llu delivered (%.1f%%), %llu duplicates, %llu unknown\n",
+          (unsigned long long)readingsSent, (unsigned long long)readingsDelivered,
+          readingsSent ? 100.0 * readingsDelivered / readingsSent : 0.0,
+          (unsigned long long)duplicates, (unsigned long long)unknownReadings);
+  fprintf(out, "  resends       %llu readings resent, %llu abandoned by nodes\n",
+          (unsigned long long)readingsResent, (unsigned long long)readingsAbandoned);
+  fprintf(out, "  throughput    %.1f readings/s\n", readingsDelivered / seconds);
+  fprintf(out, "  latency ms    p50 %.0f, p90 %.0f, p99 %.0f, max %.0f\n",
+          percentileMs(sorted, 0.5), percentileMs(sorted, 0.9), percentileMs(sorted, 0.99),
+          sorted.empty() ? 0.0 : sorted.back() / 1000.0);
+  fprintf(out, "  http          %llu batch posts, %llu metrics posts, %llu failed, %llu connects\n",
+          (unsigned long long)batchPosts, (unsigned long long)metricsPosts,
+          (unsigned long long)failedPosts, (unsigned long long)httpConnects);
+  fprintf(out, "  batch bodies  %llu bytes, %llu partial commits, %llu readings posted again\n",
+          (unsigned long long)batchBytes, (unsigned long long)partialPosts,
+          (unsigned long long)replayedReadings);
+}
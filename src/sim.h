@@ -0,0 +1,259 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdio.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "hal_native.h"
+#include "frame.h"
+#include "adr.h"
+#include "lora_radio.h"
+
+enum SimRadio : uint8_t { SIM_ESPNOW, SIM_LORA, SIM_BOTH };
+
+struct SimConfig {
+  SimRadio radio = SIM_ESPNOW;  // With both, every other node is on LoRa
+  int nodes = 10;
+  double loss = 0;              // Per frame and direction, before MAC retries, on top of fading
+  uint32_t loraRangeM = 1800;   // LoRa nodes are spread evenly over a disc this wide around the base
+  int interferers = 0;          // Foreign LoRa transmitters on the channel, heard by base and nodes
+  double interfererDuty = 0.05; // Share of the time each one is on air
+  uint32_t latencyUs = 1000;    // One way, on top of the LoRa airtime
+  uint32_t jitterUs = 500;
+  uint32_t nodeProcessingUs = 300; // Node loop delay before a trigger reply
+  uint8_t espNowRetries = 3;    // MAC-level retries of unicast frames
+  uint32_t joinSpreadMs = 2000; // Nodes boot at random within this
+  uint32_t durationMs = 60000;  // Nodes answer polls for this long
+  uint32_t drainMs = 10000;     // Then the base gets this long to upload
+  double speed = 1;
+  uint32_t httpConnectMs = 300;
+  uint32_t httpLatencyMs = 150;
+  double httpFailRate = 0;      // 503 before anything is committed
+  double httpPartialRate = 0;   // 503 after committing part of the batch, with its acks
+  double httpLostRate = 0;      // Committed, then the response is lost
+  uint32_t seed = 1;
+};
+
+// Radio medium, a fleet of nodes and an HTTP sink around one base built
+// from the firmware sources. Nodes follow the protocol in node_common.cpp:
+// they join, answer triggers and answer beacons in their slot, resending
+// readings until the base acks them. Each reading carries a per-node
+// counter as its value, so the sink can tell when it was taken and count
+// end-to-end latency and duplicates.
+//
+// Frames travel as timed events on one thread, which also runs the nodes
+// and calls the base's receive callbacks, like the WiFi task and the LoRa
+// ISR do on the device.
+//
+// On LoRa every link has a log-distance path loss with per-node shadowing
+// and per-frame fading. A frame gets through when its SNR clears the
+// floor of the data rate it was sent on and the receiver is tuned to
+// that rate, so the base's ADR orders can be checked against real
+// margins. Interferers send foreign frames at random rates, without
+// listening first; they collide with frames on the same rate at the
+// base and at the nodes. Nodes listen before talking as LoRaRadio does,
+// and hear every frame on air on their rate, the base's and each other's.
+// With both radios, every other node is on LoRa; the two fleets share
+// nothing but the base.
+class Simulator : public HalBackend {
+public:
+  explicit Simulator(const SimConfig& config);
+  ~Simulator();
+
+  void start();
+  // Nodes stop answering; what is still in flight is delivered. Slots
+  // listed from here on, or still open, are left out of the report.
+  void stopNodes();
+  void stop();
+  void report(FILE* out) const;
+
+  // Beacon slots as the base's radio saw them, to check the sweep
+  struct SlotStats {
+    uint64_t beacons;  // Beacon frames, one per group
+    uint64_t listed;   // Slots in them
+    uint64_t answered; // Replies to a beacon that reached the base
+    uint64_t late;     // Of those, after the end of the node's slot
+  };
+  SlotStats getSlotStats() const;
+
+  void espNowSend(const uint8_t* dest, const uint8_t* data, size_t len) override;
+  void loraSend(const uint8_t* data, size_t len, uint32_t airtimeUs, int spreadingFactor,
+                long bandwidth) override;
+  bool loraChannelActive(int spreadingFactor, long bandwidth) override;
+  bool httpConnect(const char* host, uint16_t port) override;
+  int httpPost(const char* host, const char* path, const char* contentType,
+               const char* idempotencyKey, const uint8_t* body, size_t len,
+               std::string& response) override;
+
+  static const uint8_t baseMac[6];
+
+private:
+  enum EventType : uint8_t {
+    TO_NODE,      // Frame arrives at a node
+    TO_BASE,      // Frame arrives at the base
+    SEND_STATUS,  // ESP-NOW send callback on the base
+    NODE_JOIN,    // Node (re)sends its join
+    NODE_REPLY,   // Node's scheduled reply is due
+    NODE_TIMEOUT, // Node checks whether it still hears the base
+    NODE_SEND,    // LoRa node runs CAD and, if the channel is clear, transmits
+    INTERFERE,    // An interferer transmits
+  };
+
+  struct Event {
+    uint64_t at;   // Simulated us
+    uint64_t order;
+    EventType type;
+    bool delivered;
+    int node;
+    uint32_t token;  // NODE_REPLY: stale when the node rescheduled since
+    int rxSlot;      // TO_BASE over LoRa: entry in loraRx, -1 otherwise
+    uint8_t rate;    // TO_BASE, TO_NODE and NODE_SEND over LoRa: data rate
+    int16_t rssi;    // TO_BASE over LoRa: signal as the base measures it
+    int8_t snr;
+    uint8_t txPower; // NODE_SEND: setting when the node started sending,
+    uint8_t attempt; // and CAD attempts so far
+    uint64_t airStart; // TO_NODE over LoRa: us the frame was on air
+    uint64_t airEnd;
+    uint8_t len;
+    uint8_t data[FRAME_MAX_SIZE];
+  };
+
+  struct Later {
+    bool operator()(const Event& a, const Event& b) const {
+      return a.at != b.at ? a.at > b.at : a.order > b.order;
+    }
+  };
+
+  struct Unacked {
+    uint16_t seq;
+    int32_t value;
+    uint64_t takenAt; // us
+  };
+
+  struct Node {
+    SimRadio radio;      // SIM_ESPNOW or SIM_LORA
+    uint8_t mac[6];
+    uint16_t id;
+    bool joined;
+    uint16_t seq;
+    uint16_t replyTo;
+    uint32_t replyToken;
+    uint8_t unlistedBeacons;
+    double pathLoss;     // dB to the base, shadowing included
+    uint8_t rate;        // LoRa data rate and TX power, as LoRaNode
+    uint8_t txPower;
+    uint8_t radioOrder;  // From the latest trigger, 0 for none
+    uint64_t heardAt;    // us, the last frame from the base
+    uint64_t joinedAt;   // us, of the latest join
+    uint32_t joins;
+    uint32_t joinAttempts; // Unanswered since the last join
+    std::vector<uint64_t> sentAt;  // Indexed by reading value
+    std::vector<bool> delivered;
+    std::vector<Unacked> unacked;  // Oldest first, at most SIM_RESEND_SLOTS
+  };
+
+  // A LoRa frame on air, from a node on its way to the base or from an
+  // interferer, to find overlapping ones
+  struct LoRaRx {
+    uint64_t start;
+    uint64_t end;
+    uint8_t rate; // Frames on other rates do not interfere
+    bool collided;
+    bool foreign; // From an interferer
+  };
+
+  void run();
+  void push(Event& event);
+  Event makeEvent(uint64_t at, EventType type, int node, const uint8_t* data, size_t len);
+  uint64_t linkDelay(size_t len);
+  bool lost();
+  // SNR in dB over the 125 kHz noise floor of one frame between node and
+  // base; rssi, when given, gets the received power in dBm
+  double linkSnr(const Node& node, int txPower, double* rssi = nullptr);
+  void forgetBase(int index, uint64_t now);
+  // Records a frame on air; marks it and those it overlaps as collided
+  int addLoRaRx(uint64_t start, uint64_t end, uint8_t rate, bool foreign);
+  // CAD on rate at now: a node's or an interferer's frame, or the
+  // base's own when a node listens
+  bool loraBusy(uint8_t rate, uint64_t now, bool base);
+  bool hasLoRa() const { return cfg.radio != SIM_ESPNOW; }
+  void interfere(uint64_t now);
+  // Delivered, and after how many attempts, for an ESP-NOW unicast
+  bool unicast(uint32_t& attempts);
+
+  void handle(Event& event);
+  void nodeReceive(Node& node, const Event& event);
+  void applyAck(Node& node, const FrameAck& ack);
+  void nodeSend(int index, const uint8_t* frame, size_t len, uint64_t now);
+  void loraTransmit(Event& send);
+  void sendJoin(int index, uint64_t now);
+  void sendReading(int index, uint64_t now);
+  void sinkReading(const uint8_t* mac, int32_t value, uint64_t now);
+  // Remembers when each slot of a beacon ends; airEnd is when it left
+  void noteBeacon(const uint8_t* data, size_t len, uint64_t airEnd);
+  void noteSlotReply(const Event& event);
+
+  SimConfig cfg;
+  std::vector<Node> nodes;
+  std::unordered_map<uint64_t, int> nodeByMac;
+  // Per idempotency key, MAC << 16 | seq of every reading committed
+  std::unordered_map<std::string, std::unordered_set<uint64_t>> committed;
+
+  std::mutex lock; // Events, RNG and the counters below
+  std::condition_variable wake;
+  std::priority_queue<Event, std::vector<Event>, Later> events;
+  std::vector<LoRaRx> loraRx;
+  uint64_t nextRx = 0;
+  uint64_t nextOrder = 0;
+  std::mt19937 rng;
+  std::thread worker;
+  std::atomic<bool> running;
+  std::atomic<bool> nodesActive;
+
+  // Counters, under lock
+  uint64_t framesToNodes = 0;
+  uint64_t framesToBase = 0;
+  uint64_t framesLost = 0;
+  uint64_t loraCollisions = 0;
+  uint64_t loraFaded = 0;      // Below the floor of their data rate
+  uint64_t loraOffRate = 0;    // Reached the base while it was on another rate
+  uint64_t loraBaseAirUs = 0;
+  uint64_t loraNodeAirUs = 0;
+  uint64_t sweeps = 0;         // Distinct beacon seqs sent
+  int32_t lastBeaconSeq = -1;
+  SlotStats slots = {};
+  std::unordered_map<uint32_t, uint64_t> slotEnds; // By beacon seq << 16 | node id, us
+  uint64_t baseAirStart = 0;   // The base's latest LoRa frame
+  uint64_t baseAirEnd = 0;
+  uint8_t baseAirRate = 0;
+  uint64_t interfererFrames = 0;
+  uint64_t loraInterfered = 0; // Frames to nodes lost to an interferer
+  uint64_t nodeBusy = 0;       // Node CAD found the channel busy
+  uint64_t nodeAbandoned = 0;
+  uint64_t nodeSentOnAttempt[LORA_LBT_ATTEMPTS > 0 ? LORA_LBT_ATTEMPTS : 1] = {};
+  uint64_t readingsSent = 0;
+  uint64_t readingsResent = 0;
+  uint64_t readingsAbandoned = 0;
+  uint64_t readingsDelivered = 0;
+  uint64_t duplicates = 0;
+  uint64_t unknownReadings = 0;
+  uint64_t batchPosts = 0;
+  uint64_t metricsPosts = 0;
+  uint64_t failedPosts = 0;
+  uint64_t partialPosts = 0;
+  uint64_t replayedReadings = 0; // Posted again under their key, stored once
+  uint64_t batchBytes = 0;
+  uint64_t httpConnects = 0;
+  uint64_t firstDeliveryAt = 0;
+  uint64_t lastDeliveryAt = 0;
+  std::vector<uint32_t> latenciesUs;
+};
+
+#endif
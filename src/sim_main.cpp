@@ -0,0 +1,145 @@
+// Native simulator: one base built from the firmware sources against
+// hal_native, a fleet of simulated nodes and an HTTP sink.
+//
+//   .pio/build/native/program --radio espnow --nodes 50 --loss 0.05
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include "hal.h"
+#include "log.h"
+#include "sim.h"
+#include "base_espnow.h"
+#include "base_lora.h"
+
+// pio test builds the env's sources around each test's own main()
+#ifndef PIO_UNIT_TESTING
+
+static Base base;
+static EspNowTransport espNow;
+static LoRaTransport lora;
+
+static void usage() {
+  fprintf(stderr,
+          "usage: program [--radio espnow|lora|both] [--nodes N] [--loss P] [--range M]\n"
+          "               [--interferers N] [--duty P]\n"
+          "               [--latency US] [--jitter US] [--duration S] [--drain S]\n"
+          "               [--speed X] [--http-latency MS] [--http-fail P]\n"
+          "               [--http-partial P] [--http-lost P]\n"
+          "               [--seed N] [--quiet]\n");
+  exit(2);
+}
+
+static bool parseArgs(int argc, char** argv, SimConfig& cfg, bool& quiet) {
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    if (strcmp(arg, "--quiet") == 0) {
+      quiet = true;
+      continue;
+    }
+    if (i + 1 >= argc) return false;
+    const char* value = argv[++i];
+    if (strcmp(arg, "--radio") == 0) {
+      if (strcmp(value, "espnow") == 0) cfg.radio = SIM_ESPNOW;
+      else if (strcmp(value, "lora") == 0) cfg.radio = SIM_LORA;
+      else if (strcmp(value, "both") == 0) cfg.radio = SIM_BOTH;
+      else return false;
+    } else if (strcmp(arg, "--nodes") == 0) {
+      cfg.nodes = atoi(value);
+    } else if (strcmp(arg, "--loss") == 0) {
+      cfg.loss = atof(value);
+    } else if (strcmp(arg, "--range") == 0) {
+      cfg.loraRangeM = strtoul(value, nullptr, 10);
+    } else if (strcmp(arg, "--interferers") == 0) {
+      cfg.interferers = atoi(value);
+    } else if (strcmp(arg, "--duty") == 0) {
+      cfg.interfererDuty = atof(value);
+    } else if (strcmp(arg, "--latency") == 0) {
+      cfg.latencyUs = strtoul(value, nullptr, 10);
+    } else if (strcmp(arg, "--jitter") == 0) {
+      cfg.jitterUs = strtoul(value, nullptr, 10);
+    } else if (strcmp(arg, "--duration") == 0) {
+      cfg.durationMs = static_cast<uint32_t>(atof(value) * 1000);
+    } else if (strcmp(arg, "--drain") == 0) {
+      cfg.drainMs = static_cast<uint32_t>(atof(value) * 1000);
+    } else if (strcmp(arg, "--speed") == 0) {
+      cfg.speed = atof(value);
+    } else if (strcmp(arg, "--http-latency") == 0) {
+      cfg.httpLatencyMs = strtoul(value, nullptr, 10);
+    } else if (strcmp(arg, "--http-fail") == 0) {
+      cfg.httpFailRate = atof(value);
+    } else if (strcmp(arg, "--http-partial") == 0) {
+      cfg.httpPartialRate = atof(value);
+    } else if (strcmp(arg, "--http-lost") == 0) {
+      cfg.httpLostRate = atof(value);
+    } else if (strcmp(arg, "--seed") == 0) {
+      cfg.seed = strtoul(value, nullptr, 10);
+    } else {
+      return false;
+    }
+  }
+  return cfg.nodes > 0 && cfg.nodes <= 0xFFFF && cfg.speed > 0 && cfg.interferers >= 0 &&
+         cfg.interfererDuty > 0 && cfg.interfererDuty < 1;
+}
+
+// Runs the base loop until millis() reaches end
+static void runBase(Base& base, uint32_t end, bool quiet) {
+  while (static_cast<int32_t>(millis() - end) < 0) {
+    base.update();
+    if (!quiet) logDrain();
+    std::this_thread::sleep_for(std::chrono::microseconds(20));
+  }
+}
+
+int main(int argc, char** argv) {
+  SimConfig cfg;
+  bool quiet = false;
+  if (!parseArgs(argc, argv, cfg, quiet)) usage();
+
+#ifdef BATCH_LOG_PATH
+  remove(BATCH_LOG_PATH);
+#endif
+
+  static Simulator sim(cfg);
+  HalNativeConfig hal;
+  memcpy(hal.mac, Simulator::baseMac, 6);
+  halNativeSetSpeed(cfg.speed);
+  halNativeBegin(&sim, hal);
+
+  if (cfg.radio != SIM_LORA) base.addTransport(espNow);
+  if (cfg.radio != SIM_ESPNOW) base.addTransport(lora);
+  logBegin();
+  base.begin();
+  sim.start();
+
+  uint32_t start = millis();
+  runBase(base, start + cfg.durationMs, quiet);
+  // Polls from here on go unanswered: counted up to now, a clean run
+  // reports no misses
+  TriggerEngine::Stats triggers = Base::getTriggerStats();
+  sim.stopNodes();
+  runBase(base, start + cfg.durationMs + cfg.drainMs, quiet);
+  if (!quiet) logDrain();
+
+  sim.report(stdout);
+  const Base::UplinkStats& uplink = Base::getUplinkStats();
+  printf("  base          %lu batches, %lu readings, %lu failures, max upload %lu ms\n",
+         (unsigned long)uplink.batches, (unsigned long)uplink.readings,
+         (unsigned long)uplink.failures, (unsigned long)uplink.maxLatency);
+  printf("  triggers      %lu sent, %lu retries, %lu answered, %lu missed, %lu group frames\n",
+         (unsigned long)triggers.sent, (unsigned long)triggers.retries,
+         (unsigned long)triggers.answered, (unsigned long)triggers.missed,
+         (unsigned long)triggers.groups);
+  MetricsSnapshot snap;
+  Base::getMetrics().snapshot(snap, millis());
+  printf("  dedup         %lu recovered, %lu duplicates dropped, %lu abandoned\n",
+         (unsigned long)snap.counters[METRIC_READINGS_RESENT],
+         (unsigned long)snap.counters[METRIC_DUPLICATES],
+         (unsigned long)snap.counters[METRIC_READINGS_ABANDONED]);
+  fflush(stdout);
+  // Task threads are still running; skip the static destructors
+  _Exit(0);
+}
+
+#endif
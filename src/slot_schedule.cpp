@@ -0,0 +1,85 @@
+#include "slot_schedule.h"
+#include <string.h>
+
+void SlotSchedule::setSlotLength(uint16_t ms) {
+  for (uint8_t rate = 0; rate < SLOT_SCHEDULE_RATES; rate++) slotMs[rate] = ms;
+}
+
+void SlotSchedule::begin(const uint16_t* nodeIds, const uint8_t* nodeAcks,
+                         const uint8_t* nodeRates, size_t n, uint16_t sweepSeq) {
+  count = n > SLOT_SCHEDULE_MAX ? SLOT_SCHEDULE_MAX : n;
+  if (nodeRates == nullptr) {
+    memcpy(ids, nodeIds, count * sizeof(uint16_t));
+    memcpy(acks, nodeAcks, count);
+    memset(rates, 0, count);
+  } else {
+    // Counting sort by rate, stable, so every group has a single rate
+    size_t start[SLOT_SCHEDULE_RATES + 1] = {};
+    for (size_t i = 0; i < count; i++) start[nodeRates[i] % SLOT_SCHEDULE_RATES + 1]++;
+    for (uint8_t r = 0; r < SLOT_SCHEDULE_RATES; r++) start[r + 1] += start[r];
+    for (size_t i = 0; i < count; i++) {
+      uint8_t rate = nodeRates[i] % SLOT_SCHEDULE_RATES;
+      size_t at = start[rate]++;
+      ids[at] = nodeIds[i];
+      acks[at] = nodeAcks[i];
+      rates[at] = rate;
+    }
+  }
+  memset(slotOf, 0, sizeof(slotOf));
+  for (size_t i = 0; i < count; i++) {
+    size_t h = hashId(ids[i]);
+    while (slotOf[h] != 0 && ids[slotOf[h] - 1] != ids[i]) {
+      h = (h + 1) & (SLOT_SCHEDULE_INDEX - 1);
+    }
+    // A repeated id keeps its first position
+    if (slotOf[h] == 0) slotOf[h] = static_cast<uint16_t>(i + 1);
+  }
+  memset(answered, 0, sizeof(answered));
+  answers = 0;
+  nextGroup = 0;
+  groupSize = 0;
+  groupEnd = 0;
+  seq = sweepSeq;
+}
+
+size_t SlotSchedule::poll(uint32_t now, uint8_t* out, size_t outLen) {
+  if (nextGroup >= count || static_cast<int32_t>(now - groupEnd) < 0) return 0;
+
+  size_t n = 1;
+  while (nextGroup + n < count && n < BEACON_MAX_SLOTS && rates[nextGroup + n] == rates[nextGroup]) {
+    n++;
+  }
+
+  size_t len = encodeBeacon(out, outLen, seq, slotMs[rates[nextGroup]], ids + nextGroup,
+                            acks + nextGroup, n);
+  if (len == 0) return 0;
+
+  // Slot 0 is the guard after the beacon, replies fill slots 1..n
+  groupSize = n;
+  nextGroup += n;
+  beaconSent(now);
+  return len;
+}
+
+bool SlotSchedule::done(uint32_t now) const {
+  return nextGroup >= count && static_cast<int32_t>(now - groupEnd) >= 0;
+}
+
+// Probes until the id or a free entry; the table is never more than half full
+int SlotSchedule::findId(uint16_t id) const {
+  if (count == 0) return -1;
+  for (size_t h = hashId(id); slotOf[h] != 0; h = (h + 1) & (SLOT_SCHEDULE_INDEX - 1)) {
+    if (ids[slotOf[h] - 1] == id) return slotOf[h] - 1;
+  }
+  return -1;
+}
+
+bool SlotSchedule::markAnswered(uint16_t nodeId) {
+  int i = findId(nodeId);
+  if (i < 0) return false;
+  if (!answeredAt(i)) {
+    answered[i / 8] |= 1 << (i % 8);
+    answers++;
+  }
+  return true;
+}
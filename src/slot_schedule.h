@@ -0,0 +1,75 @@
+#ifndef SLOT_SCHEDULE_H
+#define SLOT_SCHEDULE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "frame.h"
+
+#define SLOT_SCHEDULE_MAX 256
+#define SLOT_SCHEDULE_RATES 8 // Data rates a sweep can mix
+#define SLOT_SCHEDULE_INDEX 512 // Power of two, at least twice SLOT_SCHEDULE_MAX
+
+// Time-slotted polling sweep. Instead of triggering nodes one by one and
+// waiting out a timeout for each, the base broadcasts a beacon listing up
+// to BEACON_MAX_SLOTS node ids and every listed node answers in its own
+// slot. Larger fleets get one beacon per group, each sent after the
+// previous group's slots are over, so a sweep costs one beacon per
+// BEACON_MAX_SLOTS nodes plus one slot per node.
+//
+// On LoRa nodes can be on different data rates (see adr.h). A group then
+// only holds nodes of one rate, the base sends its beacon on that rate and
+// listens on it for the group's slots, which are as long as that rate
+// needs for a reply.
+class SlotSchedule {
+public:
+  void setSlotLength(uint16_t ms);
+  void setSlotLength(uint8_t rate, uint16_t ms) { slotMs[rate] = ms; }
+  uint16_t slotLength(uint8_t rate = 0) const { return slotMs[rate]; }
+
+  // Starts a sweep over ids and the ack byte of each (copied, at most
+  // SLOT_SCHEDULE_MAX). rates, when given, holds each node's data rate;
+  // the sweep goes through them one rate at a time.
+  void begin(const uint16_t* ids, const uint8_t* acks, const uint8_t* rates, size_t count,
+             uint16_t sweepSeq);
+
+  // Writes the next beacon into out once it is due and returns its
+  // length; returns 0 while the current group's slots are still running.
+  size_t poll(uint32_t now, uint8_t* out, size_t outLen);
+  // Data rate of the group whose beacon poll() wrote last
+  uint8_t groupRate() const { return rates[nextGroup - groupSize]; }
+  // Call once the beacon from poll() is on air: slots count from here
+  void beaconSent(uint32_t at) { groupEnd = at + (groupSize + 1) * slotMs[groupRate()]; }
+
+  bool done(uint32_t now) const;
+  bool active() const { return count > 0; }
+  void finish() { count = 0; }
+
+  // Records a reply; false when nodeId is not part of this sweep. A hash
+  // lookup, so a burst of replies does not scan the sweep once each.
+  bool markAnswered(uint16_t nodeId);
+  bool answeredAt(size_t i) const { return answered[i / 8] & (1 << (i % 8)); }
+
+  size_t size() const { return count; }
+  size_t answeredCount() const { return answers; }
+  uint16_t idAt(size_t i) const { return ids[i]; }
+  uint16_t sequence() const { return seq; }
+
+private:
+  static size_t hashId(uint16_t id) { return (id * 40503u >> 7) & (SLOT_SCHEDULE_INDEX - 1); }
+  int findId(uint16_t id) const;
+
+  uint16_t ids[SLOT_SCHEDULE_MAX];
+  uint8_t acks[SLOT_SCHEDULE_MAX];
+  uint8_t rates[SLOT_SCHEDULE_MAX];
+  uint8_t answered[SLOT_SCHEDULE_MAX / 8];
+  uint16_t slotOf[SLOT_SCHEDULE_INDEX]; // Open addressing by id, position + 1, 0 when free
+  size_t count = 0;
+  size_t answers = 0;
+  size_t nextGroup = 0;   // Index of the first id not yet beaconed
+  size_t groupSize = 0;
+  uint32_t groupEnd = 0;  // When the last beaconed group's slots are over
+  uint16_t slotMs[SLOT_SCHEDULE_RATES] = {10, 10, 10, 10, 10, 10, 10, 10};
+  uint16_t seq = 0;
+};
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+// Fixed-capacity single-producer/single-consumer ring. Slots live inline,
+// so pushing and popping never touch the heap. One context (a radio
+// callback or ISR) may push while another task or core pops; head is only
+// written by the producer and tail only by the consumer.
+//
+// Overflow policy: a full ring rejects the new item and counts it in
+// dropped(). Evicting the oldest item would mean the producer moving the
+// consumer's tail, which is not safe without a lock.
+template <typename T, size_t N>
+class SpscRing {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "SpscRing capacity must be a power of two");
+
+public:
+  // Producer side
+  bool push(const T& item) {
+    const uint32_t h = head.load(std::memory_order_relaxed);
+    const uint32_t t = tail.load(std::memory_order_acquire);
+    if (h - t >= N) {
+      drops.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    slots[h & (N - 1)] = item;
+    head.store(h + 1, std::memory_order_release);
+
+    const uint32_t depth = h + 1 - t;
+    if (depth > peak.load(std::memory_order_relaxed)) {
+      peak.store(depth, std::memory_order_relaxed);
+    }
+    return true;
+  }
+
+  // Consumer side
+  bool pop(T& item) {
+    const uint32_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire)) return false;
+    item = slots[t & (N - 1)];
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side: discards everything queued so far
+  void clear() {
+    tail.store(head.load(std::memory_order_acquire), std::memory_order_release);
+  }
+
+  size_t size() const {
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+  }
+  bool empty() const { return size() == 0; }
+  static constexpr size_t capacity() { return N; }
+
+  uint32_t dropped() const { return drops.load(std::memory_order_relaxed); }
+  uint32_t highWater() const { return peak.load(std::memory_order_relaxed); }
+
+private:
+  T slots[N];
+  std::atomic<uint32_t> head{0};
+  std::atomic<uint32_t> tail{0};
+  std::atomic<uint32_t> drops{0};
+  std::atomic<uint32_t> peak{0};
+};
+
+#endif
@@ -0,0 +1,46 @@
+#include "transport.h"
+
+NodeTable& Transport::nodes = Base::nodes;
+Metrics& Transport::metrics = Base::metrics;
+#ifdef CAPTURE
+Capture& Transport::capture = Base::capture;
+#endif
+
+Transport::Transport() : triggers(Base::nodes) {}
+
+void Transport::enqueueReading(const uint8_t* mac, const ReadingFrame& reading,
+                               int16_t rssi, int8_t snr, uint32_t receivedAt) {
+  Message msg;
+  memcpy(msg.mac, mac, 6);
+  msg.nodeId = reading.nodeId;
+  msg.rssi = rssi;
+  msg.snr = snr;
+  msg.span = 0;
+  msg.replyTo = 0;
+  msg.epoch = 0;
+
+  // Oldest first, so the newest reading settles the node's window last
+  for (uint8_t i = 0; i < reading.resentCount; i++) {
+    msg.seq = reading.resent[i].seq;
+    msg.value = reading.resent[i].value;
+    msg.receivedAt = receivedAt - reading.resent[i].ageMs;
+    enqueueMessage(msg);
+  }
+
+  msg.seq = reading.seq;
+  msg.value = reading.value;
+  msg.replyTo = reading.replyTo;
+  msg.receivedAt = receivedAt;
+  if (reading.resentCount > 0) {
+    msg.span = static_cast<uint8_t>(reading.seq - reading.resent[0].seq);
+  }
+  enqueueMessage(msg);
+}
+
+void Transport::enqueueJoin(const uint8_t* mac, uint16_t requestedId, int32_t ackedSeq) {
+  JoinRequest request;
+  memcpy(request.mac, mac, 6);
+  request.requestedId = requestedId;
+  request.ackedSeq = ackedSeq;
+  joinQueue.push(request);
+}
@@ -0,0 +1,81 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include "base.h"
+
+// One radio the base polls its nodes over. The driver brings the radio
+// up, sends what the base's polling loop hands it and queues what it
+// hears; the sweep, the trigger engine and the queues here only ever
+// hold this radio's nodes. Node ids are unique across all transports, so
+// a reply's id and replyTo still say which node and which poll it is.
+class Transport {
+public:
+  typedef Base::Message Message;
+  typedef Base::JoinRequest JoinRequest;
+
+  Transport();
+  virtual ~Transport() {}
+
+  virtual void begin() = 0;
+  // Loop task, before the queues are drained: for radios that read on it
+  virtual void receive() {}
+  // Loop task, after this radio's polls went out
+  virtual void idle() {}
+  virtual CaptureRadio captureRadio() const = 0;
+  // On the WiFi station's radio and channel: polls wait while WiFi scans
+  virtual bool sharesWifiRadio() const { return false; }
+
+  // Radio receive context: never allocates, never blocks. A full queue
+  // drops the new reading and bumps the ring's drop counter.
+  void enqueueMessage(const Message& msg) { messageQueue.push(msg); }
+  // Queues a reading frame: the readings resent with it, oldest first, then its own.
+  // receivedAt is millis() when the frame came off the radio.
+  void enqueueReading(const uint8_t* mac, const ReadingFrame& reading,
+                      int16_t rssi, int8_t snr, uint32_t receivedAt);
+  void enqueueJoin(const uint8_t* mac, uint16_t requestedId, int32_t ackedSeq);
+
+  const TriggerEngine::Stats& getTriggerStats() const { return triggers.getStats(); }
+
+protected:
+  friend class Base;
+
+  virtual void sendBroadcast(const uint8_t* frame, size_t len) = 0; // Beacons, join accepts
+  virtual bool sendTrigger(uint16_t nodeId, uint16_t seq) = 0;
+  // Polls several pending nodes with one group trigger, see
+  // TriggerEngine::nextGroup(); false when none went out and single
+  // triggers should
+  virtual bool sendGroupTrigger(uint32_t now, uint16_t seq) { return false; }
+  // Data rate for what is sent next and heard after it; LoRa only
+  virtual void tuneRadio(uint8_t rate) {}
+  // The node left the table or moved to another radio: releases whatever
+  // the radio holds for it, such as its ESP-NOW peer entry
+  virtual void forgetPeer(const uint8_t* mac) {}
+
+  // The base's shared state, for the drivers
+  static NodeTable& nodes;
+  static Metrics& metrics;
+#ifdef CAPTURE
+  static Capture& capture;
+#endif
+  static const uint8_t* findNodeMac(uint16_t nodeId) { return Base::findNodeMac(nodeId); }
+  static size_t buildTrigger(uint8_t* out, size_t outLen, uint16_t nodeId, uint16_t seq,
+                             uint8_t radio = 0) {
+    return Base::buildTrigger(out, outLen, nodeId, seq, radio);
+  }
+
+  uint8_t index = 0; // In the base's list, see NodeInfo::transport
+  SlotSchedule schedule;
+  TriggerEngine triggers; // Unicast retries for nodes that missed their slot
+  // Filled from the radio receive context, drained on the loop task
+  SpscRing<Message, MAX_QUEUE_SIZE> messageQueue;
+  SpscRing<JoinRequest, JOIN_QUEUE_SIZE> joinQueue;
+
+private:
+  // Kept by the base's loop
+  unsigned long lastSweepStart = 0;
+  unsigned long lastSweepEnd = 0;
+  uint32_t reportedMisses = 0;
+  uint32_t reportedDrops = 0;
+};
+
+#endif
@@ -0,0 +1,160 @@
+#include "trigger_engine.h"
+
+void TriggerEngine::configure(uint8_t win, uint16_t rtt, uint16_t minMs, uint16_t maxMs) {
+  window = win ? win : 1;
+  initialRtt = rtt;
+  minTimeout = minMs;
+  maxTimeout = maxMs;
+}
+
+uint16_t TriggerEngine::timeoutFor(int index) const {
+  const NodeInfo& node = table[index];
+  uint32_t t = node.srtt ? node.srtt + 4u * node.rttvar : initialRtt * 2u;
+  uint8_t attempts = polls[index].attempts;
+  t <<= attempts > 0 ? attempts - 1 : 0; // Back off on every retry
+  if (t < minTimeout) t = minTimeout;
+  if (t > maxTimeout) t = maxTimeout;
+  return t;
+}
+
+void TriggerEngine::request(int index) {
+  PollState& poll = polls[index];
+  if (poll.state == IDLE) {
+    poll.state = PENDING;
+    poll.attempts = 0;
+    pending++;
+  }
+}
+
+void TriggerEngine::forget(int index) {
+  PollState& poll = polls[index];
+  if (poll.state == PENDING) pending--;
+  else if (poll.state == IN_FLIGHT) inFlight--;
+  else if (poll.state == BACKOFF) waiting--;
+  poll.state = IDLE;
+}
+
+void TriggerEngine::reset() {
+  for (size_t i = 0; i < NODE_TABLE_CAPACITY; i++) {
+    polls[i].state = IDLE;
+  }
+  inFlight = 0;
+  pending = 0;
+  waiting = 0;
+}
+
+bool TriggerEngine::next(uint32_t now, int& index, uint16_t seq) {
+  if (inFlight >= window || pending == 0) return false;
+
+  for (size_t n = 0; n < NODE_TABLE_CAPACITY; n++) {
+    size_t i = (cursor + n) % NODE_TABLE_CAPACITY;
+    PollState& poll = polls[i];
+    if (poll.state != PENDING) continue;
+
+    send(i, now, seq, 0);
+    cursor = (i + 1) % NODE_TABLE_CAPACITY;
+    index = i;
+    return true;
+  }
+  return false;
+}
+
+int TriggerEngine::peek() const {
+  if (inFlight >= window || pending == 0) return -1;
+
+  for (size_t n = 0; n < NODE_TABLE_CAPACITY; n++) {
+    size_t i = (cursor + n) % NODE_TABLE_CAPACITY;
+    if (polls[i].state == PENDING) return i;
+  }
+  return -1;
+}
+
+size_t TriggerEngine::nextGroup(uint32_t now, uint16_t seq, uint16_t slotMs,
+                                bool (*fits)(int first, int index), int* indices, size_t max) {
+  int first = peek();
+  if (first < 0 || max < 2 || !fits(first, first)) return 0;
+
+  size_t count = 0;
+  for (size_t n = 0; n < NODE_TABLE_CAPACITY && count < max; n++) {
+    size_t i = (first + n) % NODE_TABLE_CAPACITY;
+    if (polls[i].state == PENDING && fits(first, i)) indices[count++] = i;
+  }
+  if (count < 2) return 0;
+
+  for (size_t slot = 0; slot < count; slot++) {
+    send(indices[slot], now, seq, (slot + 1) * slotMs);
+  }
+  cursor = (indices[count - 1] + 1) % NODE_TABLE_CAPACITY;
+  stats.groups++;
+  return count;
+}
+
+void TriggerEngine::send(int index, uint32_t now, uint16_t seq, uint32_t slotDelay) {
+  PollState& poll = polls[index];
+  poll.state = IN_FLIGHT;
+  poll.grouped = slotDelay > 0;
+  poll.seq = seq;
+  poll.sentAt = now;
+  poll.attempts++;
+  poll.deadline = now + slotDelay + timeoutFor(index);
+  pending--;
+  inFlight++;
+  stats.sent++;
+  if (poll.attempts > 1) stats.retries++;
+}
+
+bool TriggerEngine::onReply(int index, uint16_t seq, uint32_t now, int32_t* rtt) {
+  if (index < 0 || polls[index].state != IN_FLIGHT || polls[index].seq != seq) {
+    stats.stale++;
+    return false;
+  }
+
+  PollState& poll = polls[index];
+  NodeInfo& node = table[index];
+
+  // Jacobson/Karels: srtt += err/8, rttvar += (|err| - rttvar)/4. Only
+  // first attempts are sampled so a late reply cannot skew the estimate.
+  if (rtt) *rtt = -1;
+  if (poll.attempts == 1 && !poll.grouped) {
+    int32_t sample = now - poll.sentAt;
+    if (rtt) *rtt = sample;
+    if (node.srtt == 0) {
+      node.srtt = sample;
+      node.rttvar = sample / 2;
+    } else {
+      int32_t err = sample - node.srtt;
+      node.srtt += err / 8;
+      node.rttvar += ((err < 0 ? -err : err) - node.rttvar) / 4;
+    }
+  }
+
+  poll.state = IDLE;
+  inFlight--;
+  stats.answered++;
+  return true;
+}
+
+void TriggerEngine::expire(uint32_t now) {
+  for (size_t i = 0; i < NODE_TABLE_CAPACITY; i++) {
+    PollState& poll = polls[i];
+    if (poll.state == IDLE || poll.state == PENDING) continue;
+    if (static_cast<int32_t>(now - poll.deadline) < 0) continue;
+
+    if (poll.state == IN_FLIGHT) {
+      inFlight--;
+      if (poll.attempts <= TRIGGER_MAX_RETRIES) {
+        poll.state = BACKOFF;
+        poll.deadline = now + timeoutFor(i) / 2;
+        waiting++;
+      } else {
+        poll.state = IDLE;
+        table[i].misses++;
+        stats.missed++;
+      }
+    } else {
+      poll.state = PENDING;
+      waiting--;
+      pending++;
+    }
+  }
+}
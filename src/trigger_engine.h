@@ -0,0 +1,106 @@
+#ifndef TRIGGER_ENGINE_H
+#define TRIGGER_ENGINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "node_table.h"
+
+#define TRIGGER_MAX_RETRIES 3
+
+// Unicast polls with several triggers in flight at once. Each node has its
+// own small state machine:
+//
+//   IDLE -> PENDING -> IN_FLIGHT -> IDLE       reply matched by node and seq
+//                          |
+//                          +-> BACKOFF -> PENDING   timeout, retries left
+//                          +-> IDLE                 retries used up, miss counted
+//
+// Timeouts adapt per node from measured round trips (smoothed RTT plus
+// four deviations, as in TCP), and double with every retry. Nodes are
+// addressed by their NodeTable index; the RTT estimate and miss count are
+// kept in the table entry.
+//
+// Where one frame can poll several nodes (a group trigger, replies in
+// slots), nextGroup() hands out a whole group under one seq instead.
+class TriggerEngine {
+public:
+  explicit TriggerEngine(NodeTable& table) : table(table) {}
+
+  struct Stats {
+    uint32_t sent;
+    uint32_t retries;
+    uint32_t answered;
+    uint32_t missed;
+    uint32_t stale; // replies that matched no outstanding trigger
+    uint32_t groups; // group triggers; their polls count in sent too
+  };
+
+  // window: triggers allowed in flight at once, sized from airtime.
+  // initialRtt seeds the estimate for nodes never measured.
+  void configure(uint8_t window, uint16_t initialRtt, uint16_t minTimeout, uint16_t maxTimeout);
+
+  // Requests a poll of the node at index
+  void request(int index);
+  // Drops any poll state of index, for a node leaving the table
+  void forget(int index);
+  // Drops all pending polls and in-flight triggers
+  void reset();
+
+  // Returns true with the node and seq to trigger when the window allows
+  // one more. The caller sends it and must call it again for the next.
+  bool next(uint32_t now, int& index, uint16_t seq);
+  // The node next() would hand out, -1 when it would not
+  int peek() const;
+  // Like next() for a group trigger: the node next() would hand out and
+  // up to max - 1 more pending ones that fits() accepts along with it go
+  // in flight under seq, listed in indices in slot order. The node in
+  // slot i answers (i + 1) * slotMs later than to a trigger of its own,
+  // so its timeout is that much longer and its reply is not sampled for
+  // the RTT. Returns the count, or 0 with nothing handed out when fewer
+  // than two would go.
+  size_t nextGroup(uint32_t now, uint16_t seq, uint16_t slotMs,
+                   bool (*fits)(int first, int index), int* indices, size_t max);
+  // Matches a reply to its trigger and feeds the RTT estimate. rtt, when
+  // given, gets the round trip in ms, or -1 for a reply to a retry, which
+  // could belong to any of the attempts, or to a group trigger.
+  bool onReply(int index, uint16_t seq, uint32_t now, int32_t* rtt = nullptr);
+  // Times out in-flight triggers and releases due retries
+  void expire(uint32_t now);
+
+  bool idle() const { return inFlight == 0 && pending == 0 && waiting == 0; }
+  // True when next() would hand out a trigger
+  bool ready() const { return inFlight < window && pending > 0; }
+  uint8_t outstanding() const { return inFlight; }
+  uint16_t timeoutFor(int index) const; // Current timeout, backoff included
+  const Stats& getStats() const { return stats; }
+
+private:
+  // PENDING -> IN_FLIGHT; slotDelay is how much later than to a trigger
+  // of its own the node answers
+  void send(int index, uint32_t now, uint16_t seq, uint32_t slotDelay);
+
+  enum State : uint8_t { IDLE, PENDING, IN_FLIGHT, BACKOFF };
+
+  struct PollState {
+    State state;
+    uint8_t attempts;
+    bool grouped; // Sent in a group trigger
+    uint16_t seq;
+    uint32_t sentAt;
+    uint32_t deadline; // timeout while IN_FLIGHT, retry time while BACKOFF
+  };
+
+  NodeTable& table;
+  PollState polls[NODE_TABLE_CAPACITY] = {};
+  size_t cursor = 0; // Round-robin start for next()
+  uint8_t inFlight = 0;
+  uint16_t pending = 0;
+  uint16_t waiting = 0; // Nodes in BACKOFF
+  uint8_t window = 1;
+  uint16_t initialRtt = 50;
+  uint16_t minTimeout = 20;
+  uint16_t maxTimeout = 1000;
+  Stats stats = {};
+};
+
+#endif
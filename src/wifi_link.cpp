@@ -0,0 +1,132 @@
+#include "wifi_link.h"
+#include "log.h"
+#include "hal.h"
+#include <time.h>
+
+// Defaults until other credentials are stored, override with -D
+#ifndef WIFI_SSID
+#define WIFI_SSID "MEO-563920"
+#endif
+#ifndef WIFI_PASSWORD
+#define WIFI_PASSWORD "346cbe99b8"
+#endif
+
+#define WIFI_NAMESPACE "wifi"
+#define NTP_SERVER "pool.ntp.org"
+
+void WifiLink::begin() {
+  Preferences prefs;
+  prefs.begin(WIFI_NAMESPACE, true);
+  if (prefs.getString("ssid", ssid, sizeof(ssid)) == 0) {
+    strncpy(ssid, WIFI_SSID, sizeof(ssid) - 1);
+    strncpy(password, WIFI_PASSWORD, sizeof(password) - 1);
+  } else {
+    prefs.getString("password", password, sizeof(password));
+  }
+  channel = prefs.getUChar("channel", 0);
+  if (prefs.getBytes("bssid", bssid, 6) != 6) channel = 0;
+  prefs.end();
+
+  WiFi.mode(WIFI_AP_STA);
+  WiFi.setAutoReconnect(false); // Reconnects go through update()
+  connect(channel != 0);
+}
+
+void WifiLink::connect(bool fast) {
+  WiFi.disconnect();
+  if (fast) {
+    WiFi.begin(ssid, password, channel, bssid, true);
+  } else {
+    WiFi.begin(ssid, password);
+  }
+  state = fast ? FAST : SCAN;
+  stateSince = millis();
+}
+
+void WifiLink::update() {
+  uint32_t now = millis();
+
+  switch (state) {
+    case FAST:
+    case SCAN:
+      if (WiFi.status() == WL_CONNECTED) {
+        onConnected();
+      } else if (now - stateSince >= (state == FAST ? WIFI_FAST_TIMEOUT : WIFI_SCAN_TIMEOUT)) {
+        if (state == FAST) {
+          LOG_W("⚠️ Cached access point not answering, scanning");
+          connect(false);
+        } else {
+          LOG_W("WiFi connection failed, retrying in %lu ms", (unsigned long)backoff);
+          WiFi.disconnect();
+          state = BACKOFF;
+          stateSince = now;
+        }
+      }
+      break;
+
+    case BACKOFF:
+      if (now - stateSince >= backoff) {
+        backoff = backoff * 2 > WIFI_BACKOFF_MAX ? WIFI_BACKOFF_MAX : backoff * 2;
+        connect(false);
+      }
+      break;
+
+    case CONNECTED:
+      if (WiFi.status() != WL_CONNECTED) {
+        stats.drops++;
+        LOG_W("⚠️ WiFi lost, reconnecting");
+        connect(channel != 0);
+      } else if (!timeSynced() && time(nullptr) > 1600000000) {
+        stats.timeSyncedAt = now;
+        LOG_I("Time synchronized %lu ms after reset", (unsigned long)now);
+      }
+      break;
+  }
+}
+
+void WifiLink::onConnected() {
+  uint32_t now = millis();
+  LOG_I("✔️ WiFi connected in %lu ms (%s), IP: %s, channel %d",
+        (unsigned long)(now - stateSince), state == FAST ? "cached" : "scan",
+        WiFi.localIP().toString().c_str(), (int)WiFi.channel());
+
+  state = CONNECTED;
+  backoff = WIFI_BACKOFF_MIN;
+  stats.connects++;
+  if (stats.firstConnectAt == 0) stats.firstConnectAt = now;
+
+  const uint8_t* current = WiFi.BSSID();
+  if (current != nullptr && (channel != WiFi.channel() || memcmp(bssid, current, 6) != 0)) {
+    saveAccessPoint();
+  }
+  // SNTP runs in the background from here; update() notices the sync
+  if (!timeSynced()) configTime(0, 0, NTP_SERVER);
+}
+
+void WifiLink::saveAccessPoint() {
+  memcpy(bssid, WiFi.BSSID(), 6);
+  channel = WiFi.channel();
+
+  Preferences prefs;
+  prefs.begin(WIFI_NAMESPACE, false);
+  prefs.putBytes("bssid", bssid, 6);
+  prefs.putUChar("channel", channel);
+  prefs.end();
+}
+
+void WifiLink::setCredentials(const char* newSsid, const char* newPassword) {
+  memset(ssid, 0, sizeof(ssid));
+  memset(password, 0, sizeof(password));
+  strncpy(ssid, newSsid, sizeof(ssid) - 1);
+  strncpy(password, newPassword, sizeof(password) - 1);
+  channel = 0;
+
+  Preferences prefs;
+  prefs.begin(WIFI_NAMESPACE, false);
+  prefs.putString("ssid", ssid);
+  prefs.putString("password", password);
+  prefs.putUChar("channel", 0);
+  prefs.end();
+
+  connect(false);
+}
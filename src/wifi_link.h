@@ -0,0 +1,66 @@
+#ifndef WIFI_LINK_H
+#define WIFI_LINK_H
+
+#include <stdint.h>
+
+#define WIFI_FAST_TIMEOUT 3000     // Reconnect to the cached BSSID and channel
+#define WIFI_SCAN_TIMEOUT 10000    // Full connect, the radio scans all channels
+#define WIFI_BACKOFF_MIN 1000
+#define WIFI_BACKOFF_MAX 60000
+
+// Station connection driven from the loop: update() never blocks, so radio
+// collection runs while WiFi comes up and while it reconnects.
+//
+//   FAST ----timeout---> SCAN ----timeout---> BACKOFF ---> SCAN ...
+//     \                   /
+//      +--> CONNECTED <--+        a drop goes back to FAST
+//
+// SSID, password and the last good BSSID/channel live in NVS. A warm boot
+// skips the scan and usually connects in well under a second. NTP is
+// started once connected and syncs in the background.
+//
+// ESP-NOW runs on the station interface. A full scan hops it over every
+// channel, so anything sent over ESP-NOW meanwhile goes out on whichever
+// channel the scan is on and replies are missed. The base holds its
+// ESP-NOW polls while scanning() (see Transport::sharesWifiRadio); FAST
+// stays on the cached channel and needs no such pause.
+class WifiLink {
+public:
+  enum State : uint8_t { FAST, SCAN, CONNECTED, BACKOFF };
+
+  struct Stats {
+    uint32_t connects;
+    uint32_t drops;
+    uint32_t firstConnectAt; // millis() at the first connect since reset, 0 before
+    uint32_t timeSyncedAt;   // millis() at the first NTP sync, 0 before
+  };
+
+  // Loads the config from NVS; the compiled-in defaults are used until
+  // setCredentials() stores others.
+  void begin();
+  void update();
+  // Stores new credentials, drops the cached BSSID and reconnects
+  void setCredentials(const char* ssid, const char* password);
+
+  bool connected() const { return state == CONNECTED; }
+  bool scanning() const { return state == SCAN; }
+  bool timeSynced() const { return stats.timeSyncedAt != 0; }
+  State getState() const { return state; }
+  const Stats& getStats() const { return stats; }
+
+private:
+  void connect(bool fast);
+  void onConnected();
+  void saveAccessPoint();
+
+  char ssid[33] = {0};
+  char password[65] = {0};
+  uint8_t bssid[6] = {0};
+  uint8_t channel = 0; // 0 when no access point is cached
+  State state = SCAN;
+  uint32_t stateSince = 0;
+  uint32_t backoff = WIFI_BACKOFF_MIN;
+  Stats stats = {};
+};
+
+#endif
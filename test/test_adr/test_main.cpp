@@ -0,0 +1,172 @@
+// ADR decisions fed with synthetic SNR series: the rate and TX power each
+// series earns, the dead band that keeps a node where it is, the order
+// pending until the node confirms with triggers alternating between both
+// rates, and the radio bytes a frame may carry.
+#include <unity.h>
+#include "adr.h"
+
+static AdrState adr;
+
+// Feeds a series of reply SNRs; true when the last one ordered a change
+// and none before it did
+static bool record(const int8_t* snr, int count) {
+  for (int i = 0; i < count - 1; i++) TEST_ASSERT_FALSE(adrRecord(adr, snr[i]));
+  return adrRecord(adr, snr[count - 1]);
+}
+
+// Puts the node on rate and power as if it had confirmed an order
+static void settle(uint8_t rate, uint8_t txPower) {
+  adrReset(adr);
+  adr.decided = true;
+  adrConfirm(adr, adrRadio(rate, txPower));
+  adr.targetRate = rate;
+  adr.targetPower = txPower;
+  TEST_ASSERT_FALSE(adrPending(adr));
+}
+
+static void assertTarget(uint8_t rate, uint8_t txPower) {
+  TEST_ASSERT_EQUAL_UINT8(rate, adr.targetRate);
+  TEST_ASSERT_EQUAL_UINT8(txPower, adr.targetPower);
+}
+
+void setUp() {
+  adrReset(adr);
+}
+
+void tearDown() {}
+
+// One reply at 0 dB leaves 9 dB over SF10's floor after the margin: enough
+// for SF7 at 125 kHz, not 250 kHz, and the power stays until more are in
+void test_first_reply_leaves_home() {
+  TEST_ASSERT_EQUAL_UINT8(LORA_HOME_RATE, adr.rate);
+  TEST_ASSERT_EQUAL_UINT8(ADR_MAX_TX_POWER, adr.txPower);
+  TEST_ASSERT_TRUE(adrRecord(adr, 0));
+  assertTarget(3, ADR_MAX_TX_POWER);
+  TEST_ASSERT_TRUE(adrPending(adr));
+  TEST_ASSERT_EQUAL_UINT8(LORA_HOME_RATE, adr.rate); // Not before the node confirms
+}
+
+// The best reply of the history decides; what is left after the rate
+// steps goes on lower power
+void test_history_lowers_rate_then_power() {
+  settle(3, ADR_MAX_TX_POWER);
+  const int8_t snr[ADR_HISTORY] = {-2, 1, 5, 3, 0, -1};
+  TEST_ASSERT_TRUE(record(snr, ADR_HISTORY));
+  assertTarget(4, ADR_MAX_TX_POWER - ADR_POWER_STEP);
+}
+
+// Strong replies run into the fastest rate and the lowest power
+void test_limits_hold() {
+  settle(ADR_MAX_RATE, ADR_MAX_TX_POWER);
+  const int8_t strong[ADR_HISTORY] = {20, 20, 20, 20, 20, 20};
+  TEST_ASSERT_TRUE(record(strong, ADR_HISTORY));
+  assertTarget(ADR_MAX_RATE, ADR_MAX_TX_POWER - 5 * ADR_POWER_STEP);
+  TEST_ASSERT_GREATER_OR_EQUAL(ADR_MIN_TX_POWER, adr.targetPower);
+
+  // And weak ones into the home rate at full power, with nothing to order
+  settle(LORA_HOME_RATE, ADR_MAX_TX_POWER);
+  const int8_t weak[ADR_HISTORY] = {-20, -20, -20, -20, -20, -20};
+  TEST_ASSERT_FALSE(record(weak, ADR_HISTORY));
+  TEST_ASSERT_FALSE(adrPending(adr));
+}
+
+// At SF7 a best SNR of -1 dB leaves 0.5 dB over floor and margin: less than
+// a power step, so nothing changes. 1 dB less and the node goes back to SF8.
+void test_dead_band() {
+  settle(3, ADR_MAX_TX_POWER);
+  const int8_t hold[ADR_HISTORY] = {-4, -1, -3, -2, -1, -5};
+  TEST_ASSERT_FALSE(record(hold, ADR_HISTORY));
+  TEST_ASSERT_FALSE(adrPending(adr));
+  // Again with the same series: still no order
+  TEST_ASSERT_FALSE(record(hold, ADR_HISTORY));
+
+  const int8_t drop[ADR_HISTORY] = {-4, -2, -3, -2, -3, -5};
+  TEST_ASSERT_TRUE(record(drop, ADR_HISTORY));
+  assertTarget(2, ADR_MAX_TX_POWER);
+}
+
+// Falling SNR takes power back before it gives up rate
+void test_fade_restores_power_first() {
+  settle(4, 8);
+  const int8_t dip[ADR_HISTORY] = {-3, -3, -4, -3, -5, -3};
+  TEST_ASSERT_TRUE(record(dip, ADR_HISTORY));
+  assertTarget(4, 8 + ADR_POWER_STEP);
+
+  settle(4, 8);
+  const int8_t fade[ADR_HISTORY] = {-12, -13, -12, -14, -12, -12};
+  TEST_ASSERT_TRUE(record(fade, ADR_HISTORY));
+  assertTarget(3, ADR_MAX_TX_POWER);
+}
+
+// Until the node says it switched, triggers alternate between the rate it
+// is on and the ordered one; confirming the old setting changes nothing
+void test_pending_order_until_confirmed() {
+  TEST_ASSERT_TRUE(adrRecord(adr, 0));
+  const uint8_t expected[] = {LORA_HOME_RATE, 3, LORA_HOME_RATE, 3};
+  for (uint8_t rate : expected) TEST_ASSERT_EQUAL_UINT8(rate, adrNextRate(adr));
+
+  TEST_ASSERT_FALSE(adrConfirm(adr, adrRadio(LORA_HOME_RATE, ADR_MAX_TX_POWER)));
+  TEST_ASSERT_TRUE(adrPending(adr));
+
+  TEST_ASSERT_TRUE(adrConfirm(adr, adrRadio(3, ADR_MAX_TX_POWER)));
+  TEST_ASSERT_FALSE(adrPending(adr));
+  TEST_ASSERT_EQUAL_UINT8(3, adr.rate);
+  for (int i = 0; i < 3; i++) TEST_ASSERT_EQUAL_UINT8(3, adrNextRate(adr));
+  TEST_ASSERT_FALSE(adrConfirm(adr, adrRadio(3, ADR_MAX_TX_POWER))); // Not news twice
+}
+
+// Replies measured before the switch do not count towards the new setting
+void test_confirm_restarts_history() {
+  TEST_ASSERT_TRUE(adrRecord(adr, 0));
+  const int8_t early[ADR_HISTORY - 1] = {10, 10, 10, 10, 10};
+  for (int8_t snr : early) TEST_ASSERT_FALSE(adrRecord(adr, snr));
+  TEST_ASSERT_TRUE(adrConfirm(adr, adrRadio(3, ADR_MAX_TX_POWER)));
+
+  const int8_t hold[ADR_HISTORY] = {-1, -1, -1, -1, -1, -1};
+  TEST_ASSERT_FALSE(record(hold, ADR_HISTORY));
+  TEST_ASSERT_FALSE(adrPending(adr));
+}
+
+// A second order before the first was confirmed starts alternating afresh
+void test_new_order_while_pending() {
+  TEST_ASSERT_TRUE(adrRecord(adr, 0));
+  TEST_ASSERT_EQUAL_UINT8(LORA_HOME_RATE, adrNextRate(adr));
+  const int8_t weaker[ADR_HISTORY] = {-5, -5, -5, -5, -5, -5};
+  TEST_ASSERT_TRUE(record(weaker, ADR_HISTORY));
+  assertTarget(1, ADR_MAX_TX_POWER);
+  TEST_ASSERT_EQUAL_UINT8(LORA_HOME_RATE, adrNextRate(adr));
+  TEST_ASSERT_EQUAL_UINT8(1, adrNextRate(adr));
+}
+
+void test_radio_valid_bounds() {
+  TEST_ASSERT_FALSE(adrRadioValid(0));
+  TEST_ASSERT_TRUE(adrRadioValid(adrRadio(LORA_HOME_RATE, ADR_MIN_TX_POWER)));
+  TEST_ASSERT_TRUE(adrRadioValid(adrRadio(ADR_MAX_RATE, ADR_MAX_TX_POWER)));
+  TEST_ASSERT_FALSE(adrRadioValid(adrRadio(ADR_MAX_RATE + 1, ADR_MAX_TX_POWER)));
+  TEST_ASSERT_FALSE(adrRadioValid(adrRadio(7, ADR_MAX_TX_POWER)));
+  TEST_ASSERT_FALSE(adrRadioValid(adrRadio(LORA_HOME_RATE, ADR_MIN_TX_POWER - 1)));
+  TEST_ASSERT_FALSE(adrRadioValid(adrRadio(LORA_HOME_RATE, ADR_MAX_TX_POWER + 1)));
+
+  // Every byte, against the fields it packs
+  for (int radio = 0; radio < 256; radio++) {
+    int rate = adrRadioRate(radio);
+    int power = adrRadioPower(radio);
+    bool valid = rate >= LORA_HOME_RATE && rate <= ADR_MAX_RATE &&
+                 power >= ADR_MIN_TX_POWER && power <= ADR_MAX_TX_POWER;
+    TEST_ASSERT_EQUAL(valid, adrRadioValid(radio));
+  }
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_first_reply_leaves_home);
+  RUN_TEST(test_history_lowers_rate_then_power);
+  RUN_TEST(test_limits_hold);
+  RUN_TEST(test_dead_band);
+  RUN_TEST(test_fade_restores_power_first);
+  RUN_TEST(test_pending_order_until_confirmed);
+  RUN_TEST(test_confirm_restarts_history);
+  RUN_TEST(test_new_order_while_pending);
+  RUN_TEST(test_radio_valid_bounds);
+  return UNITY_END();
+}
@@ -0,0 +1,195 @@
+// Compact upload body: encode then decode gives back every reading, also
+// resent ones whose receive time runs backwards, seqs wrapping at 0xFFFF
+// and values at the ends of the int32 range.
+#include <unity.h>
+#include <stdint.h>
+#include <string.h>
+#include "batch_codec.h"
+
+static uint8_t body[READING_JSON_BODY_SIZE];
+static ReadingStore batch;
+static ReadingStore decoded;
+
+static Reading reading(uint8_t node, uint16_t seq, int32_t value, uint32_t receivedAt) {
+  Reading r = {};
+  const uint8_t mac[6] = {0x24, 0x6F, 0x28, 0x10, 0x00, node};
+  memcpy(r.mac, mac, 6);
+  r.nodeId = node;
+  r.seq = seq;
+  r.value = value;
+  r.receivedAt = receivedAt;
+  return r;
+}
+
+// Encodes the batch, decodes it and checks the readings come back grouped
+// by node in order of first appearance, arrival order kept within a node
+static size_t roundTrip() {
+  size_t len = encodeCompactBatch(batch, body, sizeof(body));
+  TEST_ASSERT_GREATER_THAN(0, len);
+  TEST_ASSERT_TRUE(decodeCompactBatch(body, len, decoded));
+  TEST_ASSERT_EQUAL(batch.size(), decoded.size());
+
+  bool done[READING_STORE_CAPACITY] = {};
+  size_t out = 0;
+  for (size_t i = 0; i < batch.size(); i++) {
+    if (done[i]) continue;
+    for (size_t j = i; j < batch.size(); j++) {
+      if (done[j] || memcmp(batch[j].mac, batch[i].mac, 6) != 0) continue;
+      done[j] = true;
+      const Reading& want = batch[j];
+      const Reading& got = decoded[out++];
+      TEST_ASSERT_EQUAL_HEX8_ARRAY(want.mac, got.mac, 6);
+      TEST_ASSERT_EQUAL_UINT16(want.seq, got.seq);
+      TEST_ASSERT_EQUAL_INT32(want.value, got.value);
+      TEST_ASSERT_EQUAL_UINT32(want.receivedAt, got.receivedAt);
+      TEST_ASSERT_EQUAL_UINT32(want.epoch, got.epoch);
+    }
+  }
+  return len;
+}
+
+void setUp() {
+  batch.clear();
+  decoded.clear();
+}
+
+void tearDown() {}
+
+void test_empty_batch() {
+  TEST_ASSERT_EQUAL(6, roundTrip()); // Magic, version, two zero refs, no groups
+}
+
+// A sweep: nodes interleaved, steady slot spacing, consecutive seqs
+void test_interleaved_nodes() {
+  uint32_t t = 5000;
+  for (uint16_t round = 0; round < 20; round++) {
+    for (uint8_t node = 1; node <= 5; node++) {
+      batch.add(reading(node, 100 + round, 2000 + node * 37 + round % 3, t));
+      t += 50;
+    }
+  }
+  size_t len = roundTrip();
+  // After each node's first reading, one byte each for time, value and seq
+  TEST_ASSERT_LESS_OR_EQUAL(6 + 5 * (6 + 1 + 7) + 95 * 3, len);
+}
+
+// A node's backlog resent with a live reading: receivedAt is set back by
+// the age of each resent one, so it jumps back and then forward again
+void test_resent_readings_run_backwards() {
+  batch.add(reading(1, 10, 500, 100000));
+  batch.add(reading(2, 40, -7, 100020));
+  batch.add(reading(1, 11, 501, 100250));
+  batch.add(reading(1, 7, 480, 99250));   // Resent, older than the first
+  batch.add(reading(1, 8, 485, 99500));
+  batch.add(reading(1, 9, 490, 99750));
+  batch.add(reading(2, 38, -9, 98000));   // Seq behind too
+  batch.add(reading(1, 12, 502, 100500));
+  batch.add(reading(2, 41, -6, 100520));
+  roundTrip();
+}
+
+void test_seq_wraps_at_0xffff() {
+  uint16_t seqs[] = {0xFFFD, 0xFFFE, 0xFFFF, 0, 1, 0xFFFF, 2, 0x8000, 3};
+  uint32_t t = 1000;
+  for (uint16_t seq : seqs) {
+    batch.add(reading(3, seq, seq, t));
+    t += 100;
+  }
+  batch.add(reading(4, 0xFFFF, 1, 2000)); // Wraps right after a group's first reading
+  batch.add(reading(4, 0, 2, 2100));
+  roundTrip();
+}
+
+void test_extreme_values_and_millis_wrap() {
+  batch.add(reading(1, 1, INT32_MAX, 0xFFFFFF00));
+  batch.add(reading(1, 2, INT32_MIN, 0xFFFFFFF0));
+  batch.add(reading(1, 3, INT32_MAX, 0x00000010)); // millis() wrapped
+  batch.add(reading(1, 4, 0, 0x00000000));
+  batch.add(reading(2, 1, INT32_MIN, 0));
+  batch.add(reading(2, 2, -1, 0x7FFFFFFF));
+  roundTrip();
+}
+
+// Unix time is carried once; each reading gets it back from its receive
+// time, also readings from before the reference point
+void test_epoch_from_reference() {
+  uint32_t refEpoch = 1760000000;
+  uint32_t refMillis = 50000;
+  uint32_t times[] = {50000, 52500, 41000, 60999, 50000 - 999};
+  for (int i = 0; i < 5; i++) {
+    Reading r = reading(static_cast<uint8_t>(1 + i % 2), static_cast<uint16_t>(i), i, times[i]);
+    int32_t sinceRef = static_cast<int32_t>(times[i] - refMillis);
+    r.epoch = refEpoch + sinceRef / 1000;
+    batch.add(r);
+  }
+  roundTrip();
+
+  // Before NTP sync no reading has an epoch and none comes back with one
+  batch.clear();
+  batch.add(reading(1, 1, 1, 1000));
+  batch.add(reading(1, 2, 2, 2000));
+  roundTrip();
+}
+
+void test_full_batch() {
+  uint32_t t = 0;
+  for (uint16_t i = 0; !batch.full(); i++) {
+    uint8_t node = static_cast<uint8_t>(i % 50);
+    t += 40 + (i * 7) % 20;
+    batch.add(reading(node, static_cast<uint16_t>(0xFFF0 + i / 50), i * 1000 - 60000, t));
+  }
+  roundTrip();
+}
+
+void test_out_too_small() {
+  for (uint8_t node = 1; node <= 10; node++) batch.add(reading(node, 1, 1, 1000));
+  size_t len = encodeCompactBatch(batch, body, sizeof(body));
+  TEST_ASSERT_EQUAL(0, encodeCompactBatch(batch, body, len - 1));
+  TEST_ASSERT_EQUAL(len, encodeCompactBatch(batch, body, len));
+}
+
+void test_malformed_input_rejected() {
+  for (int i = 0; i < 10; i++) batch.add(reading(1, static_cast<uint16_t>(i), i * 300, i * 1000));
+  size_t len = encodeCompactBatch(batch, body, sizeof(body));
+
+  // Cut anywhere short of the end
+  for (size_t cut = 0; cut < len; cut++) {
+    TEST_ASSERT_FALSE(decodeCompactBatch(body, cut, decoded));
+  }
+
+  uint8_t bad[sizeof(body)];
+  memcpy(bad, body, len);
+  bad[0] = 'X';
+  TEST_ASSERT_FALSE(decodeCompactBatch(bad, len, decoded));
+  memcpy(bad, body, len);
+  bad[2] = BATCH_COMPACT_VERSION + 1;
+  TEST_ASSERT_FALSE(decodeCompactBatch(bad, len, decoded));
+
+  // More readings than a store holds
+  const uint8_t tooMany[] = {'V', 'B', BATCH_COMPACT_VERSION, 0, 0, 1,
+                             1, 2, 3, 4, 5, 6, 0x81, 0x01}; // 129 readings
+  uint8_t big[sizeof(tooMany) + 3 * 129];
+  memset(big, 0, sizeof(big));
+  memcpy(big, tooMany, sizeof(tooMany));
+  TEST_ASSERT_FALSE(decodeCompactBatch(big, sizeof(big), decoded));
+
+  // A reference time of 32 bits decodes, one that needs more does not
+  uint8_t wide[] = {'V', 'B', BATCH_COMPACT_VERSION, 0xFF, 0xFF, 0xFF, 0xFF, 0x0F, 0, 0};
+  TEST_ASSERT_TRUE(decodeCompactBatch(wide, sizeof(wide), decoded));
+  wide[7] = 0x1F;
+  TEST_ASSERT_FALSE(decodeCompactBatch(wide, sizeof(wide), decoded));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_empty_batch);
+  RUN_TEST(test_interleaved_nodes);
+  RUN_TEST(test_resent_readings_run_backwards);
+  RUN_TEST(test_seq_wraps_at_0xffff);
+  RUN_TEST(test_extreme_values_and_millis_wrap);
+  RUN_TEST(test_epoch_from_reference);
+  RUN_TEST(test_full_batch);
+  RUN_TEST(test_out_too_small);
+  RUN_TEST(test_malformed_input_rejected);
+  return UNITY_END();
+}
@@ -0,0 +1,250 @@
+// BatchLog on a plain file: what a restart finds after torn writes, a
+// wrapped ring and an ack watermark that never made it to flash. Closing
+// and reopening the log stands in for a reset.
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include "batch_log.h"
+
+#define LOG_PATH "test_batch_log.bin"
+
+static BatchLog batchLog;
+
+// Batch n holds n % 7 + 1 readings whose values say which batch they are
+static void fillBatch(ReadingStore& batch, uint32_t n) {
+  batch.clear();
+  for (uint32_t i = 0; i < n % 7 + 1; i++) {
+    Reading r = {};
+    r.nodeId = static_cast<uint16_t>(i + 1);
+    r.seq = static_cast<uint16_t>(n);
+    r.value = static_cast<int32_t>(n * 1000 + i);
+    r.receivedAt = n * 10;
+    batch.add(r);
+  }
+}
+
+static void appendBatches(uint32_t from, uint32_t to) {
+  ReadingStore batch;
+  for (uint32_t n = from; n <= to; n++) {
+    fillBatch(batch, n);
+    TEST_ASSERT_TRUE(batchLog.append(batch, n * 10));
+  }
+}
+
+static void restart() {
+  batchLog.close();
+  TEST_ASSERT_TRUE(batchLog.open(LOG_PATH));
+}
+
+// Peeks and acks everything pending; returns the seqs seen, checking
+// each batch's contents against the one appended under that seq
+static std::vector<uint32_t> drain() {
+  std::vector<uint32_t> seqs;
+  ReadingStore batch, expected;
+  uint32_t seq, createdAt;
+  while (batchLog.peek(batch, seq, createdAt)) {
+    fillBatch(expected, seq);
+    TEST_ASSERT_EQUAL(expected.size(), batch.size());
+    for (size_t i = 0; i < batch.size(); i++) {
+      TEST_ASSERT_EQUAL_INT32(expected[i].value, batch[i].value);
+    }
+    TEST_ASSERT_EQUAL_UINT32(seq * 10, createdAt);
+    seqs.push_back(seq);
+    batchLog.ack(seq);
+  }
+  return seqs;
+}
+
+static std::vector<uint32_t> range(uint32_t from, uint32_t to) {
+  std::vector<uint32_t> seqs;
+  for (uint32_t n = from; n <= to; n++) seqs.push_back(n);
+  return seqs;
+}
+
+static void assertSeqs(const std::vector<uint32_t>& expected, const std::vector<uint32_t>& got) {
+  TEST_ASSERT_EQUAL(expected.size(), got.size());
+  for (size_t i = 0; i < expected.size(); i++) TEST_ASSERT_EQUAL_UINT32(expected[i], got[i]);
+}
+
+// File offset of the slot holding seq, found by its header
+static long slotOffset(uint32_t seq) {
+  FILE* file = fopen(LOG_PATH, "rb");
+  TEST_ASSERT_NOT_NULL(file);
+  uint32_t words[2];
+  long offset = -1;
+  for (long pos = 0; offset < 0 && fseek(file, pos, SEEK_SET) == 0 &&
+                     fread(words, sizeof(words), 1, file) == 1; pos += 4) {
+    if (words[0] == BATCH_LOG_MAGIC && words[1] == seq) offset = pos;
+  }
+  fclose(file);
+  TEST_ASSERT_GREATER_OR_EQUAL(0, offset);
+  return offset;
+}
+
+static long slotSize() {
+  return slotOffset(2) - slotOffset(1);
+}
+
+// Where the slot's records start, after its header
+static long recordsOffset(uint32_t seq) {
+  return slotOffset(seq) + slotSize() - static_cast<long>(sizeof(Reading)) * READING_STORE_CAPACITY;
+}
+
+static void corruptByte(long offset) {
+  FILE* file = fopen(LOG_PATH, "r+b");
+  uint8_t b;
+  fseek(file, offset, SEEK_SET);
+  TEST_ASSERT_EQUAL(1, fread(&b, 1, 1, file));
+  b ^= 0xFF;
+  fseek(file, offset, SEEK_SET);
+  fwrite(&b, 1, 1, file);
+  fclose(file);
+}
+
+void setUp() {
+  batchLog.close();
+  batchLog = BatchLog(); // Fresh stats
+  remove(LOG_PATH);
+  TEST_ASSERT_TRUE(batchLog.open(LOG_PATH));
+}
+
+void tearDown() {
+  batchLog.close();
+  remove(LOG_PATH);
+}
+
+void test_backlog_survives_restart() {
+  appendBatches(1, 5);
+  ReadingStore batch;
+  uint32_t seq, createdAt;
+  TEST_ASSERT_TRUE(batchLog.peek(batch, seq, createdAt));
+  batchLog.ack(seq);
+  appendBatches(6, 6); // Persists the ack of 1
+
+  restart();
+  TEST_ASSERT_EQUAL_UINT32(5, batchLog.pending());
+  TEST_ASSERT_EQUAL_UINT32(2, batchLog.oldestPending());
+  assertSeqs(range(2, 6), drain());
+  TEST_ASSERT_EQUAL_UINT32(0, batchLog.pending());
+  TEST_ASSERT_EQUAL_UINT32(0, batchLog.oldestPending());
+}
+
+void test_empty_log_numbers_from_start_seq() {
+  batchLog.close();
+  remove(LOG_PATH);
+  TEST_ASSERT_TRUE(batchLog.open(LOG_PATH, 1000));
+  TEST_ASSERT_EQUAL_UINT32(0, batchLog.pending());
+  ReadingStore batch;
+  fillBatch(batch, 1);
+  TEST_ASSERT_TRUE(batchLog.append(batch, 10));
+  TEST_ASSERT_EQUAL_UINT32(1001, batchLog.oldestPending());
+
+  // A log with batches in it keeps its own numbering
+  batchLog.close();
+  TEST_ASSERT_TRUE(batchLog.open(LOG_PATH, 5000));
+  TEST_ASSERT_EQUAL_UINT32(1001, batchLog.oldestPending());
+}
+
+// Reset while a slot at the end of the file was being written: its header
+// made it, the records did not
+void test_torn_write_at_end_of_file() {
+  appendBatches(1, 3);
+  long cut = recordsOffset(3) + 10;
+  batchLog.close();
+  FILE* file = fopen(LOG_PATH, "r+b");
+  TEST_ASSERT_EQUAL_INT(0, ftruncate(fileno(file), cut));
+  fclose(file);
+
+  restart();
+  TEST_ASSERT_EQUAL_UINT32(3, batchLog.pending());
+  assertSeqs(range(1, 2), drain());
+  TEST_ASSERT_EQUAL_UINT32(1, batchLog.getStats().errors);
+  TEST_ASSERT_EQUAL_UINT32(0, batchLog.pending());
+
+  // Appends carry on after the torn slot
+  appendBatches(4, 4);
+  restart();
+  assertSeqs(range(4, 4), drain());
+}
+
+// Reset while a slot was being overwritten: new header, records partly
+// the new batch and partly the old one. The batch is skipped, the ones
+// around it are not.
+void test_torn_overwrite_in_the_middle() {
+  appendBatches(1, 4);
+  batchLog.close();
+  corruptByte(recordsOffset(2));
+
+  restart();
+  assertSeqs({1, 3, 4}, drain());
+  TEST_ASSERT_EQUAL_UINT32(1, batchLog.getStats().errors);
+}
+
+// More batches than slots: the oldest were overwritten, the scan finds
+// the newest and the oldest still on flash, and replay starts there
+void test_restart_scan_with_wrapped_ring() {
+  uint32_t last = BATCH_LOG_SLOTS + 9;
+  appendBatches(1, last);
+  TEST_ASSERT_EQUAL_UINT32(9, batchLog.getStats().overwritten);
+  TEST_ASSERT_EQUAL_UINT32(BATCH_LOG_SLOTS, batchLog.pending());
+
+  restart();
+  TEST_ASSERT_EQUAL_UINT32(BATCH_LOG_SLOTS, batchLog.pending());
+  TEST_ASSERT_EQUAL_UINT32(10, batchLog.oldestPending());
+
+  // Ack part of the way around, then persist it with an append that
+  // wraps once more
+  ReadingStore batch;
+  uint32_t seq, createdAt;
+  for (int i = 0; i < 20; i++) {
+    TEST_ASSERT_TRUE(batchLog.peek(batch, seq, createdAt));
+    batchLog.ack(seq);
+  }
+  TEST_ASSERT_EQUAL_UINT32(29, seq);
+  appendBatches(last + 1, last + 3);
+
+  restart();
+  TEST_ASSERT_EQUAL_UINT32(30, batchLog.oldestPending());
+  assertSeqs(range(30, last + 3), drain());
+  TEST_ASSERT_EQUAL_UINT32(0, batchLog.getStats().errors);
+}
+
+// The watermark only reaches flash with the next append: acks since then
+// are lost in a reset and those batches are replayed, never dropped
+void test_ack_watermark_lost_before_next_append() {
+  appendBatches(1, 5);
+  ReadingStore batch;
+  uint32_t seq, createdAt;
+  for (int i = 0; i < 3; i++) {
+    TEST_ASSERT_TRUE(batchLog.peek(batch, seq, createdAt));
+    batchLog.ack(seq);
+  }
+  TEST_ASSERT_EQUAL_UINT32(2, batchLog.pending());
+
+  restart();
+  TEST_ASSERT_EQUAL_UINT32(5, batchLog.pending());
+  assertSeqs(range(1, 5), drain());
+
+  // Acked, then persisted by an append before the reset
+  restart();
+  for (int i = 0; i < 3; i++) {
+    TEST_ASSERT_TRUE(batchLog.peek(batch, seq, createdAt));
+    batchLog.ack(seq);
+  }
+  appendBatches(6, 6);
+  restart();
+  assertSeqs(range(4, 6), drain());
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_backlog_survives_restart);
+  RUN_TEST(test_empty_log_numbers_from_start_seq);
+  RUN_TEST(test_torn_write_at_end_of_file);
+  RUN_TEST(test_torn_overwrite_in_the_middle);
+  RUN_TEST(test_restart_scan_with_wrapped_ring);
+  RUN_TEST(test_ack_watermark_lost_before_next_append);
+  return UNITY_END();
+}
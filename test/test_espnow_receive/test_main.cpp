@@ -0,0 +1,195 @@
+// ESP-NOW readings from frame to batch: a reading names its node by id
+// only, so one whose id is unknown, taken by another MAC or homed on the
+// other radio is dropped as invalid and leaves the node's dedup window,
+// settled seqs and polls alone. Also, a node that leaves the table or
+// joins over the other radio gives up its ESP-NOW peer entry.
+#include <unity.h>
+#include <string.h>
+#include "hal.h"
+#include "base_espnow.h"
+
+#define NODE_ID 0x0101
+#define OTHER_ID 0x0202
+
+// The other radio of a two-radio base; never sends anything here
+class StubTransport : public Transport {
+public:
+  void begin() override {}
+  CaptureRadio captureRadio() const override { return CAPTURE_LORA; }
+
+protected:
+  void sendBroadcast(const uint8_t* frame, size_t len) override {}
+  bool sendTrigger(uint16_t nodeId, uint16_t seq) override { return false; }
+};
+
+// Exposes the unicast trigger, which registers the node as a peer
+class TestEspNow : public EspNowTransport {
+public:
+  using EspNowTransport::sendTrigger;
+};
+
+// Sent frames go nowhere
+class NullBackend : public HalBackend {
+public:
+  void espNowSend(const uint8_t* dest, const uint8_t* data, size_t len) override {}
+  void loraSend(const uint8_t* data, size_t len, uint32_t airtimeUs, int spreadingFactor,
+                long bandwidth) override {}
+  bool httpConnect(const char* host, uint16_t port) override { return false; }
+  int httpPost(const char* host, const char* path, const char* contentType,
+               const char* idempotencyKey, const uint8_t* body, size_t len,
+               std::string& response) override {
+    return -1;
+  }
+};
+
+// Exposes the loop-side steps to the test
+class TestBase : public Base {
+public:
+  using Base::addNode;
+  using Base::removeNode;
+  using Base::processJoins;
+  using Base::processMessageQueue;
+  using Base::readings;
+  using Base::nodes;
+};
+
+static TestBase base;
+static TestEspNow espNow;
+static StubTransport other;
+static NullBackend backend;
+
+static const uint8_t nodeMac[6] = {0x24, 0x6F, 0x28, 0x10, 0x00, 0x01};
+static const uint8_t otherMac[6] = {0x24, 0x6F, 0x28, 0x10, 0x00, 0x02};
+static const uint8_t strangerMac[6] = {0x24, 0x6F, 0x28, 0x10, 0x00, 0x03};
+
+// Sends a reading frame over ESP-NOW and drains the queues into the batch;
+// resent is the seq of one reading resent with it, 0 for none
+static void receive(const uint8_t* mac, uint16_t nodeId, uint16_t seq, uint16_t resent = 0) {
+  ReadingFrame reading = {};
+  reading.nodeId = nodeId;
+  reading.seq = seq;
+  reading.value = seq * 10;
+  if (resent != 0) {
+    reading.resentCount = 1;
+    reading.resent[0].seq = resent;
+    reading.resent[0].value = resent * 10;
+    reading.resent[0].ageMs = 1000;
+  }
+  uint8_t frame[FRAME_MAX_SIZE];
+  size_t len = encodeReading(frame, sizeof(frame), reading);
+  TEST_ASSERT_GREATER_THAN(0, len);
+  halNativeEspNowReceive(mac, frame, len);
+  base.processMessageQueue();
+}
+
+static uint32_t invalidFrames() {
+  static MetricsSnapshot snap;
+  Base::getMetrics().snapshot(snap, millis());
+  return snap.counters[METRIC_FRAMES_INVALID];
+}
+
+// True when the batch holds the node's reading seq
+static bool stored(uint16_t nodeId, uint16_t seq) {
+  for (size_t i = 0; i < TestBase::readings->size(); i++) {
+    const Reading& r = (*TestBase::readings)[i];
+    if (r.nodeId == nodeId && r.seq == seq) return true;
+  }
+  return false;
+}
+
+void setUp() {
+  TestBase::readings->clear();
+  TestBase::nodes.clear();
+  int index = TestBase::addNode(nodeMac, NODE_ID);
+  TEST_ASSERT_GREATER_OR_EQUAL(0, index);
+  TestBase::nodes[index].transport = 0;
+  index = TestBase::addNode(otherMac, OTHER_ID);
+  TEST_ASSERT_GREATER_OR_EQUAL(0, index);
+  TestBase::nodes[index].transport = 1;
+}
+
+void tearDown() {}
+
+void test_reading_from_known_node_stored() {
+  uint32_t invalid = invalidFrames();
+  receive(nodeMac, NODE_ID, 5, 4);
+  TEST_ASSERT_TRUE(stored(NODE_ID, 4));
+  TEST_ASSERT_TRUE(stored(NODE_ID, 5));
+  TEST_ASSERT_EQUAL(2, TestBase::readings->size());
+  TEST_ASSERT_EQUAL_UINT32(invalid, invalidFrames());
+
+  // The same seq again is a duplicate, not an invalid frame
+  receive(nodeMac, NODE_ID, 5);
+  TEST_ASSERT_EQUAL(2, TestBase::readings->size());
+  TEST_ASSERT_EQUAL_UINT32(invalid, invalidFrames());
+}
+
+void test_unknown_id_dropped() {
+  uint32_t invalid = invalidFrames();
+  receive(strangerMac, 0x0303, 1);
+  TEST_ASSERT_EQUAL(0, TestBase::readings->size());
+  TEST_ASSERT_EQUAL_UINT32(invalid + 1, invalidFrames());
+}
+
+// A node that still uses an id the base has since given to another MAC
+void test_id_held_by_other_mac_dropped() {
+  receive(nodeMac, NODE_ID, 10);
+  uint32_t invalid = invalidFrames();
+  receive(strangerMac, NODE_ID, 20, 14); // Would settle 11 to 13
+  TEST_ASSERT_EQUAL(1, TestBase::readings->size());
+  TEST_ASSERT_EQUAL_UINT32(invalid + 2, invalidFrames());
+
+  // The real node's window was not touched: 20 is not held, 12 not settled
+  receive(nodeMac, NODE_ID, 20);
+  receive(nodeMac, NODE_ID, 12);
+  TEST_ASSERT_TRUE(stored(NODE_ID, 20));
+  TEST_ASSERT_TRUE(stored(NODE_ID, 12));
+  TEST_ASSERT_EQUAL_UINT32(invalid + 2, invalidFrames());
+}
+
+// A node that moved to the other radio and is still heard on this one
+void test_node_on_other_radio_dropped() {
+  uint32_t invalid = invalidFrames();
+  receive(otherMac, OTHER_ID, 7);
+  TEST_ASSERT_EQUAL(0, TestBase::readings->size());
+  TEST_ASSERT_EQUAL_UINT32(invalid + 1, invalidFrames());
+
+  // Back on this radio, the same reading is new to the base
+  TestBase::nodes[TestBase::nodes.findId(OTHER_ID)].transport = 0;
+  receive(otherMac, OTHER_ID, 7);
+  TEST_ASSERT_TRUE(stored(OTHER_ID, 7));
+  TEST_ASSERT_EQUAL_UINT32(invalid + 1, invalidFrames());
+}
+
+void test_removed_node_gives_up_peer() {
+  TEST_ASSERT_TRUE(espNow.sendTrigger(NODE_ID, 1));
+  TEST_ASSERT_TRUE(esp_now_is_peer_exist(nodeMac));
+  TestBase::removeNode(TestBase::nodes.findId(NODE_ID));
+  TEST_ASSERT_FALSE(esp_now_is_peer_exist(nodeMac));
+}
+
+void test_node_moving_to_other_radio_gives_up_peer() {
+  TEST_ASSERT_TRUE(espNow.sendTrigger(NODE_ID, 1));
+  TEST_ASSERT_TRUE(esp_now_is_peer_exist(nodeMac));
+  other.enqueueJoin(nodeMac, NODE_ID, -1);
+  base.processJoins(other);
+  TEST_ASSERT_EQUAL_UINT8(1, TestBase::nodes[TestBase::nodes.findId(NODE_ID)].transport);
+  TEST_ASSERT_FALSE(esp_now_is_peer_exist(nodeMac));
+}
+
+int main(int argc, char** argv) {
+  HalNativeConfig hal;
+  halNativeBegin(&backend, hal);
+  base.addTransport(espNow);
+  base.addTransport(other);
+  espNow.begin();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_reading_from_known_node_stored);
+  RUN_TEST(test_unknown_id_dropped);
+  RUN_TEST(test_id_held_by_other_mac_dropped);
+  RUN_TEST(test_node_on_other_radio_dropped);
+  RUN_TEST(test_removed_node_gives_up_peer);
+  RUN_TEST(test_node_moving_to_other_radio_gives_up_peer);
+  return UNITY_END();
+}
@@ -0,0 +1,335 @@
+// Frame codec: every frame type round-trips, and damaged or foreign
+// frames are rejected or skipped the way the radio callbacks rely on.
+#include <unity.h>
+#include <string.h>
+#include "frame.h"
+
+static const uint8_t mac[6] = {0x24, 0x6F, 0x28, 0x10, 0xAB, 0xCD};
+
+// A frame from raw header and field bytes, with a valid CRC
+static size_t rawFrame(uint8_t* out, uint8_t type, const uint8_t* fields, size_t len) {
+  const uint8_t header[FRAME_HEADER_SIZE] = {static_cast<uint8_t>(FRAME_VERSION << 4 | type), 0x07, 0x00, 0x2A, 0x00};
+  memcpy(out, header, FRAME_HEADER_SIZE);
+  memcpy(out + FRAME_HEADER_SIZE, fields, len);
+  size_t end = FRAME_HEADER_SIZE + len;
+  uint16_t crc = frameCrc16(out, end);
+  out[end] = crc & 0xFF;
+  out[end + 1] = crc >> 8;
+  return end + FRAME_CRC_SIZE;
+}
+
+static ReadingFrame fullReading() {
+  ReadingFrame reading;
+  reading.nodeId = 0xFFFE;
+  reading.seq = 3; // Resent seqs wrap below 0
+  reading.replyTo = 0xFFFF;
+  reading.value = INT32_MIN;
+  reading.radio = 0x7F;
+  reading.resentCount = FRAME_MAX_RESENT;
+  const int32_t values[FRAME_MAX_RESENT] = {INT32_MAX, INT32_MIN, -1, 0, 1, 0x12345678, -0x7654321};
+  for (uint8_t i = 0; i < FRAME_MAX_RESENT; i++) {
+    reading.resent[i].seq = static_cast<uint16_t>(reading.seq - (FRAME_MAX_RESENT - i) * 9000);
+    reading.resent[i].value = values[i];
+    reading.resent[i].ageMs = i == 0 ? 0xFFFFFFFF : i * 1000;
+  }
+  return reading;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_trigger_round_trip() {
+  uint8_t buf[FRAME_MAX_SIZE];
+  FrameAck ack = {0xFFFF, 0xFFFFFFFF};
+  size_t len = encodeTrigger(buf, sizeof(buf), 0x1234, 0xBEEF, &ack, 0x35);
+  TEST_ASSERT_GREATER_THAN(0, len);
+
+  FrameReader reader;
+  TEST_ASSERT_TRUE(reader.parse(buf, len));
+  TEST_ASSERT_EQUAL_UINT8(FRAME_VERSION, reader.header().version);
+  TEST_ASSERT_EQUAL_UINT8(FRAME_TRIGGER, reader.header().type);
+  TEST_ASSERT_EQUAL_UINT16(0x1234, reader.header().nodeId);
+  TEST_ASSERT_EQUAL_UINT16(0xBEEF, reader.header().seq);
+
+  FrameAck got;
+  TEST_ASSERT_TRUE(findAck(reader, got));
+  TEST_ASSERT_EQUAL_UINT16(ack.seq, got.seq);
+  TEST_ASSERT_EQUAL_UINT32(ack.window, got.window);
+  uint8_t radio = 0;
+  TEST_ASSERT_TRUE(findRadio(reader, radio));
+  TEST_ASSERT_EQUAL_UINT8(0x35, radio);
+
+  // A plain trigger is header and CRC only
+  len = encodeTrigger(buf, sizeof(buf), 1, 2);
+  TEST_ASSERT_EQUAL(FRAME_MIN_SIZE, len);
+  TEST_ASSERT_TRUE(reader.parse(buf, len));
+  TEST_ASSERT_FALSE(findAck(reader, got));
+  TEST_ASSERT_FALSE(findRadio(reader, radio));
+}
+
+void test_reading_round_trip() {
+  uint8_t buf[FRAME_MAX_SIZE];
+  ReadingFrame sent = fullReading();
+  size_t len = encodeReading(buf, sizeof(buf), sent);
+  TEST_ASSERT_GREATER_THAN(0, len);
+
+  ReadingFrame got;
+  TEST_ASSERT_TRUE(decodeReading(buf, len, got));
+  TEST_ASSERT_EQUAL_UINT16(sent.nodeId, got.nodeId);
+  TEST_ASSERT_EQUAL_UINT16(sent.seq, got.seq);
+  TEST_ASSERT_EQUAL_UINT16(sent.replyTo, got.replyTo);
+  TEST_ASSERT_EQUAL_INT32(sent.value, got.value);
+  TEST_ASSERT_EQUAL_UINT8(sent.radio, got.radio);
+  TEST_ASSERT_EQUAL_UINT8(sent.resentCount, got.resentCount);
+  for (uint8_t i = 0; i < sent.resentCount; i++) {
+    TEST_ASSERT_EQUAL_UINT16(sent.resent[i].seq, got.resent[i].seq);
+    TEST_ASSERT_EQUAL_INT32(sent.resent[i].value, got.resent[i].value);
+    TEST_ASSERT_EQUAL_UINT32(sent.resent[i].ageMs, got.resent[i].ageMs);
+  }
+
+  // Optional fields left out decode to their defaults
+  sent.replyTo = 0;
+  sent.radio = 0;
+  sent.resentCount = 0;
+  sent.value = 0;
+  len = encodeReading(buf, sizeof(buf), sent);
+  TEST_ASSERT_TRUE(decodeReading(buf, len, got));
+  TEST_ASSERT_EQUAL_UINT16(0, got.replyTo);
+  TEST_ASSERT_EQUAL_UINT8(0, got.radio);
+  TEST_ASSERT_EQUAL_UINT8(0, got.resentCount);
+  TEST_ASSERT_EQUAL_INT32(0, got.value);
+}
+
+void test_max_length_varints() {
+  const int32_t values[] = {INT32_MIN, INT32_MAX, -1, 0x7FFFFFF, -0x8000000};
+  const size_t sizes[] = {5, 5, 1, 4, 4}; // Zigzagged
+  for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+    uint8_t buf[FRAME_MAX_SIZE];
+    FrameWriter writer(buf, sizeof(buf));
+    writer.begin(FRAME_READING, 1, 1);
+    writer.putVarint(FIELD_VALUE, values[i]);
+    size_t len = writer.finish();
+    TEST_ASSERT_EQUAL(FRAME_MIN_SIZE + 1 + sizes[i], len);
+
+    FrameReader reader;
+    FrameReader::Field field;
+    TEST_ASSERT_TRUE(reader.parse(buf, len));
+    TEST_ASSERT_TRUE(reader.next(field));
+    TEST_ASSERT_EQUAL_INT32(values[i], field.value);
+    TEST_ASSERT_FALSE(reader.next(field));
+  }
+}
+
+void test_varint_past_32_bits_rejected() {
+  FrameReader reader;
+  FrameReader::Field field;
+  uint8_t buf[FRAME_MAX_SIZE];
+
+  // 0xFFFFFFFF, the largest that fits
+  const uint8_t top[] = {FIELD_VALUE << 3 | WIRE_VARINT, 0xFF, 0xFF, 0xFF, 0xFF, 0x0F};
+  TEST_ASSERT_TRUE(reader.parse(buf, rawFrame(buf, FRAME_READING, top, sizeof(top))));
+  TEST_ASSERT_TRUE(reader.next(field));
+  TEST_ASSERT_EQUAL_INT32(INT32_MIN, field.value);
+
+  // Any of the fifth byte's upper bits set would be dropped on decode
+  for (uint8_t fifth = 0x10; fifth < 0x80; fifth += 0x10) {
+    const uint8_t over[] = {FIELD_VALUE << 3 | WIRE_VARINT, 0xFF, 0xFF, 0xFF, 0xFF, fifth};
+    TEST_ASSERT_TRUE(reader.parse(buf, rawFrame(buf, FRAME_READING, over, sizeof(over))));
+    TEST_ASSERT_FALSE(reader.next(field));
+  }
+
+  // A sixth byte is never valid
+  const uint8_t longer[] = {FIELD_VALUE << 3 | WIRE_VARINT, 0x80, 0x80, 0x80, 0x80, 0x80, 0x00};
+  TEST_ASSERT_TRUE(reader.parse(buf, rawFrame(buf, FRAME_READING, longer, sizeof(longer))));
+  TEST_ASSERT_FALSE(reader.next(field));
+
+  // Same inside the resent list: the reading itself still decodes
+  const uint8_t resent[] = {FIELD_VALUE << 3 | WIRE_VARINT, 0x02,
+                            FIELD_RESENT << 3 | WIRE_BYTES, 7, 0x01, 0x80, 0x80, 0x80, 0x80, 0x10, 0x00};
+  ReadingFrame reading;
+  TEST_ASSERT_TRUE(decodeReading(buf, rawFrame(buf, FRAME_READING, resent, sizeof(resent)), reading));
+  TEST_ASSERT_EQUAL_INT32(1, reading.value);
+  TEST_ASSERT_EQUAL_UINT8(0, reading.resentCount);
+}
+
+void test_beacon_round_trip() {
+  uint16_t ids[BEACON_MAX_SLOTS];
+  uint8_t acks[BEACON_MAX_SLOTS];
+  for (size_t i = 0; i < BEACON_MAX_SLOTS; i++) {
+    ids[i] = static_cast<uint16_t>(i * 877 + 1);
+    acks[i] = static_cast<uint8_t>(i * 3);
+  }
+
+  uint8_t buf[FRAME_MAX_SIZE];
+  size_t len = encodeBeacon(buf, sizeof(buf), 0xFFFF, 40, ids, acks, BEACON_MAX_SLOTS);
+  TEST_ASSERT_GREATER_THAN(0, len);
+  TEST_ASSERT_EQUAL(0, encodeBeacon(buf, sizeof(buf), 1, 40, ids, acks, BEACON_MAX_SLOTS + 1));
+
+  FrameReader reader;
+  TEST_ASSERT_TRUE(reader.parse(buf, len));
+  TEST_ASSERT_EQUAL_UINT8(FRAME_BEACON, reader.header().type);
+  TEST_ASSERT_EQUAL_UINT16(FRAME_BROADCAST_ID, reader.header().nodeId);
+  for (size_t i = 0; i < BEACON_MAX_SLOTS; i++) {
+    uint32_t delayMs = 0;
+    int ack = -2;
+    reader.rewind();
+    TEST_ASSERT_TRUE(findBeaconSlot(reader, ids[i], delayMs, &ack));
+    TEST_ASSERT_EQUAL_UINT32((i + 1) * 40, delayMs);
+    TEST_ASSERT_EQUAL_INT(acks[i], ack);
+  }
+  uint32_t delayMs;
+  reader.rewind();
+  TEST_ASSERT_FALSE(findBeaconSlot(reader, 2, delayMs));
+
+  // Group trigger: same slots, trigger type; without acks a node gets -1
+  len = encodeGroupTrigger(buf, sizeof(buf), 9, 25, ids, nullptr, 3);
+  TEST_ASSERT_TRUE(reader.parse(buf, len));
+  TEST_ASSERT_EQUAL_UINT8(FRAME_TRIGGER, reader.header().type);
+  int ack = 0;
+  TEST_ASSERT_TRUE(findBeaconSlot(reader, ids[2], delayMs, &ack));
+  TEST_ASSERT_EQUAL_UINT32(75, delayMs);
+  TEST_ASSERT_EQUAL_INT(-1, ack);
+
+  // A unicast trigger has no slots
+  len = encodeTrigger(buf, sizeof(buf), ids[0], 9);
+  TEST_ASSERT_TRUE(reader.parse(buf, len));
+  TEST_ASSERT_FALSE(findBeaconSlot(reader, ids[0], delayMs));
+}
+
+void test_join_round_trip() {
+  uint8_t buf[FRAME_MAX_SIZE];
+  uint8_t got[6];
+  int32_t ackedSeq = 0;
+  FrameReader reader;
+
+  size_t len = encodeJoin(buf, sizeof(buf), 0xFFFE, mac, 0xFFFF);
+  TEST_ASSERT_TRUE(reader.parse(buf, len));
+  TEST_ASSERT_EQUAL_UINT8(FRAME_JOIN, reader.header().type);
+  TEST_ASSERT_EQUAL_UINT16(0xFFFE, reader.header().nodeId);
+  TEST_ASSERT_TRUE(findJoinMac(reader, got, &ackedSeq));
+  TEST_ASSERT_EQUAL_MEMORY(mac, got, 6);
+  TEST_ASSERT_EQUAL_INT32(0xFFFF, ackedSeq);
+
+  len = encodeJoinAccept(buf, sizeof(buf), 42, mac);
+  TEST_ASSERT_TRUE(reader.parse(buf, len));
+  TEST_ASSERT_EQUAL_UINT8(FRAME_JOIN_ACCEPT, reader.header().type);
+  TEST_ASSERT_EQUAL_UINT16(42, reader.header().nodeId);
+  memset(got, 0, sizeof(got));
+  TEST_ASSERT_TRUE(findJoinMac(reader, got, &ackedSeq));
+  TEST_ASSERT_EQUAL_MEMORY(mac, got, 6);
+  TEST_ASSERT_EQUAL_INT32(-1, ackedSeq);
+
+  // A MAC field of the wrong length does not count
+  const uint8_t shortMac[] = {FIELD_MAC << 3 | WIRE_BYTES, 5, 1, 2, 3, 4, 5};
+  TEST_ASSERT_TRUE(reader.parse(buf, rawFrame(buf, FRAME_JOIN, shortMac, sizeof(shortMac))));
+  TEST_ASSERT_FALSE(findJoinMac(reader, got));
+}
+
+void test_corrupted_crc() {
+  uint8_t buf[FRAME_MAX_SIZE];
+  size_t len = encodeReading(buf, sizeof(buf), fullReading());
+  FrameReader reader;
+  ReadingFrame reading;
+
+  // CRC-16 catches every single-byte error, CRC bytes included
+  for (size_t i = 0; i < len; i++) {
+    for (uint8_t flip = 1; flip != 0; flip <<= 1) {
+      buf[i] ^= flip;
+      TEST_ASSERT_FALSE(reader.parse(buf, len));
+      TEST_ASSERT_FALSE(decodeReading(buf, len, reading));
+      buf[i] ^= flip;
+    }
+  }
+  TEST_ASSERT_TRUE(decodeReading(buf, len, reading));
+
+  // A valid CRC on an unknown version is still rejected
+  buf[0] = (FRAME_VERSION + 1) << 4 | FRAME_READING;
+  uint16_t crc = frameCrc16(buf, len - FRAME_CRC_SIZE);
+  buf[len - 2] = crc & 0xFF;
+  buf[len - 1] = crc >> 8;
+  TEST_ASSERT_FALSE(reader.parse(buf, len));
+}
+
+void test_truncated_frames() {
+  uint8_t buf[FRAME_MAX_SIZE];
+  size_t len = encodeReading(buf, sizeof(buf), fullReading());
+  FrameReader reader;
+  for (size_t cut = 0; cut < len; cut++) {
+    TEST_ASSERT_FALSE(reader.parse(buf, cut));
+  }
+  TEST_ASSERT_FALSE(reader.parse(nullptr, len));
+
+  // Fields cut short under a valid CRC: the walk stops at the damage
+  FrameReader::Field field;
+  const uint8_t varint[] = {FIELD_VALUE << 3 | WIRE_VARINT, 0x02, FIELD_REPLY_TO << 3 | WIRE_VARINT, 0x80};
+  TEST_ASSERT_TRUE(reader.parse(buf, rawFrame(buf, FRAME_READING, varint, sizeof(varint))));
+  TEST_ASSERT_TRUE(reader.next(field));
+  TEST_ASSERT_EQUAL_INT32(1, field.value);
+  TEST_ASSERT_FALSE(reader.next(field));
+
+  const uint8_t bytes[] = {FIELD_MAC << 3 | WIRE_BYTES, 6, 1, 2, 3};
+  TEST_ASSERT_TRUE(reader.parse(buf, rawFrame(buf, FRAME_JOIN, bytes, sizeof(bytes))));
+  TEST_ASSERT_FALSE(reader.next(field));
+
+  const uint8_t noLength[] = {FIELD_MAC << 3 | WIRE_BYTES};
+  TEST_ASSERT_TRUE(reader.parse(buf, rawFrame(buf, FRAME_JOIN, noLength, sizeof(noLength))));
+  TEST_ASSERT_FALSE(reader.next(field));
+
+  // A resent list cut mid-reading keeps the whole ones before it
+  const uint8_t resent[] = {FIELD_VALUE << 3 | WIRE_VARINT, 0x02,
+                            FIELD_RESENT << 3 | WIRE_BYTES, 5, 0x01, 0x04, 0x10, 0x02, 0x06};
+  ReadingFrame reading;
+  TEST_ASSERT_TRUE(decodeReading(buf, rawFrame(buf, FRAME_READING, resent, sizeof(resent)), reading));
+  TEST_ASSERT_EQUAL_UINT8(1, reading.resentCount);
+  TEST_ASSERT_EQUAL_UINT16(41, reading.resent[0].seq);
+  TEST_ASSERT_EQUAL_INT32(2, reading.resent[0].value);
+  TEST_ASSERT_EQUAL_UINT32(16, reading.resent[0].ageMs);
+
+  // No room for the frame: the writer reports 0 instead of a partial frame
+  TEST_ASSERT_EQUAL(0, encodeReading(buf, 20, fullReading()));
+  TEST_ASSERT_EQUAL(0, encodeTrigger(buf, FRAME_MIN_SIZE - 1, 1, 1));
+}
+
+void test_unknown_tags_skipped() {
+  uint8_t buf[FRAME_MAX_SIZE];
+  ReadingFrame reading;
+  // Unknown varint and bytes fields around the known ones, and a known
+  // id with the wrong wire type
+  const uint8_t fields[] = {
+      31 << 3 | WIRE_VARINT, 0xFF, 0xFF, 0xFF, 0xFF, 0x0F,
+      FIELD_VALUE << 3 | WIRE_VARINT, 0x54,
+      30 << 3 | WIRE_BYTES, 3, 0xAA, 0xBB, 0xCC,
+      FIELD_REPLY_TO << 3 | WIRE_BYTES, 2, 0x01, 0x02,
+      FIELD_RADIO << 3 | WIRE_VARINT, 0x0A,
+  };
+  TEST_ASSERT_TRUE(decodeReading(buf, rawFrame(buf, FRAME_READING, fields, sizeof(fields)), reading));
+  TEST_ASSERT_EQUAL_INT32(42, reading.value);
+  TEST_ASSERT_EQUAL_UINT16(0, reading.replyTo);
+  TEST_ASSERT_EQUAL_UINT8(5, reading.radio);
+
+  // An unknown wire type ends the walk; what came before still counts
+  const uint8_t wire[] = {FIELD_VALUE << 3 | WIRE_VARINT, 0x54, FIELD_REPLY_TO << 3 | 5, 0x02,
+                          FIELD_RADIO << 3 | WIRE_VARINT, 0x0A};
+  TEST_ASSERT_TRUE(decodeReading(buf, rawFrame(buf, FRAME_READING, wire, sizeof(wire)), reading));
+  TEST_ASSERT_EQUAL_INT32(42, reading.value);
+  TEST_ASSERT_EQUAL_UINT8(0, reading.radio);
+
+  // Frame types the decoders do not handle
+  const uint8_t none[] = {FIELD_VALUE << 3 | WIRE_VARINT, 0x54};
+  TEST_ASSERT_FALSE(decodeReading(buf, rawFrame(buf, 0x0F, none, sizeof(none)), reading));
+  TEST_ASSERT_FALSE(decodeReading(buf, rawFrame(buf, FRAME_TRIGGER, none, sizeof(none)), reading));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_trigger_round_trip);
+  RUN_TEST(test_reading_round_trip);
+  RUN_TEST(test_max_length_varints);
+  RUN_TEST(test_varint_past_32_bits_rejected);
+  RUN_TEST(test_beacon_round_trip);
+  RUN_TEST(test_join_round_trip);
+  RUN_TEST(test_corrupted_crc);
+  RUN_TEST(test_truncated_frames);
+  RUN_TEST(test_unknown_tags_skipped);
+  return UNITY_END();
+}
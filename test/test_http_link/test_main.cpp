@@ -0,0 +1,211 @@
+// HttpLink against a stand-in server behind hal_native: keep-alive reuse,
+// handshake and request timed apart, backoff only for errors before a
+// status, and a server that closes behind its response.
+#include <unity.h>
+#include <string>
+#include <vector>
+#include "hal.h"
+#include "http_link.h"
+
+#define SERVER_HOST "stand-in.local"
+#define SERVER_PORT 443
+#define HANDSHAKE_MS 300
+#define REQUEST_MS 50
+#define CLOCK_SPEED 10
+
+// Scripted replies, one per post; an empty script answers 200
+class StandInServer : public HalBackend {
+public:
+  struct Reply {
+    int code;
+    const char* body;
+    bool close; // Closes the connection behind the response
+  };
+
+  void espNowSend(const uint8_t* dest, const uint8_t* data, size_t len) override {}
+  void loraSend(const uint8_t* data, size_t len, uint32_t airtimeUs, int spreadingFactor,
+                long bandwidth) override {}
+
+  bool httpConnect(const char* host, uint16_t port) override {
+    connects++;
+    delay(HANDSHAKE_MS);
+    return !refuse && host == std::string(SERVER_HOST) && port == SERVER_PORT;
+  }
+
+  int httpPost(const char* host, const char* path, const char* contentType,
+               const char* idempotencyKey, const uint8_t* body, size_t len,
+               std::string& response) override {
+    delay(REQUEST_MS);
+    lastPath = path;
+    lastContentType = contentType;
+    lastKey = idempotencyKey;
+    lastBody.assign(reinterpret_cast<const char*>(body), len);
+    Reply reply = {HTTP_CODE_OK, "", false};
+    if (!script.empty()) {
+      reply = script.front();
+      script.erase(script.begin());
+    }
+    response = reply.body;
+    closing = reply.close;
+    return reply.code;
+  }
+
+  bool httpKeepAlive() override { return !closing; }
+
+  bool refuse = false;
+  int connects = 0;
+  std::vector<Reply> script;
+  std::string lastPath, lastContentType, lastKey, lastBody;
+
+private:
+  bool closing = false;
+};
+
+static StandInServer server;
+static const uint8_t body[] = "[{\"value\":1}]";
+
+static int post(HttpLink& link, char* response = nullptr, size_t responseLen = 0,
+                const char* key = nullptr) {
+  return link.post("/esp/data", "application/json", body, sizeof(body) - 1, response,
+                   responseLen, key);
+}
+
+void setUp() {
+  server = StandInServer();
+}
+
+void tearDown() {}
+
+void test_keep_alive_reuses_connection() {
+  WiFiClientSecure client;
+  HttpLink link(client, SERVER_HOST, SERVER_PORT, true);
+  server.script = {{HTTP_CODE_OK, "{\"acked\":[]}", false}};
+  char response[64];
+
+  TEST_ASSERT_EQUAL_INT(HTTP_CODE_OK, post(link, response, sizeof(response), "key-1"));
+  TEST_ASSERT_EQUAL_STRING("{\"acked\":[]}", response);
+  TEST_ASSERT_EQUAL_STRING("/esp/data", server.lastPath.c_str());
+  TEST_ASSERT_EQUAL_STRING("application/json", server.lastContentType.c_str());
+  TEST_ASSERT_EQUAL_STRING("key-1", server.lastKey.c_str());
+  TEST_ASSERT_EQUAL_STRING(reinterpret_cast<const char*>(body), server.lastBody.c_str());
+
+  for (int i = 0; i < 4; i++) TEST_ASSERT_EQUAL_INT(HTTP_CODE_OK, post(link));
+  const HttpLink::Stats& stats = link.getStats();
+  TEST_ASSERT_EQUAL_INT(1, server.connects);
+  TEST_ASSERT_EQUAL_UINT32(5, stats.requests);
+  TEST_ASSERT_EQUAL_UINT32(1, stats.connects);
+  TEST_ASSERT_EQUAL_UINT32(4, stats.reused);
+  TEST_ASSERT_EQUAL_UINT32(0, stats.failures);
+  TEST_ASSERT_EQUAL_STRING("", server.lastKey.c_str());
+}
+
+void test_handshake_timed_apart_from_request() {
+  WiFiClientSecure client;
+  HttpLink link(client, SERVER_HOST, SERVER_PORT, true);
+  TEST_ASSERT_EQUAL_INT(HTTP_CODE_OK, post(link));
+  const HttpLink::Stats& stats = link.getStats();
+  // Scaled sleeps overshoot a little, never undershoot
+  TEST_ASSERT_GREATER_OR_EQUAL(HANDSHAKE_MS, stats.lastHandshake);
+  TEST_ASSERT_LESS_THAN(HANDSHAKE_MS + REQUEST_MS, stats.lastHandshake);
+  TEST_ASSERT_GREATER_OR_EQUAL(REQUEST_MS, stats.lastRequest);
+  TEST_ASSERT_LESS_THAN(HANDSHAKE_MS, stats.lastRequest);
+  TEST_ASSERT_EQUAL_UINT32(stats.lastHandshake, stats.maxHandshake);
+}
+
+void test_refused_connect_backs_off() {
+  WiFiClientSecure client;
+  HttpLink link(client, SERVER_HOST, SERVER_PORT, true);
+  server.refuse = true;
+  uint32_t expected = HTTP_LINK_BACKOFF_MIN;
+  TEST_ASSERT_EQUAL_UINT32(expected, link.retryDelay());
+  for (int i = 0; i < 8; i++) {
+    TEST_ASSERT_EQUAL_INT(HTTPC_ERROR_CONNECTION_REFUSED, post(link));
+    expected = expected * 2 > HTTP_LINK_BACKOFF_MAX ? HTTP_LINK_BACKOFF_MAX : expected * 2;
+    TEST_ASSERT_EQUAL_UINT32(expected, link.retryDelay());
+  }
+  TEST_ASSERT_EQUAL_UINT32(HTTP_LINK_BACKOFF_MAX, link.retryDelay());
+  TEST_ASSERT_EQUAL_UINT32(8, link.getStats().failures);
+  TEST_ASSERT_EQUAL_INT(HTTPC_ERROR_CONNECTION_REFUSED, link.getStats().lastStatus);
+
+  server.refuse = false;
+  TEST_ASSERT_EQUAL_INT(HTTP_CODE_OK, post(link));
+  TEST_ASSERT_EQUAL_UINT32(HTTP_LINK_BACKOFF_MIN, link.retryDelay());
+  TEST_ASSERT_EQUAL_UINT32(1, link.getStats().connects);
+}
+
+void test_error_before_status_drops_connection() {
+  WiFiClientSecure client;
+  HttpLink link(client, SERVER_HOST, SERVER_PORT, true);
+  server.script = {{HTTPC_ERROR_READ_TIMEOUT, "", false}, {HTTP_CODE_OK, "", false}};
+
+  TEST_ASSERT_EQUAL_INT(HTTPC_ERROR_READ_TIMEOUT, post(link));
+  TEST_ASSERT_EQUAL_UINT32(1, link.getStats().failures);
+  TEST_ASSERT_EQUAL_UINT32(2 * HTTP_LINK_BACKOFF_MIN, link.retryDelay());
+  TEST_ASSERT_FALSE(client.connected());
+
+  TEST_ASSERT_EQUAL_INT(HTTP_CODE_OK, post(link));
+  TEST_ASSERT_EQUAL_INT(2, server.connects);
+  TEST_ASSERT_EQUAL_UINT32(HTTP_LINK_BACKOFF_MIN, link.retryDelay());
+}
+
+void test_close_after_status_is_not_a_failure() {
+  WiFiClientSecure client;
+  HttpLink link(client, SERVER_HOST, SERVER_PORT, true);
+  server.script = {{HTTP_CODE_OK, "", false},
+                   {HTTP_CODE_NO_CONTENT, "", true},
+                   {HTTP_CODE_CREATED, "{}", true},
+                   {HTTP_CODE_OK, "", false}};
+  TEST_ASSERT_EQUAL_INT(HTTP_CODE_OK, post(link));
+
+  // The upload went through; only the connection is gone
+  TEST_ASSERT_EQUAL_INT(HTTP_CODE_NO_CONTENT, post(link));
+  TEST_ASSERT_EQUAL_UINT32(0, link.getStats().failures);
+  TEST_ASSERT_EQUAL_UINT32(HTTP_LINK_BACKOFF_MIN, link.retryDelay());
+  TEST_ASSERT_EQUAL_INT(HTTP_CODE_NO_CONTENT, link.getStats().lastStatus);
+
+  TEST_ASSERT_EQUAL_INT(HTTP_CODE_CREATED, post(link));
+  TEST_ASSERT_EQUAL_INT(HTTP_CODE_OK, post(link));
+  TEST_ASSERT_EQUAL_UINT32(0, link.getStats().failures);
+  TEST_ASSERT_EQUAL_UINT32(HTTP_LINK_BACKOFF_MIN, link.retryDelay());
+  // Each close costs one reconnect
+  TEST_ASSERT_EQUAL_INT(3, server.connects);
+  TEST_ASSERT_EQUAL_UINT32(1, link.getStats().reused);
+}
+
+void test_server_error_status_keeps_link() {
+  WiFiClientSecure client;
+  HttpLink link(client, SERVER_HOST, SERVER_PORT, true);
+  server.script = {{HTTP_CODE_SERVICE_UNAVAILABLE, "busy", false}};
+  char response[8];
+  TEST_ASSERT_EQUAL_INT(HTTP_CODE_SERVICE_UNAVAILABLE, post(link, response, sizeof(response)));
+  TEST_ASSERT_EQUAL_STRING("busy", response);
+  TEST_ASSERT_EQUAL_UINT32(0, link.getStats().failures);
+  TEST_ASSERT_TRUE(client.connected());
+}
+
+void test_response_cut_to_buffer() {
+  WiFiClientSecure client;
+  HttpLink link(client, SERVER_HOST, SERVER_PORT, true);
+  server.script = {{HTTP_CODE_OK, "0123456789", false}};
+  char response[5];
+  TEST_ASSERT_EQUAL_INT(HTTP_CODE_OK, post(link, response, sizeof(response)));
+  TEST_ASSERT_EQUAL_STRING("0123", response);
+}
+
+int main(int argc, char** argv) {
+  HalNativeConfig config;
+  config.wifiConnectMs = 0;
+  halNativeSetSpeed(CLOCK_SPEED);
+  halNativeBegin(&server, config);
+  WiFi.begin("stand-in", "");
+
+  UNITY_BEGIN();
+  RUN_TEST(test_keep_alive_reuses_connection);
+  RUN_TEST(test_handshake_timed_apart_from_request);
+  RUN_TEST(test_refused_connect_backs_off);
+  RUN_TEST(test_error_before_status_drops_connection);
+  RUN_TEST(test_close_after_status_is_not_a_failure);
+  RUN_TEST(test_server_error_status_keeps_link);
+  RUN_TEST(test_response_cut_to_buffer);
+  return UNITY_END();
+}
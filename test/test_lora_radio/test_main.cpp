@@ -0,0 +1,183 @@
+// LoRaRadio::drain() against the SX127x in hal_native: each packet read
+// out with its RSSI and SNR, the radio back in receive before the next
+// one lands, a packet left unread overwritten by the one behind it, and
+// a FIFO the decoder does not empty dropping the newest.
+#include <unity.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include "hal.h"
+#include "lora_radio.h"
+
+#define TEST_SS 18
+#define TEST_RESET 14
+#define TEST_DIO0 26
+#define BURST_PACKETS 200
+
+// Packet n carries n in its first two bytes and is n % 20 + 2 long
+static void receive(uint16_t n, int rssi = -90, float snr = 7.0f) {
+  uint8_t data[FRAME_MAX_SIZE];
+  size_t len = n % 20 + 2;
+  memset(data, 0xA5, sizeof(data));
+  data[0] = static_cast<uint8_t>(n);
+  data[1] = static_cast<uint8_t>(n >> 8);
+  halNativeLoRaReceive(data, len, rssi, snr);
+}
+
+static void assertPacket(uint16_t n, const LoRaPacket& packet) {
+  TEST_ASSERT_EQUAL_UINT8(n % 20 + 2, packet.len);
+  TEST_ASSERT_EQUAL_UINT16(n, packet.data[0] | packet.data[1] << 8);
+}
+
+// Drains whenever DIO0 was raised, as the receive task does when notified
+static void drainPending() {
+  if (LoRaRadio::pending()) LoRaRadio::drain();
+}
+
+void setUp() {
+  LoRaPacket packet;
+  while (LoRaRadio::pop(packet)) {}
+}
+
+void tearDown() {}
+
+void test_drain_reads_packet_and_rearms() {
+  uint32_t missed = halNativeLoRaMissed();
+  TEST_ASSERT_TRUE(halNativeLoRaReady());
+  TEST_ASSERT_FALSE(LoRaRadio::pending());
+
+  uint32_t before = millis();
+  receive(7, -101, -4.5f);
+  TEST_ASSERT_TRUE(LoRaRadio::pending());
+  TEST_ASSERT_FALSE(halNativeLoRaReady()); // Holding an unread packet
+  LoRaRadio::drain();
+  TEST_ASSERT_FALSE(LoRaRadio::pending());
+  TEST_ASSERT_TRUE(halNativeLoRaReady());
+
+  LoRaPacket packet;
+  TEST_ASSERT_TRUE(LoRaRadio::pop(packet));
+  assertPacket(7, packet);
+  TEST_ASSERT_EQUAL_INT16(-101, packet.rssi);
+  TEST_ASSERT_EQUAL_INT8(-4, packet.snr);
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT32(before, packet.receivedAt);
+  TEST_ASSERT_FALSE(LoRaRadio::pop(packet));
+
+  // Nothing pending, nothing queued
+  LoRaRadio::drain();
+  TEST_ASSERT_FALSE(LoRaRadio::pop(packet));
+  TEST_ASSERT_EQUAL_UINT32(missed, halNativeLoRaMissed());
+}
+
+// Packets right behind each other: every one is drained before the next
+// lands, none is missed and they come out in order
+void test_back_to_back_packets() {
+  uint32_t missed = halNativeLoRaMissed();
+  for (uint16_t n = 0; n < LORA_RX_FIFO_SIZE; n++) {
+    receive(n);
+    drainPending();
+  }
+  LoRaPacket packet;
+  for (uint16_t n = 0; n < LORA_RX_FIFO_SIZE; n++) {
+    TEST_ASSERT_TRUE(LoRaRadio::pop(packet));
+    assertPacket(n, packet);
+  }
+  TEST_ASSERT_FALSE(LoRaRadio::pop(packet));
+  TEST_ASSERT_EQUAL_UINT32(missed, halNativeLoRaMissed());
+}
+
+// A packet not drained in time is overwritten at the radio by the next
+void test_undrained_packet_overwritten() {
+  uint32_t missed = halNativeLoRaMissed();
+  receive(1);
+  receive(2);
+  drainPending();
+  TEST_ASSERT_EQUAL_UINT32(missed + 1, halNativeLoRaMissed());
+
+  LoRaPacket packet;
+  TEST_ASSERT_TRUE(LoRaRadio::pop(packet));
+  assertPacket(2, packet);
+  TEST_ASSERT_FALSE(LoRaRadio::pop(packet));
+}
+
+// A decoder that falls behind: the FIFO keeps the oldest packets and
+// counts the rest, the radio itself misses nothing
+void test_fifo_overflow_drops_newest() {
+  uint32_t missed = halNativeLoRaMissed();
+  uint32_t dropped = LoRaRadio::dropped();
+  for (uint16_t n = 0; n < LORA_RX_FIFO_SIZE + 5; n++) {
+    receive(n);
+    drainPending();
+  }
+  TEST_ASSERT_EQUAL_UINT32(dropped + 5, LoRaRadio::dropped());
+  TEST_ASSERT_EQUAL_UINT32(LORA_RX_FIFO_SIZE, LoRaRadio::highWater());
+  TEST_ASSERT_EQUAL_UINT32(missed, halNativeLoRaMissed());
+
+  LoRaPacket packet;
+  for (uint16_t n = 0; n < LORA_RX_FIFO_SIZE; n++) {
+    TEST_ASSERT_TRUE(LoRaRadio::pop(packet));
+    assertPacket(n, packet);
+  }
+  TEST_ASSERT_FALSE(LoRaRadio::pop(packet));
+
+  // Room again once the decoder catches up
+  receive(1000);
+  drainPending();
+  TEST_ASSERT_TRUE(LoRaRadio::pop(packet));
+  assertPacket(1000, packet);
+}
+
+// A packet longer than a frame is cut to one
+void test_long_packet_cut() {
+  uint8_t data[FRAME_MAX_SIZE + 40];
+  for (size_t i = 0; i < sizeof(data); i++) data[i] = static_cast<uint8_t>(i);
+  halNativeLoRaReceive(data, sizeof(data), -80, 9.0f);
+  drainPending();
+
+  LoRaPacket packet;
+  TEST_ASSERT_TRUE(LoRaRadio::pop(packet));
+  TEST_ASSERT_EQUAL_UINT8(FRAME_MAX_SIZE, packet.len);
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(data, packet.data, FRAME_MAX_SIZE);
+  TEST_ASSERT_TRUE(halNativeLoRaReady());
+}
+
+// The radio on another thread, sending each packet as soon as the last
+// one was read, while this one drains and decodes
+void test_burst_from_radio_thread() {
+  uint32_t missed = halNativeLoRaMissed();
+  uint32_t dropped = LoRaRadio::dropped();
+  std::atomic<bool> done(false);
+  std::thread radio([&] {
+    for (uint16_t n = 0; n < BURST_PACKETS; n++) {
+      while (!halNativeLoRaReady()) std::this_thread::yield();
+      receive(n);
+    }
+    done.store(true);
+  });
+
+  LoRaPacket packet;
+  uint16_t next = 0;
+  for (;;) {
+    bool finished = done.load();
+    drainPending();
+    while (LoRaRadio::pop(packet)) assertPacket(next++, packet);
+    if (finished && !LoRaRadio::pending()) break;
+  }
+  radio.join();
+
+  TEST_ASSERT_EQUAL_UINT16(BURST_PACKETS, next);
+  TEST_ASSERT_EQUAL_UINT32(missed, halNativeLoRaMissed());
+  TEST_ASSERT_EQUAL_UINT32(dropped, LoRaRadio::dropped());
+}
+
+int main(int argc, char** argv) {
+  if (!LoRaRadio::begin(TEST_SS, TEST_RESET, TEST_DIO0, 868E6, 7, 125000, 5)) return 1;
+
+  UNITY_BEGIN();
+  RUN_TEST(test_drain_reads_packet_and_rearms);
+  RUN_TEST(test_back_to_back_packets);
+  RUN_TEST(test_undrained_packet_overwritten);
+  RUN_TEST(test_fifo_overflow_drops_newest);
+  RUN_TEST(test_long_packet_cut);
+  RUN_TEST(test_burst_from_radio_thread);
+  return UNITY_END();
+}
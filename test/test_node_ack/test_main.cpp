@@ -0,0 +1,226 @@
+// Node-side acks: which unacked readings an ack releases, cumulative ack
+// bytes from beacons, seq wrap, and a radio callback publishing acks while
+// the loop takes them, never pairing one poll's seq with another's window.
+// Scheduled replies likewise: due once, and never with another poll's seq.
+#include <unity.h>
+#include <atomic>
+#include <thread>
+#include "hal.h"
+#include "node.h"
+
+#define STRESS_ACKS 2000000
+
+class TestNode : public Node {
+public:
+  void begin() override {}
+  void update() override {}
+
+  using Node::noteAck;
+  using Node::noteAckByte;
+  using Node::takeAck;
+  using Node::applyAck;
+  using Node::buildReading;
+  using Node::sequence;
+  using Node::unacked;
+  using Node::unackedCount;
+  using Node::pendingAck;
+  using Node::scheduleReply;
+  using Node::replyDue;
+  using Node::replyTo;
+  using Node::pendingReply;
+
+  // Takes n readings, as n replies would
+  static void take(int n) {
+    uint8_t frame[FRAME_MAX_SIZE];
+    ReadingFrame reading;
+    for (int i = 0; i < n; i++) buildReading(frame, sizeof(frame), FRAME_MAX_RESENT, reading);
+  }
+
+  static void assertUnacked(const uint16_t* seqs, uint8_t count) {
+    TEST_ASSERT_EQUAL_UINT8(count, unackedCount);
+    for (uint8_t i = 0; i < count; i++) TEST_ASSERT_EQUAL_UINT16(seqs[i], unacked[i].seq);
+  }
+};
+
+// Every window a function of its seq, so a torn pair shows
+static uint32_t windowFor(uint16_t seq) {
+  return seq * 2654435761u;
+}
+
+void setUp() {
+  TestNode::sequence = 0;
+  TestNode::unackedCount = 0;
+  TestNode::pendingAck.store(0);
+  TestNode::pendingReply.store(0);
+}
+
+void tearDown() {}
+
+void test_ack_releases_held_readings() {
+  TestNode::take(5); // Seqs 0-4
+  // Holds 3, 2 and 0; 1 is missing at the base, 4 is newer than the ack
+  TestNode::noteAck({3, 0xB});
+  TestNode::applyAck();
+  const uint16_t left[] = {1, 4};
+  TestNode::assertUnacked(left, 2);
+
+  // Applied once only
+  TestNode::applyAck();
+  TestNode::assertUnacked(left, 2);
+}
+
+void test_readings_past_the_window_count_as_held() {
+  TestNode::sequence = 100;
+  TestNode::take(3); // 100-102
+  TestNode::noteAck({102 + FRAME_ACK_WINDOW, 0});
+  TestNode::applyAck();
+  TEST_ASSERT_EQUAL_UINT8(0, TestNode::unackedCount);
+}
+
+void test_latest_ack_wins() {
+  TestNode::take(4);
+  TestNode::noteAck({0, 1});
+  TestNode::noteAck({3, 0x8}); // Only seq 0 is held
+  FrameAck ack;
+  TEST_ASSERT_TRUE(TestNode::takeAck(ack));
+  TEST_ASSERT_EQUAL_UINT16(3, ack.seq);
+  TEST_ASSERT_EQUAL_UINT32(0x8, ack.window);
+  TEST_ASSERT_FALSE(TestNode::takeAck(ack));
+
+  TestNode::noteAck({3, 0x8});
+  TestNode::applyAck();
+  const uint16_t left[] = {1, 2, 3};
+  TestNode::assertUnacked(left, 3);
+}
+
+// Beacons carry the low byte of the node's cumulative ack
+void test_ack_byte_is_cumulative() {
+  TestNode::sequence = 0x01FE;
+  TestNode::take(4); // 0x01FE-0x0201
+  TestNode::noteAckByte(0xFF);
+  TestNode::applyAck();
+  const uint16_t left[] = {0x0200, 0x0201};
+  TestNode::assertUnacked(left, 2);
+
+  TestNode::noteAckByte(-1); // Slot without an ack byte
+  FrameAck ack;
+  TEST_ASSERT_FALSE(TestNode::takeAck(ack));
+}
+
+void test_seq_wrap() {
+  TestNode::sequence = 0xFFFE;
+  TestNode::take(4); // 0xFFFE, 0xFFFF, 0, 1
+  TestNode::noteAck({0, 0x5}); // Holds 0 and 0xFFFE
+  TestNode::applyAck();
+  const uint16_t left[] = {0xFFFF, 1};
+  TestNode::assertUnacked(left, 2);
+
+  TestNode::noteAckByte(0x01);
+  TestNode::applyAck();
+  TEST_ASSERT_EQUAL_UINT8(0, TestNode::unackedCount);
+}
+
+// A full resend buffer gives up the oldest reading, the ack still applies
+void test_full_buffer_drops_oldest() {
+  TestNode::take(NODE_RESEND_SLOTS + 2);
+  TEST_ASSERT_EQUAL_UINT8(NODE_RESEND_SLOTS, TestNode::unackedCount);
+  TEST_ASSERT_EQUAL_UINT16(2, TestNode::unacked[0].seq);
+  TestNode::noteAck({NODE_RESEND_SLOTS + 1, ~0u});
+  TestNode::applyAck();
+  TEST_ASSERT_EQUAL_UINT8(0, TestNode::unackedCount);
+}
+
+// The ESP-NOW callback notes acks on the WiFi task while update() takes
+// them; every ack taken must be one that was noted, whole
+void test_callback_and_loop_race() {
+  std::atomic<bool> done(false);
+  std::thread callback([&] {
+    for (uint32_t n = 1; n <= STRESS_ACKS; n++) {
+      uint16_t seq = static_cast<uint16_t>(n);
+      TestNode::noteAck({seq, windowFor(seq)});
+    }
+    done.store(true, std::memory_order_release);
+  });
+
+  uint32_t taken = 0;
+  uint32_t torn = 0;
+  FrameAck ack;
+  uint16_t last = 0;
+  for (;;) {
+    bool finished = done.load(std::memory_order_acquire);
+    if (TestNode::takeAck(ack)) {
+      taken++;
+      if (ack.window != windowFor(ack.seq)) torn++;
+      last = ack.seq;
+    } else if (finished) {
+      break;
+    }
+  }
+  callback.join();
+
+  TEST_ASSERT_EQUAL_UINT32(0, torn);
+  TEST_ASSERT_GREATER_THAN(0, taken);
+  // The final ack is never lost
+  TEST_ASSERT_EQUAL_UINT16(static_cast<uint16_t>(STRESS_ACKS), last);
+}
+
+void test_reply_due_once() {
+  TEST_ASSERT_FALSE(TestNode::replyDue());
+  TestNode::scheduleReply(0, 7);
+  TEST_ASSERT_TRUE(TestNode::replyDue());
+  TEST_ASSERT_EQUAL_UINT16(7, TestNode::replyTo);
+  TEST_ASSERT_FALSE(TestNode::replyDue());
+
+  // A later poll replaces the reply still waiting for its slot
+  TestNode::scheduleReply(60000, 8);
+  TEST_ASSERT_FALSE(TestNode::replyDue());
+  TestNode::scheduleReply(0, 9);
+  TEST_ASSERT_TRUE(TestNode::replyDue());
+  TEST_ASSERT_EQUAL_UINT16(9, TestNode::replyTo);
+}
+
+// The callback schedules even seqs now and odd ones a minute out while
+// update() takes what is due; a due reply with an odd seq is torn
+void test_reply_callback_and_loop_race() {
+  std::atomic<bool> done(false);
+  std::thread callback([&] {
+    for (uint32_t n = 1; n <= STRESS_ACKS; n++) {
+      uint16_t seq = static_cast<uint16_t>(n);
+      TestNode::scheduleReply(seq & 1 ? 60000 : 0, seq);
+    }
+    done.store(true, std::memory_order_release);
+  });
+
+  uint32_t taken = 0;
+  uint32_t torn = 0;
+  for (;;) {
+    bool finished = done.load(std::memory_order_acquire);
+    if (TestNode::replyDue()) {
+      taken++;
+      if (TestNode::replyTo & 1) torn++;
+    } else if (finished) {
+      break;
+    }
+  }
+  callback.join();
+
+  TEST_ASSERT_EQUAL_UINT32(0, torn);
+  TEST_ASSERT_GREATER_THAN(0, taken);
+  // The final poll is due at once and its reply never lost
+  TEST_ASSERT_EQUAL_UINT16(static_cast<uint16_t>(STRESS_ACKS), TestNode::replyTo);
+  TEST_ASSERT_EQUAL_UINT64(0, TestNode::pendingReply.load());
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_ack_releases_held_readings);
+  RUN_TEST(test_readings_past_the_window_count_as_held);
+  RUN_TEST(test_latest_ack_wins);
+  RUN_TEST(test_ack_byte_is_cumulative);
+  RUN_TEST(test_seq_wrap);
+  RUN_TEST(test_full_buffer_drops_oldest);
+  RUN_TEST(test_callback_and_loop_race);
+  RUN_TEST(test_reply_due_once);
+  RUN_TEST(test_reply_callback_and_loop_race);
+  return UNITY_END();
+}
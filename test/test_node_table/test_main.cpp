@@ -0,0 +1,217 @@
+// NodeTable: lookups by MAC and id across probe chains that collide and
+// wrap past the last slot, removal shifting later entries back so they
+// stay reachable, the least active node as the one to evict from a full
+// table, and the accept/settleBefore dedup window across seq wrap.
+#include <unity.h>
+#include <string.h>
+#include "node_table.h"
+
+static NodeTable table;
+
+static void nodeMac(uint16_t n, uint8_t* mac) {
+  const uint8_t prefix[4] = {0x24, 0x6F, 0x28, 0x10};
+  memcpy(mac, prefix, 4);
+  mac[4] = static_cast<uint8_t>(n >> 8);
+  mac[5] = static_cast<uint8_t>(n);
+}
+
+static int add(uint16_t n, uint16_t id, uint32_t now = 0) {
+  uint8_t mac[6];
+  nodeMac(n, mac);
+  return table.add(mac, id, now);
+}
+
+static int find(uint16_t n) {
+  uint8_t mac[6];
+  nodeMac(n, mac);
+  return table.find(mac);
+}
+
+// Ids whose home is slot in the id index, hashed as node_table.cpp does
+static void idsHomedAt(size_t slot, uint16_t* ids, int count) {
+  for (uint32_t id = 1; count > 0 && id < 0xFFFF; id++) {
+    if (((id * 2654435761u >> 16) & (NODE_TABLE_SLOTS - 1)) != slot) continue;
+    *ids++ = static_cast<uint16_t>(id);
+    count--;
+  }
+  TEST_ASSERT_EQUAL(0, count);
+}
+
+void setUp() {
+  table.clear();
+}
+
+void tearDown() {}
+
+// Ids homed in the last slot and in the first share one chain that wraps
+// around the end of the index: last, first, first, then three more homed
+// last. Removing from the front and the middle of it must leave every
+// later one reachable, and those homed at the start where they are.
+void test_collision_chain_across_wrap() {
+  uint16_t ids[6];
+  uint16_t last[4];
+  idsHomedAt(NODE_TABLE_SLOTS - 1, last, 4);
+  idsHomedAt(0, ids + 1, 2);
+  ids[0] = last[0];
+  memcpy(ids + 3, last + 1, 3 * sizeof(uint16_t));
+  int index[6];
+  for (int i = 0; i < 6; i++) {
+    index[i] = add(i, ids[i]);
+    TEST_ASSERT_GREATER_OR_EQUAL(0, index[i]);
+  }
+  for (int i = 0; i < 6; i++) TEST_ASSERT_EQUAL(index[i], table.findId(ids[i]));
+
+  const int order[] = {0, 4, 2};
+  bool removed[6] = {};
+  for (int r : order) {
+    TEST_ASSERT_TRUE(table.remove(index[r]));
+    removed[r] = true;
+    for (int i = 0; i < 6; i++) {
+      TEST_ASSERT_EQUAL(removed[i] ? -1 : index[i], table.findId(ids[i]));
+      TEST_ASSERT_EQUAL(removed[i] ? -1 : index[i], find(i));
+    }
+  }
+  TEST_ASSERT_FALSE(table.remove(index[0])); // Already gone
+  TEST_ASSERT_EQUAL(3, table.size());
+
+  // The freed places are taken again
+  TEST_ASSERT_GREATER_OR_EQUAL(0, add(10, ids[0]));
+  TEST_ASSERT_GREATER_OR_EQUAL(0, add(14, ids[4]));
+  TEST_ASSERT_GREATER_OR_EQUAL(0, add(12, ids[2]));
+  TEST_ASSERT_EQUAL(add(10, ids[0]), table.findId(ids[0]));
+  TEST_ASSERT_EQUAL(-1, find(0));
+  for (int i = 1; i < 6; i += 2) TEST_ASSERT_EQUAL(index[i], table.findId(ids[i]));
+  TEST_ASSERT_EQUAL(6, table.size());
+}
+
+// Many nodes in and out in an order unrelated to their slots; both
+// indexes must agree with the entries after every removal
+void test_churn_keeps_both_indexes() {
+  int index[NODE_TABLE_CAPACITY];
+  for (uint16_t n = 0; n < NODE_TABLE_CAPACITY; n++) {
+    index[n] = add(n, static_cast<uint16_t>(n * 97 + 1));
+    TEST_ASSERT_GREATER_OR_EQUAL(0, index[n]);
+  }
+  TEST_ASSERT_TRUE(table.full());
+
+  for (int round = 0; round < 3; round++) {
+    for (uint16_t n = round; n < NODE_TABLE_CAPACITY; n += 3) {
+      TEST_ASSERT_TRUE(table.remove(index[n]));
+    }
+    for (uint16_t n = 0; n < NODE_TABLE_CAPACITY; n++) {
+      bool gone = n % 3 <= round;
+      TEST_ASSERT_EQUAL(gone ? -1 : index[n], find(n));
+      TEST_ASSERT_EQUAL(gone ? -1 : index[n], table.findId(static_cast<uint16_t>(n * 97 + 1)));
+    }
+  }
+  TEST_ASSERT_TRUE(table.empty());
+}
+
+void test_add_rejects_taken_id() {
+  int first = add(1, 0x0042);
+  TEST_ASSERT_GREATER_OR_EQUAL(0, first);
+  TEST_ASSERT_EQUAL(first, add(1, 0x0099)); // Known MAC keeps its entry and id
+  TEST_ASSERT_EQUAL_UINT16(0x0042, table[first].id);
+  TEST_ASSERT_EQUAL(-1, add(2, 0x0042));
+  TEST_ASSERT_EQUAL(1, table.size());
+}
+
+// What Base::addNode does with a full table: the node quiet the longest
+// goes, and the new one takes its place
+void test_full_table_evicts_least_active() {
+  for (uint16_t n = 0; n < NODE_TABLE_CAPACITY; n++) add(n, n + 1, 1000 + n);
+  TEST_ASSERT_EQUAL(-1, add(NODE_TABLE_CAPACITY, 0x0F00, 5000));
+
+  // Node 0 answers again; node 1 is now the quietest
+  table.seen(find(0), -70, 0, 6000);
+  int victim = table.leastActive();
+  TEST_ASSERT_EQUAL(find(1), victim);
+
+  TEST_ASSERT_TRUE(table.remove(victim));
+  int index = add(NODE_TABLE_CAPACITY, 0x0F00, 6000);
+  TEST_ASSERT_EQUAL(victim, index);
+  TEST_ASSERT_EQUAL(-1, find(1));
+  TEST_ASSERT_EQUAL(-1, table.findId(2));
+  TEST_ASSERT_EQUAL(index, table.findId(0x0F00));
+  TEST_ASSERT_EQUAL(find(2), table.leastActive());
+}
+
+// lastSeen is millis(): a node seen just after the wrap is the recent one
+void test_least_active_across_millis_wrap() {
+  add(1, 1, 0xFFFFFF00);
+  add(2, 2, 0x00000100);
+  add(3, 3, 0xFFFFFFF0);
+  TEST_ASSERT_EQUAL(find(1), table.leastActive());
+  table.clear();
+  TEST_ASSERT_EQUAL(-1, table.leastActive());
+}
+
+void test_accept_duplicates_and_window() {
+  int index = add(1, 1);
+  TEST_ASSERT_TRUE(table.accept(index, 100)); // First reading starts the window
+  TEST_ASSERT_FALSE(table.accept(index, 100));
+  TEST_ASSERT_FALSE(table.accept(index, 99)); // Older than the first one counts as held
+
+  TEST_ASSERT_TRUE(table.accept(index, 103)); // 101 and 102 missing
+  TEST_ASSERT_EQUAL_UINT16(100, table.ackedThrough(index));
+  TEST_ASSERT_TRUE(table.accept(index, 101));
+  TEST_ASSERT_FALSE(table.accept(index, 101));
+  TEST_ASSERT_EQUAL_UINT16(101, table.ackedThrough(index));
+  TEST_ASSERT_TRUE(table.accept(index, 102));
+  TEST_ASSERT_EQUAL_UINT16(103, table.ackedThrough(index));
+
+  // A jump past the window leaves only the new seq held; the ones behind
+  // it that fell out of the window count as held
+  TEST_ASSERT_TRUE(table.accept(index, 103 + FRAME_ACK_WINDOW));
+  TEST_ASSERT_EQUAL_UINT32(1, table[index].seqWindow);
+  TEST_ASSERT_FALSE(table.accept(index, 103));
+  TEST_ASSERT_TRUE(table.accept(index, 104));
+}
+
+void test_accept_across_seq_wrap() {
+  int index = add(1, 1);
+  TEST_ASSERT_TRUE(table.accept(index, 0xFFFD));
+  TEST_ASSERT_TRUE(table.accept(index, 0x0001)); // 0xFFFE, 0xFFFF and 0 missing
+  TEST_ASSERT_EQUAL_UINT16(0x0001, table[index].lastSeq);
+  TEST_ASSERT_EQUAL_UINT16(0xFFFD, table.ackedThrough(index));
+  TEST_ASSERT_TRUE(table.accept(index, 0xFFFF));
+  TEST_ASSERT_FALSE(table.accept(index, 0xFFFF));
+  TEST_ASSERT_TRUE(table.accept(index, 0x0000));
+  TEST_ASSERT_TRUE(table.accept(index, 0xFFFE));
+  TEST_ASSERT_EQUAL_UINT16(0x0001, table.ackedThrough(index));
+  TEST_ASSERT_FALSE(table.accept(index, 0x0001));
+}
+
+// A frame whose oldest resent reading is seq: everything before it was
+// given up by the node and must not be waited for, nor accepted again
+void test_settle_before() {
+  int index = add(1, 1);
+  TEST_ASSERT_TRUE(table.accept(index, 10));
+  TEST_ASSERT_TRUE(table.accept(index, 20)); // 11-19 missing
+  TEST_ASSERT_EQUAL_UINT16(5, table.settleBefore(index, 16));
+  TEST_ASSERT_EQUAL_UINT16(15, table.ackedThrough(index));
+  TEST_ASSERT_FALSE(table.accept(index, 13));
+  TEST_ASSERT_TRUE(table.accept(index, 16));
+  TEST_ASSERT_EQUAL_UINT16(0, table.settleBefore(index, 16)); // Nothing new to settle
+
+  // Across the wrap
+  table[index].seqWindow = 0;
+  TEST_ASSERT_TRUE(table.accept(index, 0xFFF0));
+  TEST_ASSERT_TRUE(table.accept(index, 0x0002));
+  TEST_ASSERT_EQUAL_UINT16(0x0F, table.settleBefore(index, 0x0000));
+  TEST_ASSERT_EQUAL_UINT16(0xFFFF, table.ackedThrough(index));
+  TEST_ASSERT_TRUE(table.accept(index, 0x0000));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_collision_chain_across_wrap);
+  RUN_TEST(test_churn_keeps_both_indexes);
+  RUN_TEST(test_add_rejects_taken_id);
+  RUN_TEST(test_full_table_evicts_least_active);
+  RUN_TEST(test_least_active_across_millis_wrap);
+  RUN_TEST(test_accept_duplicates_and_window);
+  RUN_TEST(test_accept_across_seq_wrap);
+  RUN_TEST(test_settle_before);
+  return UNITY_END();
+}
@@ -0,0 +1,170 @@
+// PeerCache against the ESP-NOW peer table in hal_native, which keeps the
+// driver's limit of 20 peers: hits, least recently used eviction, the hold
+// time after a send, peers added outside the cache, and millis() wrap.
+#include <unity.h>
+#include <string.h>
+#include "hal.h"
+#include "peer_cache.h"
+
+#define TEST_MACS 40
+
+static PeerCache cache;
+static uint8_t macs[TEST_MACS][6];
+static const uint8_t broadcast[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+static void addOutside(const uint8_t* mac) {
+  esp_now_peer_info_t peer = {};
+  memcpy(peer.peer_addr, mac, 6);
+  TEST_ASSERT_EQUAL_INT(ESP_OK, esp_now_add_peer(&peer));
+}
+
+// Fills the cache with macs[0..PEER_CACHE_SIZE), one every 100 ms from start
+static void fill(uint32_t start) {
+  for (int i = 0; i < PEER_CACHE_SIZE; i++) {
+    TEST_ASSERT_TRUE(cache.acquire(macs[i], start + i * 100));
+  }
+}
+
+void setUp() {
+  for (auto& mac : macs) esp_now_del_peer(mac);
+  esp_now_del_peer(broadcast);
+  cache = PeerCache();
+  cache.begin(1);
+}
+
+void tearDown() {}
+
+void test_repeated_sends_hit() {
+  for (uint32_t t = 0; t < 10; t++) TEST_ASSERT_TRUE(cache.acquire(macs[0], t));
+  const PeerCache::Stats& stats = cache.getStats();
+  TEST_ASSERT_EQUAL_UINT32(1, stats.misses);
+  TEST_ASSERT_EQUAL_UINT32(9, stats.hits);
+  TEST_ASSERT_EQUAL(1, halNativeEspNowPeerCount());
+  TEST_ASSERT_TRUE(esp_now_is_peer_exist(macs[0]));
+}
+
+void test_evicts_least_recently_used() {
+  fill(0);
+  TEST_ASSERT_EQUAL(PEER_CACHE_SIZE, cache.size());
+  TEST_ASSERT_TRUE(cache.acquire(macs[0], 2000)); // Now the most recent
+
+  TEST_ASSERT_TRUE(cache.acquire(macs[PEER_CACHE_SIZE], 2100));
+  TEST_ASSERT_FALSE(esp_now_is_peer_exist(macs[1]));
+  TEST_ASSERT_TRUE(esp_now_is_peer_exist(macs[0]));
+  TEST_ASSERT_TRUE(esp_now_is_peer_exist(macs[PEER_CACHE_SIZE]));
+
+  TEST_ASSERT_TRUE(cache.acquire(macs[PEER_CACHE_SIZE + 1], 2200));
+  TEST_ASSERT_FALSE(esp_now_is_peer_exist(macs[2]));
+
+  const PeerCache::Stats& stats = cache.getStats();
+  TEST_ASSERT_EQUAL_UINT32(2, stats.evictions);
+  TEST_ASSERT_EQUAL_UINT32(0, stats.failures);
+  TEST_ASSERT_EQUAL(PEER_CACHE_SIZE, cache.size());
+  TEST_ASSERT_EQUAL(PEER_CACHE_SIZE, halNativeEspNowPeerCount());
+}
+
+// A node polled round-robin over more peers than fit churns one peer per
+// send, and the driver table never grows past the cache
+void test_round_robin_churn() {
+  uint32_t now = 0;
+  for (int round = 0; round < 3; round++) {
+    for (int i = 0; i < TEST_MACS; i++) {
+      TEST_ASSERT_TRUE(cache.acquire(macs[i], now += PEER_CACHE_HOLD_MS));
+      TEST_ASSERT_LESS_OR_EQUAL(PEER_CACHE_SIZE, halNativeEspNowPeerCount());
+    }
+  }
+  const PeerCache::Stats& stats = cache.getStats();
+  TEST_ASSERT_EQUAL_UINT32(3 * TEST_MACS, stats.misses);
+  TEST_ASSERT_EQUAL_UINT32(3 * TEST_MACS - PEER_CACHE_SIZE, stats.evictions);
+}
+
+// No peer goes while the driver may still be retrying a frame to it
+void test_hold_time_blocks_eviction() {
+  for (int i = 0; i < PEER_CACHE_SIZE; i++) TEST_ASSERT_TRUE(cache.acquire(macs[i], 1000 + i));
+  uint32_t lastUse = 1000 + PEER_CACHE_SIZE - 1;
+
+  TEST_ASSERT_FALSE(cache.acquire(macs[PEER_CACHE_SIZE], 1000 + PEER_CACHE_HOLD_MS - 1));
+  TEST_ASSERT_EQUAL_UINT32(1, cache.getStats().failures);
+  TEST_ASSERT_EQUAL_UINT32(0, cache.getStats().evictions);
+  TEST_ASSERT_FALSE(esp_now_is_peer_exist(macs[PEER_CACHE_SIZE]));
+
+  // Only macs[0] is past its hold
+  TEST_ASSERT_TRUE(cache.acquire(macs[PEER_CACHE_SIZE], 1000 + PEER_CACHE_HOLD_MS));
+  TEST_ASSERT_FALSE(esp_now_is_peer_exist(macs[0]));
+  TEST_ASSERT_FALSE(cache.acquire(macs[0], 1000 + PEER_CACHE_HOLD_MS));
+  TEST_ASSERT_TRUE(cache.acquire(macs[0], lastUse + PEER_CACHE_HOLD_MS));
+  TEST_ASSERT_FALSE(esp_now_is_peer_exist(macs[1]));
+}
+
+// The broadcast peer and others added outside leave the cache less room
+// in the driver; a full driver fails the add without caching the peer
+void test_peers_added_outside() {
+  addOutside(broadcast);
+  int outside = ESP_NOW_MAX_TOTAL_PEER_NUM - PEER_CACHE_SIZE - 1;
+  for (int i = 0; i < outside; i++) addOutside(macs[TEST_MACS - 1 - i]);
+  fill(0);
+  TEST_ASSERT_EQUAL(ESP_NOW_MAX_TOTAL_PEER_NUM, halNativeEspNowPeerCount());
+
+  // Evicting makes room
+  TEST_ASSERT_TRUE(cache.acquire(macs[PEER_CACHE_SIZE], 5000));
+  TEST_ASSERT_FALSE(esp_now_is_peer_exist(macs[0]));
+  TEST_ASSERT_EQUAL(ESP_NOW_MAX_TOTAL_PEER_NUM, halNativeEspNowPeerCount());
+
+  // A free cache entry, but the spot went to another peer added outside
+  cache.drop(macs[PEER_CACHE_SIZE]);
+  addOutside(macs[TEST_MACS - 1 - outside]);
+  TEST_ASSERT_FALSE(cache.acquire(macs[PEER_CACHE_SIZE + 1], 6000));
+  TEST_ASSERT_EQUAL_UINT32(1, cache.getStats().failures);
+  TEST_ASSERT_FALSE(esp_now_is_peer_exist(macs[PEER_CACHE_SIZE + 1]));
+  TEST_ASSERT_EQUAL(PEER_CACHE_SIZE - 1, cache.size());
+
+  // A peer already added outside is taken as it is
+  TEST_ASSERT_TRUE(cache.acquire(macs[TEST_MACS - 1], 7000));
+  TEST_ASSERT_EQUAL(PEER_CACHE_SIZE, cache.size());
+  TEST_ASSERT_TRUE(esp_now_is_peer_exist(broadcast));
+}
+
+void test_drop_and_begin_remove_driver_peers() {
+  fill(0);
+  cache.drop(macs[3]);
+  cache.drop(macs[PEER_CACHE_SIZE]); // Not cached, nothing happens
+  TEST_ASSERT_FALSE(esp_now_is_peer_exist(macs[3]));
+  TEST_ASSERT_EQUAL(PEER_CACHE_SIZE - 1, cache.size());
+  TEST_ASSERT_EQUAL(PEER_CACHE_SIZE - 1, halNativeEspNowPeerCount());
+
+  // The freed entry is used before anything is evicted
+  TEST_ASSERT_TRUE(cache.acquire(macs[PEER_CACHE_SIZE], 5000));
+  TEST_ASSERT_EQUAL_UINT32(0, cache.getStats().evictions);
+
+  addOutside(broadcast);
+  cache.begin(1);
+  TEST_ASSERT_EQUAL(0, cache.size());
+  TEST_ASSERT_EQUAL(1, halNativeEspNowPeerCount());
+  TEST_ASSERT_TRUE(esp_now_is_peer_exist(broadcast));
+}
+
+void test_lru_across_millis_wrap() {
+  fill(0xFFFFFFFF - 1000);                        // Last ones used after the wrap
+  TEST_ASSERT_TRUE(cache.acquire(macs[0], 1000)); // Wrapped, most recent
+  TEST_ASSERT_TRUE(cache.acquire(macs[PEER_CACHE_SIZE], 1100));
+  TEST_ASSERT_FALSE(esp_now_is_peer_exist(macs[1]));
+  TEST_ASSERT_TRUE(esp_now_is_peer_exist(macs[0]));
+}
+
+int main(int argc, char** argv) {
+  for (int i = 0; i < TEST_MACS; i++) {
+    const uint8_t mac[6] = {0x24, 0x6F, 0x28, 0x10, 0x00, static_cast<uint8_t>(i + 1)};
+    memcpy(macs[i], mac, 6);
+  }
+  esp_now_init();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_repeated_sends_hit);
+  RUN_TEST(test_evicts_least_recently_used);
+  RUN_TEST(test_round_robin_churn);
+  RUN_TEST(test_hold_time_blocks_eviction);
+  RUN_TEST(test_peers_added_outside);
+  RUN_TEST(test_drop_and_begin_remove_driver_peers);
+  RUN_TEST(test_lru_across_millis_wrap);
+  return UNITY_END();
+}
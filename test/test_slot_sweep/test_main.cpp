@@ -0,0 +1,123 @@
+// SlotSchedule reply bookkeeping, and a simulated ESP-NOW fleet large
+// enough for two beacon groups, where every listed node must answer in
+// its own slot and no sweep may fall back on trigger retries.
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include "hal.h"
+#include "sim.h"
+#include "slot_schedule.h"
+#include "base_espnow.h"
+
+#define SIM_NODES 120         // Two beacon groups
+#define SIM_CHECK_AT_MS 28000 // Between two sweeps, 5 s apart
+#define SIM_SPEED 10
+
+static SlotSchedule schedule;
+
+void setUp() {}
+void tearDown() {}
+
+void test_mark_answered_by_id() {
+  // Ids as the node table hands them out: sparse, up to 0xFFFE
+  uint16_t ids[SLOT_SCHEDULE_MAX];
+  uint8_t acks[SLOT_SCHEDULE_MAX] = {};
+  for (size_t i = 0; i < SLOT_SCHEDULE_MAX; i++) ids[i] = static_cast<uint16_t>(0xFFFE - i * 251);
+  schedule.begin(ids, acks, nullptr, SLOT_SCHEDULE_MAX, 42);
+
+  for (size_t i = 0; i < SLOT_SCHEDULE_MAX; i += 3) TEST_ASSERT_TRUE(schedule.markAnswered(ids[i]));
+  TEST_ASSERT_TRUE(schedule.markAnswered(ids[0])); // Twice counts once
+  TEST_ASSERT_EQUAL(SLOT_SCHEDULE_MAX / 3 + 1, schedule.answeredCount());
+  for (size_t i = 0; i < SLOT_SCHEDULE_MAX; i++) {
+    TEST_ASSERT_EQUAL(i % 3 == 0, schedule.answeredAt(i));
+  }
+
+  TEST_ASSERT_FALSE(schedule.markAnswered(0));
+  TEST_ASSERT_FALSE(schedule.markAnswered(0xFFFF));
+  TEST_ASSERT_FALSE(schedule.markAnswered(ids[1] + 1));
+  TEST_ASSERT_EQUAL(SLOT_SCHEDULE_MAX / 3 + 1, schedule.answeredCount());
+}
+
+// Ids that collide in the index still find their own positions
+void test_mark_answered_colliding_ids() {
+  uint16_t ids[64];
+  uint8_t acks[64] = {};
+  for (size_t i = 0; i < 64; i++) ids[i] = static_cast<uint16_t>(i * SLOT_SCHEDULE_INDEX);
+  schedule.begin(ids, acks, nullptr, 64, 1);
+  for (size_t i = 64; i-- > 0;) {
+    TEST_ASSERT_TRUE(schedule.markAnswered(ids[i]));
+    TEST_ASSERT_EQUAL(64 - i, schedule.answeredCount());
+    TEST_ASSERT_TRUE(schedule.answeredAt(i));
+  }
+  TEST_ASSERT_FALSE(schedule.markAnswered(64 * SLOT_SCHEDULE_INDEX));
+}
+
+// Positions follow the rate sort, and a new sweep forgets the last one
+void test_mark_answered_after_rate_sort() {
+  uint16_t ids[] = {10, 20, 30, 40, 50};
+  uint8_t acks[5] = {};
+  uint8_t rates[] = {2, 0, 2, 1, 0};
+  schedule.begin(ids, acks, rates, 5, 7);
+  TEST_ASSERT_TRUE(schedule.markAnswered(30));
+  TEST_ASSERT_EQUAL_UINT16(30, schedule.idAt(4)); // 20 50 | 40 | 10 30
+  TEST_ASSERT_TRUE(schedule.answeredAt(4));
+  TEST_ASSERT_FALSE(schedule.answeredAt(3));
+
+  uint16_t next[] = {60};
+  schedule.begin(next, acks, nullptr, 1, 8);
+  TEST_ASSERT_FALSE(schedule.markAnswered(30));
+  TEST_ASSERT_TRUE(schedule.markAnswered(60));
+  schedule.finish();
+  TEST_ASSERT_FALSE(schedule.markAnswered(60));
+}
+
+static Base base;
+static EspNowTransport espNow;
+
+void test_simulated_sweep() {
+#ifdef BATCH_LOG_PATH
+  remove(BATCH_LOG_PATH);
+#endif
+  SimConfig cfg;
+  cfg.nodes = SIM_NODES;
+  cfg.speed = SIM_SPEED;
+  static Simulator sim(cfg);
+  HalNativeConfig hal;
+  memcpy(hal.mac, Simulator::baseMac, 6);
+  halNativeSetSpeed(cfg.speed);
+  halNativeBegin(&sim, hal);
+  base.addTransport(espNow);
+  base.begin();
+  sim.start();
+
+  uint32_t end = millis() + SIM_CHECK_AT_MS;
+  while (static_cast<int32_t>(millis() - end) < 0) {
+    base.update();
+    std::this_thread::sleep_for(std::chrono::microseconds(20));
+  }
+
+  Simulator::SlotStats slots = sim.getSlotStats();
+  TriggerEngine::Stats triggers = Base::getTriggerStats();
+  // Five sweeps of two groups each
+  TEST_ASSERT_EQUAL_UINT64(10, slots.beacons);
+  TEST_ASSERT_GREATER_OR_EQUAL(5 * SIM_NODES, slots.listed);
+  TEST_ASSERT_EQUAL_UINT64(slots.listed, slots.answered);
+  TEST_ASSERT_EQUAL_UINT64(0, slots.late);
+  TEST_ASSERT_EQUAL_UINT32(0, triggers.retries);
+  TEST_ASSERT_EQUAL_UINT32(0, triggers.missed);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_mark_answered_by_id);
+  RUN_TEST(test_mark_answered_colliding_ids);
+  RUN_TEST(test_mark_answered_after_rate_sort);
+  RUN_TEST(test_simulated_sweep);
+  int failures = UNITY_END();
+  fflush(stdout);
+  // The base's tasks are still running; skip the static destructors
+  _Exit(failures);
+}
@@ -0,0 +1,150 @@
+// SpscRing: FIFO order across wraparound, drop-newest on overflow, and a
+// producer and a consumer thread hammering a base-sized ring of readings
+// in 50-node bursts without tearing or losing a message uncounted.
+#include <unity.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include "spsc_ring.h"
+#include "reading_store.h"
+
+#define STRESS_MESSAGES 2000000
+#define STRESS_BURST 50 // Nodes answering one beacon at once
+#define STRESS_RING 128 // As the base's message queue
+
+// Every field derived from the seq, so a torn copy shows
+static Reading stressReading(uint32_t n) {
+  Reading r;
+  for (int i = 0; i < 6; i++) r.mac[i] = static_cast<uint8_t>(n >> (i * 4));
+  r.nodeId = static_cast<uint16_t>(n % STRESS_BURST + 1);
+  r.seq = static_cast<uint16_t>(n);
+  r.rssi = static_cast<int16_t>(-(n % 120));
+  r.snr = static_cast<int8_t>(n % 21 - 10);
+  r.span = static_cast<uint8_t>(n % 8);
+  r.replyTo = static_cast<uint16_t>(n / STRESS_BURST);
+  r.value = static_cast<int32_t>(n * 2654435761u);
+  r.receivedAt = n;
+  r.epoch = ~n;
+  return r;
+}
+
+static bool sameReading(const Reading& a, const Reading& b) {
+  return memcmp(a.mac, b.mac, 6) == 0 && a.nodeId == b.nodeId && a.seq == b.seq &&
+         a.rssi == b.rssi && a.snr == b.snr && a.span == b.span && a.replyTo == b.replyTo &&
+         a.value == b.value && a.receivedAt == b.receivedAt && a.epoch == b.epoch;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_fifo_across_wraparound() {
+  SpscRing<uint32_t, 8> ring;
+  uint32_t next = 0;
+  uint32_t expect = 0;
+  // Uneven pushes and pops walk head and tail around the slots many times
+  for (int round = 0; round < 1000; round++) {
+    int pushes = 1 + round % 7;
+    for (int i = 0; i < pushes; i++) TEST_ASSERT_TRUE(ring.push(next++));
+    int pops = 1 + (round * 3) % pushes;
+    for (int i = 0; i < pops; i++) {
+      uint32_t got;
+      TEST_ASSERT_TRUE(ring.pop(got));
+      TEST_ASSERT_EQUAL_UINT32(expect++, got);
+    }
+    uint32_t got;
+    while (ring.size() > 1 && ring.pop(got)) TEST_ASSERT_EQUAL_UINT32(expect++, got);
+  }
+  uint32_t got;
+  while (ring.pop(got)) TEST_ASSERT_EQUAL_UINT32(expect++, got);
+  TEST_ASSERT_EQUAL_UINT32(next, expect);
+  TEST_ASSERT_GREATER_THAN(8 * 100, next);
+  TEST_ASSERT_EQUAL_UINT32(0, ring.dropped());
+  TEST_ASSERT_TRUE(ring.empty());
+}
+
+void test_full_ring_drops_newest() {
+  SpscRing<uint32_t, 4> ring;
+  for (uint32_t i = 0; i < 4; i++) TEST_ASSERT_TRUE(ring.push(i));
+  TEST_ASSERT_FALSE(ring.push(100));
+  TEST_ASSERT_FALSE(ring.push(101));
+  TEST_ASSERT_EQUAL_UINT32(2, ring.dropped());
+  TEST_ASSERT_EQUAL_UINT32(4, ring.highWater());
+  TEST_ASSERT_EQUAL(4, ring.size());
+
+  // The queued items survive, the rejected ones never show up
+  uint32_t got;
+  TEST_ASSERT_TRUE(ring.pop(got));
+  TEST_ASSERT_EQUAL_UINT32(0, got);
+  TEST_ASSERT_TRUE(ring.push(4));
+  for (uint32_t i = 1; i <= 4; i++) {
+    TEST_ASSERT_TRUE(ring.pop(got));
+    TEST_ASSERT_EQUAL_UINT32(i, got);
+  }
+  TEST_ASSERT_FALSE(ring.pop(got));
+  TEST_ASSERT_EQUAL_UINT32(2, ring.dropped());
+}
+
+void test_clear() {
+  SpscRing<uint32_t, 4> ring;
+  ring.push(1);
+  ring.push(2);
+  ring.clear();
+  TEST_ASSERT_TRUE(ring.empty());
+  uint32_t got;
+  TEST_ASSERT_FALSE(ring.pop(got));
+  TEST_ASSERT_TRUE(ring.push(3));
+  TEST_ASSERT_TRUE(ring.pop(got));
+  TEST_ASSERT_EQUAL_UINT32(3, got);
+  TEST_ASSERT_EQUAL_UINT32(2, ring.highWater());
+}
+
+void test_threads_burst_stress() {
+  static SpscRing<Reading, STRESS_RING> ring;
+  std::atomic<bool> done(false);
+  uint32_t rejected = 0;
+
+  std::thread producer([&] {
+    for (uint32_t n = 0; n < STRESS_MESSAGES; n++) {
+      if (!ring.push(stressReading(n))) rejected++;
+      // A burst of replies, then a gap while the next beacon goes out
+      if (n % STRESS_BURST == STRESS_BURST - 1) std::this_thread::yield();
+    }
+    done.store(true, std::memory_order_release);
+  });
+
+  uint32_t received = 0;
+  uint32_t torn = 0;
+  uint32_t reordered = 0;
+  int64_t last = -1;
+  Reading r;
+  for (;;) {
+    bool finished = done.load(std::memory_order_acquire);
+    if (!ring.pop(r)) {
+      if (finished) break;
+      continue;
+    }
+    received++;
+    uint32_t n = r.receivedAt;
+    if (!sameReading(r, stressReading(n))) torn++;
+    if (static_cast<int64_t>(n) <= last) reordered++;
+    last = n;
+  }
+  producer.join();
+
+  TEST_ASSERT_EQUAL_UINT32(0, torn);
+  TEST_ASSERT_EQUAL_UINT32(0, reordered);
+  // Every message was either delivered or counted as dropped
+  TEST_ASSERT_EQUAL_UINT32(rejected, ring.dropped());
+  TEST_ASSERT_EQUAL_UINT32(STRESS_MESSAGES, received + ring.dropped());
+  TEST_ASSERT_LESS_OR_EQUAL(STRESS_RING, ring.highWater());
+  TEST_ASSERT_TRUE(ring.empty());
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_fifo_across_wraparound);
+  RUN_TEST(test_full_ring_drops_newest);
+  RUN_TEST(test_clear);
+  RUN_TEST(test_threads_burst_stress);
+  return UNITY_END();
+}
@@ -0,0 +1,264 @@
+// TriggerEngine on a fake clock: each node's IDLE/PENDING/IN_FLIGHT/BACKOFF
+// cycle, the window of triggers in flight, timeouts doubling per retry
+// until a miss, the Jacobson/Karels estimate fed by first attempts only,
+// stale replies, and group triggers with their slot-delayed timeouts.
+#include <unity.h>
+#include <string.h>
+#include "trigger_engine.h"
+
+#define TEST_RTT 50 // Unmeasured nodes time out after twice this
+#define TEST_MIN_TIMEOUT 20
+#define TEST_MAX_TIMEOUT 1000
+#define TEST_NODES 6
+
+static NodeTable table;
+static TriggerEngine* triggers;
+static int nodes[TEST_NODES];
+
+// Hands out the next trigger, which must be for index, at now
+static void sendNext(uint32_t now, int index, uint16_t seq) {
+  int got = -1;
+  TEST_ASSERT_TRUE(triggers->next(now, got, seq));
+  TEST_ASSERT_EQUAL(index, got);
+}
+
+static bool sameParity(int first, int index) {
+  return first % 2 == index % 2;
+}
+
+void setUp() {
+  table.clear();
+  for (int i = 0; i < TEST_NODES; i++) {
+    const uint8_t mac[6] = {0x24, 0x6F, 0x28, 0x10, 0x00, static_cast<uint8_t>(i + 1)};
+    nodes[i] = table.add(mac, static_cast<uint16_t>(i + 1), 0);
+  }
+  triggers = new TriggerEngine(table);
+  triggers->configure(2, TEST_RTT, TEST_MIN_TIMEOUT, TEST_MAX_TIMEOUT);
+}
+
+void tearDown() {
+  delete triggers;
+}
+
+void test_request_send_reply() {
+  TEST_ASSERT_TRUE(triggers->idle());
+  triggers->request(nodes[0]);
+  triggers->request(nodes[0]); // Already pending, counted once
+  TEST_ASSERT_TRUE(triggers->ready());
+  TEST_ASSERT_EQUAL(nodes[0], triggers->peek());
+
+  sendNext(1000, nodes[0], 7);
+  TEST_ASSERT_FALSE(triggers->ready());
+  TEST_ASSERT_EQUAL_UINT8(1, triggers->outstanding());
+  triggers->request(nodes[0]); // In flight already, no second poll
+
+  int32_t rtt = 0;
+  TEST_ASSERT_TRUE(triggers->onReply(nodes[0], 7, 1030, &rtt));
+  TEST_ASSERT_EQUAL_INT32(30, rtt);
+  TEST_ASSERT_TRUE(triggers->idle());
+  TEST_ASSERT_EQUAL_UINT32(1, triggers->getStats().sent);
+  TEST_ASSERT_EQUAL_UINT32(1, triggers->getStats().answered);
+  TEST_ASSERT_EQUAL_UINT32(0, triggers->getStats().retries);
+}
+
+void test_window_limits_in_flight() {
+  for (int i = 0; i < 3; i++) triggers->request(nodes[i]);
+  sendNext(0, nodes[0], 1);
+  sendNext(0, nodes[1], 2);
+  int index;
+  TEST_ASSERT_FALSE(triggers->next(0, index, 3));
+  TEST_ASSERT_EQUAL(-1, triggers->peek());
+
+  TEST_ASSERT_TRUE(triggers->onReply(nodes[1], 2, 10));
+  sendNext(10, nodes[2], 3);
+}
+
+// Replies that match no trigger in flight change nothing but the count
+void test_stale_replies() {
+  triggers->request(nodes[0]);
+  sendNext(0, nodes[0], 5);
+
+  TEST_ASSERT_FALSE(triggers->onReply(nodes[0], 4, 10));  // Older poll
+  TEST_ASSERT_FALSE(triggers->onReply(nodes[1], 5, 10));  // Never polled
+  TEST_ASSERT_FALSE(triggers->onReply(-1, 5, 10));        // Unknown node
+  TEST_ASSERT_EQUAL_UINT32(3, triggers->getStats().stale);
+  TEST_ASSERT_EQUAL_UINT8(1, triggers->outstanding());
+  TEST_ASSERT_EQUAL_UINT16(0, table[nodes[0]].srtt);
+
+  TEST_ASSERT_TRUE(triggers->onReply(nodes[0], 5, 20));
+  TEST_ASSERT_FALSE(triggers->onReply(nodes[0], 5, 25)); // Answered already
+  TEST_ASSERT_EQUAL_UINT32(4, triggers->getStats().stale);
+  TEST_ASSERT_EQUAL_UINT32(1, triggers->getStats().answered);
+}
+
+// An unmeasured node times out after twice the initial RTT, then waits
+// half its timeout before the retry; each retry doubles the timeout, and
+// after the last one the node counts a miss
+void test_backoff_doubles_until_miss() {
+  int n = nodes[0];
+  triggers->request(n);
+  uint32_t now = 1000;
+  uint32_t timeout = 2 * TEST_RTT;
+  for (int attempt = 1; attempt <= TRIGGER_MAX_RETRIES + 1; attempt++) {
+    sendNext(now, n, static_cast<uint16_t>(attempt));
+    TEST_ASSERT_EQUAL_UINT16(timeout, triggers->timeoutFor(n));
+
+    triggers->expire(now + timeout - 1);
+    TEST_ASSERT_EQUAL_UINT8(1, triggers->outstanding());
+    now += timeout;
+    triggers->expire(now);
+    TEST_ASSERT_EQUAL_UINT8(0, triggers->outstanding());
+    if (attempt > TRIGGER_MAX_RETRIES) break;
+
+    // BACKOFF: not pending until half the timeout has passed
+    TEST_ASSERT_FALSE(triggers->ready());
+    TEST_ASSERT_FALSE(triggers->idle());
+    triggers->expire(now + timeout / 2 - 1);
+    TEST_ASSERT_FALSE(triggers->ready());
+    now += timeout / 2;
+    triggers->expire(now);
+    TEST_ASSERT_TRUE(triggers->ready());
+    timeout *= 2;
+  }
+
+  TEST_ASSERT_TRUE(triggers->idle());
+  TEST_ASSERT_EQUAL_UINT16(1, table[n].misses);
+  const TriggerEngine::Stats& stats = triggers->getStats();
+  TEST_ASSERT_EQUAL_UINT32(TRIGGER_MAX_RETRIES + 1, stats.sent);
+  TEST_ASSERT_EQUAL_UINT32(TRIGGER_MAX_RETRIES, stats.retries);
+  TEST_ASSERT_EQUAL_UINT32(1, stats.missed);
+}
+
+void test_timeout_clamped() {
+  triggers->configure(1, 400, TEST_MIN_TIMEOUT, 500);
+  triggers->request(nodes[0]);
+  sendNext(0, nodes[0], 1);
+  TEST_ASSERT_EQUAL_UINT16(500, triggers->timeoutFor(nodes[0])); // 800 capped
+
+  table[nodes[1]].srtt = 3;
+  table[nodes[1]].rttvar = 1;
+  TEST_ASSERT_EQUAL_UINT16(TEST_MIN_TIMEOUT, triggers->timeoutFor(nodes[1])); // 7 raised
+}
+
+// srtt += err / 8, rttvar += (|err| - rttvar) / 4, timeout srtt + 4 rttvar
+void test_rtt_estimate() {
+  int n = nodes[0];
+  const uint32_t samples[] = {40, 80, 20};
+  const uint16_t srtt[] = {40, 45, 42};
+  const uint16_t rttvar[] = {20, 25, 25};
+  uint32_t now = 0;
+  for (int i = 0; i < 3; i++) {
+    triggers->request(n);
+    sendNext(now, n, static_cast<uint16_t>(i + 1));
+    TEST_ASSERT_TRUE(triggers->onReply(n, static_cast<uint16_t>(i + 1), now + samples[i]));
+    TEST_ASSERT_EQUAL_UINT16(srtt[i], table[n].srtt);
+    TEST_ASSERT_EQUAL_UINT16(rttvar[i], table[n].rttvar);
+    now += 1000;
+  }
+  TEST_ASSERT_EQUAL_UINT16(42 + 4 * 25, triggers->timeoutFor(n));
+}
+
+// A reply to a retry could answer any of the attempts: it is matched, but
+// not sampled
+void test_retry_not_sampled() {
+  int n = nodes[0];
+  table[n].srtt = 40;
+  table[n].rttvar = 10;
+  triggers->request(n);
+  sendNext(0, n, 1);
+  triggers->expire(80);  // Timeout 40 + 4 * 10
+  triggers->expire(120); // Half of it waited
+  sendNext(120, n, 2);
+  TEST_ASSERT_EQUAL_UINT16(160, triggers->timeoutFor(n));
+
+  int32_t rtt = 0;
+  TEST_ASSERT_TRUE(triggers->onReply(n, 2, 125, &rtt));
+  TEST_ASSERT_EQUAL_INT32(-1, rtt);
+  TEST_ASSERT_EQUAL_UINT16(40, table[n].srtt);
+  TEST_ASSERT_EQUAL_UINT16(10, table[n].rttvar);
+  TEST_ASSERT_EQUAL_UINT32(1, triggers->getStats().retries);
+
+  // The next poll starts over at the first attempt and is sampled again
+  triggers->request(n);
+  sendNext(200, n, 3);
+  TEST_ASSERT_EQUAL_UINT16(80, triggers->timeoutFor(n));
+  TEST_ASSERT_TRUE(triggers->onReply(n, 3, 248, &rtt));
+  TEST_ASSERT_EQUAL_INT32(48, rtt);
+  TEST_ASSERT_EQUAL_UINT16(41, table[n].srtt);
+}
+
+// Group triggers take the pending nodes fit() accepts, past the window,
+// in slot order; each node's timeout waits for its slot, and replies are
+// not sampled
+void test_group_trigger() {
+  for (int i = 0; i < TEST_NODES; i++) triggers->request(nodes[i]);
+  int group[3];
+  const uint16_t slotMs = 30;
+  size_t count = triggers->nextGroup(1000, 9, slotMs, sameParity, group, 3);
+  TEST_ASSERT_EQUAL(3, count);
+  TEST_ASSERT_EQUAL(nodes[0], group[0]);
+  TEST_ASSERT_EQUAL(nodes[2], group[1]);
+  TEST_ASSERT_EQUAL(nodes[4], group[2]);
+  TEST_ASSERT_EQUAL_UINT8(3, triggers->outstanding());
+  TEST_ASSERT_EQUAL_UINT32(1, triggers->getStats().groups);
+  TEST_ASSERT_EQUAL(-1, triggers->peek()); // Past the window, singles wait
+
+  // Slot i answers (i + 1) * slotMs later than to a trigger of its own
+  uint32_t timeout = 2 * TEST_RTT;
+  triggers->expire(1000 + slotMs + timeout);
+  TEST_ASSERT_EQUAL_UINT8(2, triggers->outstanding());
+  triggers->expire(1000 + 3 * slotMs + timeout - 1);
+  TEST_ASSERT_EQUAL_UINT8(1, triggers->outstanding());
+
+  int32_t rtt = 0;
+  TEST_ASSERT_TRUE(triggers->onReply(nodes[4], 9, 1100, &rtt));
+  TEST_ASSERT_EQUAL_INT32(-1, rtt);
+  TEST_ASSERT_EQUAL_UINT16(0, table[nodes[4]].srtt);
+  TEST_ASSERT_EQUAL_UINT32(3, triggers->getStats().sent);
+}
+
+// Fewer than two nodes that fit: nothing handed out, single triggers go
+void test_group_needs_two() {
+  triggers->request(nodes[0]);
+  triggers->request(nodes[1]);
+  int group[4];
+  TEST_ASSERT_EQUAL(0, triggers->nextGroup(0, 1, 30, sameParity, group, 4));
+  TEST_ASSERT_EQUAL(0, triggers->nextGroup(0, 1, 30, sameParity, group, 1));
+  TEST_ASSERT_EQUAL_UINT8(0, triggers->outstanding());
+  TEST_ASSERT_EQUAL_UINT32(0, triggers->getStats().sent);
+  sendNext(0, nodes[0], 1);
+}
+
+void test_forget_and_reset() {
+  for (int i = 0; i < 3; i++) triggers->request(nodes[i]);
+  sendNext(0, nodes[0], 1);
+  sendNext(0, nodes[1], 2);
+  triggers->expire(2 * TEST_RTT); // Both in BACKOFF
+  triggers->forget(nodes[0]);
+  triggers->forget(nodes[2]);
+  TEST_ASSERT_FALSE(triggers->idle());
+  triggers->forget(nodes[1]);
+  TEST_ASSERT_TRUE(triggers->idle());
+
+  // Round robin carries on after the last node sent to
+  for (int i = 0; i < 3; i++) triggers->request(nodes[i]);
+  sendNext(500, nodes[2], 3);
+  triggers->reset();
+  TEST_ASSERT_TRUE(triggers->idle());
+  TEST_ASSERT_FALSE(triggers->onReply(nodes[2], 3, 510));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_request_send_reply);
+  RUN_TEST(test_window_limits_in_flight);
+  RUN_TEST(test_stale_replies);
+  RUN_TEST(test_backoff_doubles_until_miss);
+  RUN_TEST(test_timeout_clamped);
+  RUN_TEST(test_rtt_estimate);
+  RUN_TEST(test_retry_not_sampled);
+  RUN_TEST(test_group_trigger);
+  RUN_TEST(test_group_needs_two);
+  RUN_TEST(test_forget_and_reset);
+  return UNITY_END();
+}